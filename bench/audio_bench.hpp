@@ -0,0 +1,129 @@
+#ifndef AUDIO_BENCH_HPP
+#define AUDIO_BENCH_HPP
+
+#include "audio.hpp"
+#include "bench.hpp"
+#include "settings.h"
+#include <cmath>
+#include <vector>
+
+namespace bench {
+
+///@brief A WAV file in memory: 44.1 kHz stereo, a kick drum twice a second
+/// over a rising tone, so the source resamples and mixes
+std::vector<uint8_t> wavImage(uint32_t seconds) {
+  const uint32_t rate   = 44100;
+  const uint32_t frames = rate * seconds;
+  const uint32_t bytes  = frames * 4;
+  std::vector<uint8_t> wav;
+  auto put16 = [&](uint16_t value) {
+    wav.push_back(value & 0xFF);
+    wav.push_back(value >> 8);
+  };
+  auto put32 = [&](uint32_t value) {
+    put16(value & 0xFFFF);
+    put16(value >> 16);
+  };
+  auto tag = [&](const char *name) { wav.insert(wav.end(), name, name + 4); };
+
+  tag("RIFF");
+  put32(36 + bytes);
+  tag("WAVE");
+  tag("fmt ");
+  put32(16);
+  put16(1); // PCM
+  put16(2);
+  put32(rate);
+  put32(rate * 4);
+  put16(4);
+  put16(16);
+  tag("data");
+  put32(bytes);
+  for (uint32_t n = 0; n < frames; n++) {
+    double t     = double(n) / rate;
+    double phase = fmod(t, 0.5);
+    double kick  = phase < 0.1 ? 0.6 * sin(2 * M_PI * 70 * t) *
+                                    (1 - phase / 0.1)
+                               : 0;
+    double tone  = 0.1 * sin(2 * M_PI * (200 + 500 * t) * t);
+    int16_t v    = int16_t(32767 * (kick + tone));
+    put16(v);
+    put16(v);
+  }
+  return wav;
+}
+
+} // namespace bench
+
+///
+///@brief The audio pipeline: FFTs a second, the analysis of a hop read from
+/// a WAV file against the hop's duration, and the audio modes' frames. The
+/// analysis and a frame are the part of the sound to light delay spent on
+/// the CPU, the rest is the wire.
+///
+void audio_bench() {
+  if (!bench::enabled("audio")) {
+    return;
+  }
+  bench::header("audio");
+
+  // Noise at a tenth of full scale, copied in as the FFT works in place
+  int16_t noise[audioFftSize];
+  uint32_t seed = 1;
+  for (int16_t &sample : noise) {
+    seed   = seed * 1664525 + 1013904223;
+    sample = int16_t(seed >> 16) / 10;
+  }
+  Fft fft;
+  int16_t re[audioFftSize];
+  int16_t im[audioFftSize];
+  bench::Result transform =
+      bench::measure("audio", "fft_512", audioFftSize, [&] {
+        memcpy(re, noise, sizeof(re));
+        memset(im, 0, sizeof(im));
+        fft.transform(re, im);
+      });
+
+  wavAudioSource.load(bench::wavImage(4));
+  wavAudioSource.looping = true;
+  AudioFeatures features;
+  int16_t hop[audioHop];
+  bench::Result analysis =
+      bench::measure("audio", "read_analyze_hop", audioHop, [&] {
+        wavAudioSource.read(hop, audioHop);
+        audioAnalyzer.analyze(hop, 0, features);
+      });
+
+  const double hopNs = 1e9 * audioHop / audioSampleRate;
+  if (!bench::options.csv) {
+    printf("%.0f FFTs/s, a hop analyzed in %.1f us: %.0fx real time\n",
+           1e9 / transform.nsPerFrame, analysis.nsPerFrame / 1000,
+           hopNs / analysis.nsPerFrame);
+  }
+
+  audioFeed.listen(true);
+  audioFeed.publish(features);
+  audioFeed.receive(0);
+  const Color_RGB low  = {0, 0, 255};
+  const Color_RGB high = {255, 0, 40};
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    length = device.strip.numPixels();
+
+    bench::Result frame = bench::measure("audio", "spectrum", length, [&] {
+      spectrum(device.strip, 0, length, low, high, 128);
+    });
+    unsigned long now = 0;
+    bench::measure("audio", "pulse", length, [&] {
+      now += 16;
+      pulse(device.strip, 0, length, high, 160, now);
+    });
+
+    if (!bench::options.csv) {
+      printf("analysis + spectrum frame: %.1f us of a %.1f ms frame\n",
+             (analysis.nsPerFrame + frame.nsPerFrame) / 1000, 1000.0 / 60);
+    }
+  }
+}
+
+#endif // AUDIO_BENCH_HPP
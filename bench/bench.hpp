@@ -0,0 +1,86 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+namespace bench {
+
+/// Strip lengths every render suite sweeps over.
+const uint16_t stripLengths[] = {30, 60, 144, 300, 600, 1000, 2000, 4096};
+
+struct Options {
+  const char *filter = nullptr; // Run only suites whose name contains it
+  uint32_t minMillis = 200;     // Minimum measuring time for every case
+  bool csv           = false;
+} options;
+
+struct Result {
+  uint64_t frames;
+  double nsPerFrame;
+  double nsPerPixel;
+};
+
+bool enabled(const char *suite) {
+  return options.filter == nullptr || strstr(suite, options.filter) != nullptr;
+}
+
+void header(const char *suite) {
+  if (options.csv) {
+    return;
+  }
+  printf("\n== %s ==\n", suite);
+  printf("%-24s %8s %14s %12s %12s\n", "case", "pixels", "ns/frame",
+         "ns/pixel", "frames/s");
+}
+
+///
+///@brief Run frame() until options.minMillis have elapsed and report the
+/// average cost per frame and per pixel.
+/// Batches double in size so the clock is read rarely on cheap frames.
+///
+template <typename Frame>
+Result measure(const char *suite, const char *name, uint32_t pixels,
+               Frame frame) {
+  typedef std::chrono::steady_clock clock;
+
+  // Warm up caches and any lazily built tables.
+  for (int i = 0; i < 3; i++) {
+    frame();
+  }
+
+  uint64_t frames    = 0;
+  uint64_t batch     = 1;
+  double elapsedNs   = 0;
+  const double minNs = options.minMillis * 1e6;
+  const auto start   = clock::now();
+  do {
+    for (uint64_t i = 0; i < batch; i++) {
+      frame();
+    }
+    frames += batch;
+    batch *= 2;
+    elapsedNs = std::chrono::duration<double, std::nano>(clock::now() - start)
+                    .count();
+  } while (elapsedNs < minNs);
+
+  Result result;
+  result.frames     = frames;
+  result.nsPerFrame = elapsedNs / frames;
+  result.nsPerPixel = pixels ? result.nsPerFrame / pixels : 0;
+
+  if (options.csv) {
+    printf("%s,%s,%u,%.1f,%.3f\n", suite, name, pixels, result.nsPerFrame,
+           result.nsPerPixel);
+  } else {
+    printf("%-24s %8u %14.1f %12.3f %12.0f\n", name, pixels, result.nsPerFrame,
+           result.nsPerPixel, 1e9 / result.nsPerFrame);
+  }
+  return result;
+}
+
+} // namespace bench
+
+#endif // BENCH_HPP
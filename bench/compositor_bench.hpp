@@ -0,0 +1,88 @@
+#ifndef COMPOSITOR_BENCH_HPP
+#define COMPOSITOR_BENCH_HPP
+
+#include "bench.hpp"
+#include "compositor.hpp"
+#include "settings.h"
+
+///
+///@brief Cost of blending one layer in every blend mode, of composing a
+/// three layer stack (gradient, sparkle overlay, dimming) into the strip and
+/// of the sparkle mode, which composes its two layers a chunk at a time.
+/// Ends with the share of a 60 FPS frame the stack takes at 1000 LEDs.
+///
+void compositor_bench() {
+  if (!bench::enabled("compositor")) {
+    return;
+  }
+  bench::header("compositor");
+
+  typedef Compositor<3, STRIP_MAX_LEDS> BenchCompositor;
+  static BenchCompositor compositor;
+  static uint32_t out[BenchCompositor::capacity()];
+
+  // Slow gradient, sparse sparkles over it, and a dimming multiply on top
+  BenchCompositor::Layer &gradient = compositor.layer(0);
+  BenchCompositor::Layer &overlay  = compositor.layer(1);
+  BenchCompositor::Layer &dimming  = compositor.layer(2);
+  uint32_t seed                    = 1;
+  for (uint16_t i = 0; i < BenchCompositor::capacity(); i++) {
+    uint8_t ramp       = i & 0xFF;
+    gradient.pixels[i] = Adafruit_NeoPixel::Color(ramp, 64, 255 - ramp);
+    seed               = seed * 1664525 + 1013904223;
+    overlay.pixels[i]  = (seed >> 28) == 0 ? 0x00FFFFFF : 0;
+    dimming.pixels[i]  = 0x00C0C0C0;
+  }
+  overlay.blend   = Blend_Mode::add;
+  overlay.opacity = 200;
+  dimming.blend   = Blend_Mode::multiply;
+
+  struct Case {
+    const char *name;
+    Blend_Mode mode;
+    uint8_t opacity;
+  };
+  const Case cases[] = {
+      {"normal", Blend_Mode::normal, 255},
+      {"normal_50%", Blend_Mode::normal, 128},
+      {"add", Blend_Mode::add, 255},
+      {"add_50%", Blend_Mode::add, 128},
+      {"multiply", Blend_Mode::multiply, 255},
+      {"max", Blend_Mode::max, 255},
+  };
+
+  const Color_RGB blue    = {0, 40, 120};
+  const Color_RGB purple  = {90, 0, 110};
+  unsigned long now       = 0;
+  bench::Result stack1000 = {0, 0, 0};
+  for (uint16_t length : bench::stripLengths) {
+    for (const Case &c : cases) {
+      memcpy(out, gradient.pixels, length * sizeof(uint32_t));
+      bench::measure("compositor", c.name, length, [&] {
+        blendRow(out, overlay.pixels, length, c.mode, c.opacity);
+      });
+    }
+
+    device.strip.setLength(length);
+    bench::Result stack =
+        bench::measure("compositor", "3_layers_to_strip", length, [&] {
+          compositor.compose(out, length);
+          writePixels(device.strip, 0, out, length);
+        });
+    if (length == 1000) {
+      stack1000 = stack;
+    }
+
+    bench::measure("compositor", "sparkle_mode", length, [&] {
+      now += 16;
+      sparkle(device.strip, 0, length, blue, purple, 40, 200, now);
+    });
+  }
+
+  if (!bench::options.csv && stack1000.frames > 0) {
+    printf("3 layers at 1000 LEDs: %.1f us, %.2f%% of a 60 FPS frame\n",
+           stack1000.nsPerFrame / 1000, stack1000.nsPerFrame / 16666667 * 100);
+  }
+}
+
+#endif // COMPOSITOR_BENCH_HPP
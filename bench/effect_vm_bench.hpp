@@ -0,0 +1,79 @@
+#ifndef EFFECT_VM_BENCH_HPP
+#define EFFECT_VM_BENCH_HPP
+
+#include "bench.hpp"
+#include "effect_vm.hpp"
+#include "loop_modes.hpp"
+#include "settings.h"
+
+///
+///@brief Cost of effect programs against the native modes. The built-in
+/// rainbow program next to rainbow(), with their ratio: the price of an
+/// uploaded effect over a compiled one. Below 256 LEDs rainbow() walks its
+/// ramp pixel by pixel, from 256 on it is two memcpy and the ratio is that
+/// of computing every pixel against copying it. Then a 7 instruction plasma
+/// of three waves, for the cost of a longer program.
+///
+void effect_vm_bench() {
+  if (!bench::enabled("effect_vm")) {
+    return;
+  }
+  bench::header("effect_vm");
+
+  //   mul r11, r2, r7   time * p3
+  //   add r12, r3, r11  position + time
+  //   wave r8, r12
+  //   sub r13, r3, r11  position - time
+  //   wave r9, r13
+  //   add r14, r12, r13 twice the position
+  //   wave r10, r14
+  const uint8_t plasmaImage[] = {
+      programVersion,         7,          //
+      uint8_t(Op_Code::mul),  11, 2,  7,  //
+      uint8_t(Op_Code::add),  12, 3,  11, //
+      uint8_t(Op_Code::wave), 8,  12, 0,  //
+      uint8_t(Op_Code::sub),  13, 3,  11, //
+      uint8_t(Op_Code::wave), 9,  13, 0,  //
+      uint8_t(Op_Code::add),  14, 12, 13, //
+      uint8_t(Op_Code::wave), 10, 14, 0,  //
+  };
+  EffectProgram rainbowProgram;
+  EffectProgram plasma;
+  uint8_t at;
+  verifyProgram(defaultProgramImage, sizeof(defaultProgramImage),
+                rainbowProgram, at);
+  verifyProgram(plasmaImage, sizeof(plasmaImage), plasma, at);
+  const uint8_t params[4] = {255, 255, 255, 50};
+
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    length = device.strip.numPixels();
+
+    uint32_t phase = 0;
+    rainbowEngine.prepare(length);
+    bench::Result native = bench::measure("effect_vm", "rainbow", length, [&] {
+      phase = RainbowEngine::advance(phase, 16, 50);
+      rainbow(device.strip, 0, length, phase);
+    });
+
+    unsigned long now = 0;
+    bench::Result vm =
+        bench::measure("effect_vm", "program_rainbow", length, [&] {
+          now += 16;
+          effectVm.run<StripFormat>(rainbowProgram, device.strip, 0, length,
+                                    now, params);
+        });
+
+    bench::measure("effect_vm", "program_plasma_7", length, [&] {
+      now += 16;
+      effectVm.run<StripFormat>(plasma, device.strip, 0, length, now, params);
+    });
+
+    if (!bench::options.csv) {
+      printf("program_rainbow / rainbow: %.1fx\n",
+             vm.nsPerFrame / native.nsPerFrame);
+    }
+  }
+}
+
+#endif // EFFECT_VM_BENCH_HPP
@@ -0,0 +1,53 @@
+/*
+   Host benchmarks for the render path (env:native).
+
+   Usage: program [filter] [--min-ms N] [--csv]
+     filter    run only the suites whose name contains it (e.g. "render")
+     --min-ms  minimum measuring time for every case (default 200)
+     --csv     print suite,case,pixels,ns/frame,ns/pixel rows
+*/
+
+#include "Arduino.h"
+
+#include "audio_bench.hpp"
+#include "bench.hpp"
+#include "compositor_bench.hpp"
+#include "effect_vm_bench.hpp"
+#include "output_bench.hpp"
+#include "palette_bench.hpp"
+#include "particles_bench.hpp"
+#include "render_bench.hpp"
+#include "segments_bench.hpp"
+#include "settings_bench.hpp"
+#include "stream_bench.hpp"
+#include "transition_bench.hpp"
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0) {
+      bench::options.csv = true;
+    } else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+      bench::options.minMillis = strtoul(argv[++i], nullptr, 10);
+    } else {
+      bench::options.filter = argv[i];
+    }
+  }
+
+  if (bench::options.csv) {
+    printf("suite,case,pixels,ns_per_frame,ns_per_pixel\n");
+  }
+
+  render_bench();
+  segments_bench();
+  compositor_bench();
+  palette_bench();
+  particles_bench();
+  effect_vm_bench();
+  audio_bench();
+  transition_bench();
+  stream_bench();
+  output_bench();
+  settings_bench();
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef OUTPUT_BENCH_HPP
+#define OUTPUT_BENCH_HPP
+
+#include "bench.hpp"
+#include "loop_modes.hpp"
+#include "output.hpp"
+
+///
+///@brief Cost of the output stage on a rainbow frame at brightness 64, with
+/// and without dithering, against gamma32() and the strip brightness applied
+/// per pixel through setPixelColor(), as rainbow() did before the LUT.
+/// Then rainbow frames rendered and shown through the simulated driver, with
+/// the transfer awaited after every show() as the blocking driver does, and
+/// pipelined: the pipelined frame rate should be at the wire limit.
+///
+void output_bench() {
+  if (!bench::enabled("output")) {
+    return;
+  }
+  bench::header("output");
+
+  static StripPixels scaled{0, -1, stripPixelType};
+  static StripPixels frame{0, -1, stripPixelType};
+  scaled.setBrightness(64);
+  outputStage.setBrightness(64);
+
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    scaled.setLength(length);
+    rainbowEngine.prepare(length);
+    rainbow(device.strip, 0, length, 0);
+
+    bench::measure("output", "setpixel_gamma32", length, [&] {
+      const uint8_t *pixel = device.strip.getPixels();
+      for (uint16_t i = 0; i < length; i++) {
+        uint32_t color = Adafruit_NeoPixel::Color(pixel[StripFormat::red],
+                                                  pixel[StripFormat::green],
+                                                  pixel[StripFormat::blue]);
+        scaled.setPixelColor(i, Adafruit_NeoPixel::gamma32(color));
+        pixel += stripBytesPerPixel;
+      }
+    });
+    outputStage.setDithering(false);
+    bench::measure("output", "lut", length, [&] {
+      outputStage.apply(device.strip, frame);
+    });
+    outputStage.setDithering(true);
+    bench::measure("output", "lut_dither", length, [&] {
+      outputStage.apply(device.strip, frame);
+    });
+  }
+
+  outputStage.begin(-1, simulatedOutputDriver);
+  device.defaultData.brightness = 64;
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    length = device.strip.numPixels();
+    rainbowEngine.prepare(length);
+
+    uint32_t phase = 0;
+    bench::measure("output", "rainbow_show_serial", length, [&] {
+      phase = RainbowEngine::advance(phase, 16, 50);
+      rainbow(device.strip, 0, length, phase);
+      outputStage.show(device);
+      outputStage.wait();
+    });
+    bench::measure("output", "rainbow_show_pipelined", length, [&] {
+      phase = RainbowEngine::advance(phase, 16, 50);
+      rainbow(device.strip, 0, length, phase);
+      outputStage.show(device);
+    });
+    outputStage.wait();
+    if (!bench::options.csv) {
+      printf("wire limit at %u LEDs: %.0f frames/s\n", length,
+             1e6 / OutputDriver::wireMicros(length));
+    }
+  }
+  device.defaultData.brightness = 255;
+  outputStage.setBrightness(255);
+}
+
+#endif // OUTPUT_BENCH_HPP
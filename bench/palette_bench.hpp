@@ -0,0 +1,70 @@
+#ifndef PALETTE_BENCH_HPP
+#define PALETTE_BENCH_HPP
+
+#include "bench.hpp"
+#include "palette.hpp"
+#include "settings.h"
+
+///
+///@brief Cost of the palette and palette_sparkle modes, and of composing the
+/// three layer stack of compositor_bench (gradient, sparkles added, dimming
+/// multiply) as palette indices and expanding it into the strip. Ends with
+/// the RAM of the stack against the packed pixels of Compositor.
+///
+void palette_bench() {
+  if (!bench::enabled("palette")) {
+    return;
+  }
+  bench::header("palette");
+
+  typedef IndexCompositor<3, STRIP_MAX_LEDS> BenchCompositor;
+  static BenchCompositor compositor;
+  static uint8_t out[BenchCompositor::capacity()];
+
+  device.paletteData = defaultPalette;
+  paletteEngine.prepare(device.paletteData);
+
+  BenchCompositor::Layer &gradient = compositor.layer(0);
+  BenchCompositor::Layer &overlay  = compositor.layer(1);
+  BenchCompositor::Layer &dimming  = compositor.layer(2);
+  uint32_t seed                    = 1;
+  for (uint16_t i = 0; i < BenchCompositor::capacity(); i++) {
+    gradient.indices[i] = i & 0xFF;
+    seed                = seed * 1664525 + 1013904223;
+    overlay.indices[i]  = (seed >> 28) == 0 ? 200 : 0;
+    dimming.indices[i]  = 0xC0;
+  }
+  overlay.blend = Blend_Mode::add;
+  dimming.blend = Blend_Mode::multiply;
+
+  unsigned long now = 0;
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+
+    uint32_t phase = 0;
+    bench::measure("palette", "palette", length, [&] {
+      phase = RainbowEngine::advance(phase, 16, 50);
+      paletteEngine.prepare(device.paletteData);
+      palette(device.strip, 0, length, phase);
+    });
+    bench::measure("palette", "palette_sparkle", length, [&] {
+      now += 16;
+      phase = RainbowEngine::advance(phase, 16, 50);
+      paletteEngine.prepare(device.paletteData);
+      palette_sparkle(device.strip, 0, length, phase, 60, Blend_Mode::max,
+                      now);
+    });
+    bench::measure("palette", "3_index_layers_to_strip", length, [&] {
+      compositor.compose(out, length);
+      paletteEngine.expand(out, device.strip, 0, length);
+    });
+  }
+
+  if (!bench::options.csv) {
+    printf("3 layers of %u LEDs: %u B of indices, %u B packed\n",
+           BenchCompositor::capacity(), unsigned(sizeof(compositor)),
+           unsigned(3 * BenchCompositor::capacity() * sizeof(uint32_t)));
+  }
+}
+
+#endif // PALETTE_BENCH_HPP
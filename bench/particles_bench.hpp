@@ -0,0 +1,66 @@
+#ifndef PARTICLES_BENCH_HPP
+#define PARTICLES_BENCH_HPP
+
+#include "bench.hpp"
+#include "particles.hpp"
+#include "settings.h"
+
+///
+///@brief Cost of the particle effects at 60 fps of simulated time. Twinkle at
+/// a fixed rate and 8 comets over every strip length: the particles stay the
+/// same, so ns/frame should hardly move while ns/pixel falls. Then twinkle on
+/// 1000 LEDs at rates giving more and more live particles, the count in the
+/// case name: ns/frame should follow it.
+///
+void particles_bench() {
+  if (!bench::enabled("particles")) {
+    return;
+  }
+  bench::header("particles");
+
+  const Color_RGB white = {255, 255, 255};
+  const Color_RGB amber = {255, 160, 60};
+  unsigned long now     = 0;
+
+  // Two seconds of frames, so the live particles are at their steady count
+  auto settle = [&](uint16_t length, uint8_t rate) {
+    particleEngine.reset();
+    for (uint16_t f = 0; f < 120; f++) {
+      now += 16;
+      twinkle(device.strip, 0, length, white, amber, rate, now);
+    }
+  };
+
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    length = device.strip.numPixels();
+
+    settle(length, 200);
+    bench::measure("particles", "twinkle_200", length, [&] {
+      now += 16;
+      twinkle(device.strip, 0, length, white, amber, 200, now);
+    });
+
+    particleEngine.reset();
+    bench::measure("particles", "comet_8", length, [&] {
+      now += 16;
+      comet(device.strip, 0, length, white, amber, 50, 8, now);
+    });
+  }
+
+  const uint16_t length = 1000;
+  device.strip.setLength(length);
+  const uint8_t rates[] = {10, 40, 120, 255};
+  for (uint8_t rate : rates) {
+    settle(length, rate);
+    char name[32];
+    snprintf(name, sizeof(name), "twinkle_%u_particles",
+             particleEngine.pool.count());
+    bench::measure("particles", name, length, [&] {
+      now += 16;
+      twinkle(device.strip, 0, length, white, amber, rate, now);
+    });
+  }
+}
+
+#endif // PARTICLES_BENCH_HPP
@@ -0,0 +1,70 @@
+#ifndef RENDER_BENCH_HPP
+#define RENDER_BENCH_HPP
+
+#include "bench.hpp"
+#include "loop_modes.hpp"
+
+///
+///@brief Per-pixel ColorHSV + gamma32 rainbow, the way rainbow() rendered
+/// before RainbowEngine. Kept as the baseline the ramp is measured against.
+///
+void rainbow_hsv(DeviceInfo &dev) {
+  long hueDifference = 65536L / dev.strip.numPixels();
+  long firstPixelHue = long(
+      ((int(millis() * 3 * dev.rainbowData.velocity / 100) % 1000) / 1000.0) *
+      65535L);
+
+  for (int i = 0; i < dev.strip.numPixels(); i++) {
+    int pixelHue = firstPixelHue + (i * hueDifference);
+    dev.strip.setPixelColor(i, dev.strip.gamma32(dev.strip.ColorHSV(
+                                   pixelHue, 255, dev.defaultData.brightness)));
+  }
+}
+
+///
+///@brief Cost of one frame of every mode in loop_modes.hpp, for each strip
+/// length in bench::stripLengths. show() is the host mock, so this is pure
+/// render time without the WS2812 transfer.
+///
+void render_bench() {
+  if (!bench::enabled("render")) {
+    return;
+  }
+  bench::header("render");
+
+  // Same parameters as data/settings.json
+  device.defaultData.brightness = 255;
+  device.fixedColorData.color   = Color_RGB{0, 0, 255};
+  device.rainbowData.velocity   = 50;
+  device.colorSplitData.color1  = Color_RGB{100, 100, 200};
+  device.colorSplitData.color2  = Color_RGB{25, 25, 150};
+
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    device.defaultData.ledLenght           = length;
+    device.colorSplitData.endFirstLedSplit = length / 3;
+
+    unsigned long now = 0;
+    uint32_t phase    = 0;
+    bench::measure("render", "fixed_color", length, [&] {
+      fixed_color(device.strip, 0, length, device.fixedColorData.color);
+    });
+    bench::measure("render", "rainbow", length, [&] {
+      // Step the animation like a 60 FPS loop would.
+      phase = RainbowEngine::advance(phase, 16, device.rainbowData.velocity);
+      rainbowEngine.prepare(length);
+      rainbow(device.strip, 0, length, phase);
+    });
+    bench::measure("render", "rainbow_hsv", length, [&] {
+      mock::setMillis(now += 16);
+      rainbow_hsv(device);
+    });
+    bench::measure("render", "color_split", length, [&] {
+      color_split(device.strip, 0, length,
+                  device.colorSplitData.endFirstLedSplit,
+                  device.colorSplitData.color1, device.colorSplitData.color2);
+    });
+  }
+}
+
+#endif // RENDER_BENCH_HPP
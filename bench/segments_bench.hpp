@@ -0,0 +1,55 @@
+#ifndef SEGMENTS_BENCH_HPP
+#define SEGMENTS_BENCH_HPP
+
+#include "bench.hpp"
+#include "segments.hpp"
+
+///
+///@brief SegmentEngine with the strip split in four zones (fixed_color,
+/// rainbow, color_split, fixed_color): a full redraw against a 60 FPS frame
+/// where only the rainbow zone is due.
+///
+void segments_bench() {
+  if (!bench::enabled("segments")) {
+    return;
+  }
+  bench::header("segments");
+
+  device.isOn                   = true;
+  device.defaultData.brightness = 255;
+
+  const Mode_Type modes[] = {Mode_Type::fixed_color, Mode_Type::rainbow,
+                             Mode_Type::color_split, Mode_Type::fixed_color};
+
+  const uint8_t zones = sizeof(modes) / sizeof(modes[0]);
+
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    device.defaultData.ledLenght = length;
+
+    device.fixedColorData.color            = Color_RGB{100, 100, 200};
+    device.rainbowData.velocity            = 50;
+    device.colorSplitData.endFirstLedSplit = length / zones / 2;
+    device.colorSplitData.color1           = Color_RGB{100, 100, 200};
+    device.colorSplitData.color2           = Color_RGB{25, 25, 150};
+
+    device.segmentsData.count = zones;
+    for (uint8_t i = 0; i < zones; i++) {
+      SegmentData &segment = device.segmentsData.segments[i];
+      segment.start        = i * (length / zones);
+      segment.length       = length / zones;
+      segment.mode         = modes[i];
+      findMode(segment.mode)->segment(device, segment);
+    }
+
+    unsigned long now = 0;
+    bench::measure("segments", "full_redraw", length,
+                   [&] { segmentEngine.render(device, true, now += 16); });
+    bench::measure("segments", "animated_zone_only", length,
+                   [&] { segmentEngine.render(device, false, now += 16); });
+  }
+
+  device.segmentsData.count = 0;
+}
+
+#endif // SEGMENTS_BENCH_HPP
@@ -0,0 +1,32 @@
+#ifndef SETTINGS_BENCH_HPP
+#define SETTINGS_BENCH_HPP
+
+#include "bench.hpp"
+#include "settings_store.hpp"
+
+///
+///@brief Boot-time settings load: the binary record against the JSON import
+/// it replaced. SPIFFS is the in-memory host mock, so this is decode cost only.
+///
+void settings_bench() {
+  if (!bench::enabled("settings")) {
+    return;
+  }
+  bench::header("settings");
+
+  device.defaultData.ledLenght  = 30;
+  device.defaultData.brightness = 255;
+  exportJsonSettings(device, SETTINGS_JSON_FILE);
+  saveSettings(SETTINGS_FILE);
+
+  bench::measure("settings", "loadSettings", 0,
+                 [] { loadSettings(SETTINGS_FILE); });
+  bench::measure("settings", "importJsonSettings", 0,
+                 [] { importJsonSettings(SETTINGS_JSON_FILE, device); });
+  bench::measure("settings", "saveSettings", 0,
+                 [] { saveSettings(SETTINGS_FILE); });
+  bench::measure("settings", "exportJsonSettings", 0,
+                 [] { exportJsonSettings(device, SETTINGS_JSON_FILE); });
+}
+
+#endif // SETTINGS_BENCH_HPP
@@ -0,0 +1,133 @@
+#ifndef STREAM_BENCH_HPP
+#define STREAM_BENCH_HPP
+
+#include "bench.hpp"
+#include "stream.hpp"
+#include <vector>
+
+namespace bench {
+
+const int streamCycle = 32; // frames, the last one leads into the first
+
+///
+///@brief Decode a cycle of frames sent in packets of `payload` bytes, again
+/// and again
+///
+void streamCase(const char *show, uint8_t (*frames)[STRIP_MAX_LEDS * 3],
+                uint16_t length, size_t payload) {
+  typedef std::vector<uint8_t> Packet;
+  const int cycle = streamCycle;
+
+  StreamEncoder encoder(payload);
+  std::vector<Packet> packets[cycle];
+  size_t bytes = 0;
+  size_t count = 0;
+  for (int f = 0; f < cycle; f++) {
+    const uint8_t *previous = frames[(f + cycle - 1) % cycle];
+    bytes += encoder.encode(previous, frames[f], length,
+                            [&](const uint8_t *data, size_t size) {
+                              packets[f].emplace_back(data, data + size);
+                            });
+    count += packets[f].size();
+  }
+  // Start from the last frame of the cycle, the deltas follow on
+  uint8_t sequence = 0;
+  encoder.encode(nullptr, frames[cycle - 1], length,
+                 [&](const uint8_t *data, size_t size) {
+                   streamDecoder.decode(data, size);
+                   sequence = data[1] + 1;
+                 });
+  int f = 0;
+
+  char name[24];
+  snprintf(name, sizeof(name), "%s_%u", show, unsigned(payload));
+  measure("stream", name, length, [&] {
+    for (Packet &packet : packets[f]) {
+      // The cycle repeats, keep the sequence going on
+      packet[1] = sequence++;
+      streamDecoder.decode(packet.data(), packet.size());
+    }
+    streamDecoder.draw(device.strip, 0, length);
+    f = (f + 1) % cycle;
+  });
+
+  if (!options.csv) {
+    double perFrame = double(bytes) / cycle;
+    printf("%-24s %8u %14.0f B/frame %5.1f packets %6.1f frames/s per KB/s\n",
+           "", length, perFrame, double(count) / cycle, 1024 / perFrame);
+  }
+}
+
+} // namespace bench
+
+///
+///@brief Streamed frames: the cost of decoding a frame into the strip and
+/// how many frames a second every KB/s of link carries.
+/// Three shows, a scrolling rainbow where every pixel changes, sparkles over
+/// a still background and a pulsing solid color, are encoded for the packets
+/// of three ATT MTUs: the default 23 bytes a client gets until it asks for
+/// more (20 bytes of payload, 4 of them the packet header), 247 and the 517
+/// the firmware offers (512, the longest packet).
+///
+void stream_bench() {
+  if (!bench::enabled("stream")) {
+    return;
+  }
+  bench::header("stream");
+
+  const size_t payloads[] = {20, 244, streamPacketMax};
+  const int cycle         = bench::streamCycle;
+
+  struct Show {
+    const char *name;
+    void (*frame)(uint8_t *rgb, uint16_t count, int index);
+  };
+  const Show shows[] = {
+      {"scroll",
+       [](uint8_t *rgb, uint16_t count, int index) {
+         for (uint16_t i = 0; i < count; i++) {
+           uint8_t hue    = i * 3 + index * 8;
+           rgb[3 * i]     = hue;
+           rgb[3 * i + 1] = 255 - hue;
+           rgb[3 * i + 2] = hue ^ 0x80;
+         }
+       }},
+      {"sparkle",
+       [](uint8_t *rgb, uint16_t count, int index) {
+         uint32_t seed = index * 2654435761u;
+         for (uint16_t i = 0; i < count; i++) {
+           seed           = seed * 1664525 + 1013904223;
+           bool spark     = (seed >> 27) == 0; // 1 in 32
+           rgb[3 * i]     = spark ? 255 : 0;
+           rgb[3 * i + 1] = spark ? 255 : 0;
+           rgb[3 * i + 2] = spark ? 255 : 32;
+         }
+       }},
+      {"pulse",
+       [](uint8_t *rgb, uint16_t count, int index) {
+         uint8_t level = index < cycle / 2 ? index * 16 : (cycle - index) * 16;
+         for (uint16_t i = 0; i < count; i++) {
+           rgb[3 * i]     = level;
+           rgb[3 * i + 1] = level / 2;
+           rgb[3 * i + 2] = 0;
+         }
+       }},
+  };
+
+  static uint8_t frames[cycle][STRIP_MAX_LEDS * 3];
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+
+    for (const Show &show : shows) {
+      for (int f = 0; f < cycle; f++) {
+        show.frame(frames[f], length, f);
+      }
+
+      for (size_t payload : payloads) {
+        bench::streamCase(show.name, frames, length, payload);
+      }
+    }
+  }
+}
+
+#endif // STREAM_BENCH_HPP
@@ -0,0 +1,70 @@
+#ifndef TRANSITION_BENCH_HPP
+#define TRANSITION_BENCH_HPP
+
+#include "bench.hpp"
+#include "segments.hpp"
+#include "transition.hpp"
+
+///
+///@brief Cost of a crossfade frame against a steady rainbow frame. The
+/// transition never ends while measuring: its duration is longer than the
+/// simulated time.
+///
+void transition_bench() {
+  if (!bench::enabled("transition")) {
+    return;
+  }
+  bench::header("transition");
+
+  device.isOn                   = true;
+  device.defaultData.brightness = 255;
+  device.segmentsData.count     = 0;
+  device.rainbowData.velocity   = 50;
+  device.fixedColorData.color   = Color_RGB{0, 0, 255};
+  device.colorSplitData.color1  = Color_RGB{100, 100, 200};
+  device.colorSplitData.color2  = Color_RGB{25, 25, 150};
+
+  // One clock for all the cases, zone deadlines carry over between them
+  unsigned long now = 0;
+
+  for (uint16_t length : bench::stripLengths) {
+    device.strip.setLength(length);
+    device.defaultData.ledLenght           = length;
+    device.colorSplitData.endFirstLedSplit = length / 3;
+
+    auto fade = [&](const char *name, Mode_Type from, Mode_Type to) {
+      auto begin = [&] {
+        device.activeMode = from;
+        segmentEngine.render(device, true, now);
+        transitionEngine.begin(wholeStripSegment(device),
+                               segmentEngine.state(0), device.strip, 65535,
+                               now);
+        device.activeMode = to;
+        segmentEngine.render(device, true, now);
+      };
+      begin();
+      bench::measure("transition", name, length, [&] {
+        now += 16;
+        // Restarted about every 4000 frames, the cost is amortized
+        if (!transitionEngine.active()) {
+          begin();
+        }
+        transitionEngine.restoreIncoming(device.strip);
+        segmentEngine.render(device, false, now);
+        transitionEngine.blend(device.strip, now);
+      });
+      transitionEngine.cancel();
+    };
+
+    device.activeMode = Mode_Type::rainbow;
+    segmentEngine.render(device, true, now);
+    bench::measure("transition", "steady_rainbow", length,
+                   [&] { segmentEngine.render(device, false, now += 16); });
+
+    fade("static_to_static", Mode_Type::fixed_color, Mode_Type::color_split);
+    fade("rainbow_to_static", Mode_Type::rainbow, Mode_Type::fixed_color);
+    fade("static_to_rainbow", Mode_Type::fixed_color, Mode_Type::rainbow);
+  }
+}
+
+#endif // TRANSITION_BENCH_HPP
@@ -0,0 +1,677 @@
+#ifndef AUDIO_HPP
+#define AUDIO_HPP
+
+#include "Arduino.h"
+#include "diagnostics.hpp"
+#include "loop_modes.hpp"
+#include "particles.hpp"
+#include "settings.h"
+#include "spsc_ring.hpp"
+#include <atomic>
+#include <math.h>
+
+#ifdef ESP32
+#include "driver/i2s.h"
+#else
+#include <cstdio>
+#include <utility>
+#include <vector>
+#endif
+
+///
+/// Sound input of the spectrum and pulse modes:
+///   AudioSource    16 kHz mono samples: a microphone through the I2S DMA on
+///                  the ESP32, a WAV file on the host
+///   AudioAnalyzer  every audioHop samples, a fixed-point FFT of the last
+///                  audioFftSize ones, audioBands smoothed band levels, the
+///                  overall level and the beats
+///   AudioFeed      the AudioFeatures of every analysis, from the audio task
+///                  to the render task
+/// The audio task wakes the render task after each analysis, and it redraws
+/// the audio zones at once instead of at their next frame: the light follows
+/// the sound by the analysis, one render and the wire, under a frame. The
+/// `audio` probe measures it, from the last sample of an analysis being
+/// captured to the end of the transfer of the first frame drawn from it.
+///
+
+const uint16_t audioSampleRate = 16000;
+const uint8_t audioFftBits     = 9;
+const uint16_t audioFftSize    = 1 << audioFftBits; // 32 ms, 31.25 Hz a bin
+const uint16_t audioHop        = 256;               // 16 ms between analyses
+const uint8_t audioBands       = 16;
+
+inline int16_t saturate16(int32_t value) {
+  return value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+}
+
+///
+///@brief Where the samples come from, audioSampleRate mono 16 bit.
+///
+class AudioSource {
+public:
+  virtual ~AudioSource() {}
+
+  ///@brief Block until `count` samples are read
+  ///@return the samples read, fewer at the end of the input or on an error
+  virtual size_t read(int16_t *samples, size_t count) = 0;
+  virtual const char *name() const = 0;
+};
+
+#ifdef ESP32
+
+///
+/// Microphone, none by default:
+///   -D AUDIO_I2S_SD_PIN=32   an I2S MEMS microphone (INMP441, SPH0645) on
+///                            the left channel, clocked on AUDIO_I2S_SCK_PIN
+///                            and AUDIO_I2S_WS_PIN
+///   -D AUDIO_ADC_CHANNEL=6   an analog microphone on an ADC1 channel (6 is
+///                            GPIO34), sampled by the I2S built-in ADC mode
+///
+#ifndef AUDIO_I2S_SCK_PIN
+#define AUDIO_I2S_SCK_PIN 14
+#endif
+#ifndef AUDIO_I2S_WS_PIN
+#define AUDIO_I2S_WS_PIN 15
+#endif
+
+///
+///@brief I2S0 fills a ring of DMA buffers at audioSampleRate, read()
+/// returns when the buffer with the last sample asked for is complete. Half
+/// a hop per buffer: a read ends at most 8 ms after its last sample.
+///
+class I2sAudioSource : public AudioSource {
+public:
+  ///@return false if there is no microphone or the driver failed
+  bool begin() {
+#if !defined(AUDIO_ADC_CHANNEL) && !defined(AUDIO_I2S_SD_PIN)
+    return false;
+#else
+    i2s_config_t config         = {};
+    config.sample_rate          = audioSampleRate;
+    config.channel_format       = I2S_CHANNEL_FMT_ONLY_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+    config.dma_buf_count        = 4;
+    config.dma_buf_len          = audioHop / 2;
+#if defined(AUDIO_ADC_CHANNEL)
+    config.mode = i2s_mode_t(I2S_MODE_MASTER | I2S_MODE_RX |
+                             I2S_MODE_ADC_BUILT_IN);
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+    if (i2s_driver_install(port, &config, 0, nullptr) != ESP_OK) {
+      return false;
+    }
+    if (i2s_set_adc_mode(ADC_UNIT_1, adc1_channel_t(AUDIO_ADC_CHANNEL)) !=
+            ESP_OK ||
+        i2s_adc_enable(port) != ESP_OK) {
+      i2s_driver_uninstall(port);
+      return false;
+    }
+    adc = true;
+    return true;
+#else
+    config.mode            = i2s_mode_t(I2S_MODE_MASTER | I2S_MODE_RX);
+    config.bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT;
+    if (i2s_driver_install(port, &config, 0, nullptr) != ESP_OK) {
+      return false;
+    }
+    i2s_pin_config_t pins = {};
+    pins.bck_io_num       = AUDIO_I2S_SCK_PIN;
+    pins.ws_io_num        = AUDIO_I2S_WS_PIN;
+    pins.data_out_num     = I2S_PIN_NO_CHANGE;
+    pins.data_in_num      = AUDIO_I2S_SD_PIN;
+    if (i2s_set_pin(port, &pins) != ESP_OK) {
+      i2s_driver_uninstall(port);
+      return false;
+    }
+    return true;
+#endif
+#endif
+  }
+
+  size_t read(int16_t *samples, size_t count) override {
+    size_t done = 0;
+    while (done < count) {
+      size_t n     = min<size_t>(count - done, chunk);
+      size_t bytes = 0;
+      if (adc) {
+        if (i2s_read(port, samples + done, n * sizeof(int16_t), &bytes,
+                     portMAX_DELAY) != ESP_OK) {
+          break;
+        }
+        n = bytes / sizeof(int16_t);
+        // 12 bit, unsigned, the channel in the top 4 bits
+        for (size_t i = 0; i < n; i++) {
+          int32_t raw       = uint16_t(samples[done + i]) & 0x0FFF;
+          samples[done + i] = int16_t((raw - 2048) << 4);
+        }
+      } else {
+        int32_t raw[chunk];
+        if (i2s_read(port, raw, n * sizeof(int32_t), &bytes,
+                     portMAX_DELAY) != ESP_OK) {
+          break;
+        }
+        n = bytes / sizeof(int32_t);
+        // 24 bit, left aligned. MEMS microphones peak far below full scale,
+        // 2 more bits than the top 16 are kept, saturating.
+        for (size_t i = 0; i < n; i++) {
+          samples[done + i] = saturate16(raw[i] >> 14);
+        }
+      }
+      done += n;
+    }
+    return done;
+  }
+
+  const char *name() const override { return adc ? "adc" : "i2s"; }
+
+private:
+  static const i2s_port_t port = I2S_NUM_0; // the only one with the ADC
+  static const size_t chunk    = 64;
+
+  bool adc = false;
+} i2sAudioSource;
+
+#else
+
+///
+///@brief A WAV file, PCM 16 bit, mono or stereo at any rate: the channels are
+/// mixed and the samples resampled to audioSampleRate by linear
+/// interpolation, so the same file gives the same samples on every run.
+///
+class WavAudioSource : public AudioSource {
+public:
+  // Start again at the end of the file instead of ending
+  bool looping = false;
+
+  ///@return false if the file cannot be read or is not a PCM 16 bit WAV
+  bool open(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+      return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      data.insert(data.end(), buffer, buffer + size);
+    }
+    fclose(file);
+    return load(std::move(data));
+  }
+
+  ///@brief The WAV file in `data`
+  bool load(std::vector<uint8_t> &&data) {
+    wav      = std::move(data);
+    frames   = 0;
+    position = 0;
+    if (wav.size() < 12 || memcmp(wav.data(), "RIFF", 4) != 0 ||
+        memcmp(wav.data() + 8, "WAVE", 4) != 0) {
+      return false;
+    }
+    bool format = false;
+    for (size_t at = 12; at + 8 <= wav.size();) {
+      uint32_t size = get32(at + 4);
+      at += 8;
+      if (size > wav.size() - at) {
+        size = wav.size() - at;
+      }
+      if (memcmp(wav.data() + at - 8, "fmt ", 4) == 0 && size >= 16) {
+        channels = get16(at + 2);
+        rate     = get32(at + 4);
+        format   = get16(at) == 1 && get16(at + 14) == 16 && channels > 0 &&
+                 rate > 0;
+      } else if (memcmp(wav.data() + at - 8, "data", 4) == 0 && format) {
+        pcm    = at;
+        frames = size / (2 * channels);
+        // 16.16 input frames per output sample
+        step = (uint64_t(rate) << 16) / audioSampleRate;
+        return frames > 0;
+      }
+      at += size + (size & 1);
+    }
+    return false;
+  }
+
+  size_t read(int16_t *samples, size_t count) override {
+    for (size_t i = 0; i < count; i++) {
+      uint32_t frame = position >> 16;
+      if (frame >= frames) {
+        if (!looping || frames == 0) {
+          return i;
+        }
+        position -= uint64_t(frames) << 16;
+        frame = position >> 16;
+      }
+      int32_t a   = mono(frame);
+      int32_t b   = frame + 1 < frames ? mono(frame + 1) : a;
+      int32_t mix = (position & 0xFFFF) >> 1;
+      samples[i]  = int16_t(a + (((b - a) * mix) >> 15));
+      position += step;
+    }
+    return count;
+  }
+
+  const char *name() const override { return "wav"; }
+
+  ///@brief Samples the file lasts, at audioSampleRate
+  uint64_t length() const {
+    return step == 0 ? 0 : (uint64_t(frames) << 16) / step;
+  }
+
+private:
+  uint16_t get16(size_t at) const { return wav[at] | wav[at + 1] << 8; }
+  uint32_t get32(size_t at) const {
+    return get16(at) | uint32_t(get16(at + 2)) << 16;
+  }
+
+  int32_t mono(uint32_t frame) const {
+    int32_t sum = 0;
+    size_t at   = pcm + size_t(frame) * channels * 2;
+    for (uint16_t c = 0; c < channels; c++) {
+      sum += int16_t(get16(at + 2 * c));
+    }
+    return sum / channels;
+  }
+
+  std::vector<uint8_t> wav;
+  size_t pcm        = 0;
+  uint32_t frames   = 0;
+  uint16_t channels = 1;
+  uint32_t rate     = audioSampleRate;
+  uint64_t step     = 1 << 16;
+  uint64_t position = 0;
+} wavAudioSource;
+
+#endif
+
+// The source the audio task reads, nullptr when there is none
+AudioSource *audioSource = nullptr;
+
+///
+///@brief In-place radix-2 decimation in time FFT of audioFftSize Q15
+/// complex values, with block floating point: a stage whose inputs could
+/// overflow halves or quarters its outputs. transform() returns the count of
+/// halvings, the spectrum is the DFT times 2^-shift.
+///
+class Fft {
+public:
+  static const uint16_t size = audioFftSize;
+
+  Fft() {
+    for (uint16_t i = 0; i <= size / 4; i++) {
+      sine[i] = int16_t(lround(32767 * sin(2 * M_PI * i / size)));
+    }
+  }
+
+  uint8_t transform(int16_t *re, int16_t *im) const {
+    // Rounded rather than truncated: a truncation bias adds up over the
+    // stages into the low bins
+    const int32_t half15 = 1 << 14;
+    int32_t peak         = 0;
+    for (uint16_t i = 0; i < size; i++) {
+      uint16_t j = reverse(i);
+      if (j > i) {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+      peak = max(peak, max(abs(int32_t(re[i])), abs(int32_t(im[i]))));
+    }
+
+    uint8_t shift = 0;
+    for (uint16_t half = 1; half < size; half <<= 1) {
+      // An output is at most (1 + sqrt(2)) times the largest input
+      uint8_t scale = peak <= 13500 ? 0 : peak <= 27000 ? 1 : 2;
+      int32_t round = (1 << scale) >> 1;
+      shift += scale;
+      peak = 0;
+
+      uint16_t stride = size / (2 * half);
+      for (uint16_t k = 0; k < half; k++) {
+        int32_t wr, wi;
+        twiddle(k * stride, wr, wi);
+        for (uint16_t i = k; i < size; i += 2 * half) {
+          uint16_t j = i + half;
+          int32_t tr = (wr * re[j] - wi * im[j] + half15) >> 15;
+          int32_t ti = (wr * im[j] + wi * re[j] + half15) >> 15;
+          int32_t ar = re[i] + round;
+          int32_t ai = im[i] + round;
+
+          re[i] = (ar + tr) >> scale;
+          im[i] = (ai + ti) >> scale;
+          re[j] = (ar - tr) >> scale;
+          im[j] = (ai - ti) >> scale;
+          peak  = max(peak, max(max(abs(int32_t(re[i])), abs(int32_t(im[i]))),
+                                max(abs(int32_t(re[j])), abs(int32_t(im[j])))));
+        }
+      }
+    }
+    return shift;
+  }
+
+private:
+  static uint16_t reverse(uint16_t i) {
+    uint16_t r = 0;
+    for (uint8_t b = 0; b < audioFftBits; b++) {
+      r = r << 1 | (i >> b & 1);
+    }
+    return r;
+  }
+
+  ///@brief e^(-2 pi i k / size), Q15, for k below size / 2
+  void twiddle(uint16_t k, int32_t &wr, int32_t &wi) const {
+    if (k <= size / 4) {
+      wr = sine[size / 4 - k];
+      wi = -sine[k];
+    } else {
+      wr = -sine[k - size / 4];
+      wi = -sine[size / 2 - k];
+    }
+  }
+
+  int16_t sine[size / 4 + 1];
+};
+
+///
+///@brief What an analysis found, from the audio task to the render task
+///
+struct AudioFeatures {
+  uint8_t bands[audioBands]; // smoothed levels, low to high frequencies
+  uint8_t level;             // mean of the bands, smoothed
+  uint16_t beats;            // beats found so far, wrapping
+  uint32_t capturedUs;       // micros() when the last sample was captured
+};
+
+///
+///@brief Band levels and beats of the sound, one analysis per hop.
+/// Levels are on a log scale, 0 to 255 for the loudest band of the last
+/// seconds down to rangeLog2 below it: the gain follows the loudness, only
+/// falling slowly, and never goes above that of quietLog2 so a silent room
+/// stays dark. A beat is the energy of the bass bands jumping beatLog2 above
+/// its average of the last half second.
+///
+class AudioAnalyzer {
+public:
+  // Log2 of energies, Q8. A full scale sine is about 44.
+  static const int32_t rangeLog2    = 10 * 256; // 30 dB of levels
+  static const int32_t quietLog2    = 34 * 256; // -30 dB full scale
+  static const int32_t releaseLog2  = 4;        // 3 dB a second
+  static const int32_t beatLog2     = 256;      // twice the average energy
+  static const uint8_t bassBands    = 3;        // up to about 180 Hz
+  static const uint8_t beatMinHops  = 15;       // 240 ms, up to 250 BPM
+  static const uint8_t attack       = 160;      // of 256 per hop, rising
+  static const uint8_t release      = 40;       // falling
+
+  AudioAnalyzer() {
+    // Hann window, symmetric
+    for (uint16_t i = 0; i < audioFftSize / 2; i++) {
+      window[i] =
+          int16_t(lround(32767 * (0.5 - 0.5 * cos(2 * M_PI * i /
+                                                  (audioFftSize - 1)))));
+    }
+    // Log-spaced, from 62.5 Hz to the Nyquist frequency, a bin at least
+    const uint16_t first = 2;
+    const uint16_t last  = audioFftSize / 2;
+    edges[0]             = first;
+    for (uint8_t b = 1; b <= audioBands; b++) {
+      uint16_t edge = uint16_t(
+          lround(first * pow(double(last) / first, double(b) / audioBands)));
+      edges[b] = max<uint16_t>(edge, edges[b - 1] + 1);
+    }
+    reset();
+  }
+
+  void reset() {
+    memset(history, 0, sizeof(history));
+    memset(smoothed, 0, sizeof(smoothed));
+    smoothedLevel = 0;
+    dc            = 0;
+    ceiling       = quietLog2;
+    bassAverage   = 0;
+    sinceBeat     = beatMinHops;
+    beats         = 0;
+  }
+
+  ///@brief Analyze the last audioFftSize samples, `hop` the audioHop newest
+  void analyze(const int16_t *hop, uint32_t capturedUs,
+               AudioFeatures &features) {
+    memmove(history, history + audioHop,
+            (audioFftSize - audioHop) * sizeof(int16_t));
+    // DC blocker: an analog microphone sits on an offset
+    int16_t *fresh = history + audioFftSize - audioHop;
+    for (uint16_t i = 0; i < audioHop; i++) {
+      dc += (int32_t(hop[i]) * 256 - dc) >> 8;
+      fresh[i] = saturate16(hop[i] - (dc >> 8));
+    }
+
+    for (uint16_t i = 0; i < audioFftSize; i++) {
+      uint16_t w = i < audioFftSize / 2 ? window[i]
+                                        : window[audioFftSize - 1 - i];
+      re[i] = int16_t((int32_t(history[i]) * w) >> 15);
+      im[i] = 0;
+    }
+    uint8_t shift = fft.transform(re, im);
+
+    // Band energies as log2 Q8, in units of the unscaled DFT
+    int32_t bandLog[audioBands];
+    uint64_t bass   = 0;
+    int32_t loudest = 0;
+    for (uint8_t b = 0; b < audioBands; b++) {
+      uint64_t energy = 0;
+      for (uint16_t k = edges[b]; k < edges[b + 1]; k++) {
+        energy += uint32_t(int32_t(re[k]) * re[k]) +
+                  uint32_t(int32_t(im[k]) * im[k]);
+      }
+      if (b < bassBands) {
+        bass += energy;
+      }
+      bandLog[b] = log2Q8(energy) + shift * 2 * 256;
+      loudest    = max(loudest, bandLog[b]);
+    }
+
+    ceiling = max(loudest, max(ceiling - releaseLog2, quietLog2));
+    uint32_t sum = 0;
+    for (uint8_t b = 0; b < audioBands; b++) {
+      uint16_t level = toLevel(bandLog[b]);
+      sum += level;
+      smooth(smoothed[b], level);
+      features.bands[b] = smoothed[b] >> 8;
+    }
+    // The mean of the bands
+    smooth(smoothedLevel, sum / audioBands);
+    features.level = smoothedLevel >> 8;
+
+    int32_t bassLog = log2Q8(bass) + shift * 2 * 256;
+    if (sinceBeat < beatMinHops) {
+      sinceBeat++;
+    }
+    if (sinceBeat >= beatMinHops && bassLog > ceiling - rangeLog2 &&
+        bassLog - bassAverage > beatLog2) {
+      beats++;
+      sinceBeat = 0;
+    }
+    bassAverage += (bassLog - bassAverage) >> 5;
+
+    features.beats      = beats;
+    features.capturedUs = capturedUs;
+  }
+
+  ///@brief First FFT bin of band b, audioBands the end of the last band
+  uint16_t edge(uint8_t b) const { return edges[b]; }
+
+  ///@brief log2(value) in Q8, the fraction linear between powers of two
+  static int32_t log2Q8(uint64_t value) {
+    if (value == 0) {
+      return 0;
+    }
+    uint8_t exponent = 63 - __builtin_clzll(value);
+    uint32_t mantissa =
+        exponent >= 8 ? uint32_t(value >> (exponent - 8)) & 0xFF
+                      : uint32_t(value << (8 - exponent)) & 0xFF;
+    return exponent * 256 + mantissa;
+  }
+
+private:
+  uint16_t toLevel(int32_t log2) const {
+    int32_t above = log2 - (ceiling - rangeLog2);
+    if (above <= 0) {
+      return 0;
+    }
+    return min<int32_t>(above * 255 / rangeLog2, 255) << 8;
+  }
+
+  ///@brief Q8 level towards target, fast up and slow down
+  static void smooth(uint16_t &level, uint16_t target) {
+    int32_t delta = int32_t(target) - level;
+    level += delta * (delta > 0 ? attack : release) / 256;
+  }
+
+  Fft fft;
+  int16_t window[audioFftSize / 2];
+  uint16_t edges[audioBands + 1];
+  int16_t history[audioFftSize];
+  int16_t re[audioFftSize];
+  int16_t im[audioFftSize];
+  uint16_t smoothed[audioBands];
+  uint16_t smoothedLevel;
+  int32_t dc;
+  int32_t ceiling;
+  int32_t bassAverage;
+  uint8_t sinceBeat;
+  uint16_t beats;
+} audioAnalyzer;
+
+///
+///@brief The analyses, from the audio task to the render task, and the
+/// latency of the frames drawn from them.
+/// The audio task only publishes while the render task listens, when an
+/// audio zone is visible: otherwise nothing wakes the render task.
+///
+class AudioFeed {
+public:
+  ///@brief Render task, every iteration
+  void listen(bool visible) {
+    listening.store(visible, std::memory_order_relaxed);
+  }
+
+  ///@brief Audio task
+  ///@return false if the render task is not listening or is behind
+  bool publish(const AudioFeatures &features) {
+    return listening.load(std::memory_order_relaxed) && ring.push(features);
+  }
+
+  ///@brief Render task: take the newest analysis, `now` is the time of the
+  /// frame, a new beat starts there
+  ///@return false if there is none
+  bool receive(unsigned long now) {
+    AudioFeatures next;
+    bool received = false;
+    while (ring.pop(next)) {
+      received = true;
+    }
+    if (!received) {
+      return false;
+    }
+    if (next.beats != latest.beats) {
+      beatMs = now;
+    }
+    latest  = next;
+    pending = true;
+    return true;
+  }
+
+  const AudioFeatures &features() const { return latest; }
+  unsigned long lastBeatMs() const { return beatMs; }
+
+  ///@brief Render task, when an audio zone is drawn
+  void drawn() { drawnPending = pending; }
+
+  ///
+  ///@brief Render task, after a show(): the latency of the first frame drawn
+  /// from the newest analysis goes to the `audio` probe, the time since its
+  /// capture and the `wireUs` the frame takes to reach the LEDs
+  ///
+  void frameShown(uint32_t wireUs) {
+    if (!drawnPending) {
+      return;
+    }
+    diagnostics.recordMicros(Probe_Id::audio,
+                             micros() - latest.capturedUs + wireUs);
+    pending      = false;
+    drawnPending = false;
+  }
+
+private:
+  SpscRing<AudioFeatures, 4> ring;
+  std::atomic<bool> listening{false};
+  AudioFeatures latest  = {};
+  unsigned long beatMs  = 0;
+  bool pending          = false;
+  bool drawnPending     = false;
+} audioFeed;
+
+// Loop Functions
+// The audio modes draw the newest analysis of audioFeed.
+#pragma region AudioFunctions
+
+///
+///@brief The bands spread over the zone, low to high, each band's level
+/// times gain / 128 lighting a color between low and high. The levels are
+/// interpolated between the band centers.
+///
+template <typename Format = StripFormat>
+void spectrum(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+              const Color_RGB &low, const Color_RGB &high, uint8_t gain) {
+  uint8_t *pixels = clearZone(strip, first, count);
+  if (pixels == nullptr) {
+    return;
+  }
+  audioFeed.drawn();
+  const uint8_t *bands = audioFeed.features().bands;
+
+  const int32_t span = (audioBands - 1) * 256;
+  for (uint16_t i = 0; i < count; i++) {
+    // Band position of the pixel's center, Q8
+    int32_t at = (int32_t(2 * i + 1) * audioBands * 128) / count - 128;
+    at         = min(max(at, int32_t(0)), span);
+    uint8_t b  = at >> 8;
+    uint8_t f  = at & 0xFF;
+    uint8_t level =
+        b + 1 < audioBands ? mix8(bands[b], bands[b + 1], f) : bands[b];
+    uint16_t scaled = min<uint16_t>((level * gain) >> 7, 255);
+    Color_RGB color = mixColor(low, high, at * 255 / span);
+    splat<Format>(pixels, i, color, scaled);
+  }
+}
+
+///@brief How long a pulse takes to fade, from the velocity: 20 ms to 1 s
+inline uint16_t pulseFadeMs(uint8_t velocity) {
+  return 20 + (255 - velocity) * 4;
+}
+
+///
+///@brief The whole zone flashes color on every beat and fades out, faster
+/// as velocity goes up. Between the beats it glows with the sound's level.
+///
+template <typename Format = StripFormat>
+void pulse(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+           const Color_RGB &color, uint8_t velocity, unsigned long now) {
+  audioFeed.drawn();
+  const AudioFeatures &features = audioFeed.features();
+
+  uint8_t level         = features.level >> 2;
+  unsigned long elapsed = now - audioFeed.lastBeatMs();
+  uint16_t fadeMs       = pulseFadeMs(velocity);
+  if (features.beats != 0 && elapsed < fadeMs) {
+    // Quadratic fade: a sharp flash, a long tail
+    uint32_t left  = fadeMs - elapsed;
+    uint8_t flash  = left * left * 255 / (uint32_t(fadeMs) * fadeMs);
+    level          = max(level, flash);
+  }
+  Color_RGB scaled = Color_RGB{uint8_t((color.r * (level + 1)) >> 8),
+                               uint8_t((color.g * (level + 1)) >> 8),
+                               uint8_t((color.b * (level + 1)) >> 8)};
+  fixed_color<Format>(strip, first, count, scaled);
+}
+
+#pragma endregion AudioFunctions
+
+#endif // AUDIO_HPP
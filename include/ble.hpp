@@ -9,239 +9,567 @@
 
 #include "Arduino.h"
 #include "SPIFFS.h"
+#include "clock.hpp"
+#include "commands.hpp"
+#include "diagnostics.hpp"
+#include "frame_scheduler.hpp"
+#include "log.hpp"
+#include "output.hpp"
+#include "persistence.hpp"
+#include "power.hpp"
+#include "segments.hpp"
 #include "settings.h"
+#include "settings_store.hpp"
+#include "tasks.hpp"
+#include "transition.hpp"
 #include <Adafruit_NeoPixel.h>
+#include <atomic>
 
 #pragma region CallbackSetMods
 
+///
+///@brief BLE layout of a zone, 16 bit fields little endian
+/// [start, length, mode, params...] [16, 16, 8, segmentParamsSize bytes]
+/// params is the payload of the mode's characteristic (FireData's for
+/// fire...), zero padded. It is only read up to the mode's payload, which
+/// can be written without the padding.
+///
+const size_t segmentHeaderSize  = 5;
+const size_t segmentPayloadSize = segmentHeaderSize + segmentParamsSize;
+
+void encodeSegment(const SegmentData &segment, byte *buffer) {
+  buffer[0]    = lowByte(segment.start);
+  buffer[1]    = highByte(segment.start);
+  buffer[2]    = lowByte(segment.length);
+  buffer[3]    = highByte(segment.length);
+  buffer[4]    = byte(segment.mode);
+  byte *params = buffer + segmentHeaderSize;
+  memset(params, 0, segmentParamsSize);
+  const ModeEntry *mode = findMode(segment.mode);
+  if (mode != nullptr) {
+    mode->encodeZone(segment, params);
+  }
+}
+
+///
+///@param length at least segmentHeaderSize
+///@return false if the mode is unknown or its parameters are not valid
+///
+bool decodeSegment(const byte *buffer, size_t length, SegmentData &segment) {
+  segment.start  = buffer[0] | buffer[1] << 8;
+  segment.length = buffer[2] | buffer[3] << 8;
+  if (!decodeMode(buffer[4], segment.mode)) {
+    return false;
+  }
+  memset(segment.params, 0, sizeof(segment.params));
+  size_t params = min<size_t>(length - segmentHeaderSize, segmentParamsSize);
+  return findMode(segment.mode)->decodeZone(buffer + segmentHeaderSize,
+                                            params, segment);
+}
+
+#pragma region StateEncoders
+
+// Payloads the characteristics are read and notified with, the same layouts
+// the app writes. Each one fills buffer and returns its size.
+
+size_t encodeDefaultData(byte *buffer) {
+  buffer[0] = lowByte(device.defaultData.ledLenght);
+  buffer[1] = highByte(device.defaultData.ledLenght);
+  buffer[2] = device.defaultData.brightness;
+  return 3;
+}
+
+///@brief The parameters of Mode, as its decode() reads them
+template <typename Mode> size_t encodeModeData(byte *buffer) {
+  return Mode::encode(Mode::params(device), buffer);
+}
+
+size_t encodeActiveMode(byte *buffer) {
+  buffer[0] = byte(device.activeMode);
+  return 1;
+}
+
+///
+///@brief [count, zones...], every zone as encodeSegment()
+///
+size_t encodeSegmentsData(byte *buffer) {
+  buffer[0] = device.segmentsData.count;
+  for (uint8_t i = 0; i < device.segmentsData.count; i++) {
+    encodeSegment(device.segmentsData.segments[i],
+                  buffer + 1 + i * segmentPayloadSize);
+  }
+  return 1 + device.segmentsData.count * segmentPayloadSize;
+}
+
+size_t encodeTransitionData(byte *buffer) {
+  buffer[0] = lowByte(device.transitionData.duration);
+  buffer[1] = highByte(device.transitionData.duration);
+  return 2;
+}
+
+///
+///@brief [flags, (red, green, blue) * count] [8, (8,8,8) * count]
+/// flags bit 0: blend, count 1 to paletteColorsMax
+///
+size_t encodePaletteData(byte *buffer) {
+  const PaletteData &palette = device.paletteData;
+  buffer[0]                  = palette.blend ? 1 : 0;
+  for (uint8_t i = 0; i < palette.count; i++) {
+    buffer[1 + 3 * i] = palette.colors[i].r;
+    buffer[2 + 3 * i] = palette.colors[i].g;
+    buffer[3 + 3 * i] = palette.colors[i].b;
+  }
+  return 1 + 3 * palette.count;
+}
+
+size_t encodeOnOff(byte *buffer) {
+  buffer[0] = byte(device.isOn);
+  return 1;
+}
+
+// Longest state payload, the zone table
+const size_t statePayloadMax = 1 + SEGMENTS_MAX * segmentPayloadSize;
+
+///
+///@brief A characteristic holding part of the device state
+///
+struct StateField {
+  BLECharacteristic *DeviceInfo::*characteristic;
+  size_t (*encode)(byte *buffer);
+};
+
+// In the bit order of the StateChanged mask, new fields go at the end
+const StateField stateFields[] = {
+    {&DeviceInfo::blecDefaultData, encodeDefaultData},
+    {&DeviceInfo::blecFixedColorData, encodeModeData<FixedColorMode>},
+    {&DeviceInfo::blecRainbowData, encodeModeData<RainbowMode>},
+    {&DeviceInfo::blecColorSplitData, encodeModeData<ColorSplitMode>},
+    {&DeviceInfo::blecActiveMode, encodeActiveMode},
+    {&DeviceInfo::blecSegmentData, encodeSegmentsData},
+    {&DeviceInfo::blecTransitionData, encodeTransitionData},
+    {&DeviceInfo::blecPaletteMode, encodeModeData<PaletteMode>},
+    {&DeviceInfo::blecPalette, encodePaletteData},
+    {&DeviceInfo::blecFireData, encodeModeData<FireMode>},
+    {&DeviceInfo::blecMeteorData, encodeModeData<MeteorMode>},
+    {&DeviceInfo::blecTwinkleData, encodeModeData<TwinkleMode>},
+    {&DeviceInfo::blecCometData, encodeModeData<CometMode>},
+    {&DeviceInfo::blecProgramMode, encodeModeData<ProgramMode>},
+    {&DeviceInfo::blecSpectrumData, encodeModeData<SpectrumMode>},
+    {&DeviceInfo::blecPulseData, encodeModeData<PulseMode>},
+    {&DeviceInfo::blecOnOff, encodeOnOff},
+    {&DeviceInfo::blecSparkleData, encodeModeData<SparkleMode>},
+    {&DeviceInfo::blecPaletteSparkle, encodeModeData<PaletteSparkleMode>},
+};
+
+const uint8_t stateFieldCount = sizeof(stateFields) / sizeof(stateFields[0]);
+static_assert(stateFieldCount <= 32, "StateChanged has a 32 bit mask");
+
+#pragma endregion StateEncoders
+
 void loadBLESettingsData() {
-  // TODO: Update function for sending data to the right location.
-  Serial.println("[STRIP] - sendSettings - Sending Settings to Phone");
-  byte *data;
-
-  // blecDefaultData
-  byte defaultData[] = {device.defaultData.ledLenght,
-                        device.defaultData.brightness};
-  device.blecDefaultData->setValue(defaultData, sizeof(DefaultData));
-  data = device.blecDefaultData->getData();
-  Serial.println("[STRIP] - sendSettings - blecDefaultData - Data: " +
-                 String(int(data[0])) + "," + String(int(data[1])));
-
-  // blecFixedColorData
-  byte fixedColorData[] = {
-      device.fixedColorData.color.r,
-      device.fixedColorData.color.g,
-      device.fixedColorData.color.b,
-  };
-  device.blecFixedColorData->setValue(fixedColorData, sizeof(fixedColorData));
-  data = device.blecFixedColorData->getData();
-  Serial.println("[STRIP] - sendSettings - blecFixedColorData - Data: " +
-                 String(int(data[0])) + "," + String(int(data[1])) + "," +
-                 String(int(data[2])));
-
-  // blecRainbowData
-  byte rainbowData[] = {
-      device.rainbowData.velocity,
-  };
-  device.blecRainbowData->setValue(rainbowData, sizeof(rainbowData));
-  data = device.blecRainbowData->getData();
-  Serial.println("[STRIP] - sendSettings - blecRainbowData - Data: " +
-                 String(int(data[0])));
-
-  // blecFixedColorData
-  byte colorSplitData[] = {
-      device.colorSplitData.endFirstLedSplit, device.colorSplitData.color1.r,
-      device.colorSplitData.color1.g,         device.colorSplitData.color1.b,
-      device.colorSplitData.color2.r,         device.colorSplitData.color2.g,
-      device.colorSplitData.color2.b,
-  };
-  device.blecColorSplitData->setValue(colorSplitData, sizeof(colorSplitData));
-  data = device.blecColorSplitData->getData();
-  Serial.println("[STRIP] - sendSettings - blecColorSplitData - Data: " +
-                 String(int(data[0])) + "," + String(int(data[1])) + "," +
-                 String(int(data[2])) + "," + String(int(data[3])) + "," +
-                 String(int(data[4])) + "," + String(int(data[5])) + "," +
-                 String(int(data[6])));
-
-  // blecRainbowData
-  byte blecActiveMode[] = {
-      byte(device.activeMode),
-  };
-  device.blecActiveMode->setValue(blecActiveMode, sizeof(blecActiveMode));
-  data = device.blecActiveMode->getData();
-  Serial.println("[STRIP] - sendSettings - blecActiveMode - Data: " +
-                 String(int(data[0])));
+  LOG_INFO(STRIP, "sendSettings - Sending Settings to Phone");
+  byte buffer[statePayloadMax];
+  for (const StateField &field : stateFields) {
+    size_t size = field.encode(buffer);
+    (device.*field.characteristic)->setValue(buffer, size);
+  }
+  LOG_INFO(STRIP, "sendSettings - Sending Settings Done");
+}
 
-  byte blecOnOff[] = {
-      byte(device.isOn),
-  };
-  device.blecOnOff->setValue(blecOnOff, sizeof(blecOnOff));
-  data = device.blecActiveMode->getData();
-  Serial.println("[STRIP] - sendSettings - blecOnOff - Data: " +
-                 String(int(data[0])));
-
-  Serial.println("[STRIP] - sendSettings - Sending Settings Done");
-}
-
-void setDefaultSettings(const byte *buffer) {
-  Serial.println("[STRIP] - setDefaultSettings - Called");
-  if (buffer[0] > 0) {
-    device.strip.clear();
-    device.strip.fill(0);
-    device.strip.show();
-    device.defaultData.ledLenght = buffer[0];
-    device.strip.updateLength(device.defaultData.ledLenght);
-    device.strip.show();
-  } else {
-    Serial.println(
-        "[STRIP] - setDefaultSettings - ERROR - Recived negative lenght");
-  }
-  Serial.println("[STRIP] - setDefaultSettings - Strip Lenght updated");
-
-  device.defaultData.brightness = buffer[1];
-  device.strip.setBrightness(device.defaultData.brightness);
-  device.strip.show();
-  Serial.println("[STRIP] - setDefaultSettings - Strip brightess Updated");
-
-  Serial.println("************Default***********");
-  Serial.println("LedLenght: " + String(device.defaultData.ledLenght));
-  Serial.println("Brightness: " + String(device.defaultData.brightness));
-  Serial.println("******************************");
-}
-
-void setFixedColorData(const byte *buffer) {
-  Serial.println("[STRIP] - setFixedColorData - Called");
-  int index                     = 0;
-  device.fixedColorData.color.r = buffer[index++];
-  device.fixedColorData.color.g = buffer[index++];
-  device.fixedColorData.color.b = buffer[index++];
-  Serial.println("[STRIP] - setFixedColorData - color updated");
-
-  Serial.println("********FixedColor Mod********");
-  Serial.println("Color: " + String(device.fixedColorData.color.r) + "," +
-                 String(device.fixedColorData.color.g) + "," +
-                 String(device.fixedColorData.color.b));
-  Serial.println("******************************");
-}
-
-void setRainbowData(const byte *buffer) {
-  Serial.println("[STRIP] - setRainbowData - Called");
-
-  int velocityIndex           = 0;
-  device.rainbowData.velocity = buffer[velocityIndex];
-
-  Serial.println("**********Rainbow Mod*********");
-  Serial.println("Velocity: " + String(device.rainbowData.velocity));
-  Serial.println("******************************");
-}
-
-void setColorSplitData(const byte *buffer) {
-  Serial.println("[STRIP] - setColorSplitData - Called");
-  int index = 0;
-
-  device.colorSplitData.endFirstLedSplit = buffer[index++];
-  Serial.println("[STRIP] - setFixedColorData - endFirstLedSplit updated");
-
-  device.colorSplitData.color1.r = buffer[index++];
-  device.colorSplitData.color1.g = buffer[index++];
-  device.colorSplitData.color1.b = buffer[index++];
-  Serial.println("[STRIP] - setFixedColorData - color1 updated");
-
-  device.colorSplitData.color2.r = buffer[index++];
-  device.colorSplitData.color2.g = buffer[index++];
-  device.colorSplitData.color2.b = buffer[index++];
-  Serial.println("[STRIP] - setFixedColorData - color2 updated");
-
-  Serial.println("********ColorSplit Mod********");
-  Serial.println("FirstSplitLenght: " +
-                 String(device.colorSplitData.endFirstLedSplit));
-  Serial.println("SecondSplitLenght: " +
-                 String(device.defaultData.ledLenght -
-                        device.colorSplitData.endFirstLedSplit));
-  Serial.println("Color1: " + String(device.colorSplitData.color1.r) + "," +
-                 String(device.colorSplitData.color1.g) + "," +
-                 String(device.colorSplitData.color1.b));
-  Serial.println("Color2: " + String(device.colorSplitData.color2.r) + "," +
-                 String(device.colorSplitData.color2.g) + "," +
-                 String(device.colorSplitData.color2.b));
-  Serial.println("******************************");
-}
-
-void setActiveMode(const byte *buffer) {
-  Serial.println("[STRIP] - setActiveMode - Called");
-  switch (buffer[0]) {
-  case (int)Mode_Type::fixed_color:
-    device.activeMode = Mode_Type::fixed_color;
-    Serial.println("[STRIP] - setActiveMode - Mode_Type::fixed_color Active");
-    break;
+///
+///@brief The ATT MTU of every connection, set from the GATT server events.
+/// A notification carries at most MTU - 3 bytes, a longer value would reach
+/// the client cut short.
+///
+class ConnectionMtu {
+public:
+  static const uint16_t standard     = 23;  // until the client negotiates
+  static const uint16_t max          = 517; // offered, BLEDevice::setMTU()
+  static const uint8_t connections   = 4;
+  static const uint8_t attHeaderSize = 3;
+
+  void connected(uint16_t id) { set(id, standard); }
+  void changed(uint16_t id, uint16_t mtu) { set(id, mtu); }
+  void disconnected(uint16_t id) { set(id, 0); }
+
+  ///@brief The longest notification every connected client gets whole
+  size_t notifyMax() const {
+    uint16_t least = max;
+    for (const std::atomic<uint16_t> &mtu : mtus) {
+      uint16_t value = mtu.load(std::memory_order_relaxed);
+      if (value != 0 && value < least) {
+        least = value;
+      }
+    }
+    return least - attHeaderSize;
+  }
 
-  case (int)Mode_Type::rainbow:
-    device.activeMode = Mode_Type::rainbow;
-    Serial.println("[STRIP] - setActiveMode - Mode_Type::rainbow Active");
-    break;
+private:
+  void set(uint16_t id, uint16_t mtu) {
+    mtus[id % connections].store(mtu, std::memory_order_relaxed);
+  }
 
-  case (int)Mode_Type::color_split:
-    device.activeMode = Mode_Type::color_split;
-    Serial.println("[STRIP] - setActiveMode - Mode_Type::color_split Active");
-    break;
+  // Written by the Bluetooth task, 0 for no connection
+  std::atomic<uint16_t> mtus[connections] = {};
+};
+
+ConnectionMtu connectionMtu;
 
+#ifdef ESP32
+///@brief GATT server events the server callbacks do not pass on
+void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t,
+                       esp_ble_gatts_cb_param_t *param) {
+  switch (event) {
+  case ESP_GATTS_CONNECT_EVT:
+    connectionMtu.connected(param->connect.conn_id);
+    break;
+  case ESP_GATTS_MTU_EVT:
+    connectionMtu.changed(param->mtu.conn_id, param->mtu.mtu);
+    LOG_INFO(BLE, "MTU %u", param->mtu.mtu);
+    break;
+  case ESP_GATTS_DISCONNECT_EVT:
+    connectionMtu.disconnected(param->disconnect.conn_id);
+    break;
   default:
-    Serial.println("[STRIP] - setActiveMode - ERROR - Recived another value: " +
-                   String((int)buffer[0]));
     break;
   }
 }
+#endif
 
-bool save_data(const char *filename) {
-  // Open the file in READ_MODE
-  File outFile = SPIFFS.open(filename, "r");
+///
+///@brief Notifies the state characteristics whose value changed.
+/// Nothing marks the changes: flush() encodes every field and compares it
+/// with what was last sent, so changes made anywhere (BLE commands, the
+/// button, a JSON import) are seen without the setters knowing about it.
+/// The control task calls it after applying the queued commands, so a batch
+/// of commands that changes a field several times sends it once.
+///
+/// A value longer than a notification of the connection can carry is not
+/// notified cut short: StateChanged notifies a mask with its bit in
+/// stateFields order, and the client reads the value, in full.
+///
+class StateNotifier {
+public:
+  ///@brief Set and notify the fields that changed since the last call
+  ///@return the number of notifications sent
+  uint8_t flush() {
+    byte buffer[statePayloadMax];
+    uint8_t notified = 0;
+    uint32_t tooLong = 0;
+    for (uint8_t i = 0; i < stateFieldCount; i++) {
+      size_t size = stateFields[i].encode(buffer);
+      if (size == sizes[i] && memcmp(buffer, sent[i], size) == 0) {
+        continue;
+      }
+      memcpy(sent[i], buffer, size);
+      sizes[i] = size;
 
-  // Allocate JsonDocument
-  DynamicJsonDocument sett(1024);
+      BLECharacteristic *characteristic =
+          device.*stateFields[i].characteristic;
+      if (characteristic == nullptr) {
+        continue;
+      }
+      characteristic->setValue(buffer, size);
+      if (!device.deviceConnected) {
+        continue;
+      }
+      if (size > connectionMtu.notifyMax()) {
+        tooLong |= uint32_t(1) << i;
+        continue;
+      }
+      characteristic->notify();
+      notified++;
+    }
 
-  // Parse outFile in Json
-  if (deserializeJson(sett, outFile) != DeserializationError::Ok) {
-    return false;
+    if (tooLong != 0 && device.blecStateChanged != nullptr) {
+      byte mask[4] = {byte(tooLong), byte(tooLong >> 8), byte(tooLong >> 16),
+                      byte(tooLong >> 24)};
+      device.blecStateChanged->setValue(mask, sizeof(mask));
+      device.blecStateChanged->notify();
+      notified++;
+    }
+    return notified;
   }
 
-  // Close the outFile
-  outFile.close();
+private:
+  byte sent[stateFieldCount][statePayloadMax];
+  // Nothing matches before the first flush()
+  size_t sizes[stateFieldCount] = {};
+};
 
-  // Sett Parameters
-  sett["DefaultData"]["ledLenght"]  = device.defaultData.ledLenght;
-  sett["DefaultData"]["brightness"] = device.defaultData.brightness;
+StateNotifier stateNotifier;
+
+void setDefaultSettings(const DefaultData &data) {
+  LOG_DEBUG(STRIP, "setDefaultSettings - Called");
+  if (data.ledLenght > StripPixels::capacity()) {
+    LOG_ERROR(STRIP, "setDefaultSettings - ERROR - Lenght over %u",
+              StripPixels::capacity());
+  } else if (data.ledLenght > 0) {
+    if (data.ledLenght != device.defaultData.ledLenght) {
+      // Blank the whole strip, LEDs past a shorter length are not sent again
+      outputStage.blank();
+      device.defaultData.ledLenght = data.ledLenght;
+      device.strip.setLength(device.defaultData.ledLenght);
+    }
+  } else {
+    LOG_ERROR(STRIP, "setDefaultSettings - ERROR - Recived negative lenght");
+  }
+  LOG_INFO(STRIP, "setDefaultSettings - Strip Lenght updated");
 
-  sett["FixedColorData"]["color"][0] = device.fixedColorData.color.r;
-  sett["FixedColorData"]["color"][1] = device.fixedColorData.color.g;
-  sett["FixedColorData"]["color"][2] = device.fixedColorData.color.b;
+  device.defaultData.brightness = data.brightness;
+  LOG_INFO(STRIP, "setDefaultSettings - Strip brightess Updated");
 
-  sett["RainbowData"]["velocity"] = device.rainbowData.velocity;
+  frameScheduler.invalidate();
 
-  sett["ColorSplitData"]["endFirstLedSplit"] =
-      device.colorSplitData.endFirstLedSplit;
-  sett["ColorSplitData"]["color1"][0] = device.colorSplitData.color1.r;
-  sett["ColorSplitData"]["color1"][1] = device.colorSplitData.color1.g;
-  sett["ColorSplitData"]["color1"][2] = device.colorSplitData.color1.b;
+  LOG_INFO(STRIP, "Default - LedLenght: %u, Brightness: %u",
+           device.defaultData.ledLenght, device.defaultData.brightness);
+}
 
-  sett["ColorSplitData"]["color2"][0] = device.colorSplitData.color2.r;
-  sett["ColorSplitData"]["color2"][1] = device.colorSplitData.color2.g;
-  sett["ColorSplitData"]["color2"][2] = device.colorSplitData.color2.b;
+void setModeData(const ModeCommand &command) {
+  LOG_DEBUG(STRIP, "setModeData - Called");
+  const ModeEntry *mode = findMode(command.mode);
+  if (mode == nullptr) {
+    return;
+  }
+  mode->apply(device, command.params);
+  LOG_INFO(STRIP, "setModeData - %s parameters updated", mode->name);
+  // An animated mode picks them up with its next frame
+  if (mode->timing.isStatic) {
+    frameScheduler.invalidate();
+  }
+}
 
-  sett["mode"] = (byte)device.activeMode;
+void setActiveMode(byte mode) {
+  LOG_DEBUG(STRIP, "setActiveMode - Called");
+  Mode_Type previous       = device.activeMode;
+  SegmentData previousZone = wholeStripSegment(device);
 
-  outFile = SPIFFS.open(filename, "w");
+  if (!decodeMode(mode, device.activeMode)) {
+    LOG_ERROR(STRIP, "setActiveMode - ERROR - Recived another value: %u",
+              mode);
+    return;
+  }
+  LOG_INFO(STRIP, "setActiveMode - %s Active",
+           findMode(device.activeMode)->name);
+
+  // The strip buffer still holds the last frame of the previous mode. With
+  // zones the active mode is not on the strip, nothing to fade.
+  if (device.activeMode != previous && device.isOn &&
+      device.segmentsData.count == 0) {
+    transitionEngine.begin(previousZone, segmentEngine.state(0), device.strip,
+                           device.transitionData.duration, frameClock->now());
+  }
+  frameScheduler.invalidate();
+}
 
-  if (serializeJson(sett, outFile) == 0) {
-    return false;
+void setTransitionData(const TransitionData &data) {
+  LOG_DEBUG(STRIP, "setTransitionData - Called");
+  device.transitionData = data;
+  LOG_INFO(STRIP, "setTransitionData - Duration: %u ms",
+           device.transitionData.duration);
+}
+
+///
+///@brief Set zone `index`, index == count appends a new zone.
+/// Zones must not overlap. A zone that keeps its place is the only one
+/// redrawn, a moved or new one redraws the whole strip.
+///
+void setSegment(uint8_t index, const SegmentData &data) {
+  LOG_DEBUG(STRIP, "setSegment - Called");
+  SegmentsData &table = device.segmentsData;
+
+  if (index > table.count || index >= SEGMENTS_MAX) {
+    LOG_ERROR(STRIP, "setSegment - ERROR - Invalid index: %u", index);
+    return;
+  }
+  if (data.length == 0 ||
+      uint32_t(data.start) + data.length > StripPixels::capacity()) {
+    LOG_ERROR(STRIP, "setSegment - ERROR - Zone out of the strip");
+    return;
+  }
+  uint8_t overlapped = table.overlapping(data, index);
+  if (overlapped != table.count) {
+    LOG_ERROR(STRIP, "setSegment - ERROR - Overlaps zone %u", overlapped);
+    return;
+  }
+
+  bool moved = index == table.count ||
+               table.segments[index].start != data.start ||
+               table.segments[index].length != data.length;
+  table.segments[index] = data;
+  if (index == table.count) {
+    table.count++;
+  }
+
+  if (moved) {
+    frameScheduler.invalidate();
+  } else {
+    segmentEngine.invalidate(index);
+  }
+  table.segments[index].print();
+}
+
+///
+///@brief Apply the last palette posted to paletteMailbox. The palette_data
+/// command of a palette applied by an earlier one is a no-op.
+///
+void setPaletteData() {
+  LOG_DEBUG(STRIP, "setPaletteData - Called");
+  PaletteData palette;
+  if (!paletteMailbox.take(palette)) {
+    return;
+  }
+  device.paletteData = palette;
+  device.paletteData.print();
+  segmentEngine.invalidateMode(device, Mode_Type::palette);
+}
+
+///
+///@brief Apply the queued programs. Unlike palettes every one is applied,
+/// in order: they can be for different slots.
+///
+void setProgramData() {
+  LOG_DEBUG(STRIP, "setProgramData - Called");
+  ProgramUpload upload;
+  bool received = false;
+  while (programQueue.pop(upload)) {
+    received = true;
+    if (upload.remove) {
+      effectPrograms.remove(upload.slot);
+      LOG_INFO(DEVICE, "ProgramData: slot %u removed", upload.slot);
+    } else {
+      effectPrograms.install(upload.slot, upload.program);
+      LOG_INFO(DEVICE, "ProgramData: slot %u, %u instructions", upload.slot,
+               upload.program.count);
+    }
+  }
+  if (received) {
+    segmentEngine.invalidateMode(device, Mode_Type::program);
   }
+}
 
-  outFile.close();
+///
+///@brief Remove zone `index`, 255 removes all of them and the whole strip
+/// runs activeMode again.
+///
+void removeSegment(uint8_t index) {
+  LOG_DEBUG(STRIP, "removeSegment - Called");
+  SegmentsData &table = device.segmentsData;
+
+  if (index == 255) {
+    table.count = 0;
+    segmentEngine.removeAll();
+  } else if (index < table.count) {
+    for (uint8_t i = index; i + 1 < table.count; i++) {
+      table.segments[i] = table.segments[i + 1];
+    }
+    table.count--;
+    segmentEngine.remove(index);
+  } else {
+    LOG_ERROR(STRIP, "removeSegment - ERROR - Invalid index: %u", index);
+    return;
+  }
+  frameScheduler.invalidate();
+}
 
+void applyCommand(const Command &command) {
+  switch (command.type) {
+  case Command_Type::default_data:
+    setDefaultSettings(command.defaultData);
+    break;
+  case Command_Type::mode_data:
+    setModeData(command.modeData);
+    break;
+  case Command_Type::active_mode:
+    setActiveMode(command.activeMode);
+    break;
+  case Command_Type::toggle_on_off:
+    device.isOn = !device.isOn;
+    break;
+  case Command_Type::on_off:
+    device.isOn = command.isOn;
+    break;
+  case Command_Type::save_settings:
+    // Written by the persistence task, only if something changed
+    settingsPersistence.flush();
+    break;
+  case Command_Type::export_json:
+    // Written by the storage task from this snapshot, see persistence.hpp
+    jsonSettingsTransfer.requestExport(recordFromDevice(device));
+    break;
+  case Command_Type::import_json:
+    // Applied by applyImportedSettings() once the storage task read it
+    jsonSettingsTransfer.requestImport(recordFromDevice(device));
+    break;
+  case Command_Type::send_settings:
+    loadBLESettingsData();
+    break;
+  case Command_Type::segment_data:
+    setSegment(command.segment.index, command.segment.data);
+    break;
+  case Command_Type::remove_segment:
+    removeSegment(command.segmentIndex);
+    break;
+  case Command_Type::transition_data:
+    setTransitionData(command.transitionData);
+    break;
+  case Command_Type::palette_data:
+    setPaletteData();
+    break;
+  case Command_Type::program_data:
+    setProgramData();
+    break;
+  }
+}
+
+///
+///@brief Apply the commands queued by the BLE callbacks.
+/// Called by the control task holding the FrameLock.
+///@return false if there were none
+///
+///
+///@brief Apply the settings.json the storage task imported, if any
+///@return true if settings were applied
+///
+bool applyImportedSettings() {
+  SettingsRecord record;
+  if (!jsonSettingsTransfer.takeImported(record)) {
+    return false;
+  }
+  LOG_INFO(DEVICE, "importJsonSettings - Data Loaded");
+  // Blank the whole strip, LEDs past a shorter length are not sent again
+  outputStage.blank();
+  recordToDevice(record, device);
+  device.strip.setLength(device.defaultData.ledLenght);
+  frameScheduler.invalidate();
+  settingsPersistence.flush();
+  loadBLESettingsData();
   return true;
 }
 
-// TaskHandle_t NotificationTask;
-// EventGroupHandle_t notificationEvent;
+bool applyPendingCommands() {
+  Command command;
+  bool applied = false;
+  while (commandQueue.pop(command)) {
+    applyCommand(command);
+    applied = true;
+  }
+  return applyImportedSettings() || applied;
+}
+
+///
+///@brief Apply the packets received on transport to the streamed frame.
+/// Called by the render task between two frames; a completed frame redraws
+/// the zones showing the stream.
+///
+void applyStreamPackets(StreamTransport &transport) {
+  static StreamPacket packet;
+  while (transport.receive(packet)) {
+    if (streamDecoder.decode(packet.data, packet.length)) {
+      segmentEngine.invalidateMode(device, Mode_Type::stream);
+    }
+  }
+}
 
 #pragma endregion CallbackSetMods
 
@@ -254,147 +582,506 @@ bool save_data(const char *filename) {
 class StripServerCallbacks : public BLEServerCallbacks {
   void onConnect(BLEServer *pServer) {
     device.deviceConnected = true;
-    Serial.println("Device Conected");
-    device.led.fill(Adafruit_NeoPixel::Color(255, 255, 255, 255));
-    device.led.show();
+    LOG_INFO(BLE, "Device Conected");
+    // The control task lights the status LED
+    tasks.raise(connectionEvent);
 
-    // xEventGroupSetBits(notificationEvent, BIT0);
-
-    loadBLESettingsData();
+    pushCommand(Command_Type::send_settings);
     BLEDevice::startAdvertising();
   };
 
   void onDisconnect(BLEServer *pServer) {
     device.deviceConnected = false;
+    tasks.raise(connectionEvent);
 
-    if (!save_data("/settings.json")) {
-      Serial.println(
-          "[DEVICE] - save_data('/settings.json') - Error: Data Not Saved");
-    } else {
-      Serial.println("[DEVICE] - save_data('/settings.json') - Data Saved");
-    }
+    pushCommand(Command_Type::save_settings);
 
-    device.led.clear();
-    device.led.show();
+    LOG_INFO(BLE, "Device Disconnected");
+  }
+};
 
-    Serial.println("Device Disconnected");
+///
+///@brief Checks that a write carries at least `size` bytes
+///
+bool checkPayload(size_t length, size_t size, const char *name) {
+  if (length < size) {
+    LOG_ERROR(BLE, "%s - Error: expected %u bytes, received %u", name, size,
+              length);
+    return false;
   }
+  return true;
+}
+
+///
+///@brief Reads a little endian uint16_t from a BLE payload
+///
+uint16_t readUint16(const byte *buffer) { return buffer[0] | buffer[1] << 8; }
+
+#pragma region PayloadDecoders
+
+// Decoders of the payloads written by the app, shared by the characteristics
+// and the command batch. Each one fills command from `length` bytes and
+// returns false if the payload is not valid.
+
+///
+///@brief [LedLenght, Brightness] [16,8], LedLenght little endian
+/// The 2 bytes payload [8,8] of the older apps is still accepted.
+///
+bool decodeDefaultData(const byte *buffer, size_t length, Command &command) {
+  if (!checkPayload(length, 2, "decodeDefaultData")) {
+    return false;
+  }
+  command.type = Command_Type::default_data;
+  if (length == 2) {
+    command.defaultData.ledLenght  = buffer[0];
+    command.defaultData.brightness = buffer[1];
+  } else {
+    command.defaultData.ledLenght  = readUint16(buffer);
+    command.defaultData.brightness = buffer[2];
+  }
+  return true;
+}
+
+///
+///@brief The parameters of a mode, its payload is described by its decode()
+/// in modes.hpp
+///
+bool decodeModeData(const ModeEntry &mode, const byte *buffer, size_t length,
+                    Command &command) {
+  if (!checkPayload(length, mode.payloadMin, mode.name)) {
+    return false;
+  }
+  command.type          = Command_Type::mode_data;
+  command.modeData.mode = mode.id;
+  return mode.decode(buffer, length, command.modeData.params);
+}
+
+///
+///@brief [activeMode] [8]
+///
+bool decodeActiveMode(const byte *buffer, size_t length, Command &command) {
+  if (!checkPayload(length, 1, "decodeActiveMode")) {
+    return false;
+  }
+  command.type       = Command_Type::active_mode;
+  command.activeMode = buffer[0];
+  return true;
+}
+
+///
+///@brief [duration] [16] milliseconds, little endian, 0 switches at once
+///
+bool decodeTransitionData(const byte *buffer, size_t length,
+                          Command &command) {
+  if (!checkPayload(length, 2, "decodeTransitionData")) {
+    return false;
+  }
+  command.type                    = Command_Type::transition_data;
+  command.transitionData.duration = readUint16(buffer);
+  return true;
+}
+
+///
+///@brief The layout of encodePaletteData()
+///
+bool decodePaletteData(const byte *buffer, size_t length,
+                       PaletteData &palette) {
+  if (!checkPayload(length, 4, "decodePaletteData")) {
+    return false;
+  }
+  size_t count = (length - 1) / 3;
+  if ((length - 1) % 3 != 0 || count > paletteColorsMax) {
+    LOG_ERROR(BLE, "decodePaletteData - Error: %u bytes is not 1 to %u colors",
+              length, paletteColorsMax);
+    return false;
+  }
+  memset(&palette, 0, sizeof(palette));
+  palette.count = count;
+  palette.blend = buffer[0] & 1;
+  for (uint8_t i = 0; i < count; i++) {
+    palette.colors[i] =
+        Color_RGB{buffer[1 + 3 * i], buffer[2 + 3 * i], buffer[3 + 3 * i]};
+  }
+  return true;
+}
+
+///
+///@brief [slot, image] [8, 2 to programImageMax bytes] sets the program of
+/// slot, [slot] [8] removes it. The image is verified here, see
+/// effect_vm.hpp for its layout.
+/// status is what the Program characteristic reads back:
+///   [slot, Program_Error, instruction at fault] [8, 8, 8]
+///
+bool decodeProgramData(const byte *buffer, size_t length,
+                       ProgramUpload &upload, byte *status) {
+  status[0] = length > 0 ? buffer[0] : 0;
+  status[1] = byte(Program_Error::bad_size);
+  status[2] = 0;
+  if (!checkPayload(length, 1, "decodeProgramData")) {
+    return false;
+  }
+  if (buffer[0] >= programSlots) {
+    status[1] = byte(Program_Error::bad_slot);
+    LOG_ERROR(BLE, "decodeProgramData - Error: no slot %u", buffer[0]);
+    return false;
+  }
+  upload.slot   = buffer[0];
+  upload.remove = length == 1;
+  if (upload.remove) {
+    status[1] = byte(Program_Error::none);
+    return true;
+  }
+
+  uint8_t at;
+  Program_Error error =
+      verifyProgram(buffer + 1, length - 1, upload.program, at);
+  status[1] = byte(error);
+  status[2] = at;
+  if (error != Program_Error::none) {
+    LOG_ERROR(BLE, "decodeProgramData - Error %u at instruction %u",
+              uint8_t(error), at);
+    return false;
+  }
+  return true;
+}
+
+///
+///@brief [index, zone] [8, see encodeSegment()] sets zone index
+/// [index] [8] removes zone index, [255] removes all the zones
+///
+bool decodeSegmentData(const byte *buffer, size_t length, Command &command) {
+  if (!checkPayload(length, 1, "decodeSegmentData")) {
+    return false;
+  }
+  if (length == 1) {
+    command.type         = Command_Type::remove_segment;
+    command.segmentIndex = buffer[0];
+    return true;
+  }
+  if (!checkPayload(length, 1 + segmentHeaderSize, "decodeSegmentData")) {
+    return false;
+  }
+  command.type          = Command_Type::segment_data;
+  command.segment.index = buffer[0];
+  if (!decodeSegment(buffer + 1, length - 1, command.segment.data)) {
+    LOG_ERROR(BLE, "decodeSegmentData - Error: mode %u or its parameters",
+              buffer[5]);
+    return false;
+  }
+  return true;
+}
+
+///
+///@brief [state] [8], 0 turns the strip off, anything else on
+///
+bool decodeOnOff(const byte *buffer, size_t length, Command &command) {
+  if (!checkPayload(length, 1, "decodeOnOff")) {
+    return false;
+  }
+  command.type = Command_Type::on_off;
+  command.isOn = buffer[0] > 0;
+  return true;
+}
+
+///
+///@brief Function IDs of the command batch
+///
+enum class Batch_Id : byte {
+  default_data = 1,
+  // 2 to 4 and 9 to 18: the parameters of fixed_color, rainbow,
+  // color_split, palette, fire, meteor, twinkle, comet, program, spectrum,
+  // pulse, sparkle and palette_sparkle, the batchId() of their mode
+  active_mode     = 5,
+  on_off          = 6,
+  segment_data    = 7,
+  transition_data = 8,
 };
 
+///@return the mode whose parameters have function ID id, nullptr if none
+const ModeEntry *findModeByBatchId(byte id) {
+  for (const ModeEntry &mode : Modes::table) {
+    if (mode.batchId != 0 && mode.batchId == id) {
+      return &mode;
+    }
+  }
+  return nullptr;
+}
+
+// Commands in one batch, it has to fit in the command queue at once
+const uint8_t commandBatchMax = 16;
+
 ///
-///@brief Callback, It sets the values for the LedLenght and Brightness
-/// [LedLenght, Brightness] [8,8]
+///@brief Decodes a command batch
+/// [count, (id, length, value) * count] [8, (8, 8, length bytes) * count]
+/// value is the payload of the characteristic the id stands for.
+///
+///@return the number of commands, 0 if any of them or the batch layout is
+/// invalid: a batch is applied whole or not at all
+///
+uint8_t decodeCommandBatch(const byte *buffer, size_t length,
+                           Command *commands) {
+  if (!checkPayload(length, 1, "decodeCommandBatch")) {
+    return 0;
+  }
+  uint8_t count = buffer[0];
+  if (count == 0 || count > commandBatchMax) {
+    LOG_ERROR(BLE, "decodeCommandBatch - Error: %u commands", count);
+    return 0;
+  }
+
+  size_t offset = 1;
+  for (uint8_t i = 0; i < count; i++) {
+    if (length - offset < 2) {
+      LOG_ERROR(BLE, "decodeCommandBatch - Error: truncated command %u", i);
+      return 0;
+    }
+    byte id           = buffer[offset];
+    size_t size       = buffer[offset + 1];
+    const byte *value = buffer + offset + 2;
+    offset += 2;
+    if (length - offset < size) {
+      LOG_ERROR(BLE, "decodeCommandBatch - Error: truncated command %u", i);
+      return 0;
+    }
+    offset += size;
+
+    bool valid;
+    switch (id) {
+    case (int)Batch_Id::default_data:
+      valid = decodeDefaultData(value, size, commands[i]);
+      break;
+    case (int)Batch_Id::active_mode:
+      valid = decodeActiveMode(value, size, commands[i]);
+      break;
+    case (int)Batch_Id::on_off:
+      valid = decodeOnOff(value, size, commands[i]);
+      break;
+    case (int)Batch_Id::segment_data:
+      valid = decodeSegmentData(value, size, commands[i]);
+      break;
+    case (int)Batch_Id::transition_data:
+      valid = decodeTransitionData(value, size, commands[i]);
+      break;
+    default: {
+      const ModeEntry *mode = findModeByBatchId(id);
+      if (mode == nullptr) {
+        LOG_ERROR(BLE, "decodeCommandBatch - Error: unknown id %u", id);
+        valid = false;
+        break;
+      }
+      valid = decodeModeData(*mode, value, size, commands[i]);
+      break;
+    }
+    }
+    if (!valid) {
+      return 0;
+    }
+  }
+  if (offset != length) {
+    LOG_ERROR(BLE, "decodeCommandBatch - Error: %u bytes left over",
+              length - offset);
+    return 0;
+  }
+  return count;
+}
+
+#pragma endregion PayloadDecoders
+
 ///
+///@brief Callback, It sets the values for the LedLenght and Brightness
+/// payload: decodeDefaultData
 ///
 class blecDefaultDataCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecDefaultDataCallback - Called Callback");
-    std::string value  = pCharacteristic->getValue();
-    const byte *buffer = (byte *)value.c_str();
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecDefaultDataCallback - Called Callback");
+    std::string value = pCharacteristic->getValue();
+
+    Command command;
+    if (decodeDefaultData((byte *)value.c_str(), value.length(), command)) {
+      pushCommand(command);
+    }
 
-    setDefaultSettings(buffer);
-    Serial.println("[BLE] - blecDefaultDataCallback - End Callback");
+    LOG_DEBUG(BLE, "blecDefaultDataCallback - End Callback");
   }
 };
 
 ///
-///@brief Callback, it sets the value for the FixedColor Mode
-/// [red_value, green_value, blue_value] [8,8,8]
-///
+///@brief Callback, it sets the parameters of a mode, one instance per mode
+/// payload: decodeModeData
 ///
-class blecFixedColorDataCallback : public BLECharacteristicCallbacks {
+class blecModeDataCallback : public BLECharacteristicCallbacks {
+public:
+  explicit blecModeDataCallback(const ModeEntry &mode) : mode(mode) {}
+
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecFixedColorDataCallback - Called Callback");
-    std::string value  = pCharacteristic->getValue();
-    const byte *buffer = (byte *)value.c_str();
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecModeDataCallback - Called Callback: %s", mode.name);
+    std::string value = pCharacteristic->getValue();
 
-    setFixedColorData(buffer);
+    Command command;
+    if (decodeModeData(mode, (byte *)value.c_str(), value.length(), command)) {
+      pushCommand(command);
+    }
 
-    Serial.println("[BLE] - blecFixedColorDataCallback - End Callback");
+    LOG_DEBUG(BLE, "blecModeDataCallback - End Callback");
   }
+
+private:
+  const ModeEntry &mode;
 };
 
 ///
-///@brief Callback, it sets te value for the Rainbow Mode
-/// [velocity] [8]
-///
+///@brief Callback, it sets the Current Active Mode
+/// payload: decodeActiveMode
 ///
-class blecRainbowDataCallback : public BLECharacteristicCallbacks {
+class blecActiveModeCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecRainbowDataCallback - Called Callback");
-    std::string value  = pCharacteristic->getValue();
-    const byte *buffer = (byte *)value.c_str();
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecActiveModeCallback - Called Callback");
+    std::string value = pCharacteristic->getValue();
 
-    setRainbowData(buffer);
+    Command command;
+    if (decodeActiveMode((byte *)value.c_str(), value.length(), command)) {
+      pushCommand(command);
+    }
 
-    Serial.println("[BLE] - blecRainbowDataCallback - End Callback");
+    LOG_DEBUG(BLE, "blecActiveModeCallback - End Callback");
   }
 };
 
 ///
-///@brief Callback, it sets the value for the Color Split Mode
-/// [8, 8,8,8, 8,8,8]
-/// [endFirstLedSplit, red1, green1, blue1, red2, green2, blue2]
+///@brief Callback, it sets the crossfade between active modes
+/// payload: decodeTransitionData
 ///
+class blecTransitionDataCallback : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecTransitionDataCallback - Called Callback");
+    std::string value = pCharacteristic->getValue();
+
+    Command command;
+    if (decodeTransitionData((byte *)value.c_str(), value.length(), command)) {
+      pushCommand(command);
+    }
+
+    LOG_DEBUG(BLE, "blecTransitionDataCallback - End Callback");
+  }
+};
+
 ///
-class blecColorSplitDataCallback : public BLECharacteristicCallbacks {
+///@brief Callback, it sets the colors of the palette zones
+/// payload: decodePaletteData
+///
+class blecPaletteCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecColorSplitDataCallback - Called Callback");
-    std::string value  = pCharacteristic->getValue();
-    const byte *buffer = (byte *)value.c_str();
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecPaletteCallback - Called Callback");
+    std::string value = pCharacteristic->getValue();
 
-    setColorSplitData(buffer);
+    PaletteData palette;
+    if (decodePaletteData((byte *)value.c_str(), value.length(), palette)) {
+      pushPalette(palette);
+    }
 
-    Serial.println("[BLE] - blecRainbowDataCallback - End Callback");
+    LOG_DEBUG(BLE, "blecPaletteCallback - End Callback");
   }
 };
 
 ///
-///@brief Callback, it sets the Current Active Mode
-/// [8]
-/// [activeMode]
+///@brief Callback, it sets or removes the program of a slot
+/// payload: decodeProgramData, reads back its status
 ///
+class blecProgramCallback : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecProgramCallback - Called Callback");
+    std::string value = pCharacteristic->getValue();
+
+    // Static: a program is too large for the Bluetooth task's stack
+    static ProgramUpload upload;
+    byte status[3];
+    if (decodeProgramData((byte *)value.c_str(), value.length(), upload,
+                          status) &&
+        !pushProgram(upload)) {
+      status[1] = byte(Program_Error::busy);
+    }
+    pCharacteristic->setValue(status, sizeof(status));
+
+    LOG_DEBUG(BLE, "blecProgramCallback - End Callback");
+  }
+};
+
 ///
-class blecActiveModeCallback : public BLECharacteristicCallbacks {
+///@brief Callback, it sets or removes a zone of the strip
+/// payload: decodeSegmentData
+///
+class blecSegmentDataCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecActiveModeCallback - Called Callback");
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecSegmentDataCallback - Called Callback");
     std::string value = pCharacteristic->getValue();
 
-    const byte *buffer = (byte *)value.c_str();
+    Command command;
+    if (decodeSegmentData((byte *)value.c_str(), value.length(), command)) {
+      pushCommand(command);
+    }
 
-    setActiveMode(buffer);
+    LOG_DEBUG(BLE, "blecSegmentDataCallback - End Callback");
+  }
+};
+
+///
+///@brief Callback, several settings in one write without response
+/// payload: decodeCommandBatch
+/// The commands are queued together and applied between the same two frames,
+/// in the order of the batch.
+///
+class blecCommandBatchCallback : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    ScopedProbe probe(Probe_Id::ble_write);
+    // No logging per write, apps stream batches to animate the strip
+    std::string value = pCharacteristic->getValue();
 
-    Serial.println("[BLE] - blecActiveModeCallback - End Callback");
+    // Kept off the Bluetooth task stack
+    static Command commands[commandBatchMax];
+    uint8_t count =
+        decodeCommandBatch((byte *)value.c_str(), value.length(), commands);
+    if (count > 0) {
+      pushCommands(commands, count);
+    }
   }
 };
 
 ///
-///@brief Callback, it says to Save the current configuration to the JSON
+///@brief Callback, it says to Save the current configuration
 /// bits: [8]
-/// payload: [n > 0]
-///
+/// payload: [1] save the settings
+///          [2] export the settings to settings.json
+///          [3] import the settings from settings.json
 ///
 class blecSaveSettingsCallback : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecSaveSettingsCallback - Called Callback");
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecSaveSettingsCallback - Called Callback");
     std::string value = pCharacteristic->getValue();
-
+    if (!checkPayload(value.length(), 1, "blecSaveSettingsCallback")) {
+      return;
+    }
     const byte *buffer = (byte *)value.c_str();
 
-    // if there is a "1" then save the data
-    if (buffer[0] == true) {
-      if (!save_data("/settings.json")) {
-        Serial.println(
-            "[BLE] - blecSaveSettingsCallback - Error: Data Not Saved");
-      } else {
-        Serial.println("[BLE] - blecSaveSettingsCallback - Data Saved");
-      }
+    if (buffer[0] == 1) {
+      pushCommand(Command_Type::save_settings);
+    } else if (buffer[0] == 2) {
+      pushCommand(Command_Type::export_json);
+    } else if (buffer[0] == 3) {
+      pushCommand(Command_Type::import_json);
     } else {
-      Serial.println("[BLE] - blecSaveSettingsCallback - Error: buffer data");
-      Serial.println("[BLE] - blecSaveSettingsCallback - Error: received " +
-                     String((int)buffer[0]));
+      LOG_ERROR(BLE, "blecSaveSettingsCallback - Error: buffer data");
+      LOG_ERROR(BLE, "blecSaveSettingsCallback - Error: received %u",
+                buffer[0]);
     }
-    Serial.println("[BLE] - blecSaveSettingsCallback - End Callback");
+    LOG_DEBUG(BLE, "blecSaveSettingsCallback - End Callback");
   }
 };
 
@@ -406,21 +1093,22 @@ class blecSaveSettingsCallback : public BLECharacteristicCallbacks {
 ///
 class blecSendDataCallBack : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecSendDataCallBack - Called Callback");
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecSendDataCallBack - Called Callback");
     std::string value = pCharacteristic->getValue();
-
+    if (!checkPayload(value.length(), 1, "blecSendDataCallBack")) {
+      return;
+    }
     const byte *buffer = (byte *)value.c_str();
 
-    // if there is a "1" then save the data
+    // if there is a "1" then send the data
     if (buffer[0] > 0) {
-      loadBLESettingsData();
-      Serial.println("[BLE] - blecSendDataCallBack - Data Send");
+      pushCommand(Command_Type::send_settings);
     } else {
-      Serial.println("[BLE] - blecSendDataCallBack - Error: buffer data");
-      Serial.println("[BLE] - blecSendDataCallBack - Error: received " +
-                     String((int)buffer[0]));
+      LOG_ERROR(BLE, "blecSendDataCallBack - Error: buffer data");
+      LOG_ERROR(BLE, "blecSendDataCallBack - Error: received %u", buffer[0]);
     }
-    Serial.println("[BLE] - blecSendDataCallBack - End Callback");
+    LOG_DEBUG(BLE, "blecSendDataCallBack - End Callback");
   }
 };
 
@@ -432,16 +1120,44 @@ class blecSendDataCallBack : public BLECharacteristicCallbacks {
 ///
 class blecOnOffCallBack : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic) {
-    Serial.println("[BLE] - blecOnOffCallBack - Called Callback");
+    ScopedProbe probe(Probe_Id::ble_write);
+    LOG_DEBUG(BLE, "blecOnOffCallBack - Called Callback");
     std::string value = pCharacteristic->getValue();
-
+    if (!checkPayload(value.length(), 1, "blecOnOffCallBack")) {
+      return;
+    }
     const byte *buffer = (byte *)value.c_str();
 
     if (buffer[0] > 0) {
-      device.isOn = !device.isOn;
+      pushCommand(Command_Type::toggle_on_off);
     }
 
-    Serial.println("[BLE] - blecOnOffCallBack - End Callback");
+    LOG_DEBUG(BLE, "blecOnOffCallBack - End Callback");
+  }
+};
+
+///
+///@brief Callback, a packet of the streamed frames, see stream.hpp
+/// Written without response, it is only queued here.
+///
+class blecStreamCallback : public BLECharacteristicCallbacks {
+  void onWrite(BLECharacteristic *pCharacteristic) {
+    ScopedProbe probe(Probe_Id::ble_write);
+    std::string value = pCharacteristic->getValue();
+    bleStream.push((const uint8_t *)value.c_str(), value.length());
+    powerGovernor.wake();
+  }
+};
+
+///
+///@brief Callback, read only: timings of the hot paths, see
+/// Diagnostics::encode for the payload
+///
+class blecDiagnosticsCallback : public BLECharacteristicCallbacks {
+  void onRead(BLECharacteristic *pCharacteristic) {
+    byte buffer[Diagnostics::payloadSize];
+    size_t size = diagnostics.encode(buffer);
+    pCharacteristic->setValue(buffer, size);
   }
 };
 
@@ -0,0 +1,44 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include "Arduino.h"
+
+///
+///@brief Where the render path takes the time from.
+/// The modes never read millis(): run_mod() reads frameClock once per frame
+/// and hands that time to SegmentEngine, TransitionEngine and the modes, so
+/// a frame is a function of the settings and of its time only. The firmware
+/// runs on systemClock; the host render tool (tools/render) steps a
+/// ManualClock to render faster than real time and reproducibly.
+///
+class Clock {
+public:
+  virtual ~Clock() {}
+
+  ///@brief Milliseconds, wrapping like millis()
+  virtual unsigned long now() = 0;
+};
+
+class SystemClock : public Clock {
+public:
+  unsigned long now() override { return millis(); }
+};
+
+///@brief Time that only moves when it is set
+class ManualClock : public Clock {
+public:
+  unsigned long now() override { return ms; }
+
+  void set(unsigned long time) { ms = time; }
+  void advance(unsigned long elapsed) { ms += elapsed; }
+
+private:
+  unsigned long ms = 0;
+};
+
+SystemClock systemClock;
+
+// The clock frames are rendered with
+Clock *frameClock = &systemClock;
+
+#endif // CLOCK_HPP
@@ -0,0 +1,125 @@
+#ifndef COMMANDS_HPP
+#define COMMANDS_HPP
+
+#include "Arduino.h"
+#include "log.hpp"
+#include "mailbox.hpp"
+#include "modes.hpp"
+#include "settings.h"
+#include "spsc_ring.hpp"
+#include "tasks.hpp"
+
+///
+///@brief Work requested by the BLE stack for the render loop.
+/// The GATT callbacks run on the Bluetooth task: they only decode their
+/// payload into a Command and queue it. The control task applies the queue
+/// holding the FrameLock, so device is never changed while a frame is being
+/// rendered.
+///
+enum class Command_Type : byte {
+  default_data,
+  mode_data,
+  active_mode,
+  toggle_on_off,
+  save_settings,
+  send_settings,
+  export_json,
+  import_json,
+  segment_data,
+  remove_segment,
+  transition_data,
+  on_off,
+  palette_data,
+  program_data,
+};
+
+struct SegmentCommand {
+  uint8_t index;
+  SegmentData data;
+};
+
+struct Command {
+  Command_Type type;
+  union {
+    DefaultData defaultData;
+    ModeCommand modeData;
+    byte activeMode;
+    SegmentCommand segment;
+    byte segmentIndex;
+    TransitionData transitionData;
+    bool isOn;
+  };
+};
+
+// Producer: Bluetooth task. Consumer: control task.
+SpscRing<Command, 32> commandQueue;
+
+// A palette would triple the size of every Command: it waits here and a
+// palette_data command marks its place in the queue. Only the last palette
+// written counts, a newer one replaces it.
+SpscMailbox<PaletteData> paletteMailbox;
+
+///@brief A verified program for a slot, or the removal of its program
+struct ProgramUpload {
+  uint8_t slot;
+  bool remove;
+  EffectProgram program;
+};
+
+// Programs wait here the same way, a program_data command applies them
+SpscRing<ProgramUpload, 2> programQueue;
+
+bool pushCommand(const Command &command) {
+  bool queued = commandQueue.push(command);
+  // Full or not, the control task has commands to apply
+  tasks.raise(commandEvent);
+  if (!queued) {
+    LOG_ERROR(BLE, "pushCommand - ERROR - Command queue full");
+    return false;
+  }
+  return true;
+}
+
+bool pushCommand(Command_Type type) {
+  Command command;
+  command.type = type;
+  return pushCommand(command);
+}
+
+///
+///@brief Post palette and queue the palette_data command that applies it.
+/// If the command does not fit, the palette is still applied by the next
+/// palette_data command.
+///
+bool pushPalette(const PaletteData &palette) {
+  paletteMailbox.post(palette);
+  return pushCommand(Command_Type::palette_data);
+}
+
+///
+///@brief Queue upload and the program_data command that applies it
+///
+bool pushProgram(const ProgramUpload &upload) {
+  if (!programQueue.push(upload)) {
+    LOG_ERROR(BLE, "pushProgram - ERROR - Program queue full");
+    return false;
+  }
+  return pushCommand(Command_Type::program_data);
+}
+
+///
+///@brief Queue `count` commands as one batch. The control task drains the
+/// whole queue under one FrameLock, so they all land between the same two
+/// frames.
+///
+bool pushCommands(const Command *commands, uint8_t count) {
+  bool queued = commandQueue.pushAll(commands, count);
+  tasks.raise(commandEvent);
+  if (!queued) {
+    LOG_ERROR(BLE, "pushCommands - ERROR - No room for %u commands", count);
+    return false;
+  }
+  return true;
+}
+
+#endif // COMMANDS_HPP
@@ -0,0 +1,300 @@
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+
+#include "Arduino.h"
+#include "loop_modes.hpp"
+#include <Adafruit_NeoPixel.h>
+
+enum class Blend_Mode : byte {
+  normal   = 0,
+  add      = 1,
+  multiply = 2,
+  max      = 3,
+};
+
+///
+///@brief Converts a stored or received byte to a Blend_Mode
+///
+///@return false if value is not a known blend mode, mode is left untouched
+///
+bool decodeBlendMode(byte value, Blend_Mode &mode) {
+  switch (value) {
+  case (int)Blend_Mode::normal:
+  case (int)Blend_Mode::add:
+  case (int)Blend_Mode::multiply:
+  case (int)Blend_Mode::max:
+    mode = Blend_Mode(value);
+    return true;
+  default:
+    return false;
+  }
+}
+
+///
+///@brief Blending of packed pixels (the Adafruit_NeoPixel::Color() layout,
+/// 0xWWRRGGBB) as SIMD within a register.
+/// A pixel is split in two words holding two channels each, 0x00RR00BB and
+/// 0x00WW00GG: every channel has a spare byte above it for carries and
+/// products, so one 32 bit op works on two channels at once.
+///
+namespace swar {
+
+const uint32_t lanes = 0x00FF00FF;
+
+///@brief 0xFF in every lane whose bit 8 is set, 0 in the others
+inline uint32_t carryMask(uint32_t word) {
+  uint32_t carry = (word >> 8) & 0x00010001;
+  return (carry << 8) - carry;
+}
+
+///@brief dst + (src - dst) * alpha / 256, alpha 0..256. Each lane holds at
+/// most 255 * 256, the weights sum to 256.
+inline uint32_t lerp(uint32_t dst, uint32_t src, uint16_t alpha) {
+  uint16_t inverse = 256 - alpha;
+  uint32_t dstHigh = (dst >> 8) & lanes;
+  uint32_t srcHigh = (src >> 8) & lanes;
+  uint32_t low     = (dst & lanes) * inverse + (src & lanes) * alpha;
+  uint32_t high    = dstHigh * inverse + srcHigh * alpha;
+  return ((low >> 8) & lanes) | (high & ~lanes);
+}
+
+///@brief Per channel min(dst + src, 255)
+inline uint32_t add(uint32_t dst, uint32_t src) {
+  uint32_t low  = (dst & lanes) + (src & lanes);
+  uint32_t high = ((dst >> 8) & lanes) + ((src >> 8) & lanes);
+  low |= carryMask(low);
+  high |= carryMask(high);
+  return (low & lanes) | ((high & lanes) << 8);
+}
+
+///@brief Per channel dst * src / 255 (rounded as dst * (src + 1) / 256).
+/// The lanes scale by different factors, so this one takes a multiply per
+/// channel.
+inline uint32_t multiply(uint32_t dst, uint32_t src) {
+  uint32_t result = 0;
+  for (uint8_t shift = 0; shift < 32; shift += 8) {
+    uint32_t a = (dst >> shift) & 0xFF;
+    uint32_t b = (src >> shift) & 0xFF;
+    result |= ((a * (b + 1)) >> 8) << shift;
+  }
+  return result;
+}
+
+///@brief Per channel max(dst, src). (dst | 0x100) - src keeps bit 8 set in
+/// the lanes where dst >= src.
+inline uint32_t maximum(uint32_t dst, uint32_t src) {
+  uint32_t dstLow   = dst & lanes;
+  uint32_t dstHigh  = (dst >> 8) & lanes;
+  uint32_t srcLow   = src & lanes;
+  uint32_t srcHigh  = (src >> 8) & lanes;
+  uint32_t keepLow  = carryMask((dstLow | 0x01000100) - srcLow);
+  uint32_t keepHigh = carryMask((dstHigh | 0x01000100) - srcHigh);
+  uint32_t low      = (dstLow & keepLow) | (srcLow & ~keepLow);
+  uint32_t high     = (dstHigh & keepHigh) | (srcHigh & ~keepHigh);
+  return low | (high << 8);
+}
+
+inline uint32_t normal(uint32_t, uint32_t src) { return src; }
+
+///@brief Blend a row of src over dst with Op, then fade the result in by
+/// alpha (0..256). Op is a template parameter so it inlines into the loop.
+template <uint32_t (*Op)(uint32_t, uint32_t)>
+void blendRow(uint32_t *dst, const uint32_t *src, uint16_t count,
+              uint16_t alpha) {
+  if (alpha == 256) {
+    for (uint16_t i = 0; i < count; i++) {
+      dst[i] = Op(dst[i], src[i]);
+    }
+    return;
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    dst[i] = lerp(dst[i], Op(dst[i], src[i]), alpha);
+  }
+}
+
+} // namespace swar
+
+///
+///@brief Blend `count` pixels of src over dst.
+/// opacity 0 leaves dst untouched, 255 applies the blend mode fully.
+///
+void blendRow(uint32_t *dst, const uint32_t *src, uint16_t count,
+              Blend_Mode mode, uint8_t opacity) {
+  uint16_t alpha = opacity + (opacity >> 7); // 0..256
+  if (alpha == 0) {
+    return;
+  }
+  switch (mode) {
+  case Blend_Mode::normal:
+    if (alpha == 256) {
+      memcpy(dst, src, count * sizeof(uint32_t));
+    } else {
+      swar::blendRow<swar::normal>(dst, src, count, alpha);
+    }
+    break;
+  case Blend_Mode::add:
+    swar::blendRow<swar::add>(dst, src, count, alpha);
+    break;
+  case Blend_Mode::multiply:
+    swar::blendRow<swar::multiply>(dst, src, count, alpha);
+    break;
+  case Blend_Mode::max:
+    swar::blendRow<swar::maximum>(dst, src, count, alpha);
+    break;
+  }
+}
+
+///
+///@brief Copy packed pixels into the strip in its wire Format. White is
+/// dropped, the formats are RGB.
+///
+template <typename Format = StripFormat>
+void writePixels(Adafruit_NeoPixel &strip, uint16_t first,
+                 const uint32_t *pixels, uint16_t count) {
+  if (first >= strip.numPixels()) {
+    return;
+  }
+  count = min<uint16_t>(count, strip.numPixels() - first);
+
+  uint8_t *out = strip.getPixels() + first * Format::bytesPerPixel;
+  for (uint16_t i = 0; i < count; i++) {
+    uint32_t pixel = pixels[i];
+    Format::pack(Color_RGB{byte(pixel >> 16), byte(pixel >> 8), byte(pixel)},
+                 out);
+    out += Format::bytesPerPixel;
+  }
+}
+
+///
+///@brief Stack of Layers packed pixel buffers of Capacity pixels.
+/// Effects render into a layer, compose() blends them bottom to top: layer 0
+/// is copied as is, every other visible layer is blended over the result
+/// with its blend mode and opacity.
+/// The layers are Layers * Capacity * 4 bytes, instantiate it with the
+/// smallest stack the effects need. The layered effects below compose a
+/// zone a chunk of pixels at a time, so Capacity need not be a strip.
+///
+template <uint8_t Layers, uint16_t Capacity> class Compositor {
+  static_assert(Layers > 0, "Compositor needs a layer");
+
+public:
+  struct Layer {
+    uint32_t pixels[Capacity];
+    Blend_Mode blend = Blend_Mode::normal;
+    uint8_t opacity  = 255;
+    bool visible     = true;
+
+    void fill(uint32_t color, uint16_t first, uint16_t count) {
+      for (uint16_t i = 0; i < count; i++) {
+        pixels[first + i] = color;
+      }
+    }
+  };
+
+  Layer &layer(uint8_t index) { return layers[index]; }
+
+  static constexpr uint8_t layerCount() { return Layers; }
+  static constexpr uint16_t capacity() { return Capacity; }
+
+  ///@brief Blend the first `count` pixels of every layer into out
+  void compose(uint32_t *out, uint16_t count) const {
+    if (count > Capacity) {
+      count = Capacity;
+    }
+    memcpy(out, layers[0].pixels, count * sizeof(uint32_t));
+    for (uint8_t i = 1; i < Layers; i++) {
+      if (layers[i].visible) {
+        blendRow(out, layers[i].pixels, count, layers[i].blend,
+                 layers[i].opacity);
+      }
+    }
+  }
+
+private:
+  Layer layers[Layers];
+};
+
+// Loop Functions
+// Layered effects draw their layers into a Compositor and write the result
+#pragma region LayeredFunctions
+
+// Pixels of a zone composed at a time
+const uint16_t layerChunk = 64;
+
+///@brief 32 bit integer hash, every bit of x moves about half the result
+inline uint32_t hash32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7FEB352D;
+  x ^= x >> 15;
+  x *= 0x846CA68B;
+  x ^= x >> 16;
+  return x;
+}
+
+// Time a LED takes to sparkle, fading in then out
+const uint16_t sparkleMs = 512;
+
+///
+///@brief Brightness of LED `index` of a sparkle layer at `now`. Every LED
+/// goes through cycles of sparkleMs at its own phase and sparkles during a
+/// cycle with a chance of rate / 256: the layer keeps no state.
+///
+inline uint8_t sparkleLevel(uint16_t index, unsigned long now, uint8_t rate) {
+  uint32_t seed = hash32(index);
+  uint32_t time = uint32_t(now) + seed;
+  if ((hash32(seed ^ (time / sparkleMs)) & 0xFF) >= rate) {
+    return 0;
+  }
+  uint16_t at = time % sparkleMs;
+  return at < 256 ? at : sparkleMs - 1 - at;
+}
+
+typedef Compositor<2, layerChunk> SparkleLayers;
+
+// Zones are drawn one after the other, they share the layers
+SparkleLayers sparkleLayers;
+
+///
+///@brief A gradient from color1 at the start of the zone to color2 at its
+/// end, under a layer of white sparkles added with `opacity`. `rate` is the
+/// share of the LEDs sparkling, see sparkleLevel().
+///
+template <typename Format = StripFormat>
+void sparkle(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+             const Color_RGB &color1, const Color_RGB &color2, uint8_t rate,
+             uint8_t opacity, unsigned long now) {
+  if (first >= strip.numPixels()) {
+    return;
+  }
+  count = min<uint16_t>(count, strip.numPixels() - first);
+
+  SparkleLayers::Layer &gradient = sparkleLayers.layer(0);
+  SparkleLayers::Layer &sparkles = sparkleLayers.layer(1);
+  sparkles.blend                 = Blend_Mode::add;
+  sparkles.opacity               = opacity;
+  sparkles.visible               = rate > 0 && opacity > 0;
+
+  uint32_t from = Adafruit_NeoPixel::Color(color1.r, color1.g, color1.b);
+  uint32_t to   = Adafruit_NeoPixel::Color(color2.r, color2.g, color2.b);
+  // Gradient weight of a LED, 0 to 256 over the zone, in 16.16 fixed point
+  uint32_t step = count > 1 ? (uint32_t(256) << 16) / (count - 1) : 0;
+
+  uint32_t out[layerChunk];
+  for (uint16_t done = 0; done < count; done += layerChunk) {
+    uint16_t run = min<uint16_t>(layerChunk, count - done);
+    for (uint16_t i = 0; i < run; i++) {
+      gradient.pixels[i] = swar::lerp(from, to, ((done + i) * step) >> 16);
+    }
+    if (sparkles.visible) {
+      for (uint16_t i = 0; i < run; i++) {
+        sparkles.pixels[i] = sparkleLevel(done + i, now, rate) * 0x010101UL;
+      }
+    }
+    sparkleLayers.compose(out, run);
+    writePixels<Format>(strip, first + done, out, run);
+  }
+}
+
+#pragma endregion LayeredFunctions
+
+#endif // COMPOSITOR_HPP
@@ -0,0 +1,306 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include "Arduino.h"
+#include "log.hpp"
+
+#ifndef ESP32
+#include <chrono>
+#endif
+
+///
+/// Timing of the hot paths: rendering a frame, showing it, the BLE writes,
+/// the settings flash writes and the sound to light delay, and the stack
+/// left to every task.
+///
+///   { ScopedProbe probe(Probe_Id::show); outputStage.show(device); }
+///
+/// A probe reads the CPU cycle counter on entry and exit and adds the
+/// duration to the latency histogram of its site. Reading the counter costs
+/// a few cycles, so the probes stay in release builds.
+///
+
+enum class Probe_Id : uint8_t {
+  render,    // run_mod() up to show()
+  show,      // OutputStage::show(), the LUT and the wait for the wire
+  ble_write, // a GATT onWrite callback
+  save,      // writing the settings file
+  wake,      // from a wake-up event to the render task running, power.hpp
+  audio,     // from a sound being captured to its frame on the LEDs, audio.hpp
+};
+
+const uint8_t probeCount = 6;
+
+// The tasks of the firmware, see tasks.hpp
+enum class Task_Id : uint8_t {
+  render,
+  control,
+  storage,
+  audio,
+};
+
+const uint8_t taskCount = 4;
+
+///@brief CPU cycles, wrapping. Per core: a probe starts and stops on the same
+/// task and every probed task is pinned.
+inline uint32_t cycleCount() {
+#ifdef ESP32
+  return ESP.getCycleCount();
+#else
+  // Nanoseconds stand in for the cycles on the host
+  return uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+#endif
+}
+
+inline uint32_t cyclesPerMicro() {
+#ifdef ESP32
+  static const uint32_t cycles = getCpuFrequencyMhz();
+  return cycles;
+#else
+  return 1000;
+#endif
+}
+
+///
+///@brief Counts of durations in µs, 4 buckets per power of two up to 2^24 µs
+/// (16 s), so a quantile is known within 25%. The maximum is exact, and
+/// stands for the quantiles that fall in the last bucket.
+/// Single writer: each probe site runs on one task. Readers on other tasks
+/// may see a sample half added, good enough for diagnostics.
+///
+class LatencyHistogram {
+public:
+  static const uint8_t exactMax    = 4; // values below are exact buckets
+  static const uint8_t bucketCount = exactMax + (24 - 2) * 4;
+
+  void add(uint32_t micros) {
+    buckets[bucketOf(micros)]++;
+    samples++;
+    if (micros > maximum) {
+      maximum = micros;
+    }
+  }
+
+  void reset() {
+    memset(buckets, 0, sizeof(buckets));
+    samples = 0;
+    maximum = 0;
+  }
+
+  uint32_t count() const { return samples; }
+  uint32_t max() const { return maximum; }
+
+  ///@brief Smallest duration with `perMille`/1000 of the samples at or below
+  /// it, as the middle of its bucket (capped at the maximum).
+  uint32_t quantile(uint16_t perMille) const {
+    if (samples == 0) {
+      return 0;
+    }
+    uint32_t rank = (uint64_t(samples) * perMille + 999) / 1000;
+    if (rank == 0) {
+      rank = 1;
+    }
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < bucketCount; i++) {
+      seen += buckets[i];
+      if (seen >= rank && i < bucketCount - 1) {
+        uint32_t middle = bucketLow(i) + (bucketLow(i + 1) - bucketLow(i)) / 2;
+        return middle < maximum ? middle : maximum;
+      }
+    }
+    return maximum;
+  }
+
+private:
+  static uint8_t bucketOf(uint32_t value) {
+    if (value < exactMax) {
+      return value;
+    }
+    uint8_t exponent = 31 - __builtin_clz(value); // >= 2
+    if (exponent >= 24) {
+      return bucketCount - 1;
+    }
+    uint8_t sub = (value >> (exponent - 2)) & 3;
+    return exactMax + (exponent - 2) * 4 + sub;
+  }
+
+  static uint32_t bucketLow(uint8_t bucket) {
+    if (bucket < exactMax) {
+      return bucket;
+    }
+    uint8_t exponent = (bucket - exactMax) / 4 + 2;
+    uint8_t sub      = (bucket - exactMax) % 4;
+    return (4u + sub) << (exponent - 2);
+  }
+
+  uint32_t buckets[bucketCount] = {};
+  uint32_t samples              = 0;
+  uint32_t maximum              = 0;
+};
+
+///
+///@brief The histograms of the probes and the frame rate counters.
+///
+class Diagnostics {
+public:
+  static const unsigned long windowMs = 1000;
+
+  void record(Probe_Id probe, uint32_t cycles) {
+    recordMicros(probe, cycles / cyclesPerMicro());
+  }
+
+  ///@brief For durations not measured with the cycle counter of one core
+  void recordMicros(Probe_Id probe, uint32_t micros) {
+    histograms[uint8_t(probe)].add(micros);
+  }
+
+  ///@brief From PowerGovernor, once per second
+  void setPower(uint16_t awakePerMille, uint16_t milliAmps10) {
+    awake   = awakePerMille;
+    current = milliAmps10;
+  }
+
+  ///@brief Call at the end of every render task iteration
+  void loopDone(unsigned long now) {
+    windowLoops++;
+    if (now - windowStart >= windowMs) {
+      unsigned long elapsed = now - windowStart;
+      fps10                 = windowFrames * 10000 / elapsed;
+      loopsPerSecond        = windowLoops * 1000 / elapsed;
+      windowStart           = now;
+      windowFrames          = 0;
+      windowLoops           = 0;
+    }
+  }
+  ///@brief Call after every show()
+  void frameShown() {
+    frames++;
+    windowFrames++;
+  }
+
+  ///@brief The least stack `task` had left so far, in bytes
+  void setStackFree(Task_Id task, uint32_t bytes) {
+    stackFree[uint8_t(task)] = bytes > 0xFFFF ? 0xFFFF : bytes;
+  }
+
+  const LatencyHistogram &histogram(Probe_Id probe) const {
+    return histograms[uint8_t(probe)];
+  }
+
+  void reset() {
+    for (LatencyHistogram &histogram : histograms) {
+      histogram.reset();
+    }
+    frames = 0;
+  }
+
+  ///
+  ///@brief Payload of the Diagnostics characteristic, little endian:
+  /// [version, fps x10 (16), loops/s (16), frames (32), awake per mille (16),
+  ///  estimated mA x10 (16),
+  ///  probeCount x (count, p50, p99, max (32 µs each)),
+  ///  taskCount x stack bytes left (16)]
+  /// in Probe_Id and Task_Id order.
+  ///@return the bytes written, payloadSize
+  ///
+  static const uint8_t payloadVersion = 4;
+  static const size_t payloadSize     = 13 + probeCount * 16 + taskCount * 2;
+
+  size_t encode(byte *buffer) const {
+    buffer[0] = payloadVersion;
+    put16(buffer + 1, fps10);
+    put16(buffer + 3, loopsPerSecond);
+    put32(buffer + 5, frames);
+    put16(buffer + 9, awake);
+    put16(buffer + 11, current);
+    byte *field = buffer + 13;
+    for (const LatencyHistogram &histogram : histograms) {
+      put32(field, histogram.count());
+      put32(field + 4, histogram.quantile(500));
+      put32(field + 8, histogram.quantile(990));
+      put32(field + 12, histogram.max());
+      field += 16;
+    }
+    for (uint16_t bytes : stackFree) {
+      put16(field, bytes);
+      field += 2;
+    }
+    return payloadSize;
+  }
+
+  ///@brief One log line per probe
+  void dump() const {
+    static const char *const names[probeCount] = {
+        "render", "show", "ble_write", "save", "wake", "audio"};
+    LOG_INFO(DEVICE, "Diagnostics - %u.%u fps, %u loops/s, %u frames",
+             fps10 / 10, fps10 % 10, loopsPerSecond, frames);
+    LOG_INFO(DEVICE, "Diagnostics - awake %u.%u%%, about %u.%u mA",
+             awake / 10, awake % 10, current / 10, current % 10);
+    for (uint8_t i = 0; i < probeCount; i++) {
+      const LatencyHistogram &histogram = histograms[i];
+      LOG_INFO(DEVICE, "Diagnostics - %s: %u samples, p50 %u us, p99 %u us, "
+                       "max %u us",
+               names[i], histogram.count(), histogram.quantile(500),
+               histogram.quantile(990), histogram.max());
+    }
+    LOG_INFO(DEVICE, "Diagnostics - stack left: render %u B, control %u B, "
+                     "storage %u B, audio %u B",
+             stackFree[0], stackFree[1], stackFree[2], stackFree[3]);
+  }
+
+private:
+  static void put16(byte *buffer, uint16_t value) {
+    buffer[0] = value & 0xFF;
+    buffer[1] = value >> 8;
+  }
+  static void put32(byte *buffer, uint32_t value) {
+    put16(buffer, value & 0xFFFF);
+    put16(buffer + 2, value >> 16);
+  }
+
+  LatencyHistogram histograms[probeCount];
+  uint16_t stackFree[taskCount] = {};
+  uint32_t frames               = 0;
+  uint16_t fps10                = 0;
+  uint16_t loopsPerSecond       = 0;
+  uint16_t awake                = 1000;
+  uint16_t current              = 0;
+  unsigned long windowStart     = 0;
+  uint32_t windowFrames         = 0;
+  uint32_t windowLoops          = 0;
+};
+
+Diagnostics diagnostics;
+
+///@brief Times its scope into the histogram of `probe`
+class ScopedProbe {
+public:
+  explicit ScopedProbe(Probe_Id probe) : probe(probe), start(cycleCount()) {}
+  ~ScopedProbe() { diagnostics.record(probe, cycleCount() - start); }
+
+private:
+  Probe_Id probe;
+  uint32_t start;
+};
+
+///
+///@brief Serial commands, one character each:
+/// 'd' dumps the diagnostics to the log, 'r' resets them.
+///
+void pollSerialCommands() {
+  while (Serial.available() > 0) {
+    switch (Serial.read()) {
+    case 'd':
+      diagnostics.dump();
+      break;
+    case 'r':
+      diagnostics.reset();
+      LOG_INFO(DEVICE, "Diagnostics - Reset");
+      break;
+    }
+  }
+}
+
+#endif // DIAGNOSTICS_HPP
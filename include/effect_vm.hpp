@@ -0,0 +1,581 @@
+#ifndef EFFECT_VM_HPP
+#define EFFECT_VM_HPP
+
+#include "Arduino.h"
+#include "loop_modes.hpp"
+#include "settings.h"
+#include <atomic>
+
+///
+/// Effect programs: the render of the program mode, uploaded over BLE instead
+/// of built into the firmware.
+/// A program maps every pixel of its zone to a color. It runs on 16 signed
+/// 32 bit registers, set for each pixel to:
+///   r0       index of the pixel in the zone
+///   r1       length of the zone
+///   r2       time, ms
+///   r3       position in the zone, 0 to 65535
+///   r4..r7   the 4 params of the program mode
+///   r8..r15  0
+/// and the color is r8, r9, r10 (red, green, blue, clamped to 0-255) once
+/// the last instruction has run.
+///
+/// Image, as uploaded and stored:
+///   [version, count, instruction * count], an instruction is [op, d, a, b]
+/// d is the register written, a and b the registers read, except for ldi
+/// whose a and b are a 16 bit constant. There are no jumps: a program runs
+/// each of its at most programMaxInstructions once per pixel, choices are
+/// made with lt and sel. That, and registers and opcodes in range, is what
+/// verifyProgram() checks before a program is run.
+///
+
+const uint8_t programVersion         = 1;
+const uint8_t programMaxInstructions = 64;
+const uint8_t programRegisters       = 16;
+const uint16_t programImageMax       = 2 + 4 * programMaxInstructions;
+const uint8_t programFirstOutput     = 8;
+
+///@brief Instruction set, d = result, a and b = operands
+enum class Op_Code : byte {
+  mov     = 0x01, // a
+  ldi     = 0x02, // int16_t(a | b << 8)
+  add     = 0x03, // a + b
+  sub     = 0x04, // a - b
+  mul     = 0x05, // a * b
+  scale   = 0x06, // a * b >> 8, a scaled by b / 256
+  div     = 0x07, // a / b, 0 if b is 0
+  mod     = 0x08, // a % b, 0 if b is 0
+  bit_and = 0x09, // a & b
+  bit_or  = 0x0A, // a | b
+  bit_xor = 0x0B, // a ^ b
+  shl     = 0x0C, // a << (b & 31)
+  shr     = 0x0D, // a >> (b & 31), keeps the sign
+  minimum = 0x0E, // the smaller of a and b
+  maximum = 0x0F, // the larger of a and b
+  lt      = 0x10, // 1 if a < b, else 0
+  sel     = 0x11, // b if a is not 0, else d unchanged
+  wave    = 0x12, // 128 + 127 * sine, a turn is 65536 of a: 1 to 255
+  tri     = 0x13, // 0 up to 255 and back down, a turn is 65536 of a
+  hue     = 0x14, // d, d + 1, d + 2 = red, green, blue of hue a, 65536 a turn
+  noise   = 0x15, // a hash of a, 0 to 255
+};
+
+///@brief Status of a program upload: why verifyProgram() refused it, if it did
+enum class Program_Error : byte {
+  none         = 0,
+  bad_size     = 1, // shorter than its header says, or longer
+  bad_version  = 2,
+  too_long     = 3, // more than programMaxInstructions
+  bad_opcode   = 4,
+  bad_register = 5,
+  bad_slot     = 6, // not below programSlots
+  busy         = 7, // verified, but the last uploads are not applied yet
+};
+
+struct EffectInstruction {
+  uint8_t op;
+  uint8_t d;
+  uint8_t a;
+  uint8_t b;
+};
+
+///@brief A verified program
+struct EffectProgram {
+  uint8_t count;
+  // Registers read before the program writes them: the VM only sets these
+  uint16_t initMask;
+  // Instructions whose result is the same for every pixel, bit k for code[k]:
+  // run once per zone instead of once per pixel
+  uint64_t uniformMask;
+  EffectInstruction code[programMaxInstructions];
+
+  ///@brief The image it was verified from
+  size_t encode(uint8_t *image) const {
+    image[0] = programVersion;
+    image[1] = count;
+    memcpy(image + 2, code, count * sizeof(EffectInstruction));
+    return 2 + count * sizeof(EffectInstruction);
+  }
+};
+
+static_assert(sizeof(EffectInstruction) == 4, "An instruction is 4 bytes");
+
+///
+///@brief Check an image and decode it into program
+///@return Program_Error::none if it can run, `at` is the instruction at
+/// fault otherwise
+///
+Program_Error verifyProgram(const uint8_t *image, size_t size,
+                            EffectProgram &program, uint8_t &at) {
+  at = 0;
+  if (size < 2) {
+    return Program_Error::bad_size;
+  }
+  if (image[0] != programVersion) {
+    return Program_Error::bad_version;
+  }
+  uint8_t count = image[1];
+  if (count > programMaxInstructions) {
+    return Program_Error::too_long;
+  }
+  if (size != 2 + size_t(count) * sizeof(EffectInstruction)) {
+    return Program_Error::bad_size;
+  }
+
+  uint16_t reads[programMaxInstructions];
+  uint16_t writes[programMaxInstructions];
+  uint16_t written      = 0;
+  uint16_t writtenTwice = 0;
+  uint16_t initMask     = 0;
+  for (at = 0; at < count; at++) {
+    EffectInstruction in;
+    memcpy(&in, image + 2 + at * sizeof(in), sizeof(in));
+
+    // Registers read and written by the instruction
+    uint16_t &read  = reads[at];
+    uint16_t &write = writes[at];
+    read            = 0;
+    write           = 1 << (in.d & 0x0F);
+    uint8_t last    = in.d;
+    switch (Op_Code(in.op)) {
+    case Op_Code::ldi:
+      break;
+    case Op_Code::mov:
+    case Op_Code::wave:
+    case Op_Code::tri:
+    case Op_Code::noise:
+      read = 1 << (in.a & 0x0F);
+      last = max(last, in.a);
+      break;
+    case Op_Code::hue:
+      read  = 1 << (in.a & 0x0F);
+      write = 0b111 << (in.d & 0x0F);
+      last  = max<uint8_t>(in.d + 2, in.a);
+      break;
+    case Op_Code::sel:
+      read = 1 << (in.a & 0x0F) | 1 << (in.b & 0x0F) | 1 << (in.d & 0x0F);
+      last = max(last, max(in.a, in.b));
+      break;
+    case Op_Code::add:
+    case Op_Code::sub:
+    case Op_Code::mul:
+    case Op_Code::scale:
+    case Op_Code::div:
+    case Op_Code::mod:
+    case Op_Code::bit_and:
+    case Op_Code::bit_or:
+    case Op_Code::bit_xor:
+    case Op_Code::shl:
+    case Op_Code::shr:
+    case Op_Code::minimum:
+    case Op_Code::maximum:
+    case Op_Code::lt:
+      read = 1 << (in.a & 0x0F) | 1 << (in.b & 0x0F);
+      last = max(last, max(in.a, in.b));
+      break;
+    default:
+      return Program_Error::bad_opcode;
+    }
+    if (last >= programRegisters) {
+      return Program_Error::bad_register;
+    }
+    initMask |= read & ~written;
+    writtenTwice |= write & written;
+    written |= write;
+    program.code[at] = in;
+  }
+  // The color is read after the last instruction
+  initMask |= 0b111 << programFirstOutput & ~written;
+
+  // Uniform: reading registers that hold the same value for every pixel when
+  // the zone starts (all the inputs but r0 and r3, and the results of
+  // uniform instructions), writing registers nothing else writes or reads
+  // before. Their results then hold for the whole zone.
+  uint16_t uniform     = ~(1 << 0 | 1 << 3);
+  uint64_t uniformMask = 0;
+  for (uint8_t k = 0; k < count; k++) {
+    if ((reads[k] & ~uniform) == 0 &&
+        (writes[k] & (writtenTwice | initMask)) == 0) {
+      uniformMask |= uint64_t(1) << k;
+      uniform |= writes[k];
+    } else {
+      uniform &= ~writes[k];
+    }
+  }
+
+  program.count       = count;
+  program.initMask    = initMask;
+  program.uniformMask = uniformMask;
+  return Program_Error::none;
+}
+
+///
+///@brief Runs effect programs, a batch of pixels at a time: each instruction
+/// is decoded once for `lanes` pixels and applied to them in a tight loop,
+/// instead of dispatching every instruction for every pixel.
+/// The registers are a static buffer, only the render task runs programs.
+///
+class EffectVm {
+public:
+  static const uint8_t lanes = 32;
+
+  ///@brief Pixels [first, first + count) of strip from program, params are
+  /// the 4 params of the program mode
+  template <typename Format>
+  void run(const EffectProgram &program, Adafruit_NeoPixel &strip,
+           uint16_t first, uint16_t count, unsigned long now,
+           const uint8_t *params) {
+    if (first >= strip.numPixels()) {
+      return;
+    }
+    count = min<uint16_t>(count, strip.numPixels() - first);
+    if (count == 0) {
+      return;
+    }
+
+    uint8_t *pixels = strip.getPixels() + first * Format::bytesPerPixel;
+    // Position per pixel, 16.16
+    uint32_t step = (uint32_t(1) << 31) / count * 2;
+    for (uint16_t done = 0; done < count; done += lanes) {
+      uint8_t n = min<uint16_t>(lanes, count - done);
+      load(program.initMask, done, n, count, step, now, params);
+      if (done == 0) {
+        // The first batch is the widest
+        execute(program, n, program.uniformMask);
+      }
+      execute(program, n, ~program.uniformMask);
+      store<Format>(pixels + done * Format::bytesPerPixel, n);
+    }
+  }
+
+private:
+  typedef int32_t Lanes[lanes];
+
+  void load(uint16_t mask, uint16_t done, uint8_t n, uint16_t count,
+            uint32_t step, unsigned long now, const uint8_t *params) {
+    for (uint8_t r = 0; r < programRegisters; r++) {
+      if (!(mask & 1 << r)) {
+        continue;
+      }
+      int32_t *d = regs[r];
+      switch (r) {
+      case 0:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = done + l;
+        }
+        break;
+      case 1:
+        fill(d, n, count);
+        break;
+      case 2:
+        fill(d, n, int32_t(now));
+        break;
+      case 3:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = (uint32_t(done + l) * step) >> 16;
+        }
+        break;
+      case 4:
+      case 5:
+      case 6:
+      case 7:
+        fill(d, n, params[r - 4]);
+        break;
+      default:
+        fill(d, n, 0);
+        break;
+      }
+    }
+  }
+
+  static void fill(int32_t *d, uint8_t n, int32_t value) {
+    for (uint8_t l = 0; l < n; l++) {
+      d[l] = value;
+    }
+  }
+
+  ///@brief The instructions of program in mask, on n lanes
+  void execute(const EffectProgram &program, uint8_t n, uint64_t mask) {
+    for (uint8_t k = 0; k < program.count; k++) {
+      if (!(mask >> k & 1)) {
+        continue;
+      }
+      const EffectInstruction &in = program.code[k];
+      int32_t *d                  = regs[in.d & 0x0F];
+      const int32_t *a            = regs[in.a & 0x0F];
+      const int32_t *b            = regs[in.b & 0x0F];
+
+      // Wrapping arithmetic goes through uint32_t, signed overflow is
+      // undefined
+      switch (Op_Code(in.op)) {
+      case Op_Code::mov:
+        memmove(d, a, n * sizeof(int32_t));
+        break;
+      case Op_Code::ldi:
+        fill(d, n, int16_t(in.a | in.b << 8));
+        break;
+      case Op_Code::add:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = int32_t(uint32_t(a[l]) + uint32_t(b[l]));
+        }
+        break;
+      case Op_Code::sub:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = int32_t(uint32_t(a[l]) - uint32_t(b[l]));
+        }
+        break;
+      case Op_Code::mul:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = int32_t(uint32_t(a[l]) * uint32_t(b[l]));
+        }
+        break;
+      case Op_Code::scale:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = int32_t((int64_t(a[l]) * b[l]) >> 8);
+        }
+        break;
+      case Op_Code::div:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = b[l] == 0    ? 0
+                 : b[l] == -1 ? int32_t(0 - uint32_t(a[l]))
+                              : a[l] / b[l];
+        }
+        break;
+      case Op_Code::mod:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = b[l] == 0 || b[l] == -1 ? 0 : a[l] % b[l];
+        }
+        break;
+      case Op_Code::bit_and:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] & b[l];
+        }
+        break;
+      case Op_Code::bit_or:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] | b[l];
+        }
+        break;
+      case Op_Code::bit_xor:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] ^ b[l];
+        }
+        break;
+      case Op_Code::shl:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = int32_t(uint32_t(a[l]) << (b[l] & 31));
+        }
+        break;
+      case Op_Code::shr:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] >> (b[l] & 31);
+        }
+        break;
+      case Op_Code::minimum:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] < b[l] ? a[l] : b[l];
+        }
+        break;
+      case Op_Code::maximum:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] > b[l] ? a[l] : b[l];
+        }
+        break;
+      case Op_Code::lt:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] < b[l];
+        }
+        break;
+      case Op_Code::sel:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = a[l] != 0 ? b[l] : d[l];
+        }
+        break;
+      case Op_Code::wave:
+        for (uint8_t l = 0; l < n; l++) {
+          d[l] = wave(a[l]);
+        }
+        break;
+      case Op_Code::tri:
+        for (uint8_t l = 0; l < n; l++) {
+          uint16_t t = a[l];
+          d[l]       = (t & 0x8000 ? 0xFFFF - t : t) >> 7;
+        }
+        break;
+      case Op_Code::hue: {
+        // Verified: d + 2 is a register
+        int32_t *green = regs[(in.d + 1) & 0x0F];
+        int32_t *blue  = regs[(in.d + 2) & 0x0F];
+        for (uint8_t l = 0; l < n; l++) {
+          hue(a[l], d[l], green[l], blue[l]);
+        }
+        break;
+      }
+      case Op_Code::noise:
+        for (uint8_t l = 0; l < n; l++) {
+          uint32_t x = a[l];
+          x ^= x >> 16;
+          x *= 0x7FEB352D;
+          x ^= x >> 15;
+          x *= 0x846CA68B;
+          x ^= x >> 16;
+          d[l] = x & 0xFF;
+        }
+        break;
+      }
+    }
+  }
+
+  template <typename Format> void store(uint8_t *pixel, uint8_t n) {
+    const int32_t *red   = regs[programFirstOutput];
+    const int32_t *green = regs[programFirstOutput + 1];
+    const int32_t *blue  = regs[programFirstOutput + 2];
+    for (uint8_t l = 0; l < n; l++) {
+      pixel[Format::red]   = clamp(red[l]);
+      pixel[Format::green] = clamp(green[l]);
+      pixel[Format::blue]  = clamp(blue[l]);
+      pixel += Format::bytesPerPixel;
+    }
+  }
+
+  static uint8_t clamp(int32_t value) {
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+  }
+
+  ///@brief 128 + 127 * sin, 256 steps a turn from a quarter wave
+  static int32_t sine(uint8_t step) {
+    static const uint8_t quarter[65] = {
+        0,   3,   6,   9,   12,  16,  19,  22,  25,  28,  31,  34,  37,
+        40,  43,  46,  49,  51,  54,  57,  60,  63,  65,  68,  71,  73,
+        76,  78,  81,  83,  85,  88,  90,  92,  94,  96,  98,  100, 102,
+        104, 106, 107, 109, 111, 112, 113, 115, 116, 117, 118, 120, 121,
+        122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127};
+    uint8_t index = step & 0x3F;
+    uint8_t value = quarter[step & 0x40 ? 64 - index : index];
+    return step & 0x80 ? 128 - value : 128 + value;
+  }
+
+  ///@brief sine() interpolated between its steps
+  static int32_t wave(uint32_t turn) {
+    uint8_t step   = turn >> 8;
+    int32_t from   = sine(step);
+    int32_t to     = sine(step + 1);
+    uint8_t weight = turn;
+    return from + (((to - from) * weight) >> 8);
+  }
+
+  ///@brief Full saturation and value, the hue wheel of ColorHSV()
+  static void hue(uint32_t turn, int32_t &red, int32_t &green,
+                  int32_t &blue) {
+    uint16_t h = ((turn & 0xFFFF) * 1530 + 32768) >> 16;
+    if (h < 510) {
+      blue  = 0;
+      red   = h < 255 ? 255 : 510 - h;
+      green = h < 255 ? h : 255;
+    } else if (h < 1020) {
+      red   = 0;
+      green = h < 765 ? 255 : 1020 - h;
+      blue  = h < 765 ? h - 510 : 255;
+    } else if (h < 1530) {
+      green = 0;
+      red   = h < 1275 ? h - 1020 : 255;
+      blue  = h < 1275 ? 255 : 1530 - h;
+    } else {
+      red   = 255;
+      green = 0;
+      blue  = 0;
+    }
+  }
+
+  Lanes regs[programRegisters];
+} effectVm;
+
+///
+///@brief The built-in program of slot 0 while it has none: the rainbow,
+/// scrolling at p3.
+///   mul r11, r2, r7    time * p3
+///   add r12, r11, r3   + position
+///   hue r8, r12
+///
+const uint8_t defaultProgramImage[] = {
+    programVersion,        3,         //
+    uint8_t(Op_Code::mul), 11, 2,  7, //
+    uint8_t(Op_Code::add), 12, 11, 3, //
+    uint8_t(Op_Code::hue), 8,  12, 0, //
+};
+
+///
+///@brief The verified program of every program slot, what the program mode
+/// draws. Changed by the control task holding the FrameLock, copied under it
+/// and saved by the storage task: unsaved() has a bit for every slot changed
+/// since it was last copied, or whose save failed.
+///
+class EffectPrograms {
+public:
+  EffectPrograms() {
+    uint8_t at;
+    verifyProgram(defaultProgramImage, sizeof(defaultProgramImage), fallback,
+                  at);
+  }
+
+  ///@return nullptr if slot has no program
+  const EffectProgram *get(uint8_t slot) const {
+    return slot < programSlots && used[slot] ? &programs[slot] : nullptr;
+  }
+
+  ///@brief The program drawn for slot: its own, or the built-in one for an
+  /// empty slot 0
+  ///@return nullptr if there is none
+  const EffectProgram *running(uint8_t slot) const {
+    const EffectProgram *program = get(slot);
+    return program == nullptr && slot == 0 ? &fallback : program;
+  }
+
+  void install(uint8_t slot, const EffectProgram &program) {
+    programs[slot] = program;
+    used[slot]     = true;
+    changed(slot);
+  }
+
+  void remove(uint8_t slot) {
+    used[slot] = false;
+    changed(slot);
+  }
+
+  ///@brief A program loaded from its file, nothing to save
+  void restore(uint8_t slot, const EffectProgram &program) {
+    programs[slot] = program;
+    used[slot]     = true;
+  }
+
+  uint8_t unsaved() const { return unsavedMask; }
+  void saved(uint8_t slot) { unsavedMask &= ~(1 << slot); }
+  void changed(uint8_t slot) { unsavedMask |= 1 << slot; }
+
+private:
+  EffectProgram programs[programSlots];
+  EffectProgram fallback;
+  bool used[programSlots] = {};
+  std::atomic<uint8_t> unsavedMask{0};
+} effectPrograms;
+
+///
+///@brief Draw `count` pixels from `first` with the program of slot, black
+/// if there is none
+///
+template <typename Format = StripFormat>
+void effect(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+            uint8_t slot, const uint8_t *params, unsigned long now) {
+  const EffectProgram *program = effectPrograms.running(slot);
+  if (program != nullptr) {
+    effectVm.run<Format>(*program, strip, first, count, now, params);
+    return;
+  }
+  if (first < strip.numPixels()) {
+    count = min<uint16_t>(count, strip.numPixels() - first);
+    memset(strip.getPixels() + first * Format::bytesPerPixel, 0,
+           count * Format::bytesPerPixel);
+  }
+}
+
+#endif // EFFECT_VM_HPP
@@ -0,0 +1,57 @@
+#ifndef FIXED_NEOPIXEL_HPP
+#define FIXED_NEOPIXEL_HPP
+
+#include <Adafruit_NeoPixel.h>
+
+///
+///@brief Adafruit_NeoPixel whose pixel buffer is allocated at compile time
+/// for Capacity pixels.
+/// setLength() only changes how many pixels are rendered and sent, it never
+/// frees or allocates the buffer like Adafruit_NeoPixel::updateLength() does,
+/// so resizing a long strip cannot fail or fragment the heap.
+/// Only 3 bytes per pixel types (RGB) are supported.
+///
+template <uint16_t Capacity> class FixedNeoPixel : public Adafruit_NeoPixel {
+  static_assert(Capacity <= 65535 / 3, "numBytes is 16 bits wide");
+
+public:
+  static const uint8_t bytesPerPixel = 3;
+
+  FixedNeoPixel(uint16_t length, int16_t pin, neoPixelType type)
+      : Adafruit_NeoPixel() {
+    // pixels is still NULL here, so updateType() does not allocate
+    updateType(type);
+    setPin(pin);
+    pixels = buffer;
+    setLength(length);
+  }
+
+  FixedNeoPixel(const FixedNeoPixel &) = delete;
+  FixedNeoPixel &operator=(const FixedNeoPixel &) = delete;
+
+  // The base destructor frees pixels, which is not heap memory here
+  ~FixedNeoPixel() { pixels = nullptr; }
+
+  ///@brief Set the number of pixels in use, clamped to Capacity. The pixels
+  /// past the previous length are cleared.
+  void setLength(uint16_t length) {
+    if (length > Capacity) {
+      length = Capacity;
+    }
+    if (length > numLEDs) {
+      memset(buffer + numBytes, 0, (length - numLEDs) * bytesPerPixel);
+    }
+    numLEDs  = length;
+    numBytes = length * bytesPerPixel;
+  }
+
+  // Hides Adafruit_NeoPixel::updateLength(), which would free the buffer
+  void updateLength(uint16_t length) { setLength(length); }
+
+  static uint16_t capacity() { return Capacity; }
+
+private:
+  uint8_t buffer[Capacity * bytesPerPixel];
+};
+
+#endif // FIXED_NEOPIXEL_HPP
@@ -0,0 +1,55 @@
+#ifndef FRAME_SCHEDULER_HPP
+#define FRAME_SCHEDULER_HPP
+
+#include "Arduino.h"
+#include "settings.h"
+
+///
+///@brief How often a mode has to be re-rendered.
+/// Static modes draw the same frame until their parameters change, so they
+/// are only redrawn when their zone or the whole strip is invalidated.
+/// Each mode declares its own, see modeTiming() in modes.hpp.
+///
+struct ModeTiming {
+  uint16_t fps;
+  bool isStatic;
+};
+
+///
+///@brief Decides when run_mod() has to redraw the whole strip.
+/// A full redraw is due when:
+///  - the On/Off state changed,
+///  - invalidate() was called (active mode, mode parameters, zone layout,
+///    length or brightness changed).
+/// Between full redraws SegmentEngine redraws only the zones that are due.
+///
+class FrameScheduler {
+public:
+  ///@brief Force a full redraw on the next frame.
+  void invalidate() { dirty = true; }
+
+  bool redrawDue(bool isOn) {
+    if (isOn != lastOn) {
+      lastOn = isOn;
+      dirty  = true;
+    }
+    return dirty;
+  }
+
+  ///@brief Call after show().
+  void frameShown() {
+    dirty = false;
+    frames++;
+  }
+
+  uint32_t framesShown() const { return frames; }
+
+private:
+  bool dirty      = true;
+  bool lastOn     = false;
+  uint32_t frames = 0;
+};
+
+FrameScheduler frameScheduler;
+
+#endif // FRAME_SCHEDULER_HPP
@@ -0,0 +1,301 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include "Arduino.h"
+#include <atomic>
+#include <type_traits>
+
+///
+/// Logging with compile-time levels and categories.
+///
+///   LOG_INFO(STRIP, "setActiveMode - Mode %u Active", mode);
+///
+/// A call below LOG_LEVEL or out of LOG_CATEGORIES compiles to nothing.
+/// The others queue a binary record, the id of the format string and the
+/// raw arguments, in a lock-free ring; a low priority task writes the
+/// records to Serial and tools/log_decode.py turns them back into text. No
+/// String is built and the caller never waits for the UART.
+///
+/// Arguments are integers, floats and C strings (copied, truncated to fit
+/// the record); formats use %d %u %x %c %s %f.
+///
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#ifdef ESP32
+#define LOG_LEVEL LOG_LEVEL_INFO
+#else
+// Host builds (benchmarks) have no task draining the ring
+#define LOG_LEVEL LOG_LEVEL_NONE
+#endif
+#endif
+
+// Categories, the prefixes of the log lines
+#define LOG_CATEGORY_BLE 0x01
+#define LOG_CATEGORY_STRIP 0x02
+#define LOG_CATEGORY_DEVICE 0x04
+
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES                                                         \
+  (LOG_CATEGORY_BLE | LOG_CATEGORY_STRIP | LOG_CATEGORY_DEVICE)
+#endif
+
+// The format id is computed by the compiler, the format string itself is
+// not kept in the firmware.
+#define LOG_AT(level, category, format, ...)                                   \
+  do {                                                                         \
+    if (LOG_LEVEL >= level && (LOG_CATEGORIES & LOG_CATEGORY_##category)) {    \
+      logging::write(                                                          \
+          std::integral_constant<uint32_t, logging::formatId(format)>::value,  \
+          level, LOG_CATEGORY_##category, ##__VA_ARGS__);                      \
+    }                                                                          \
+  } while (0)
+
+#define LOG_ERROR(category, format, ...)                                       \
+  LOG_AT(LOG_LEVEL_ERROR, category, format, ##__VA_ARGS__)
+#define LOG_WARN(category, format, ...)                                        \
+  LOG_AT(LOG_LEVEL_WARN, category, format, ##__VA_ARGS__)
+#define LOG_INFO(category, format, ...)                                        \
+  LOG_AT(LOG_LEVEL_INFO, category, format, ##__VA_ARGS__)
+#define LOG_DEBUG(category, format, ...)                                       \
+  LOG_AT(LOG_LEVEL_DEBUG, category, format, ##__VA_ARGS__)
+
+namespace logging {
+
+///@brief 32 bit FNV-1a of the format string, tools/log_decode.py hashes the
+/// formats it finds in the sources the same way.
+constexpr uint32_t formatId(const char *format, uint32_t hash = 2166136261u) {
+  return *format == 0
+             ? hash
+             : formatId(format + 1, (hash ^ uint8_t(*format)) * 16777619u);
+}
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+
+// Argument tags in a record
+const uint8_t argInt    = 'i';
+const uint8_t argUint   = 'u';
+const uint8_t argFloat  = 'f';
+const uint8_t argString = 's';
+
+const uint8_t recordArgsMax = 60;
+
+///
+///@brief One log call. On the wire, after the sync byte and the size:
+/// [millis, formatId, level, category, args] [32, 32, 8, 8, size bytes]
+/// then the sum of those bytes modulo 256.
+///
+struct Record {
+  uint32_t millis;
+  uint32_t formatId;
+  uint8_t level;
+  uint8_t category;
+  uint8_t size; // bytes of args
+  uint8_t args[recordArgsMax];
+};
+
+///
+///@brief Bounded multi-producer single-consumer ring of Records.
+/// Every slot carries a sequence number: a producer claims a slot with a
+/// compare and swap on head and publishes it by advancing the sequence, so
+/// every task and the Bluetooth stack can log at the same time without a
+/// lock.
+///
+template <uint32_t Capacity> class RecordRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "RecordRing Capacity must be a power of two");
+
+public:
+  RecordRing() {
+    for (uint32_t i = 0; i < Capacity; i++) {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ///@brief Any task. Returns false (and counts a drop) when full.
+  bool push(const Record &record) {
+    uint32_t position = head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+      slot              = &slots[position & (Capacity - 1)];
+      uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+      int32_t distance  = int32_t(sequence - position);
+      if (distance == 0) {
+        if (head.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (distance < 0) {
+        drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        position = head.load(std::memory_order_relaxed);
+      }
+    }
+    slot->record = record;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  ///@brief The draining task only. Returns false when empty.
+  bool pop(Record &record) {
+    Slot &slot = slots[tail & (Capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+      return false;
+    }
+    record = slot.record;
+    slot.sequence.store(tail + Capacity, std::memory_order_release);
+    tail++;
+    return true;
+  }
+
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot {
+    std::atomic<uint32_t> sequence;
+    Record record;
+  };
+
+  Slot slots[Capacity];
+  std::atomic<uint32_t> head{0};
+  uint32_t tail = 0;
+  std::atomic<uint32_t> drops{0};
+};
+
+RecordRing<64> ring;
+
+///@brief Append a tagged argument, dropped if it does not fit
+inline void putArg(Record &record, uint8_t tag, const void *data,
+                   uint8_t size) {
+  if (record.size + 1 + size > recordArgsMax) {
+    return;
+  }
+  record.args[record.size++] = tag;
+  memcpy(record.args + record.size, data, size);
+  record.size += size;
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value &&
+                        std::is_signed<T>::value>::type
+put(Record &record, T value) {
+  int32_t raw = value;
+  putArg(record, argInt, &raw, sizeof(raw));
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value &&
+                        !std::is_signed<T>::value>::type
+put(Record &record, T value) {
+  uint32_t raw = value;
+  putArg(record, argUint, &raw, sizeof(raw));
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+put(Record &record, T value) {
+  float raw = value;
+  putArg(record, argFloat, &raw, sizeof(raw));
+}
+
+///@brief [tag, length, chars], truncated to the room left
+inline void put(Record &record, const char *value) {
+  if (record.size + 2 > recordArgsMax) {
+    return;
+  }
+  uint8_t length = min<size_t>(strlen(value), recordArgsMax - record.size - 2);
+  record.args[record.size++] = argString;
+  record.args[record.size++] = length;
+  memcpy(record.args + record.size, value, length);
+  record.size += length;
+}
+
+inline void putAll(Record &) {}
+
+template <typename T, typename... Args>
+void putAll(Record &record, T value, Args... args) {
+  put(record, value);
+  putAll(record, args...);
+}
+
+template <typename... Args>
+void write(uint32_t formatId, uint8_t level, uint8_t category, Args... args) {
+  Record record;
+  record.millis   = millis();
+  record.formatId = formatId;
+  record.level    = level;
+  record.category = category;
+  record.size     = 0;
+  putAll(record, args...);
+  ring.push(record);
+}
+
+const uint8_t frameSync = 0xA5;
+// Record reporting how many records the full ring dropped, one uint arg
+const uint32_t droppedFormatId = 0;
+
+inline void send(const Record &record) {
+  uint8_t header[10];
+  memcpy(header, &record.millis, 4);
+  memcpy(header + 4, &record.formatId, 4);
+  header[8] = record.level;
+  header[9] = record.category;
+
+  uint8_t checksum = 0;
+  for (uint8_t i = 0; i < sizeof(header); i++) {
+    checksum += header[i];
+  }
+  for (uint8_t i = 0; i < record.size; i++) {
+    checksum += record.args[i];
+  }
+  uint8_t frame[2] = {frameSync, uint8_t(sizeof(header) + record.size)};
+  Serial.write(frame, sizeof(frame));
+  Serial.write(header, sizeof(header));
+  Serial.write(record.args, record.size);
+  Serial.write(&checksum, 1);
+}
+
+///@brief Write the queued records to Serial. The storage task calls it
+/// every logDrainMs.
+///@return the number of records written
+inline uint32_t drain() {
+  static uint32_t reportedDrops = 0;
+  uint32_t drops                = ring.dropped();
+  if (drops != reportedDrops) {
+    Record record;
+    record.millis   = millis();
+    record.formatId = droppedFormatId;
+    record.level    = LOG_LEVEL_WARN;
+    record.category = 0;
+    record.size     = 0;
+    put(record, drops - reportedDrops);
+    send(record);
+    reportedDrops = drops;
+  }
+
+  uint32_t count = 0;
+  Record record;
+  while (ring.pop(record)) {
+    send(record);
+    count++;
+  }
+  return count;
+}
+
+#else // LOG_LEVEL == LOG_LEVEL_NONE
+
+template <typename... Args>
+inline void write(uint32_t, uint8_t, uint8_t, Args...) {}
+inline uint32_t drain() { return 0; }
+
+#endif
+
+} // namespace logging
+
+#endif // LOG_HPP
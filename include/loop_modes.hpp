@@ -4,57 +4,188 @@
 #include "settings.h"
 #include <Adafruit_NeoPixel.h>
 
+///
+///@brief Where r, g and b go in a pixel of a NeoPixel wire format, at compile
+/// time. Only 3 bytes per pixel formats (RGB) are supported.
+///
+template <neoPixelType Type> struct PixelFormat {
+  static const uint8_t red           = (Type >> 4) & 0b11;
+  static const uint8_t green         = (Type >> 2) & 0b11;
+  static const uint8_t blue          = Type & 0b11;
+  static const uint8_t bytesPerPixel = 3;
+
+  ///@brief The wire bytes of color
+  static void pack(const Color_RGB &color, uint8_t *pixel) {
+    pixel[red]   = color.r;
+    pixel[green] = color.g;
+    pixel[blue]  = color.b;
+  }
+};
+
+// The format of device.strip
+typedef PixelFormat<stripPixelType> StripFormat;
+
+static_assert(StripFormat::bytesPerPixel == stripBytesPerPixel,
+              "stripPixelType has to be an RGB format");
+
 // Loop Functions
+// Each one renders `count` pixels of strip from `first`, the zone it runs on.
+// They only render into the strip, run_mod() decides when to show() the frame.
+// Colors are full scale: brightness and gamma are applied by OutputStage.
 #pragma region LoopFunctions
-void fixed_color(DeviceInfo &dev) {
-  dev.strip.fill(Adafruit_NeoPixel::Color(dev.fixedColorData.color.r,
-                                          dev.fixedColorData.color.g,
-                                          dev.fixedColorData.color.b),
-                 0, dev.defaultData.ledLenght);
-  dev.strip.setBrightness(dev.defaultData.brightness);
-  dev.strip.show();
+
+///
+///@brief The color is packed once in the strip's Format and copied, instead
+/// of scaling and reordering it for every pixel like fill() does.
+///
+template <typename Format = StripFormat>
+void fixed_color(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+                 const Color_RGB &color) {
+  if (first >= strip.numPixels()) {
+    return;
+  }
+  count = min<uint16_t>(count, strip.numPixels() - first);
+
+  uint8_t pixel[Format::bytesPerPixel];
+  Format::pack(color, pixel);
+  uint8_t *pixels = strip.getPixels() + first * Format::bytesPerPixel;
+  for (uint16_t i = 0; i < count; i++) {
+    memcpy(pixels, pixel, Format::bytesPerPixel);
+    pixels += Format::bytesPerPixel;
+  }
 }
 
-void rainbow(DeviceInfo &dev) {
-  static long firstPixelHue = 0;
-  long hueDifference        = 65536L / dev.strip.numPixels();
-
-  // millis() % 1000 Transorms the internal clock in the claped version of
-  // single second Then the result is translated into double with (result /
-  // 1000.0) Now we have a function that returns a value between 0 and 1 so we *
-  // 65535L The Max value for a HUE Color.
-  //
-  // 4 * rainbowData.velocity / 100
-  // (rainbowData.velocity / 100) limits the velocity between 0 and 1
-  // the the "3" means: We do the full walk of the HUE that times a second.
-  firstPixelHue = int(
-      ((int(millis() * 3 * dev.rainbowData.velocity / 100) % 1000) / 1000.0) *
-      65535L);
-
-  for (int i = 0; i < dev.strip.numPixels(); i++) {
-    int pixelHue = firstPixelHue + (i * hueDifference);
-    if (pixelHue > 65536) {
-      pixelHue -= 65535;
-    }
-    dev.strip.setPixelColor(i, dev.strip.gamma32(dev.strip.ColorHSV(
-                                   pixelHue, 255, dev.defaultData.brightness)));
-  }
-  dev.strip.show();
+///
+///@brief Hue ramp used by rainbow().
+/// The rainbow is always the same ramp rotated by a phase, so the ramp is
+/// rendered once per zone length in the strip's wire format and every frame
+/// is a rotated copy of it: two memcpy for a zone as long as the ramp, a
+/// strided copy for the others. Zones shorter than minSteps still step
+/// through minSteps hues so the motion stays as smooth as on a long strip.
+/// One ramp serves every rainbow zone: prepare() sizes it for the longest.
+/// The ramp is a static buffer sized for STRIP_MAX_LEDS.
+///
+class RainbowEngine {
+public:
+  static const uint16_t minSteps = 256;
+  // Longest ramp: a full strip, or under 2 * minSteps for a short one
+  static const uint32_t maxSteps =
+      STRIP_MAX_LEDS > 2 * minSteps ? STRIP_MAX_LEDS : 2 * minSteps;
+
+  // Phase units per millisecond at velocity 1: the phase is a 32 bit turn of
+  // the hue wheel and velocity 100 means 3 turns per second.
+  // 2^32 * 3 / (100 * 1000)
+  static const uint32_t phasePerMs = 128849UL;
+
+  ///@brief Integer phase accumulation, wraps around with the hue wheel.
+  static uint32_t advance(uint32_t phase, unsigned long elapsedMs,
+                          uint8_t velocity) {
+    return phase + uint32_t(elapsedMs) * velocity * phasePerMs;
+  }
+
+  ///
+  ///@brief Frame period of a rainbow at `velocity`: the time the phase takes
+  /// to move the ramp by one step, frames drawn sooner would be the same.
+  /// At least `minMs` (the mode's frame rate), at most `maxMs`. Call
+  /// prepare() first.
+  ///
+  unsigned long stepPeriodMs(uint8_t velocity, unsigned long minMs,
+                             unsigned long maxMs) const {
+    if (velocity == 0 || steps == 0) {
+      return maxMs;
+    }
+    uint64_t phasePerStep = ((uint64_t)1 << 32) / steps;
+    uint32_t phasePerMsAt = uint32_t(velocity) * phasePerMs;
+    uint64_t period       = (phasePerStep + phasePerMsAt - 1) / phasePerMsAt;
+    return period < minMs ? minMs : period > maxMs ? maxMs : period;
+  }
+
+  ///@brief Rebuild the ramp if it does not fit a zone of `longest` pixels.
+  ///@return false if there is no ramp to render from
+  bool prepare(uint16_t longest) {
+    if (longest == 0) {
+      return false;
+    }
+    uint16_t subSteps =
+        longest < minSteps ? (minSteps + longest - 1) / longest : 1;
+    uint32_t wanted = uint32_t(longest) * subSteps;
+    if (wanted != steps) {
+      build(wanted);
+    }
+    return steps != 0;
+  }
+
+  ///@brief Render `count` pixels from `first`, `phase` is the hue of the
+  /// first one. Call prepare() first.
+  void render(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+              uint32_t phase) {
+    if (steps == 0 || count == 0) {
+      return;
+    }
+    uint32_t start  = uint32_t((uint64_t(phase) * steps) >> 32);
+    uint8_t *pixels = strip.getPixels() + first * stripBytesPerPixel;
+
+    if (count == steps) {
+      size_t head = size_t(count - start) * stripBytesPerPixel;
+      memcpy(pixels, ramp + start * stripBytesPerPixel, head);
+      memcpy(pixels + head, ramp, start * stripBytesPerPixel);
+      return;
+    }
+
+    // 16.16 fixed point walk, steps / count ramp entries per pixel
+    uint32_t end      = steps << 16;
+    uint32_t stride   = end / count;
+    uint32_t position = start << 16;
+    for (uint16_t i = 0; i < count; i++) {
+      memcpy(pixels, ramp + (position >> 16) * stripBytesPerPixel,
+             stripBytesPerPixel);
+      pixels += stripBytesPerPixel;
+      position += stride;
+      if (position >= end) {
+        position -= end;
+      }
+    }
+  }
+
+private:
+  void build(uint32_t wanted) {
+    steps = 0;
+    if (wanted > maxSteps) {
+      return;
+    }
+    for (uint32_t i = 0; i < wanted; i++) {
+      uint16_t hue   = uint16_t((i << 16) / wanted);
+      uint32_t color = Adafruit_NeoPixel::ColorHSV(hue, 255, 255);
+      StripFormat::pack(Color_RGB{byte(color >> 16), byte(color >> 8),
+                                  byte(color)},
+                        ramp + i * stripBytesPerPixel);
+    }
+    steps = wanted;
+  }
+
+  uint8_t ramp[maxSteps * stripBytesPerPixel];
+  uint32_t steps = 0;
+} rainbowEngine;
+
+void rainbow(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+             uint32_t phase) {
+  rainbowEngine.render(strip, first, count, phase);
 }
 
-void color_split(DeviceInfo &dev) {
+///
+///@brief The first `split` pixels of the zone in color1, the rest in color2
+///
+template <typename Format = StripFormat>
+void color_split(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+                 uint16_t split, const Color_RGB &color1,
+                 const Color_RGB &color2) {
+  if (split > count) {
+    split = count;
+  }
   // Set First Color
-  dev.strip.fill(Adafruit_NeoPixel::Color(dev.colorSplitData.color1.r,
-                                          dev.colorSplitData.color1.g,
-                                          dev.colorSplitData.color1.b),
-                 0, dev.colorSplitData.endFirstLedSplit);
-
+  fixed_color<Format>(strip, first, split, color1);
   // Set Second Color
-  dev.strip.fill(Adafruit_NeoPixel::Color(dev.colorSplitData.color2.r,
-                                          dev.colorSplitData.color2.g,
-                                          dev.colorSplitData.color2.b),
-                 dev.colorSplitData.endFirstLedSplit);
-  dev.strip.show();
+  fixed_color<Format>(strip, first + split, count - split, color2);
 }
 #pragma endregion LoopFuctions
 
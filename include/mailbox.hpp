@@ -0,0 +1,45 @@
+#ifndef MAILBOX_HPP
+#define MAILBOX_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+///
+///@brief Lock-free single-producer/single-consumer mailbox of the latest
+/// value: a triple buffer. post() replaces a value not taken yet instead of
+/// failing like a full SpscRing, so take() always gets the last one posted.
+/// post() must only be called by one task and take() by one other task; both
+/// are O(1) and never block.
+///
+template <typename T> class SpscMailbox {
+public:
+  ///@brief Producer side
+  void post(const T &value) {
+    slots[back] = value;
+    // Hand the written slot over and take back the one not taken, if any
+    back = middle.exchange(back | fresh, std::memory_order_acq_rel) & slotMask;
+  }
+
+  ///@brief Consumer side
+  ///@return false if nothing was posted since the last take()
+  bool take(T &value) {
+    if (!(middle.load(std::memory_order_acquire) & fresh)) {
+      return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & slotMask;
+    value = slots[front];
+    return true;
+  }
+
+private:
+  static const uint8_t slotMask = 0x03;
+  static const uint8_t fresh    = 0x04;
+
+  T slots[3];
+  uint8_t back  = 0; // written by post()
+  uint8_t front = 1; // read by take()
+  // The slot in between, with fresh set while it holds a value not taken
+  std::atomic<uint8_t> middle{2};
+};
+
+#endif // MAILBOX_HPP
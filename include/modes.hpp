@@ -0,0 +1,1064 @@
+#ifndef MODES_HPP
+#define MODES_HPP
+
+#include "Arduino.h"
+#include "audio.hpp"
+#include "compositor.hpp"
+#include "effect_vm.hpp"
+#include "frame_scheduler.hpp"
+#include "loop_modes.hpp"
+#include "palette.hpp"
+#include "particles.hpp"
+#include "settings.h"
+#include "stream.hpp"
+#include <type_traits>
+
+///
+/// Mode registry.
+/// A mode is a struct of static members, derived from ModeBase<Mode>,
+/// declaring once:
+///  - id(), name(), timing(): its Mode_Type value, log/tool name and rate,
+///  - Params and params(dev): its whole strip parameters in DeviceInfo,
+///  - fields(): those parameters, from which ModeBase derives decode(),
+///    encode() and payloadMin(), the layout of its BLE characteristic and
+///    the value of batchId() in the command batch, and toJson(), fromJson()
+///    with defaults(), its jsonKey() object in settings.json,
+///  - characteristic(), uuid(): where that characteristic lives,
+///  - draw<Format>(): the render of a zone from its zoneParams(), for a
+///    pixel wire format,
+///  - prepare(), framePeriodMs(): optional, see ModeBase.
+/// Modes lists them and builds a constexpr table of ModeEntry, function
+/// pointers into those members instantiated for StripFormat. Mode_Type
+/// values index the table, so every dispatch is one lookup and an indirect
+/// call: no switch, no virtual call, no allocation.
+///
+/// Adding a mode: its Mode_Type value, its *Data struct and DeviceInfo
+/// field, a characteristic pointer and UUID for its parameters, a struct
+/// below and its name in Modes.
+///
+
+///@brief Where a zone's animation is, carried from frame to frame
+struct ModeState {
+  bool dirty                = true;
+  unsigned long nextFrameMs = 0;
+  // rainbow, palette, palette_sparkle
+  uint32_t phase       = 0;
+  unsigned long lastMs = 0;
+};
+
+struct NoParams {
+  void print() {}
+};
+
+typedef BLECharacteristic *DeviceInfo::*CharacteristicField;
+
+///@brief The parameters of a zone running Mode, see SegmentData
+template <typename Mode>
+const typename Mode::Params &zoneParams(const SegmentData &segment) {
+  return *reinterpret_cast<const typename Mode::Params *>(segment.params);
+}
+
+template <typename Mode>
+typename Mode::Params &zoneParams(SegmentData &segment) {
+  return *reinterpret_cast<typename Mode::Params *>(segment.params);
+}
+
+#pragma region ModeFields
+
+///@brief How a parameter is sent and stored, see ModeField
+enum class Field_Type : byte {
+  u8,    // [8]
+  u16,   // [16] little endian
+  color, // [8,8,8] red, green, blue; a [r, g, b] array in settings.json
+};
+
+///
+///@brief A parameter of a mode: where it is in the mode's Params and its key
+/// in the mode's settings.json object. The fields follow one another in the
+/// mode's BLE payload.
+/// An u8 field with a count is an array of count bytes, in settings.json
+/// too. One with a limit refuses the values from limit up in a payload and
+/// reads them as 0 from settings.json.
+///
+struct ModeField {
+  const char *key;
+  Field_Type type;
+  uint8_t offset;
+  uint8_t count;
+  uint8_t limit;
+};
+
+constexpr ModeField modeField(const char *key, Field_Type type, size_t offset,
+                              uint8_t count = 0, uint8_t limit = 0) {
+  return ModeField{key, type, uint8_t(offset), count, limit};
+}
+
+// Fields of the mode with the most of them
+const uint8_t modeFieldsMax = 4;
+
+///@brief The fields of a mode in payload order, up to the first without key
+struct ModeFields {
+  ModeField list[modeFieldsMax];
+};
+
+constexpr size_t fieldSize(const ModeField &field) {
+  return (field.type == Field_Type::u16     ? 2
+          : field.type == Field_Type::color ? 3
+                                            : 1) *
+         (field.count > 0 ? field.count : 1);
+}
+
+constexpr size_t payloadSize(const ModeFields &fields, uint8_t index = 0) {
+  return index == modeFieldsMax || fields.list[index].key == nullptr
+             ? 0
+             : fieldSize(fields.list[index]) + payloadSize(fields, index + 1);
+}
+
+///@return false if a field is past its limit
+bool decodeFields(const ModeFields &fields, const byte *buffer,
+                  void *params) {
+  for (const ModeField &field : fields.list) {
+    if (field.key == nullptr) {
+      break;
+    }
+    byte *value = static_cast<byte *>(params) + field.offset;
+    if (field.type == Field_Type::u16) {
+      uint16_t number = buffer[0] | buffer[1] << 8;
+      memcpy(value, &number, sizeof(number));
+    } else {
+      if (field.limit != 0 && buffer[0] >= field.limit) {
+        return false;
+      }
+      memcpy(value, buffer, fieldSize(field));
+    }
+    buffer += fieldSize(field);
+  }
+  return true;
+}
+
+size_t encodeFields(const ModeFields &fields, const void *params,
+                    byte *buffer) {
+  size_t size = 0;
+  for (const ModeField &field : fields.list) {
+    if (field.key == nullptr) {
+      break;
+    }
+    const byte *value = static_cast<const byte *>(params) + field.offset;
+    if (field.type == Field_Type::u16) {
+      uint16_t number;
+      memcpy(&number, value, sizeof(number));
+      buffer[size]     = lowByte(number);
+      buffer[size + 1] = highByte(number);
+    } else {
+      memcpy(buffer + size, value, fieldSize(field));
+    }
+    size += fieldSize(field);
+  }
+  return size;
+}
+
+template <typename Json>
+void fieldsToJson(const ModeFields &fields, const void *params, Json json) {
+  for (const ModeField &field : fields.list) {
+    if (field.key == nullptr) {
+      break;
+    }
+    const byte *value = static_cast<const byte *>(params) + field.offset;
+    if (field.type == Field_Type::u16) {
+      uint16_t number;
+      memcpy(&number, value, sizeof(number));
+      json[field.key] = number;
+    } else if (field.type == Field_Type::color || field.count > 0) {
+      for (size_t i = 0; i < fieldSize(field); i++) {
+        json[field.key][i] = value[i];
+      }
+    } else {
+      json[field.key] = value[0];
+    }
+  }
+}
+
+template <typename Json>
+void fieldsFromJson(const ModeFields &fields, Json json, void *params) {
+  for (const ModeField &field : fields.list) {
+    if (field.key == nullptr) {
+      break;
+    }
+    byte *value = static_cast<byte *>(params) + field.offset;
+    if (field.type == Field_Type::u16) {
+      uint16_t number = json[field.key];
+      memcpy(value, &number, sizeof(number));
+    } else if (field.type == Field_Type::color || field.count > 0) {
+      for (size_t i = 0; i < fieldSize(field); i++) {
+        value[i] = json[field.key][i];
+      }
+    } else {
+      uint8_t number = json[field.key];
+      value[0] = field.limit != 0 && number >= field.limit ? 0 : number;
+    }
+  }
+}
+
+#pragma endregion ModeFields
+
+///
+///@brief Defaults of Mode, the mode deriving from it. Its codec follows its
+/// fields(); a mode without parameters (stream) keeps all of them.
+///
+template <typename Mode> struct ModeBase {
+  typedef NoParams Params;
+
+  static Params &params(SettingsData &dev) {
+    static NoParams none;
+    return none;
+  }
+
+  ///@brief Function ID in the command batch, 0 for none. Unique across
+  /// Batch_Id (ble.hpp).
+  static constexpr byte batchId() { return 0; }
+  static constexpr CharacteristicField characteristic() { return nullptr; }
+  static const char *uuid(const BluetoothSett &sett) { return nullptr; }
+
+  static constexpr ModeFields fields() { return ModeFields{}; }
+  static constexpr size_t payloadMin() { return payloadSize(Mode::fields()); }
+  ///@brief From a payload of at least payloadMin() bytes
+  ///@return false if the payload is not valid
+  template <typename Params>
+  static bool decode(const byte *buffer, size_t length, Params &params) {
+    return decodeFields(Mode::fields(), buffer, &params);
+  }
+  template <typename Params>
+  static size_t encode(const Params &params, byte *buffer) {
+    return encodeFields(Mode::fields(), &params, buffer);
+  }
+
+  static constexpr const char *jsonKey() { return nullptr; }
+  template <typename Params, typename Json>
+  static void toJson(const Params &params, Json json) {
+    fieldsToJson(Mode::fields(), &params, json);
+  }
+  ///
+  ///@brief The files written before a mode have no object for it, json is
+  /// then null and the parameters are the mode's defaults()
+  ///
+  template <typename Json, typename Params>
+  static void fromJson(Json json, Params &params) {
+    if (json.isNull()) {
+      const void *defaults = Mode::defaults();
+      if (defaults != nullptr) {
+        memcpy(&params, defaults, sizeof(params));
+      } else {
+        memset(&params, 0, sizeof(params));
+      }
+      return;
+    }
+    fieldsFromJson(Mode::fields(), json, &params);
+  }
+  ///@brief nullptr for all 0
+  static const void *defaults() { return nullptr; }
+
+  ///@brief Called before drawing, with the longest visible zone of the mode.
+  /// Only for the modes that declare it.
+  ///@return false if the mode has nothing to draw from
+  static bool prepare(uint16_t longest) { return true; }
+
+  ///@brief Frame period of an animated zone, `minMs` is the mode's frame
+  /// rate. Slower when its frames would not change that often.
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    return minMs;
+  }
+};
+
+#pragma region Modes
+
+struct FixedColorMode : ModeBase<FixedColorMode> {
+  typedef FixedColorData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::fixed_color; }
+  static constexpr const char *name() { return "fixed_color"; }
+  static constexpr ModeTiming timing() { return ModeTiming{0, true}; }
+
+  static Params &params(SettingsData &dev) { return dev.fixedColorData; }
+
+  static constexpr byte batchId() { return 2; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecFixedColorData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_FixedColorData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("color", Field_Type::color, offsetof(FixedColorData, color)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "FixedColorData"; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    fixed_color<Format>(strip, segment.start, length,
+                        zoneParams<FixedColorMode>(segment).color);
+  }
+};
+
+struct RainbowMode : ModeBase<RainbowMode> {
+  typedef RainbowData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::rainbow; }
+  static constexpr const char *name() { return "rainbow"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.rainbowData; }
+
+  static constexpr byte batchId() { return 3; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecRainbowData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_RainbowData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("velocity", Field_Type::u8, offsetof(RainbowData, velocity)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "RainbowData"; }
+
+  ///@brief One ramp for every rainbow zone, sized for the longest one
+  static bool prepare(uint16_t longest) {
+    return rainbowEngine.prepare(longest);
+  }
+
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    const Params &params = zoneParams<RainbowMode>(segment);
+    return rainbowEngine.stepPeriodMs(params.velocity, minMs, maxMs);
+  }
+
+  ///@brief The ramp is already in the strip's wire format, any Format
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<RainbowMode>(segment);
+    state.phase  = RainbowEngine::advance(state.phase, now - state.lastMs,
+                                          params.velocity);
+    state.lastMs = now;
+    rainbow(strip, segment.start, length, state.phase);
+  }
+};
+
+struct ColorSplitMode : ModeBase<ColorSplitMode> {
+  typedef ColorSplitData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::color_split; }
+  static constexpr const char *name() { return "color_split"; }
+  static constexpr ModeTiming timing() { return ModeTiming{0, true}; }
+
+  static Params &params(SettingsData &dev) { return dev.colorSplitData; }
+
+  static constexpr byte batchId() { return 4; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecColorSplitData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_ColorSplitData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("endFirstLedSplit", Field_Type::u16,
+                  offsetof(ColorSplitData, endFirstLedSplit)),
+        modeField("color1", Field_Type::color,
+                  offsetof(ColorSplitData, color1)),
+        modeField("color2", Field_Type::color,
+                  offsetof(ColorSplitData, color2)),
+    }};
+  }
+  ///@brief The 7 bytes payload of the older apps, with an 8 bit
+  /// endFirstLedSplit, is still accepted
+  static constexpr size_t payloadMin() { return 7; }
+  static bool decode(const byte *buffer, size_t length, Params &params) {
+    if (length == 7) {
+      byte payload[8] = {buffer[0], 0};
+      memcpy(payload + 2, buffer + 1, 6);
+      return decodeFields(fields(), payload, &params);
+    }
+    return decodeFields(fields(), buffer, &params);
+  }
+
+  static constexpr const char *jsonKey() { return "ColorSplitData"; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<ColorSplitMode>(segment);
+    color_split<Format>(strip, segment.start, length, params.endFirstLedSplit,
+                        params.color1, params.color2);
+  }
+};
+
+///@brief The streamed frame, see stream.hpp. Its packets have their own
+/// characteristic, it has no parameters.
+struct StreamMode : ModeBase<StreamMode> {
+  static constexpr Mode_Type id() { return Mode_Type::stream; }
+  static constexpr const char *name() { return "stream"; }
+  // Redrawn when a streamed frame is complete
+  static constexpr ModeTiming timing() { return ModeTiming{0, true}; }
+
+  ///@brief StreamDecoder keeps the frame in the strip's wire format
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    static_assert(Format::red == StripFormat::red &&
+                      Format::green == StripFormat::green &&
+                      Format::blue == StripFormat::blue,
+                  "The stream frame is in the strip format");
+    streamDecoder.draw(strip, segment.start, length);
+  }
+};
+
+///@brief The shared PaletteData scrolling across the zone like rainbow
+struct PaletteMode : ModeBase<PaletteMode> {
+  typedef PaletteModeData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::palette; }
+  static constexpr const char *name() { return "palette"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.paletteModeData; }
+
+  static constexpr byte batchId() { return 9; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecPaletteMode;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_PaletteMode_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("velocity", Field_Type::u8,
+                  offsetof(PaletteModeData, velocity)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "PaletteModeData"; }
+
+  ///@brief Every palette zone shares device.paletteData
+  static bool prepare(uint16_t longest) {
+    return paletteEngine.prepare(device.paletteData);
+  }
+
+  ///@brief The time the phase takes to move by one of the 256 indices
+  static unsigned long scrollPeriodMs(uint8_t velocity, unsigned long minMs,
+                                      unsigned long maxMs) {
+    if (velocity == 0) {
+      return maxMs;
+    }
+    uint32_t phasePerMs  = uint32_t(velocity) * RainbowEngine::phasePerMs;
+    unsigned long period = ((1UL << 24) + phasePerMs - 1) / phasePerMs;
+    return period < minMs ? minMs : period > maxMs ? maxMs : period;
+  }
+
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    return scrollPeriodMs(zoneParams<PaletteMode>(segment).velocity, minMs,
+                          maxMs);
+  }
+
+  ///@brief The palette table is already in the strip's wire format, any
+  /// Format
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<PaletteMode>(segment);
+    state.phase  = RainbowEngine::advance(state.phase, now - state.lastMs,
+                                          params.velocity);
+    state.lastMs = now;
+    palette(strip, segment.start, length, state.phase);
+  }
+};
+
+///@brief Sparks rising from the start of the zone, see fire()
+struct FireMode : ModeBase<FireMode> {
+  typedef FireData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::fire; }
+  static constexpr const char *name() { return "fire"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.fireData; }
+
+  static constexpr byte batchId() { return 10; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecFireData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_FireData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("cooling", Field_Type::u8, offsetof(FireData, cooling)),
+        modeField("sparking", Field_Type::u8, offsetof(FireData, sparking)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "FireData"; }
+  static const Params *defaults() { return &defaultFireData; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<FireMode>(segment);
+    fire<Format>(strip, segment.start, length, params.cooling, params.sparking,
+                 now);
+  }
+};
+
+///@brief Meteors with a flickering trail crossing the zone, see meteor()
+struct MeteorMode : ModeBase<MeteorMode> {
+  typedef MeteorData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::meteor; }
+  static constexpr const char *name() { return "meteor"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.meteorData; }
+
+  static constexpr byte batchId() { return 11; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecMeteorData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_MeteorData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("color", Field_Type::color, offsetof(MeteorData, color)),
+        modeField("velocity", Field_Type::u8, offsetof(MeteorData, velocity)),
+        modeField("tail", Field_Type::u8, offsetof(MeteorData, tail)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "MeteorData"; }
+  static const Params *defaults() { return &defaultMeteorData; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<MeteorMode>(segment);
+    meteor<Format>(strip, segment.start, length, params.color, params.velocity,
+                   params.tail, now);
+  }
+};
+
+///@brief Stars lighting up and fading on random LEDs, see twinkle()
+struct TwinkleMode : ModeBase<TwinkleMode> {
+  typedef TwinkleData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::twinkle; }
+  static constexpr const char *name() { return "twinkle"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.twinkleData; }
+
+  static constexpr byte batchId() { return 12; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecTwinkleData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_TwinkleData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("color1", Field_Type::color, offsetof(TwinkleData, color1)),
+        modeField("color2", Field_Type::color, offsetof(TwinkleData, color2)),
+        modeField("rate", Field_Type::u8, offsetof(TwinkleData, rate)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "TwinkleData"; }
+  static const Params *defaults() { return &defaultTwinkleData; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<TwinkleMode>(segment);
+    twinkle<Format>(strip, segment.start, length, params.color1, params.color2,
+                    params.rate, now);
+  }
+};
+
+///@brief Comets bouncing between the ends of the zone, see comet()
+struct CometMode : ModeBase<CometMode> {
+  typedef CometData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::comet; }
+  static constexpr const char *name() { return "comet"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.cometData; }
+
+  static constexpr byte batchId() { return 13; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecCometData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_CometData_UUID;
+  }
+
+  ///@brief count is clamped to cometsMax when drawn
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("color1", Field_Type::color, offsetof(CometData, color1)),
+        modeField("color2", Field_Type::color, offsetof(CometData, color2)),
+        modeField("velocity", Field_Type::u8, offsetof(CometData, velocity)),
+        modeField("count", Field_Type::u8, offsetof(CometData, count)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "CometData"; }
+  static const Params *defaults() { return &defaultCometData; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<CometMode>(segment);
+    comet<Format>(strip, segment.start, length, params.color1, params.color2,
+                  params.velocity, min<uint8_t>(params.count, cometsMax), now);
+  }
+};
+
+///@brief An uploaded effect program, see effect_vm.hpp
+struct ProgramMode : ModeBase<ProgramMode> {
+  typedef ProgramData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::program; }
+  static constexpr const char *name() { return "program"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.programData; }
+
+  static constexpr byte batchId() { return 14; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecProgramMode;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_ProgramMode_UUID;
+  }
+
+  ///@brief The programs have their own characteristic
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("slot", Field_Type::u8, offsetof(ProgramData, slot), 0,
+                  programSlots),
+        modeField("params", Field_Type::u8, offsetof(ProgramData, params), 4),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "ProgramData"; }
+  static const Params *defaults() { return &defaultProgramData; }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<ProgramMode>(segment);
+    effect<Format>(strip, segment.start, length, params.slot, params.params,
+                   now);
+  }
+};
+
+///
+///@brief The sound's band levels spread over the zone, see spectrum().
+/// Drawn from each analysis, see AudioFeed.
+///
+struct SpectrumMode : ModeBase<SpectrumMode> {
+  typedef SpectrumData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::spectrum; }
+  static constexpr const char *name() { return "spectrum"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.spectrumData; }
+
+  static constexpr byte batchId() { return 15; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecSpectrumData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_SpectrumData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("low", Field_Type::color, offsetof(SpectrumData, low)),
+        modeField("high", Field_Type::color, offsetof(SpectrumData, high)),
+        modeField("gain", Field_Type::u8, offsetof(SpectrumData, gain)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "SpectrumData"; }
+  static const Params *defaults() { return &defaultSpectrumData; }
+
+  ///@brief Its frames only change with an analysis, which redraws it
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    return maxMs;
+  }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<SpectrumMode>(segment);
+    spectrum<Format>(strip, segment.start, length, params.low, params.high,
+                     params.gain);
+  }
+};
+
+///
+///@brief A flash on every beat of the sound, see pulse(). Drawn from each
+/// analysis, see AudioFeed.
+///
+struct PulseMode : ModeBase<PulseMode> {
+  typedef PulseData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::pulse; }
+  static constexpr const char *name() { return "pulse"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.pulseData; }
+
+  static constexpr byte batchId() { return 16; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecPulseData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_PulseData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("color", Field_Type::color, offsetof(PulseData, color)),
+        modeField("velocity", Field_Type::u8, offsetof(PulseData, velocity)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "PulseData"; }
+  static const Params *defaults() { return &defaultPulseData; }
+
+  ///@brief Its frames only change with an analysis, which redraws it
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    return maxMs;
+  }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<PulseMode>(segment);
+    pulse<Format>(strip, segment.start, length, params.color, params.velocity,
+                  now);
+  }
+};
+
+///@brief A gradient under a layer of sparkles, see sparkle()
+struct SparkleMode : ModeBase<SparkleMode> {
+  typedef SparkleData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::sparkle; }
+  static constexpr const char *name() { return "sparkle"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.sparkleData; }
+
+  static constexpr byte batchId() { return 17; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecSparkleData;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_SparkleData_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("color1", Field_Type::color, offsetof(SparkleData, color1)),
+        modeField("color2", Field_Type::color, offsetof(SparkleData, color2)),
+        modeField("rate", Field_Type::u8, offsetof(SparkleData, rate)),
+        modeField("opacity", Field_Type::u8, offsetof(SparkleData, opacity)),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "SparkleData"; }
+  static const Params *defaults() { return &defaultSparkleData; }
+
+  ///@brief Without sparkles the gradient does not change
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    const Params &params = zoneParams<SparkleMode>(segment);
+    return params.rate == 0 || params.opacity == 0 ? maxMs : minMs;
+  }
+
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<SparkleMode>(segment);
+    sparkle<Format>(strip, segment.start, length, params.color1,
+                    params.color2, params.rate, params.opacity, now);
+  }
+};
+
+///
+///@brief The shared PaletteData scrolling as in palette, under a layer of
+/// sparkles, see palette_sparkle()
+///
+struct PaletteSparkleMode : ModeBase<PaletteSparkleMode> {
+  typedef PaletteSparkleData Params;
+
+  static constexpr Mode_Type id() { return Mode_Type::palette_sparkle; }
+  static constexpr const char *name() { return "palette_sparkle"; }
+  static constexpr ModeTiming timing() { return ModeTiming{60, false}; }
+
+  static Params &params(SettingsData &dev) { return dev.paletteSparkleData; }
+
+  static constexpr byte batchId() { return 18; }
+  static constexpr CharacteristicField characteristic() {
+    return &DeviceInfo::blecPaletteSparkle;
+  }
+  static const char *uuid(const BluetoothSett &sett) {
+    return sett.BLEc_PaletteSparkle_UUID;
+  }
+
+  static constexpr ModeFields fields() {
+    return ModeFields{{
+        modeField("velocity", Field_Type::u8,
+                  offsetof(PaletteSparkleData, velocity)),
+        modeField("rate", Field_Type::u8, offsetof(PaletteSparkleData, rate)),
+        modeField("blend", Field_Type::u8,
+                  offsetof(PaletteSparkleData, blend), 0,
+                  byte(Blend_Mode::max) + 1),
+    }};
+  }
+
+  static constexpr const char *jsonKey() { return "PaletteSparkleData"; }
+  static const Params *defaults() { return &defaultPaletteSparkleData; }
+
+  static bool prepare(uint16_t longest) {
+    return PaletteMode::prepare(longest);
+  }
+
+  ///@brief Without sparkles, the period of the scroll
+  static unsigned long framePeriodMs(const SegmentData &segment,
+                                     unsigned long minMs,
+                                     unsigned long maxMs) {
+    const Params &params = zoneParams<PaletteSparkleMode>(segment);
+    return params.rate == 0
+               ? PaletteMode::scrollPeriodMs(params.velocity, minMs, maxMs)
+               : minMs;
+  }
+
+  ///@brief The palette table is already in the strip's wire format, any
+  /// Format
+  template <typename Format>
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   uint16_t length, ModeState &state, unsigned long now) {
+    const Params &params = zoneParams<PaletteSparkleMode>(segment);
+    state.phase  = RainbowEngine::advance(state.phase, now - state.lastMs,
+                                          params.velocity);
+    state.lastMs = now;
+    palette_sparkle(strip, segment.start, length, state.phase, params.rate,
+                    Blend_Mode(params.blend), now);
+  }
+};
+
+#pragma endregion Modes
+
+///
+///@brief A mode as the rest of the firmware sees it, parameters behind
+/// void pointers to a Params of the mode.
+///
+struct ModeEntry {
+  Mode_Type id;
+  const char *name;
+  ModeTiming timing;
+
+  byte batchId;
+  CharacteristicField characteristic;
+  const char *(*uuid)(const BluetoothSett &sett);
+  size_t payloadMin;
+  bool (*decode)(const byte *buffer, size_t length, void *params);
+  size_t (*encode)(const DeviceInfo &dev, byte *buffer);
+  ///@brief Set the whole strip parameters and log them
+  void (*apply)(DeviceInfo &dev, const void *params);
+
+  ///@brief Copy the whole strip parameters into the zone
+  void (*segment)(const DeviceInfo &dev, SegmentData &segment);
+  ///@brief The zone's parameters from, and to, the payload of the mode's
+  /// characteristic, at most segmentParamsSize bytes
+  bool (*decodeZone)(const byte *buffer, size_t length, SegmentData &segment);
+  size_t (*encodeZone)(const SegmentData &segment, byte *buffer);
+  // nullptr when the mode has nothing to prepare
+  bool (*prepare)(uint16_t longest);
+  void (*draw)(Adafruit_NeoPixel &strip, const SegmentData &segment,
+               uint16_t length, ModeState &state, unsigned long now);
+  unsigned long (*framePeriodMs)(const SegmentData &segment,
+                                 unsigned long minMs, unsigned long maxMs);
+};
+
+///@brief The members of ModeEntry that convert the parameters
+template <typename Mode> struct ModeAdapter {
+  typedef typename Mode::Params Params;
+
+  static_assert(std::is_trivially_copyable<Params>::value,
+                "Params are copied through the command queue");
+  static_assert(sizeof(Params) <= segmentParamsSize &&
+                    alignof(Params) <= alignof(SegmentData),
+                "Params are kept in SegmentData::params");
+  static_assert(Mode::payloadMin() <= segmentParamsSize,
+                "The payload of a zone is at most segmentParamsSize bytes");
+
+  static bool decode(const byte *buffer, size_t length, void *params) {
+    return Mode::decode(buffer, length, *static_cast<Params *>(params));
+  }
+  static size_t encode(const DeviceInfo &dev, byte *buffer) {
+    return Mode::encode(Mode::params(const_cast<DeviceInfo &>(dev)), buffer);
+  }
+  static void apply(DeviceInfo &dev, const void *params) {
+    Params &current = Mode::params(dev);
+    current         = *static_cast<const Params *>(params);
+    current.print();
+  }
+
+  static void segment(const DeviceInfo &dev, SegmentData &segment) {
+    zoneParams<Mode>(segment) = Mode::params(const_cast<DeviceInfo &>(dev));
+  }
+  static bool decodeZone(const byte *buffer, size_t length,
+                         SegmentData &segment) {
+    if (Mode::payloadMin() == 0) {
+      return true; // no parameters
+    }
+    return length >= Mode::payloadMin() &&
+           Mode::decode(buffer, length, zoneParams<Mode>(segment));
+  }
+  static size_t encodeZone(const SegmentData &segment, byte *buffer) {
+    return Mode::encode(zoneParams<Mode>(segment), buffer);
+  }
+};
+
+template <typename Mode> constexpr ModeEntry modeEntry() {
+  return ModeEntry{Mode::id(),
+                   Mode::name(),
+                   Mode::timing(),
+                   Mode::batchId(),
+                   Mode::characteristic(),
+                   Mode::uuid,
+                   Mode::payloadMin(),
+                   ModeAdapter<Mode>::decode,
+                   ModeAdapter<Mode>::encode,
+                   ModeAdapter<Mode>::apply,
+                   ModeAdapter<Mode>::segment,
+                   ModeAdapter<Mode>::decodeZone,
+                   ModeAdapter<Mode>::encodeZone,
+                   Mode::prepare == ModeBase<Mode>::prepare ? nullptr
+                                                            : Mode::prepare,
+                   Mode::template draw<StripFormat>,
+                   Mode::framePeriodMs};
+}
+
+constexpr size_t largest() { return 0; }
+
+template <typename... Sizes>
+constexpr size_t largest(size_t first, Sizes... rest) {
+  return first > largest(rest...) ? first : largest(rest...);
+}
+
+///
+///@brief The modes, in Mode_Type order from 1
+///
+template <typename... List> struct ModeList {
+  static constexpr uint8_t count = sizeof...(List);
+  static constexpr ModeEntry table[sizeof...(List)] = {modeEntry<List>()...};
+
+  // Room for the Params of any mode
+  static constexpr size_t paramsSize =
+      largest(sizeof(typename List::Params)...);
+
+  ///@brief visitor.visit<Mode>() for every mode, for what a function
+  /// pointer cannot carry (the JSON types)
+  template <typename Visitor> static void forEach(Visitor &visitor) {
+    int expand[] = {0, (visitor.template visit<List>(), 0)...};
+    (void)expand;
+  }
+
+  ///@brief The modes with a characteristic of their own
+  static constexpr uint8_t characteristics(uint8_t index = 0) {
+    return index == count ? 0
+                          : (table[index].characteristic != nullptr ? 1 : 0) +
+                                characteristics(index + 1);
+  }
+
+  ///@brief Ids are 1..count, in order
+  static constexpr bool dense(uint8_t index = 0) {
+    return index == count ||
+           (uint8_t(table[index].id) == index + 1 && dense(index + 1));
+  }
+};
+
+template <typename... List>
+constexpr ModeEntry ModeList<List...>::table[sizeof...(List)];
+
+typedef ModeList<FixedColorMode, RainbowMode, ColorSplitMode, StreamMode,
+                 PaletteMode, FireMode, MeteorMode, TwinkleMode, CometMode,
+                 ProgramMode, SpectrumMode, PulseMode, SparkleMode,
+                 PaletteSparkleMode>
+    Modes;
+
+static_assert(Modes::dense(), "Modes must list every Mode_Type in order");
+
+///@return nullptr if mode is not a known mode
+inline const ModeEntry *findMode(Mode_Type mode) {
+  uint8_t index = uint8_t(mode) - 1;
+  return index < Modes::count ? &Modes::table[index] : nullptr;
+}
+
+///
+///@brief Converts a stored or received byte to a Mode_Type
+///
+///@return false if value is not a known mode, mode is left untouched
+///
+bool decodeMode(byte value, Mode_Type &mode) {
+  if (findMode(Mode_Type(value)) == nullptr) {
+    return false;
+  }
+  mode = Mode_Type(value);
+  return true;
+}
+
+ModeTiming modeTiming(Mode_Type mode) {
+  const ModeEntry *entry = findMode(mode);
+  return entry != nullptr ? entry->timing : ModeTiming{0, true};
+}
+
+///
+///@brief Parameters of a mode, as queued by the BLE callbacks
+///
+struct ModeCommand {
+  Mode_Type mode;
+  alignas(4) byte params[Modes::paramsSize];
+};
+
+#endif // MODES_HPP
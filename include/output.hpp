@@ -0,0 +1,175 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include "Arduino.h"
+#include "loop_modes.hpp"
+#include "output_driver.hpp"
+#include "settings.h"
+#include <math.h>
+
+#ifndef OUTPUT_GAMMA
+// Exponent of the gamma curve applied to every color, 1.0 for none
+#define OUTPUT_GAMMA 2.6
+#endif
+
+#ifndef OUTPUT_CORRECTION
+// White balance: full scale of red, green and blue, 255 for none. Strips
+// with a blueish white want less blue and green, e.g. 255,176,240
+#define OUTPUT_CORRECTION 255, 255, 255
+#endif
+
+#ifndef OUTPUT_DITHER
+// 0 rounds every color to the nearest level instead of dithering it
+#define OUTPUT_DITHER 1
+#endif
+
+///
+///@brief The last stage before the LEDs.
+/// The modes, zones and transitions render full scale colors into dev.strip.
+/// show() maps every byte of it through a per-channel LUT, built once per
+/// brightness, that applies the brightness, the gamma curve and the white
+/// balance in one lookup, into a frame the OutputDriver sends. The brightness
+/// is applied before the gamma curve, so it dims evenly to the eye.
+///
+/// There are two such frames. The driver sends the front one while the loop
+/// renders the next frame and the LUT fills the back one; show() then waits
+/// for the transfer (the fence), sends the back frame and swaps them. A frame
+/// takes the longer of render and wire time instead of their sum.
+///
+/// The LUT keeps 8 bits below the LED's levels (8.8 fixed point). Dithering
+/// turns them into the share of frames and neighbours a pixel is one level
+/// up: 3.25 shows as 4 on every fourth frame and pixel and as 3 on the
+/// others. The threshold is the bit reversed frame count plus a golden ratio
+/// step per pixel, so it needs no per-pixel error memory. Fades at low
+/// brightness move in 1/256 of a level instead of whole levels.
+/// Static frames are shown once, so they keep the spatial half of the pattern.
+///
+class OutputStage {
+public:
+  // Threshold step from one pixel to the next, 256 / golden ratio
+  static const uint8_t pixelStep = 158;
+
+  void setBrightness(uint8_t value) {
+    if (value != brightness) {
+      brightness = value;
+      dirty      = true;
+    }
+  }
+  uint8_t getBrightness() const { return brightness; }
+
+  void setCorrection(const Color_RGB &value) {
+    correction = value;
+    dirty      = true;
+  }
+
+  void setDithering(bool enabled) { dithering = enabled; }
+
+  ///@brief Light level of `value` on wire byte `channel` (StripFormat
+  /// offsets), in 8.8 fixed point
+  uint16_t level(uint8_t channel, uint8_t value) {
+    build();
+    return lut[channel][value];
+  }
+
+  ///@brief Map the pixels of `frame` into `out` through the LUT, `out`
+  /// takes the length of `frame`
+  void apply(const Adafruit_NeoPixel &frame, StripPixels &out) {
+    build();
+    out.setLength(frame.numPixels());
+
+    const uint8_t *in  = frame.getPixels();
+    uint8_t *pixels    = out.getPixels();
+    uint8_t threshold  = dithering ? reverse8(frames) : 128;
+    uint8_t step       = dithering ? pixelStep : 0;
+    const uint16_t *l0 = lut[0], *l1 = lut[1], *l2 = lut[2];
+    for (uint16_t i = 0; i < frame.numPixels(); i++) {
+      pixels[0] = (l0[in[0]] + threshold) >> 8;
+      pixels[1] = (l1[in[1]] + threshold) >> 8;
+      pixels[2] = (l2[in[2]] + threshold) >> 8;
+      in += StripFormat::bytesPerPixel;
+      pixels += StripFormat::bytesPerPixel;
+      threshold += step;
+    }
+    frames++;
+  }
+
+  ///@brief Send the frames to `pin` through `driver`
+  void begin(int16_t pin, OutputDriver &driver) {
+    for (StripPixels &buffer : buffers) {
+      buffer.setPin(pin);
+    }
+    this->driver = &driver;
+  }
+
+  OutputDriver &getDriver() const { return *driver; }
+
+  ///@brief Apply dev.strip at the brightness of the settings and send it.
+  /// Returns once the transfer has started, dev.strip can be drawn into.
+  void show(DeviceInfo &dev) {
+    setBrightness(dev.defaultData.brightness);
+    apply(dev.strip, buffers[!front]);
+    swap();
+  }
+
+  ///@brief Turn off the LEDs last sent, before the strip gets shorter: the
+  /// ones past the new length are not sent again
+  void blank() {
+    StripPixels &back = buffers[!front];
+    back.setLength(buffers[front].numPixels());
+    back.clear();
+    swap();
+  }
+
+  ///@brief Block until the last frame is on the LEDs
+  void wait() { driver->wait(); }
+
+  ///@brief The frame last sent, or being sent
+  const StripPixels &sent() const { return buffers[front]; }
+
+private:
+  static uint8_t reverse8(uint8_t value) {
+    value = (value & 0xF0) >> 4 | (value & 0x0F) << 4;
+    value = (value & 0xCC) >> 2 | (value & 0x33) << 2;
+    return (value & 0xAA) >> 1 | (value & 0x55) << 1;
+  }
+
+  ///@brief The fence: the front frame is not read any more once wait()
+  /// returns, the back one becomes the front one
+  void swap() {
+    driver->wait();
+    front = !front;
+    driver->transmit(buffers[front]);
+  }
+
+  ///@brief Rebuild the LUT after a brightness or correction change. Full
+  /// scale is 255.0 (65280), so the dither threshold never carries past 255.
+  void build() {
+    if (!dirty) {
+      return;
+    }
+    const uint8_t scale[3]  = {correction.r, correction.g, correction.b};
+    const uint8_t offset[3] = {StripFormat::red, StripFormat::green,
+                               StripFormat::blue};
+    for (uint16_t v = 0; v < 256; v++) {
+      float light = powf(v * brightness / 65025.0f, OUTPUT_GAMMA) * 256;
+      for (uint8_t c = 0; c < 3; c++) {
+        lut[offset[c]][v] = uint16_t(light * scale[c] + 0.5f);
+      }
+    }
+    dirty = false;
+  }
+
+  uint16_t lut[3][256];
+  // The front one is sent, the back one is applied into
+  StripPixels buffers[2] = {{30, -1, stripPixelType},
+                            {30, -1, stripPixelType}};
+  OutputDriver *driver   = &blockingOutputDriver;
+  uint8_t front          = 0;
+  uint8_t brightness     = 255;
+  Color_RGB correction   = Color_RGB{OUTPUT_CORRECTION};
+  bool dithering         = OUTPUT_DITHER;
+  bool dirty             = true;
+  uint8_t frames         = 0;
+} outputStage;
+
+#endif // OUTPUT_HPP
@@ -0,0 +1,159 @@
+#ifndef OUTPUT_DRIVER_HPP
+#define OUTPUT_DRIVER_HPP
+
+#include "Arduino.h"
+#include "settings.h"
+
+#ifdef ESP32
+#include "driver/rmt.h"
+#include "esp_timer.h"
+#else
+#include <chrono>
+#include <thread>
+#endif
+
+#ifndef OUTPUT_RMT_CHANNEL
+// RMT channel of the strip. The Arduino core hands out channels from 0 up for
+// the other LEDs, this one takes the memory of the channel after it as well
+#define OUTPUT_RMT_CHANNEL 6
+#endif
+
+// 800 kHz: 1.25 µs per bit, and a low of at least 280 µs latches the frame
+const uint16_t wireNsPerBit = 1250;
+const uint16_t latchMicros  = 300;
+
+///
+///@brief Sends frames to the LEDs.
+/// transmit() starts sending a frame and may return before it is on the
+/// LEDs, wait() is the fence: it returns once the last transfer and its latch
+/// are over. The frame must not change and transmit() must not be called
+/// again before wait() has returned, see OutputStage::show().
+///
+class OutputDriver {
+public:
+  virtual ~OutputDriver() {}
+
+  virtual void transmit(StripPixels &frame) = 0;
+  virtual void wait() = 0;
+  virtual const char *name() const = 0;
+
+  ///@brief Time `pixels` take on the wire, latch included
+  static uint32_t wireMicros(uint16_t pixels) {
+    return uint32_t(pixels) * stripBytesPerPixel * 8 * wireNsPerBit / 1000 +
+           latchMicros;
+  }
+};
+
+///@brief Adafruit_NeoPixel::show(): the transfer is over when transmit()
+/// returns, rendering waits for it
+class BlockingOutputDriver : public OutputDriver {
+public:
+  void transmit(StripPixels &frame) override { frame.show(); }
+  void wait() override {}
+  const char *name() const override { return "blocking"; }
+} blockingOutputDriver;
+
+#ifdef ESP32
+
+///
+///@brief The RMT peripheral sends the frame while the CPU renders the next.
+/// Its ISR turns the bytes into pulses a half buffer at a time, reading the
+/// frame until the end of the transfer.
+///
+class RmtOutputDriver : public OutputDriver {
+public:
+  ///@return false if the channel could not be set up
+  bool begin(int16_t pin) {
+    rmt_config_t config  = RMT_DEFAULT_CONFIG_TX(gpio_num_t(pin), channel);
+    config.clk_div       = 2; // 25 ns ticks
+    config.mem_block_num = 2;
+    if (rmt_config(&config) != ESP_OK ||
+        rmt_driver_install(channel, 0, 0) != ESP_OK) {
+      return false;
+    }
+    return rmt_translator_init(channel, translate) == ESP_OK;
+  }
+
+  void transmit(StripPixels &frame) override {
+    doneBy = esp_timer_get_time() + wireMicros(frame.numPixels());
+    rmt_write_sample(channel, frame.getPixels(),
+                     frame.numPixels() * stripBytesPerPixel, false);
+  }
+
+  void wait() override {
+    // A transfer that ends late latches from its real end
+    if (rmt_wait_tx_done(channel, 0) == ESP_ERR_TIMEOUT) {
+      rmt_wait_tx_done(channel, portMAX_DELAY);
+      doneBy = max(doneBy, esp_timer_get_time() + latchMicros);
+    }
+    int64_t left = doneBy - esp_timer_get_time();
+    if (left > 0) {
+      delayMicroseconds(left);
+    }
+  }
+
+  const char *name() const override { return "rmt"; }
+
+private:
+  static const rmt_channel_t channel = rmt_channel_t(OUTPUT_RMT_CHANNEL);
+
+  ///@brief RMT item of a bit: `high` then `low` ticks
+  static constexpr uint32_t item(uint32_t high, uint32_t low) {
+    return high | 1u << 15 | low << 16;
+  }
+
+  ///@brief Bytes to items, called by the RMT ISR until `src_size` bytes or
+  /// `wanted_num` items are done
+  static void IRAM_ATTR translate(const void *src, rmt_item32_t *dest,
+                                  size_t src_size, size_t wanted_num,
+                                  size_t *translated_size, size_t *item_num) {
+    const uint32_t bit0  = item(16, 34); // 0.4 µs high, 0.85 µs low
+    const uint32_t bit1  = item(32, 18); // 0.8 µs high, 0.45 µs low
+    const uint8_t *bytes = static_cast<const uint8_t *>(src);
+    size_t size          = 0;
+    size_t num           = 0;
+    while (size < src_size && num + 8 <= wanted_num) {
+      for (uint8_t mask = 0x80; mask != 0; mask >>= 1) {
+        dest->val = bytes[size] & mask ? bit1 : bit0;
+        dest++;
+      }
+      size++;
+      num += 8;
+    }
+    *translated_size = size;
+    *item_num        = num;
+  }
+
+  int64_t doneBy = 0;
+} rmtOutputDriver;
+
+#else
+
+///
+///@brief Stands in for the RMT on the host: nothing is sent, but a transfer
+/// takes the wire time of the frame, and wait() sleeps until it is over.
+///
+class SimulatedOutputDriver : public OutputDriver {
+public:
+  void transmit(StripPixels &frame) override {
+    doneBy = clock::now() + std::chrono::microseconds(
+                                wireMicros(frame.numPixels()));
+    transfers++;
+  }
+
+  void wait() override { std::this_thread::sleep_until(doneBy); }
+
+  const char *name() const override { return "simulated"; }
+
+  uint32_t transferCount() const { return transfers; }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  clock::time_point doneBy;
+  uint32_t transfers = 0;
+} simulatedOutputDriver;
+
+#endif
+
+#endif // OUTPUT_DRIVER_HPP
@@ -0,0 +1,224 @@
+#ifndef PALETTE_HPP
+#define PALETTE_HPP
+
+#include "Arduino.h"
+#include "compositor.hpp"
+#include "loop_modes.hpp"
+#include "settings.h"
+
+///
+///@brief PaletteData expanded to its 256 entries in the strip's wire format.
+/// Effects drawing with a palette write one byte per pixel, an index, and
+/// expand() turns a run of indices into strip pixels with a 3 byte copy each.
+/// Frame buffers and layers of indices take a third of the RAM of RGB ones
+/// and a quarter of the packed pixels of Compositor.
+///
+class PaletteEngine {
+public:
+  static const uint16_t entries = 256;
+
+  ///@brief Expand palette if it is not the one the table was built from
+  ///@return false if the palette has no colors
+  bool prepare(const PaletteData &palette) {
+    if (!built || memcmp(&palette, &source, sizeof(source)) != 0) {
+      build(palette);
+    }
+    return source.count > 0;
+  }
+
+  ///@brief The wire bytes of entry index
+  const uint8_t *entry(uint8_t index) const {
+    return table + index * stripBytesPerPixel;
+  }
+
+  ///@brief Strip pixels from `first` for `count` indices. Call prepare()
+  /// first.
+  void expand(const uint8_t *indices, Adafruit_NeoPixel &strip,
+              uint16_t first, uint16_t count) const {
+    uint8_t *pixels = strip.getPixels() + first * stripBytesPerPixel;
+    for (uint16_t i = 0; i < count; i++) {
+      memcpy(pixels, table + indices[i] * stripBytesPerPixel,
+             stripBytesPerPixel);
+      pixels += stripBytesPerPixel;
+    }
+  }
+
+private:
+  static uint8_t mix(uint8_t from, uint8_t to, uint16_t alpha) {
+    return (from * (256 - alpha) + to * alpha) >> 8;
+  }
+
+  void build(const PaletteData &palette) {
+    source = palette;
+    built  = true;
+
+    uint8_t count = min<uint8_t>(palette.count, paletteColorsMax);
+    if (count == 0) {
+      memset(table, 0, sizeof(table));
+      return;
+    }
+    for (uint16_t i = 0; i < entries; i++) {
+      // Position among the colors, 8.8 fixed point
+      uint16_t position = i * count;
+      uint8_t from      = position >> 8;
+      Color_RGB color   = palette.colors[from];
+      if (palette.blend) {
+        const Color_RGB &to = palette.colors[(from + 1) % count];
+        uint16_t alpha      = position & 0xFF;
+        color = Color_RGB{mix(color.r, to.r, alpha), mix(color.g, to.g, alpha),
+                          mix(color.b, to.b, alpha)};
+      }
+      StripFormat::pack(color, table + i * stripBytesPerPixel);
+    }
+  }
+
+  uint8_t table[entries * stripBytesPerPixel];
+  PaletteData source;
+  bool built = false;
+} paletteEngine;
+
+///
+///@brief Stack of Layers index buffers of Capacity pixels, the Compositor of
+/// palette effects: one byte per pixel and layer, see palette_sparkle().
+/// compose() merges them bottom to top, layer 0 as is and every other
+/// visible layer by its blend:
+///   normal   -> the layer's index where it is not 0 (0 is transparent)
+///   add      -> the sum, at most 255
+///   multiply -> the product, 255 is 1
+///   max      -> the larger index
+/// add, multiply and max suit palettes ordered by intensity, black to white.
+///
+template <uint8_t Layers, uint16_t Capacity> class IndexCompositor {
+  static_assert(Layers > 0, "IndexCompositor needs a layer");
+
+public:
+  struct Layer {
+    uint8_t indices[Capacity];
+    Blend_Mode blend = Blend_Mode::normal;
+    bool visible     = true;
+
+    void fill(uint8_t index, uint16_t first, uint16_t count) {
+      memset(indices + first, index, count);
+    }
+  };
+
+  Layer &layer(uint8_t index) { return layers[index]; }
+
+  static constexpr uint8_t layerCount() { return Layers; }
+  static constexpr uint16_t capacity() { return Capacity; }
+
+  ///@brief Merge the first `count` indices of every layer into out
+  void compose(uint8_t *out, uint16_t count) const {
+    if (count > Capacity) {
+      count = Capacity;
+    }
+    memcpy(out, layers[0].indices, count);
+    for (uint8_t i = 1; i < Layers; i++) {
+      if (layers[i].visible) {
+        merge(out, layers[i].indices, count, layers[i].blend);
+      }
+    }
+  }
+
+private:
+  static void merge(uint8_t *dst, const uint8_t *src, uint16_t count,
+                    Blend_Mode blend) {
+    switch (blend) {
+    case Blend_Mode::normal:
+      for (uint16_t i = 0; i < count; i++) {
+        dst[i] = src[i] != 0 ? src[i] : dst[i];
+      }
+      break;
+    case Blend_Mode::add:
+      for (uint16_t i = 0; i < count; i++) {
+        uint16_t sum = dst[i] + src[i];
+        dst[i]       = sum > 255 ? 255 : sum;
+      }
+      break;
+    case Blend_Mode::multiply:
+      for (uint16_t i = 0; i < count; i++) {
+        dst[i] = (dst[i] * (src[i] + 1)) >> 8;
+      }
+      break;
+    case Blend_Mode::max:
+      for (uint16_t i = 0; i < count; i++) {
+        dst[i] = max(dst[i], src[i]);
+      }
+      break;
+    }
+  }
+
+  Layer layers[Layers];
+};
+
+// Loop Functions
+// Palette effects write indices, see PaletteEngine
+#pragma region PaletteFunctions
+
+///
+///@brief Indices of pixels [offset, offset + count) of a zone of `length`
+/// pixels the palette spans once, rotated by `phase` (a 32 bit turn)
+///
+void palette_scroll(uint8_t *indices, uint16_t offset, uint16_t count,
+                    uint16_t length, uint32_t phase) {
+  uint32_t step     = uint32_t((uint64_t(1) << 32) / length);
+  uint32_t position = phase + offset * step;
+  for (uint16_t i = 0; i < count; i++) {
+    indices[i] = position >> 24;
+    position += step;
+  }
+}
+
+///
+///@brief The palette across the zone, rotated by `phase`. The indices are
+/// drawn and expanded a chunk at a time on the stack, the zone needs no
+/// index buffer.
+///
+void palette(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+             uint32_t phase) {
+  const uint16_t chunk = 64;
+  uint8_t indices[chunk];
+  for (uint16_t done = 0; done < count; done += chunk) {
+    uint16_t run = min<uint16_t>(chunk, count - done);
+    palette_scroll(indices, done, run, count, phase);
+    paletteEngine.expand(indices, strip, first + done, run);
+  }
+}
+
+typedef IndexCompositor<2, layerChunk> PaletteSparkleLayers;
+
+// Zones are drawn one after the other, they share the layers
+PaletteSparkleLayers paletteSparkleLayers;
+
+///
+///@brief The palette across the zone as palette() draws it, under a layer
+/// of sparkles merged by `blend`. A sparkle is an index rising from 0 to 255
+/// and back, see sparkleLevel(): with max it brightens the palette towards
+/// its last color when the palette runs from dark to bright. The layers are
+/// composed a chunk at a time, 128 bytes whatever the zone's length.
+///
+void palette_sparkle(Adafruit_NeoPixel &strip, uint16_t first,
+                     uint16_t count, uint32_t phase, uint8_t rate,
+                     Blend_Mode blend, unsigned long now) {
+  PaletteSparkleLayers::Layer &scroll   = paletteSparkleLayers.layer(0);
+  PaletteSparkleLayers::Layer &sparkles = paletteSparkleLayers.layer(1);
+  sparkles.blend                        = blend;
+  sparkles.visible                      = rate > 0;
+
+  uint8_t indices[layerChunk];
+  for (uint16_t done = 0; done < count; done += layerChunk) {
+    uint16_t run = min<uint16_t>(layerChunk, count - done);
+    palette_scroll(scroll.indices, done, run, count, phase);
+    if (sparkles.visible) {
+      for (uint16_t i = 0; i < run; i++) {
+        sparkles.indices[i] = sparkleLevel(done + i, now, rate);
+      }
+    }
+    paletteSparkleLayers.compose(indices, run);
+    paletteEngine.expand(indices, strip, first + done, run);
+  }
+}
+
+#pragma endregion PaletteFunctions
+
+#endif // PALETTE_HPP
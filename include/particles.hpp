@@ -0,0 +1,524 @@
+#ifndef PARTICLES_HPP
+#define PARTICLES_HPP
+
+#include "Arduino.h"
+#include "loop_modes.hpp"
+#include "settings.h"
+
+#ifndef PARTICLES_MAX
+// Particles alive at once over every particle zone, allocated at compile
+// time. Override with -D PARTICLES_MAX=n
+#define PARTICLES_MAX 256
+#endif
+
+///
+///@brief Up to Capacity particles as a structure of arrays, the live ones
+/// packed in [0, count()). Positions are pixels from the start of the zone
+/// and velocities pixels per 1024 ms, both 16.16 fixed point.
+/// spawn() takes the slot after the last live particle and kill() moves the
+/// last one into the freed slot: nothing is allocated, and a frame walks the
+/// live particles only, however long the strip is.
+///
+template <uint16_t Capacity> class ParticlePool {
+public:
+  int32_t x[Capacity];
+  int32_t v[Capacity];
+  uint8_t life[Capacity];  // 0 is spent, the effect gives it a meaning
+  uint8_t decay[Capacity]; // life lost per 16 ms
+  uint8_t shade[Capacity]; // color mix or seed, per effect
+  uint8_t owner[Capacity]; // system of ParticleEngine
+
+  static constexpr uint16_t capacity() { return Capacity; }
+  uint16_t count() const { return live; }
+
+  ///@return the index of the new particle, -1 if the pool is full
+  int spawn(uint8_t system) {
+    if (live == Capacity) {
+      return -1;
+    }
+    owner[live] = system;
+    return live++;
+  }
+
+  ///@brief The last particle takes the place of i: when walking the pool,
+  /// look at i again after killing it
+  void kill(uint16_t i) {
+    live--;
+    if (i != live) {
+      x[i]     = x[live];
+      v[i]     = v[live];
+      life[i]  = life[live];
+      decay[i] = decay[live];
+      shade[i] = shade[live];
+      owner[i] = owner[live];
+    }
+  }
+
+  uint16_t countOf(uint8_t system) const {
+    uint16_t n = 0;
+    for (uint16_t i = 0; i < live; i++) {
+      n += owner[i] == system;
+    }
+    return n;
+  }
+
+  void killAll(uint8_t system) {
+    for (uint16_t i = 0; i < live;) {
+      if (owner[i] == system) {
+        kill(i);
+      } else {
+        i++;
+      }
+    }
+  }
+
+  void clear() { live = 0; }
+
+private:
+  uint16_t live = 0;
+};
+
+///
+///@brief The particle pool shared by the particle zones, and a system per
+/// zone: the particles it owns, its clock and its spawn rate remainder.
+/// A system is found by mode and zone start, not kept in ModeState, so the
+/// copy of the state TransitionEngine draws the outgoing mode with moves the
+/// same particles instead of stepping them twice.
+/// The random numbers are a fixed xorshift sequence: the render tool draws
+/// the same frames on every run.
+///
+class ParticleEngine {
+public:
+  // Every zone, and the whole strip mode fading out in a transition
+  static const uint8_t systemsMax = SEGMENTS_MAX + 1;
+  // Longest physics step, a zone drawn again after a pause does not jump
+  static const uint16_t maxStepMs = 100;
+  // A system not drawn for that long is taken back with its particles
+  static const uint16_t idleMs = 2000;
+
+  ParticlePool<PARTICLES_MAX> pool;
+
+  ///@brief The system of the `mode` zone at `start`, a new one if it has
+  /// none. dt is set to the time since its last step, at most maxStepMs.
+  uint8_t step(Mode_Type mode, uint16_t start, unsigned long now,
+               uint16_t &dt) {
+    uint8_t found = systemsMax;
+    uint8_t free  = systemsMax;
+    uint8_t least = systemsMax;
+    for (uint8_t i = 0; i < systemsMax; i++) {
+      System &system = systems[i];
+      if (system.used && system.mode == mode && system.start == start) {
+        found = i;
+        continue;
+      }
+      if (system.used && now - system.lastMs > idleMs) {
+        pool.killAll(i);
+        system.used = false;
+      }
+      if (!system.used) {
+        free = free == systemsMax ? i : free;
+      } else if (least == systemsMax ||
+                 now - system.lastMs > now - systems[least].lastMs) {
+        least = i;
+      }
+    }
+
+    if (found == systemsMax) {
+      found = free != systemsMax ? free : least;
+      pool.killAll(found);
+      systems[found] = System{mode, start, now, 0, true};
+    }
+
+    System &system        = systems[found];
+    unsigned long elapsed = now - system.lastMs;
+    dt                    = elapsed > maxStepMs ? maxStepMs : elapsed;
+    system.lastMs         = now;
+    return found;
+  }
+
+  ///@brief Particles to spawn after dt ms at `millionths` of a particle a
+  /// second, the fraction is carried to the next step
+  uint16_t due(uint8_t system, uint32_t millionths, uint16_t dt) {
+    uint64_t total = systems[system].debt + uint64_t(millionths) * dt;
+    systems[system].debt = total % particleBillionths;
+    return total / particleBillionths;
+  }
+
+  ///@brief Age particle i by dt ms, the fraction of a life unit rounded at
+  /// random so slow decays still happen at a high frame rate
+  ///@return false if it is spent
+  bool age(uint16_t i, uint16_t dt) {
+    uint16_t loss = (uint16_t(pool.decay[i]) * dt + (random() >> 28)) >> 4;
+    if (loss >= pool.life[i]) {
+      return false;
+    }
+    pool.life[i] -= loss;
+    return true;
+  }
+
+  ///@brief Move particle i by dt ms at its velocity
+  void move(uint16_t i, uint16_t dt) {
+    pool.x[i] += int32_t((int64_t(pool.v[i]) * dt) >> 10);
+  }
+
+  uint32_t random() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+
+  uint8_t random8() { return random() >> 24; }
+
+  ///@return in [0, below)
+  uint16_t random(uint16_t below) {
+    return (uint32_t(random() >> 16) * below) >> 16;
+  }
+
+  ///@brief Forget every system and particle, restart the random sequence
+  void reset() {
+    pool.clear();
+    for (System &system : systems) {
+      system.used = false;
+    }
+    seed = initialSeed;
+  }
+
+private:
+  static const uint32_t initialSeed = 0x2545F491;
+  // A rate in millionths a second times ms
+  static const uint32_t particleBillionths = 1000000000UL;
+
+  struct System {
+    Mode_Type mode;
+    uint16_t start;
+    unsigned long lastMs;
+    uint32_t debt; // billionths of a particle
+    bool used;
+  };
+
+  System systems[systemsMax] = {};
+  uint32_t seed              = initialSeed;
+} particleEngine;
+
+// Loop Functions
+// Particle effects clear their zone and add every particle of its system
+// into it: the pixels a particle covers get its color on top of what is
+// there, saturating, so crossing particles brighten each other.
+#pragma region ParticleFunctions
+
+///@brief Add color at level / 255 to pixel `index` of zone
+template <typename Format>
+inline void splat(uint8_t *zone, uint16_t index, const Color_RGB &color,
+                  uint8_t level) {
+  uint8_t *pixel = zone + index * Format::bytesPerPixel;
+  uint16_t scale = level + 1;
+  uint16_t red   = pixel[Format::red] + ((color.r * scale) >> 8);
+  uint16_t green = pixel[Format::green] + ((color.g * scale) >> 8);
+  uint16_t blue  = pixel[Format::blue] + ((color.b * scale) >> 8);
+
+  pixel[Format::red]   = red > 255 ? 255 : red;
+  pixel[Format::green] = green > 255 ? 255 : green;
+  pixel[Format::blue]  = blue > 255 ? 255 : blue;
+}
+
+///@brief A particle at x (16.16) shared between the two pixels it lies
+/// between, so slow particles glide instead of stepping
+template <typename Format>
+inline void splatAt(uint8_t *zone, uint16_t length, int32_t x,
+                    const Color_RGB &color, uint8_t level) {
+  int32_t index = x >> 16;
+  uint16_t frac = (x >> 8) & 0xFF;
+  if (index >= 0 && index < length) {
+    splat<Format>(zone, index, color, (level * (256 - frac)) >> 8);
+  }
+  if (index + 1 >= 0 && index + 1 < length && frac != 0) {
+    splat<Format>(zone, index + 1, color, (level * frac) >> 8);
+  }
+}
+
+inline uint8_t mix8(uint8_t from, uint8_t to, uint8_t alpha) {
+  return (from * (256 - alpha) + to * alpha) >> 8;
+}
+
+inline Color_RGB mixColor(const Color_RGB &from, const Color_RGB &to,
+                          uint8_t alpha) {
+  return Color_RGB{mix8(from.r, to.r, alpha), mix8(from.g, to.g, alpha),
+                   mix8(from.b, to.b, alpha)};
+}
+
+///@brief Black, red, yellow, white as heat goes up
+inline Color_RGB heatColor(uint8_t heat) {
+  uint8_t t    = (heat * 191) >> 8;
+  uint8_t ramp = (t & 0x3F) << 2;
+  if (t & 0x80) {
+    return Color_RGB{255, 255, ramp};
+  }
+  if (t & 0x40) {
+    return Color_RGB{255, ramp, 0};
+  }
+  return Color_RGB{ramp, 0, 0};
+}
+
+///@brief The zone's pixels, cleared
+///@return nullptr if no pixel of the zone is on strip
+inline uint8_t *clearZone(Adafruit_NeoPixel &strip, uint16_t first,
+                          uint16_t &count) {
+  if (first >= strip.numPixels() || count == 0) {
+    return nullptr;
+  }
+  count           = min<uint16_t>(count, strip.numPixels() - first);
+  uint8_t *pixels = strip.getPixels() + first * stripBytesPerPixel;
+  memset(pixels, 0, count * stripBytesPerPixel);
+  return pixels;
+}
+
+///
+///@brief Sparks rise from the start of the zone, slowing down and cooling
+/// from white through yellow to red. `sparking` sparks a second, `cooling`
+/// is how fast they cool: the higher, the shorter the flames.
+///
+template <typename Format = StripFormat>
+void fire(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+          uint8_t cooling, uint8_t sparking, unsigned long now) {
+  ParticlePool<PARTICLES_MAX> &pool = particleEngine.pool;
+  uint16_t dt;
+  uint8_t system  = particleEngine.step(Mode_Type::fire, first, now, dt);
+  uint8_t *pixels = clearZone(strip, first, count);
+  if (pixels == nullptr) {
+    return;
+  }
+
+  const int32_t end = int32_t(count) << 16;
+  for (uint16_t i = 0; i < pool.count();) {
+    if (pool.owner[i] != system) {
+      i++;
+      continue;
+    }
+    particleEngine.move(i, dt);
+    // Drag: the velocity halves in about 0.7 s
+    pool.v[i] -= int32_t((int64_t(pool.v[i]) * dt) >> 10);
+    if (pool.x[i] >= end || !particleEngine.age(i, dt)) {
+      pool.kill(i);
+      continue;
+    }
+    i++;
+  }
+
+  uint32_t rate = sparking * 1000000UL;
+  for (uint16_t n = particleEngine.due(system, rate, dt); n > 0; n--) {
+    int i = pool.spawn(system);
+    if (i < 0) {
+      break;
+    }
+    // Half to all of the zone a second
+    uint8_t spread = particleEngine.random8() >> 1;
+    pool.x[i]      = int32_t(particleEngine.random(3)) << 16;
+    pool.v[i]      = int32_t(uint32_t(count) * (128 + spread) << 8);
+    pool.life[i]   = 160 + (particleEngine.random8() * 95 >> 8);
+    pool.decay[i]  = 2 + (cooling >> 4) + (particleEngine.random8() >> 6);
+  }
+
+  for (uint16_t i = 0; i < pool.count(); i++) {
+    if (pool.owner[i] != system) {
+      continue;
+    }
+    Color_RGB color = heatColor(pool.life[i]);
+    splatAt<Format>(pixels, count, pool.x[i], color, 255);
+    // A short glow below the spark joins the sparks into flames
+    splatAt<Format>(pixels, count, pool.x[i] - (1 << 16), color, 128);
+    splatAt<Format>(pixels, count, pool.x[i] - (2 << 16), color, 64);
+  }
+}
+
+///
+///@brief Meteors cross the zone from its start at about 2 * velocity LEDs a
+/// second, each with a flickering trail of `tail` LEDs. A new one starts
+/// about when the last one has crossed the zone.
+///
+template <typename Format = StripFormat>
+void meteor(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+            const Color_RGB &color, uint8_t velocity, uint8_t tail,
+            unsigned long now) {
+  ParticlePool<PARTICLES_MAX> &pool = particleEngine.pool;
+  uint16_t dt;
+  uint8_t system  = particleEngine.step(Mode_Type::meteor, first, now, dt);
+  uint8_t *pixels = clearZone(strip, first, count);
+  if (pixels == nullptr) {
+    return;
+  }
+
+  const int32_t end = (int32_t(count) + tail) << 16;
+  for (uint16_t i = 0; i < pool.count();) {
+    if (pool.owner[i] != system) {
+      i++;
+      continue;
+    }
+    particleEngine.move(i, dt);
+    if (pool.x[i] >= end) {
+      pool.kill(i);
+      continue;
+    }
+    i++;
+  }
+
+  // One meteor per crossing of the zone and its trail. At velocity 1 on
+  // 2048 LEDs that is one in 1024 s, a rate in millionths keeps it.
+  uint32_t rate = uint32_t(velocity) * 2000000UL / (uint32_t(count) + tail);
+  for (uint16_t n = particleEngine.due(system, rate, dt); n > 0; n--) {
+    int i = pool.spawn(system);
+    if (i < 0) {
+      break;
+    }
+    // 2 * velocity LEDs a second, give or take a quarter
+    uint8_t spread = particleEngine.random8() >> 1;
+    pool.x[i]      = 0;
+    pool.v[i]      = int32_t(uint32_t(velocity) * (192 + spread) << 9);
+    pool.life[i]   = 255;
+    pool.decay[i]  = 0;
+  }
+
+  for (uint16_t i = 0; i < pool.count(); i++) {
+    if (pool.owner[i] != system) {
+      continue;
+    }
+    splatAt<Format>(pixels, count, pool.x[i], color, 255);
+    for (uint16_t k = 1; k <= tail; k++) {
+      uint8_t level   = 255 - (k * 255) / (tail + 1);
+      uint8_t flicker = 128 + (particleEngine.random8() >> 1);
+      splatAt<Format>(pixels, count, pool.x[i] - (int32_t(k) << 16), color,
+                      (level * flicker) >> 8);
+    }
+  }
+}
+
+///
+///@brief `rate` stars a second light up on random LEDs and fade out, in a
+/// color between color1 and color2
+///
+template <typename Format = StripFormat>
+void twinkle(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+             const Color_RGB &color1, const Color_RGB &color2, uint8_t rate,
+             unsigned long now) {
+  ParticlePool<PARTICLES_MAX> &pool = particleEngine.pool;
+  uint16_t dt;
+  uint8_t system  = particleEngine.step(Mode_Type::twinkle, first, now, dt);
+  uint8_t *pixels = clearZone(strip, first, count);
+  if (pixels == nullptr) {
+    return;
+  }
+
+  for (uint16_t i = 0; i < pool.count();) {
+    if (pool.owner[i] == system && !particleEngine.age(i, dt)) {
+      pool.kill(i);
+      continue;
+    }
+    i++;
+  }
+
+  uint32_t perSecond = rate * 1000000UL;
+  for (uint16_t n = particleEngine.due(system, perSecond, dt); n > 0; n--) {
+    int i = pool.spawn(system);
+    if (i < 0) {
+      break;
+    }
+    pool.x[i]     = int32_t(particleEngine.random(count)) << 16;
+    pool.v[i]     = 0;
+    pool.life[i]  = 255;
+    pool.decay[i] = 4 + (particleEngine.random8() >> 4); // 0.2 s to 1 s
+    pool.shade[i] = particleEngine.random8();
+  }
+
+  for (uint16_t i = 0; i < pool.count(); i++) {
+    if (pool.owner[i] != system) {
+      continue;
+    }
+    // Light up in the first half of its life, fade out in the second
+    uint8_t life  = pool.life[i];
+    uint8_t level = life & 0x80 ? (255 - life) << 1 : life << 1;
+    uint16_t led  = pool.x[i] >> 16;
+    if (led < count) {
+      splat<Format>(pixels, led, mixColor(color1, color2, pool.shade[i]),
+                    level);
+    }
+  }
+}
+
+// Comets of a comet zone, the count asked is clamped to it
+const uint8_t cometsMax = 8;
+
+///
+///@brief `comets` comets bounce between the ends of the zone at about
+/// 2 * velocity LEDs a second, their tail fading from color1 to color2
+///
+template <typename Format = StripFormat>
+void comet(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count,
+           const Color_RGB &color1, const Color_RGB &color2, uint8_t velocity,
+           uint8_t comets, unsigned long now) {
+  ParticlePool<PARTICLES_MAX> &pool = particleEngine.pool;
+  uint16_t dt;
+  uint8_t system  = particleEngine.step(Mode_Type::comet, first, now, dt);
+  uint8_t *pixels = clearZone(strip, first, count);
+  if (pixels == nullptr) {
+    return;
+  }
+  comets = min<uint8_t>(comets, cometsMax);
+
+  const int32_t last = (int32_t(count) - 1) << 16;
+  uint8_t alive      = 0;
+  for (uint16_t i = 0; i < pool.count();) {
+    if (pool.owner[i] != system) {
+      i++;
+      continue;
+    }
+    if (alive == comets) {
+      pool.kill(i);
+      continue;
+    }
+    alive++;
+    particleEngine.move(i, dt);
+    if (pool.x[i] < 0) {
+      pool.x[i] = -pool.x[i];
+      pool.v[i] = -pool.v[i];
+    } else if (pool.x[i] > last) {
+      pool.x[i] = 2 * last - pool.x[i];
+      pool.v[i] = -pool.v[i];
+    }
+    pool.x[i] = pool.x[i] < 0 ? 0 : pool.x[i] > last ? last : pool.x[i];
+    i++;
+  }
+
+  for (; alive < comets; alive++) {
+    int i = pool.spawn(system);
+    if (i < 0) {
+      break;
+    }
+    uint8_t spread = particleEngine.random8() >> 1;
+    pool.x[i]      = int32_t(particleEngine.random(count)) << 16;
+    pool.v[i]      = int32_t(uint32_t(velocity) * (192 + spread) << 9);
+    pool.life[i]   = 255;
+    pool.decay[i]  = 0;
+    if (particleEngine.random8() & 1) {
+      pool.v[i] = -pool.v[i];
+    }
+  }
+
+  // Faster comets leave longer tails
+  const uint8_t tail = 4 + (velocity >> 3);
+  for (uint16_t i = 0; i < pool.count(); i++) {
+    if (pool.owner[i] != system) {
+      continue;
+    }
+    int32_t behind = pool.v[i] < 0 ? 1 << 16 : -(1 << 16);
+    splatAt<Format>(pixels, count, pool.x[i], color1, 255);
+    for (uint8_t k = 1; k <= tail; k++) {
+      uint8_t along = (k * 255) / tail;
+      splatAt<Format>(pixels, count, pool.x[i] + k * behind,
+                      mixColor(color1, color2, along), 255 - along);
+    }
+  }
+}
+
+#pragma endregion ParticleFunctions
+
+#endif // PARTICLES_HPP
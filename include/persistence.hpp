@@ -0,0 +1,218 @@
+#ifndef PERSISTENCE_HPP
+#define PERSISTENCE_HPP
+
+#include "Arduino.h"
+#include "diagnostics.hpp"
+#include "log.hpp"
+#include "mailbox.hpp"
+#include "settings_store.hpp"
+#include "spsc_ring.hpp"
+#include "tasks.hpp"
+#include <atomic>
+
+#ifdef ESP32
+#include "freertos/queue.h"
+#endif
+
+///
+///@brief Write-behind persistence of the settings.
+/// The control task hands a snapshot of the settings to update() on every
+/// iteration.
+/// Nothing is written while it matches (by CRC) the last committed one; a
+/// change is committed once it has been stable for debounceMs, so a burst of
+/// BLE writes costs a single flash write. flush() skips the debounce (still
+/// only if something changed), e.g. on disconnect.
+///
+/// On the ESP32 the storage task takes the record out of a one slot mailbox
+/// with receive() and commits its copy without the FrameLock (tasks.hpp),
+/// so neither control nor render wait for the flash.
+///
+class SettingsPersistence {
+public:
+  static const unsigned long debounceMs = 2000;
+
+  ///@brief Call once the settings have been loaded, they count as committed.
+  void begin(const SettingsRecord &loaded) {
+    committedHash = hashOf(loaded);
+    pendingHash   = committedHash;
+#ifdef ESP32
+    mailbox = xQueueCreate(1, sizeof(SettingsRecord));
+#endif
+  }
+
+  void update(const SettingsRecord &record, unsigned long now) {
+    uint32_t hash = hashOf(record);
+    if (hash != pendingHash) {
+      pendingHash = hash;
+      deadline    = now + debounceMs;
+    }
+
+    if (hash == committedHash || hash == postedHash) {
+      flushRequested = false;
+      return;
+    }
+    if (!flushRequested && long(now - deadline) < 0) {
+      return;
+    }
+
+    flushRequested = false;
+    postedHash     = hash;
+    // A failed write is retried after another debounce window.
+    deadline = now + debounceMs;
+    post(record);
+  }
+
+  void flush() { flushRequested = true; }
+
+  ///@brief When update() has to run again to write a change
+  ///@return false if there is nothing left to write
+  bool nextWrite(unsigned long &due) const {
+    if (pendingHash == committedHash || pendingHash == postedHash) {
+      return false;
+    }
+    due = deadline;
+    return true;
+  }
+
+  uint32_t commits() const { return commitCount; }
+  uint32_t failures() const { return failureCount; }
+
+#ifdef ESP32
+  ///@brief Storage task: wait up to timeoutMs for a record to commit
+  bool receive(SettingsRecord &record, unsigned long timeoutMs) {
+    return xQueueReceive(mailbox, &record, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+  }
+#endif
+
+  ///@brief Write record to the settings file
+  void commit(const SettingsRecord &record) {
+    bool saved;
+    {
+      ScopedProbe probe(Probe_Id::save);
+      saved = saveSettingsRecord(record, SETTINGS_FILE);
+    }
+    if (saved) {
+      committedHash = hashOf(record);
+      commitCount++;
+      LOG_INFO(DEVICE, "SettingsPersistence - Data Saved");
+    } else {
+      postedHash = 0;
+      failureCount++;
+      LOG_ERROR(DEVICE, "SettingsPersistence - Error: Data Not Saved");
+    }
+  }
+
+private:
+  static uint32_t hashOf(const SettingsRecord &record) {
+    return crc32((const uint8_t *)&record, sizeof(record));
+  }
+
+#ifdef ESP32
+  void post(const SettingsRecord &record) { xQueueOverwrite(mailbox, &record); }
+
+  QueueHandle_t mailbox = nullptr;
+#else
+  void post(const SettingsRecord &record) { commit(record); }
+#endif
+
+  // Written by the storage task, read by the control task
+  std::atomic<uint32_t> committedHash{0};
+  std::atomic<uint32_t> postedHash{0};
+  std::atomic<uint32_t> commitCount{0};
+  std::atomic<uint32_t> failureCount{0};
+
+  uint32_t pendingHash   = 0;
+  unsigned long deadline = 0;
+  bool flushRequested    = false;
+};
+
+SettingsPersistence settingsPersistence;
+
+///
+///@brief settings.json export and import, run by the storage task so that
+/// neither the file nor its DynamicJsonDocument is handled under the
+/// FrameLock.
+/// Export: the control task queues a snapshot of the settings record, the
+/// storage task writes settings.json from it.
+/// Import: the control task queues the current record, the storage task
+/// reads settings.json over a staged copy of it and posts the result back.
+/// The control task takes it with takeImported() and applies it under the
+/// FrameLock.
+///
+class JsonSettingsTransfer {
+public:
+  ///@brief Control task: write record to settings.json
+  bool requestExport(const SettingsRecord &record) {
+    return request(false, record);
+  }
+
+  ///@brief Control task: read settings.json over record, what the file
+  /// leaves out keeps its value in record
+  bool requestImport(const SettingsRecord &record) {
+    return request(true, record);
+  }
+
+  ///@brief Control task: the settings imported since the last call
+  ///@return false if there are none
+  bool takeImported(SettingsRecord &record) { return imported.take(record); }
+
+  ///@brief Storage task: serve the queued requests
+  void update() {
+    Request request;
+    while (requests.pop(request)) {
+      recordToDevice(request.record, staging);
+      if (request.import) {
+        importFile();
+      } else {
+        exportFile();
+      }
+    }
+  }
+
+private:
+  struct Request {
+    bool import;
+    SettingsRecord record;
+  };
+
+  bool request(bool import, const SettingsRecord &record) {
+    Request request;
+    request.import = import;
+    request.record = record;
+    if (!requests.push(request)) {
+      LOG_ERROR(DEVICE, "JsonSettingsTransfer - ERROR - Request queue full");
+      return false;
+    }
+    return true;
+  }
+
+  void exportFile() {
+    ScopedProbe probe(Probe_Id::save);
+    if (!exportJsonSettings(staging, SETTINGS_JSON_FILE)) {
+      LOG_ERROR(DEVICE, "exportJsonSettings - Error: Data Not Saved");
+    } else {
+      LOG_INFO(DEVICE, "exportJsonSettings - Data Saved");
+    }
+  }
+
+  void importFile() {
+    if (importJsonSettings(SETTINGS_JSON_FILE, staging) != 0) {
+      LOG_ERROR(DEVICE, "importJsonSettings - Error: Data Not Loaded");
+      return;
+    }
+    imported.post(recordFromDevice(staging));
+    // The control task applies it
+    tasks.raise(commandEvent);
+  }
+
+  // Producer: control task. Consumer: storage task.
+  SpscRing<Request, 2> requests;
+  // Producer: storage task. Consumer: control task.
+  SpscMailbox<SettingsRecord> imported;
+  // Only touched by the storage task
+  SettingsData staging;
+};
+
+JsonSettingsTransfer jsonSettingsTransfer;
+
+#endif // PERSISTENCE_HPP
@@ -0,0 +1,144 @@
+#ifndef POWER_HPP
+#define POWER_HPP
+
+#include "Arduino.h"
+#include "diagnostics.hpp"
+#include <atomic>
+
+#ifdef ESP32
+#include "freertos/task.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+#endif
+
+// Estimated supply current of the board without the strip, for the
+// diagnostics: the render task running, and the render task blocked with
+// BLE still advertising or connected. Override with the measured values of
+// your board.
+#ifndef POWER_ACTIVE_MA
+#define POWER_ACTIVE_MA 68
+#endif
+#ifndef POWER_IDLE_MA
+#define POWER_IDLE_MA 27
+#endif
+
+///
+///@brief Lets the render task block while nothing can change the output.
+/// At the end of an iteration the render task asks to sleep() until its next
+/// deadline: the next animation frame, or nothing at all when the strip is
+/// off or only shows static modes. It blocks on its task notification, which
+/// wake() gives:
+///  - the GATT stream callback, when it queues a streamed packet,
+///  - the control task, when it applied commands or the button.
+/// While the render task is blocked its core runs the idle task, and with an
+/// SDK built with CONFIG_PM_ENABLE and tickless idle it drops into light
+/// sleep.
+///
+/// The time spent blocked gives the awake ratio and, from POWER_ACTIVE_MA and
+/// POWER_IDLE_MA, an estimate of the average current. The time from a wake()
+/// to the render task running again goes to the `wake` probe.
+///
+class PowerGovernor {
+public:
+  // Longest block: the frame rate counters and the control task's serial
+  // commands are polled
+  static const unsigned long idleMaxMs = 1000;
+  static const unsigned long windowMs  = 1000;
+
+  ///@brief Call on the render task, before its first sleep()
+  void begin() {
+#ifdef ESP32
+    renderTask = xTaskGetCurrentTaskHandle();
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t config;
+    config.max_freq_mhz       = getCpuFrequencyMhz();
+    config.min_freq_mhz       = 80;
+    config.light_sleep_enable = true;
+    if (esp_pm_configure(&config) != ESP_OK) {
+      LOG_WARN(DEVICE, "PowerGovernor - Light sleep not available");
+    }
+#endif
+#endif
+    windowStart = micros();
+  }
+
+  ///@brief Any task: something changed, the render task has to run
+  void wake() {
+    stampWake();
+#ifdef ESP32
+    if (renderTask != nullptr) {
+      xTaskNotifyGive(renderTask);
+    }
+#endif
+  }
+
+  ///
+  ///@brief Block the render task until a wake() or `due` (if
+  /// hasDeadline), at most idleMaxMs.
+  ///
+  void sleep(unsigned long now, bool hasDeadline, unsigned long due) {
+    unsigned long timeout = idleMaxMs;
+    if (hasDeadline) {
+      long left = long(due - now);
+      if (left <= 0) {
+        timeout = 0;
+      } else if ((unsigned long)left < idleMaxMs) {
+        timeout = left;
+      }
+    }
+
+    uint32_t start = micros();
+#ifdef ESP32
+    if (timeout > 0) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+    }
+#else
+    (void)timeout; // Nothing to wait for on the host
+#endif
+    uint32_t end = micros();
+    sleptUs += end - start;
+
+    uint32_t stamp = wakeStamp.exchange(0, std::memory_order_relaxed);
+    if (stamp != 0) {
+      diagnostics.recordMicros(Probe_Id::wake, end - stamp);
+    }
+
+    uint32_t elapsed = end - windowStart;
+    if (elapsed >= windowMs * 1000) {
+      uint32_t awake         = sleptUs < elapsed ? elapsed - sleptUs : 0;
+      uint16_t awakePerMille = uint64_t(awake) * 1000 / elapsed;
+      diagnostics.setPower(awakePerMille, estimatedMilliAmps10(awakePerMille));
+      windowStart = end;
+      sleptUs     = 0;
+    }
+  }
+
+  ///@brief Average current in 0.1 mA for the given awake ratio
+  static uint16_t estimatedMilliAmps10(uint16_t awakePerMille) {
+    return (POWER_IDLE_MA * 10000UL +
+            (POWER_ACTIVE_MA - POWER_IDLE_MA) * 10UL * awakePerMille) /
+           1000;
+  }
+
+private:
+  ///@brief Time of the first wake() since the render task last woke up, 0
+  /// for none
+  void stampWake() {
+    uint32_t expected = 0;
+    wakeStamp.compare_exchange_strong(expected, micros() | 1,
+                                      std::memory_order_relaxed);
+  }
+
+#ifdef ESP32
+  TaskHandle_t renderTask = nullptr;
+#endif
+
+  std::atomic<uint32_t> wakeStamp{0};
+  uint32_t windowStart = 0;
+  uint32_t sleptUs     = 0;
+};
+
+PowerGovernor powerGovernor;
+
+#endif // POWER_HPP
@@ -0,0 +1,173 @@
+#ifndef PROGRAM_STORE_HPP
+#define PROGRAM_STORE_HPP
+
+#include "Arduino.h"
+#include "SPIFFS.h"
+#include "effect_vm.hpp"
+#include "log.hpp"
+#include "settings_store.hpp"
+#include "tasks.hpp"
+
+///
+/// Program files, one per used slot of effectPrograms:
+///   /program<slot>.bin = [image][CRC-32 of the image]
+/// An image is checked again by verifyProgram() when loaded, a file from a
+/// build with another instruction set is refused rather than run.
+///
+
+void programPath(uint8_t slot, char *path, size_t size) {
+  snprintf(path, size, "/program%u.bin", slot);
+}
+
+///
+///@brief Load the program file of slot into effectPrograms. No heap
+/// allocation.
+///
+///@return false if there is no valid program file
+///
+bool loadProgramFile(uint8_t slot, const char *filename) {
+  File file = SPIFFS.open(filename, FILE_READ);
+  if (!file) {
+    return false;
+  }
+  uint8_t buffer[programImageMax + sizeof(uint32_t)];
+  size_t size = file.read(buffer, sizeof(buffer));
+  file.close();
+  if (size < sizeof(uint32_t)) {
+    return false;
+  }
+
+  size -= sizeof(uint32_t);
+  uint32_t crc;
+  memcpy(&crc, buffer + size, sizeof(crc));
+  if (crc != crc32(buffer, size)) {
+    LOG_ERROR(DEVICE, "loadProgramFile - Error: CRC mismatch in %s",
+              filename);
+    return false;
+  }
+
+  EffectProgram program;
+  uint8_t at;
+  Program_Error error = verifyProgram(buffer, size, program, at);
+  if (error != Program_Error::none) {
+    LOG_ERROR(DEVICE, "loadProgramFile - Error %u at %u in %s",
+              uint8_t(error), at, filename);
+    return false;
+  }
+  effectPrograms.restore(slot, program);
+  return true;
+}
+
+///
+///@brief Load every program file, recovering the temporary file of an
+/// interrupted saveProgram() like loadSettings()
+///
+void loadPrograms() {
+  for (uint8_t slot = 0; slot < programSlots; slot++) {
+    char path[16];
+    char temp[32];
+    programPath(slot, path, sizeof(path));
+    tempSettingsPath(path, temp, sizeof(temp));
+    if (loadProgramFile(slot, path)) {
+      LOG_INFO(DEVICE, "loadPrograms - Slot %u loaded", slot);
+    } else if (loadProgramFile(slot, temp)) {
+      SPIFFS.remove(path);
+      SPIFFS.rename(temp, path);
+      LOG_INFO(DEVICE, "loadPrograms - Slot %u recovered", slot);
+    }
+  }
+}
+
+///
+///@brief Write the program image of slot to its file, or remove the file if
+/// size is 0. Written to a temporary file and renamed, as the settings.
+///
+///@param buffer the image, with room for its CRC after it
+///
+bool saveProgram(uint8_t slot, uint8_t *buffer, size_t size) {
+  char path[16];
+  programPath(slot, path, sizeof(path));
+  if (size == 0) {
+    return !SPIFFS.exists(path) || SPIFFS.remove(path);
+  }
+
+  uint32_t crc = crc32(buffer, size);
+  memcpy(buffer + size, &crc, sizeof(crc));
+  size += sizeof(crc);
+
+  char temp[32];
+  tempSettingsPath(path, temp, sizeof(temp));
+  File file = SPIFFS.open(temp, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  size_t written = file.write(buffer, size);
+  file.close();
+  if (written != size) {
+    SPIFFS.remove(temp);
+    return false;
+  }
+  SPIFFS.remove(path);
+  return SPIFFS.rename(temp, path);
+}
+
+///
+///@brief Saves the slots changed since they were last saved, called by the
+/// storage task. Each image is copied under the FrameLock and written
+/// without it, so the render and control tasks do not wait for the file. The
+/// bit of a slot is cleared with the copy, so a change made meanwhile is
+/// saved by the next call, and set again if the write fails: the slot is
+/// retried after retryMinMs, twice as long after every further failure up to
+/// retryMaxMs, rather than on every iteration of a full or failing flash.
+///
+class ProgramSaver {
+public:
+  static const unsigned long retryMinMs = 1000;
+  static const unsigned long retryMaxMs = 60000;
+
+  void update(unsigned long now) {
+    if (effectPrograms.unsaved() == 0 ||
+        (retryMs != 0 && long(now - retryAt) < 0)) {
+      return;
+    }
+
+    bool failed = false;
+    for (uint8_t slot = 0; slot < programSlots; slot++) {
+      if (!(effectPrograms.unsaved() & 1 << slot)) {
+        continue;
+      }
+      uint8_t buffer[programImageMax + sizeof(uint32_t)];
+      size_t size = 0;
+      {
+        FrameLock lock;
+        const EffectProgram *program = effectPrograms.get(slot);
+        if (program != nullptr) {
+          size = program->encode(buffer);
+        }
+        effectPrograms.saved(slot);
+      }
+      if (!saveProgram(slot, buffer, size)) {
+        effectPrograms.changed(slot);
+        failed = true;
+      }
+    }
+
+    if (!failed) {
+      retryMs = 0;
+      return;
+    }
+    retryMs = retryMs == 0 ? retryMinMs : retryMs * 2;
+    if (retryMs > retryMaxMs) {
+      retryMs = retryMaxMs;
+    }
+    retryAt = now + retryMs;
+    LOG_ERROR(DEVICE, "saveProgram - Error: slots 0x%02x retried in %lu ms",
+              effectPrograms.unsaved(), retryMs);
+  }
+
+private:
+  unsigned long retryMs = 0; // 0 while the last save succeeded
+  unsigned long retryAt = 0;
+} programSaver;
+
+#endif // PROGRAM_STORE_HPP
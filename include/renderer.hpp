@@ -0,0 +1,30 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+
+#include "Arduino.h"
+#include "segments.hpp"
+#include "settings.h"
+#include "transition.hpp"
+
+///
+///@brief Render the frame due at `now`, if any, into dev.strip: the zones
+/// that are due and, during a transition, the mix with the outgoing mode.
+/// Shared by run_mod() and the host render tool.
+///
+///@return true if there is a new frame to show
+///
+bool renderFrame(DeviceInfo &dev, bool redraw, unsigned long now) {
+  if (transitionEngine.active()) {
+    // Crossfade frames run at their own rate, even over a static mode.
+    if (!redraw && !transitionEngine.frameDue(now)) {
+      return false;
+    }
+    transitionEngine.restoreIncoming(dev.strip);
+    segmentEngine.render(dev, redraw, now);
+    transitionEngine.blend(dev.strip, now);
+    return true;
+  }
+  return segmentEngine.render(dev, redraw, now);
+}
+
+#endif // RENDERER_HPP
@@ -0,0 +1,217 @@
+#ifndef SEGMENTS_HPP
+#define SEGMENTS_HPP
+
+#include "Arduino.h"
+#include "frame_scheduler.hpp"
+#include "modes.hpp"
+#include "settings.h"
+
+///
+///@brief The zone the whole strip runs when the zone table is empty:
+/// activeMode with the *Data parameters.
+///
+SegmentData wholeStripSegment(const DeviceInfo &dev) {
+  SegmentData segment = {};
+  segment.length      = dev.defaultData.ledLenght;
+  segment.mode        = dev.activeMode;
+
+  const ModeEntry *mode = findMode(dev.activeMode);
+  if (mode != nullptr) {
+    mode->segment(dev, segment);
+  }
+  return segment;
+}
+
+///@return true if the whole strip or one of the zones runs mode
+bool runsMode(const DeviceInfo &dev, Mode_Type mode) {
+  if (dev.segmentsData.count == 0) {
+    return dev.activeMode == mode;
+  }
+  for (uint8_t i = 0; i < dev.segmentsData.count; i++) {
+    if (dev.segmentsData.segments[i].mode == mode) {
+      return true;
+    }
+  }
+  return false;
+}
+
+///
+///@brief Renders the zone table into dev.strip, the framebuffer all zones
+/// share, in one pass.
+/// Every zone keeps its own schedule: a static zone is drawn once after it
+/// changed, an animated one at its mode's frame rate. render() draws only
+/// the zones that are due, the pixels of the others are still in the strip
+/// buffer from the previous frame.
+///
+class SegmentEngine {
+public:
+  ///@brief Redraw one zone on the next frame, its parameters changed.
+  void invalidate(uint8_t index) {
+    if (index < SEGMENTS_MAX) {
+      states[index].dirty = true;
+    }
+  }
+
+  ///@brief Draw the zones that are due. With redraw the strip is cleared and
+  /// every zone is drawn.
+  ///@return true if the frame has to be shown
+  bool render(DeviceInfo &dev, bool redraw, unsigned long now) {
+    const SegmentData *segments = dev.segmentsData.segments;
+    uint8_t count               = dev.segmentsData.count;
+    SegmentData wholeStrip;
+    if (count == 0) {
+      wholeStrip = wholeStripSegment(dev);
+      segments   = &wholeStrip;
+      count      = 1;
+    }
+
+    if (redraw) {
+      // Pixels no zone draws must not keep the previous colors.
+      dev.strip.clear();
+    }
+
+    // A mode prepares once for all its zones (the rainbow ramp), for the
+    // longest one
+    uint16_t longest[Modes::count] = {};
+    for (uint8_t i = 0; i < count; i++) {
+      const ModeEntry *mode = findMode(segments[i].mode);
+      if (mode != nullptr && mode->prepare != nullptr) {
+        uint16_t length = visibleLength(dev.strip, segments[i]);
+        uint8_t index   = mode - Modes::table;
+        longest[index]  = max(longest[index], length);
+      }
+    }
+    for (uint8_t m = 0; m < Modes::count; m++) {
+      if (longest[m] > 0) {
+        Modes::table[m].prepare(longest[m]);
+      }
+    }
+
+    bool drawn = redraw;
+    for (uint8_t i = 0; i < count; i++) {
+      ModeState &state      = states[i];
+      const ModeEntry *mode = findMode(segments[i].mode);
+      if (mode == nullptr) {
+        continue;
+      }
+      ModeTiming timing = mode->timing;
+      if (!redraw && !state.dirty &&
+          (timing.isStatic || long(now - state.nextFrameMs) < 0)) {
+        continue;
+      }
+
+      mode->draw(dev.strip, segments[i], visibleLength(dev.strip, segments[i]),
+                 state, now);
+      state.dirty = false;
+      drawn       = true;
+
+      if (!timing.isStatic) {
+        unsigned long period = mode->framePeriodMs(
+            segments[i], 1000UL / timing.fps, maxPeriodMs);
+        state.nextFrameMs += period;
+        // Fell behind by more than a frame: resync instead of bursting.
+        if (long(now - state.nextFrameMs) >= long(period)) {
+          state.nextFrameMs = now + period;
+        }
+      }
+    }
+    return drawn;
+  }
+
+  ///
+  ///@brief When the next frame is due without any change of settings: now
+  /// for a zone waiting to be redrawn, else the next frame of the earliest
+  /// animated zone.
+  ///@return false if every zone is static and drawn
+  ///
+  bool nextFrame(const DeviceInfo &dev, unsigned long now,
+                 unsigned long &due) const {
+    const SegmentData *segments = dev.segmentsData.segments;
+    uint8_t count               = dev.segmentsData.count;
+    SegmentData wholeStrip;
+    if (count == 0) {
+      wholeStrip = wholeStripSegment(dev);
+      segments   = &wholeStrip;
+      count      = 1;
+    }
+
+    bool found = false;
+    for (uint8_t i = 0; i < count; i++) {
+      unsigned long next;
+      if (states[i].dirty) {
+        next = now;
+      } else if (!modeTiming(segments[i].mode).isStatic) {
+        next = states[i].nextFrameMs;
+      } else {
+        continue;
+      }
+      if (!found || long(next - due) < 0) {
+        due = next;
+      }
+      found = true;
+    }
+    return found;
+  }
+
+  ///@brief Redraw the zones running `mode` on the next frame
+  void invalidateMode(const DeviceInfo &dev, Mode_Type mode) {
+    if (dev.segmentsData.count == 0) {
+      if (dev.activeMode == mode) {
+        invalidate(0);
+      }
+      return;
+    }
+    for (uint8_t i = 0; i < dev.segmentsData.count; i++) {
+      if (dev.segmentsData.segments[i].mode == mode) {
+        invalidate(i);
+      }
+    }
+  }
+
+  ///@brief Zone `index` was removed, the states of the zones after it move
+  /// down with them
+  void remove(uint8_t index) {
+    for (uint8_t i = index; i + 1 < SEGMENTS_MAX; i++) {
+      states[i] = states[i + 1];
+    }
+    states[SEGMENTS_MAX - 1] = ModeState();
+  }
+
+  ///@brief Every zone was removed
+  void removeAll() {
+    for (ModeState &state : states) {
+      state = ModeState();
+    }
+  }
+
+  const ModeState &state(uint8_t index) const { return states[index]; }
+
+  ///@brief Length of the part of the zone inside the strip
+  static uint16_t visibleLength(const Adafruit_NeoPixel &strip,
+                                const SegmentData &segment) {
+    uint16_t numPixels = strip.numPixels();
+    if (segment.start >= numPixels) {
+      return 0;
+    }
+    return min<uint16_t>(segment.length, numPixels - segment.start);
+  }
+
+  ///@brief Draw one zone into strip, its mode prepared for it
+  static void draw(Adafruit_NeoPixel &strip, const SegmentData &segment,
+                   ModeState &state, unsigned long now) {
+    const ModeEntry *mode = findMode(segment.mode);
+    if (mode != nullptr) {
+      mode->draw(strip, segment, visibleLength(strip, segment), state, now);
+    }
+  }
+
+private:
+  // Slowest frame rate of an animated zone
+  static const unsigned long maxPeriodMs = 1000;
+
+  ModeState states[SEGMENTS_MAX];
+};
+
+SegmentEngine segmentEngine;
+
+#endif // SEGMENTS_HPP
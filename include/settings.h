@@ -2,55 +2,306 @@
 #define SETTINGS_HPP
 
 #include "Arduino.h"
+#include "fixed_neopixel.hpp"
+#include "log.hpp"
 #include "util.hpp"
+#include <Adafruit_NeoPixel.h>
+#include <BLEServer.h>
 
+// Values of the modes in the settings, the BLE payloads and the zones. Each
+// one is implemented by a struct listed in Modes (modes.hpp), in this order.
 enum class Mode_Type : byte {
-  fixed_color = 1,
-  rainbow     = 2,
-  color_split = 3,
+  fixed_color     = 1,
+  rainbow         = 2,
+  color_split     = 3,
+  stream          = 4,
+  palette         = 5,
+  fire            = 6,
+  meteor          = 7,
+  twinkle         = 8,
+  comet           = 9,
+  program         = 10,
+  spectrum        = 11,
+  pulse           = 12,
+  sparkle         = 13,
+  palette_sparkle = 14,
 };
 
 //----- Modes Data structures -----//
 struct DefaultData {
-  uint8_t ledLenght;
+  uint16_t ledLenght;
   uint8_t brightness;
 
   void print() {
-    Serial.print("DefaultData.ledLenght: ");
-    Serial.println(ledLenght);
-    Serial.print("DefaultData.brightness: ");
-    Serial.println(brightness);
+    LOG_INFO(DEVICE, "DefaultData.ledLenght: %u", ledLenght);
+    LOG_INFO(DEVICE, "DefaultData.brightness: %u", brightness);
   }
 };
 struct FixedColorData {
   Color_RGB color;
 
   void print() {
-    Serial.print("FixedColorData.color: ");
-    Serial.print(color.toString());
+    LOG_INFO(DEVICE, "FixedColorData.color: %u,%u,%u", color.r, color.g,
+             color.b);
   }
 };
 
 struct RainbowData {
   uint8_t velocity;
 
+  void print() { LOG_INFO(DEVICE, "RainbowData.velocity: %u", velocity); }
+};
+struct ColorSplitData {
+  uint16_t endFirstLedSplit;
+  Color_RGB color1;
+  Color_RGB color2;
+
   void print() {
-    Serial.print("RainbowData.velocity: ");
-    Serial.println(velocity);
+    LOG_INFO(DEVICE, "ColorSplitData.endFirstLedSplit: %u", endFirstLedSplit);
+    LOG_INFO(DEVICE, "ColorSplitData.color1: %u,%u,%u", color1.r, color1.g,
+             color1.b);
+    LOG_INFO(DEVICE, "ColorSplitData.color2: %u,%u,%u", color2.r, color2.g,
+             color2.b);
   }
 };
-struct ColorSplitData {
-  uint8_t endFirstLedSplit;
+
+struct PaletteModeData {
+  uint8_t velocity;
+
+  void print() { LOG_INFO(DEVICE, "PaletteModeData.velocity: %u", velocity); }
+};
+
+struct PaletteSparkleData {
+  uint8_t velocity;
+  uint8_t rate;  // share of the LEDs sparkling, 255 all of them
+  uint8_t blend; // Blend_Mode of the sparkles over the palette
+
+  void print() {
+    LOG_INFO(DEVICE, "PaletteSparkleData.velocity: %u", velocity);
+    LOG_INFO(DEVICE, "PaletteSparkleData.rate: %u", rate);
+    LOG_INFO(DEVICE, "PaletteSparkleData.blend: %u", blend);
+  }
+};
+
+// Palette sparkle mode of the settings written before it, blend max
+const PaletteSparkleData defaultPaletteSparkleData = {20, 60, 3};
+
+struct FireData {
+  uint8_t cooling;  // how fast sparks cool, the higher the shorter the flames
+  uint8_t sparking; // sparks a second
+
+  void print() {
+    LOG_INFO(DEVICE, "FireData.cooling: %u", cooling);
+    LOG_INFO(DEVICE, "FireData.sparking: %u", sparking);
+  }
+};
+
+struct MeteorData {
+  Color_RGB color;
+  uint8_t velocity;
+  uint8_t tail; // LEDs
+
+  void print() {
+    LOG_INFO(DEVICE, "MeteorData.color: %u,%u,%u", color.r, color.g, color.b);
+    LOG_INFO(DEVICE, "MeteorData.velocity: %u", velocity);
+    LOG_INFO(DEVICE, "MeteorData.tail: %u", tail);
+  }
+};
+
+struct TwinkleData {
   Color_RGB color1;
   Color_RGB color2;
+  uint8_t rate; // stars a second
+
+  void print() {
+    LOG_INFO(DEVICE, "TwinkleData.color1: %u,%u,%u", color1.r, color1.g,
+             color1.b);
+    LOG_INFO(DEVICE, "TwinkleData.color2: %u,%u,%u", color2.r, color2.g,
+             color2.b);
+    LOG_INFO(DEVICE, "TwinkleData.rate: %u", rate);
+  }
+};
+
+struct CometData {
+  Color_RGB color1; // head
+  Color_RGB color2; // end of the tail
+  uint8_t velocity;
+  uint8_t count;
+
+  void print() {
+    LOG_INFO(DEVICE, "CometData.color1: %u,%u,%u", color1.r, color1.g,
+             color1.b);
+    LOG_INFO(DEVICE, "CometData.color2: %u,%u,%u", color2.r, color2.g,
+             color2.b);
+    LOG_INFO(DEVICE, "CometData.velocity: %u", velocity);
+    LOG_INFO(DEVICE, "CometData.count: %u", count);
+  }
+};
+
+// Particle modes of the settings written before them
+const FireData defaultFireData       = {55, 120};
+const MeteorData defaultMeteorData   = {{255, 180, 90}, 60, 16};
+const TwinkleData defaultTwinkleData = {{255, 255, 255}, {255, 160, 60}, 40};
+const CometData defaultCometData     = {{0, 160, 255}, {120, 0, 255}, 50, 2};
+
+// Effect programs kept, part of the settings record layout
+const uint8_t programSlots = 4;
+
+///
+///@brief The program the program zones run, by slot, and the 4 params it
+/// reads in r4..r7
+///
+struct ProgramData {
+  uint8_t slot;
+  uint8_t params[4];
+
+  void print() {
+    LOG_INFO(DEVICE, "ProgramData: slot %u, params %u,%u,%u,%u", slot,
+             params[0], params[1], params[2], params[3]);
+  }
+};
+
+// Program mode of the settings written before it: the built-in rainbow
+const ProgramData defaultProgramData = {0, {255, 255, 255, 50}};
+
+struct SpectrumData {
+  Color_RGB low;  // of the lowest band
+  Color_RGB high; // of the highest band
+  uint8_t gain;   // 128 shows the levels as they are
+
+  void print() {
+    LOG_INFO(DEVICE, "SpectrumData.low: %u,%u,%u", low.r, low.g, low.b);
+    LOG_INFO(DEVICE, "SpectrumData.high: %u,%u,%u", high.r, high.g, high.b);
+    LOG_INFO(DEVICE, "SpectrumData.gain: %u", gain);
+  }
+};
+
+struct PulseData {
+  Color_RGB color;
+  uint8_t velocity; // how fast a beat fades
+
+  void print() {
+    LOG_INFO(DEVICE, "PulseData.color: %u,%u,%u", color.r, color.g, color.b);
+    LOG_INFO(DEVICE, "PulseData.velocity: %u", velocity);
+  }
+};
+
+// Audio modes of the settings written before them
+const SpectrumData defaultSpectrumData = {{0, 0, 255}, {255, 0, 40}, 128};
+const PulseData defaultPulseData       = {{255, 255, 255}, 160};
+
+struct SparkleData {
+  Color_RGB color1; // gradient, start of the zone
+  Color_RGB color2; // gradient, end of the zone
+  uint8_t rate;     // share of the LEDs sparkling, 255 all of them
+  uint8_t opacity;  // of the sparkles over the gradient
 
   void print() {
-    Serial.print("ColorSplitData.endFirstLedSplit: ");
-    Serial.println(endFirstLedSplit);
-    Serial.print("ColorSplitData.color1: ");
-    Serial.println(color1.toString());
-    Serial.print("ColorSplitData.endFirstLedSplit: ");
-    Serial.println(color2.toString());
+    LOG_INFO(DEVICE, "SparkleData.color1: %u,%u,%u", color1.r, color1.g,
+             color1.b);
+    LOG_INFO(DEVICE, "SparkleData.color2: %u,%u,%u", color2.r, color2.g,
+             color2.b);
+    LOG_INFO(DEVICE, "SparkleData.rate: %u", rate);
+    LOG_INFO(DEVICE, "SparkleData.opacity: %u", opacity);
+  }
+};
+
+// Sparkle mode of the settings written before it
+const SparkleData defaultSparkleData = {{0, 40, 120}, {90, 0, 110}, 40, 200};
+
+// Colors of a palette, part of the settings record layout
+const uint8_t paletteColorsMax = 16;
+
+///
+///@brief The palette the palette zones take their colors from: `count`
+/// colors spread evenly over the 256 indices, wrapping around. With blend
+/// the indices between two colors fade from one to the other, without it
+/// every color is a band of 256 / count indices.
+///
+struct PaletteData {
+  uint8_t count;
+  bool blend;
+  Color_RGB colors[paletteColorsMax];
+
+  void print() {
+    LOG_INFO(DEVICE, "PaletteData: %u colors, blend %u", count, blend);
+    for (uint8_t i = 0; i < count && i < paletteColorsMax; i++) {
+      LOG_DEBUG(DEVICE, "PaletteData.colors[%u]: %u,%u,%u", i, colors[i].r,
+                colors[i].g, colors[i].b);
+    }
+  }
+};
+
+// Palette of the settings written before palettes: a sunset
+const PaletteData defaultPalette = {
+    4, true, {{255, 40, 0}, {255, 140, 0}, {180, 0, 120}, {40, 0, 160}}};
+
+// Crossfade when the active mode changes, 0 switches at once
+const uint16_t defaultTransitionMs = 500;
+
+struct TransitionData {
+  uint16_t duration; // ms
+
+  void print() { LOG_INFO(DEVICE, "TransitionData.duration: %u", duration); }
+};
+
+// Zones a strip can be split into, part of the settings record layout
+#define SEGMENTS_MAX 8
+
+// Bytes of the parameters of a zone, part of the settings record layout
+const size_t segmentParamsSize = 8;
+
+///
+///@brief One zone of the strip: `length` LEDs from `start` running `mode`.
+/// params holds the parameters of its mode, the Params of its struct in
+/// modes.hpp (FireData for fire...), read and written with zoneParams().
+/// Stream has none: it shows the streamed frame from its first pixel.
+///
+struct SegmentData {
+  uint16_t start;
+  uint16_t length;
+  Mode_Type mode;
+  alignas(4) uint8_t params[segmentParamsSize];
+
+  bool overlaps(const SegmentData &other) const {
+    return start < other.start + other.length &&
+           other.start < start + length;
+  }
+
+  void print() {
+    char hex[2 * segmentParamsSize + 1];
+    for (size_t i = 0; i < segmentParamsSize; i++) {
+      snprintf(hex + 2 * i, 3, "%02x", params[i]);
+    }
+    LOG_INFO(DEVICE, "SegmentData: %u+%u mode %u params %s", start, length,
+             uint8_t(mode), hex);
+  }
+};
+
+///
+///@brief Zone table. With no zones the whole strip runs activeMode with the
+/// *Data parameters above, as before zones existed.
+///
+struct SegmentsData {
+  uint8_t count;
+  SegmentData segments[SEGMENTS_MAX];
+
+  ///@brief The first zone, other than zone `index`, that `zone` overlaps
+  ///@return count if there is none
+  uint8_t overlapping(const SegmentData &zone, uint8_t index) const {
+    for (uint8_t i = 0; i < count; i++) {
+      if (i != index && zone.overlaps(segments[i])) {
+        return i;
+      }
+    }
+    return count;
+  }
+
+  void print() {
+    LOG_INFO(DEVICE, "SegmentsData.count: %u", count);
+    for (uint8_t i = 0; i < count; i++) {
+      segments[i].print();
+    }
   }
 };
 
@@ -61,11 +312,29 @@ struct BluetoothSett {
   char BLEc_RainbowData_UUID[37]    = "e1ee97c2-f08d-451b-92e6-f52c508c40af";
   char BLEc_ColorSplitData_UUID[37] = "47b31a46-19d1-407c-b126-f6c1561bb23c";
   char BLEc_ActiveMode_UUID[37]     = "6e19f003-b524-4852-a57c-63a6529c3a12";
+  char BLEc_SegmentData_UUID[37]    = "5a0d6a2e-3c59-4d8e-9f0b-6f2b1c7d4e83";
+  char BLEc_TransitionData_UUID[37] = "c4e1f7a9-2b83-4f6d-8a15-93d0e6b2c7f4";
+  char BLEc_CommandBatch_UUID[37]   = "8f3b2d61-7e4a-4c09-b5d2-1a6e9c0f4b37";
+  char BLEc_Stream_UUID[37]         = "d7a94c3e-51b8-4f26-9e0d-3c8b7a2f6e15";
+  char BLEc_PaletteMode_UUID[37]    = "3b8e5f20-6d4c-4a1e-b7f9-0c2d8e4a6b51";
+  char BLEc_Palette_UUID[37]        = "e9f1c4a7-85d2-4b3e-a0c6-7d19f2b5e843";
+  char BLEc_FireData_UUID[37]       = "71c3e8a2-4f5b-4d90-8e1a-b6d2c9f03a47";
+  char BLEc_MeteorData_UUID[37]     = "a85f2d19-c7e3-4b6a-9d04-3e1b8f6c2a95";
+  char BLEc_TwinkleData_UUID[37]    = "2e9b4c73-8a1d-4f5e-b3c6-d70a9e2f1b68";
+  char BLEc_CometData_UUID[37]      = "c6d18f4e-3b2a-4e97-a5f0-84c3b1d9e726";
+  char BLEc_ProgramMode_UUID[37]    = "5d2a7e91-0b4c-4f38-96e1-a3c8f7d2b064";
+  char BLEc_Program_UUID[37]        = "f04b9c6e-2d71-4a85-b3e9-61c7d0a5f2b8";
+  char BLEc_SpectrumData_UUID[37]   = "7b3e0c52-94d8-4a1f-8e6b-c21f5d9a03e7";
+  char BLEc_PulseData_UUID[37]      = "e18a6d3f-5c27-4b90-a4e2-9f0b7c3d6152";
+  char BLEc_SparkleData_UUID[37]    = "9a4f71c2-e35b-4d08-b6a1-2c7e0f8d5b39";
+  char BLEc_PaletteSparkle_UUID[37] = "6c0e3b85-a24f-4d71-9b38-e5f1a7c2d094";
 
   char BLEs_Settings_UUID[37]     = "f349aa66-7acf-41c6-b9a4-ce34ef3f54e6";
   char BLEc_SaveSettings_UUID[37] = "2c203874-7ad6-4230-bc5c-09e2aa7a382f";
   char BLEc_SendData_UUID[37]     = "0c098b94-87d6-4cfa-b649-7ad5debb4409";
   char BLEc_OnOff_UUID[37]        = "301b81e3-8e41-4b84-804f-2ad18cc092e5";
+  char BLEc_Diagnostics_UUID[37]  = "a63e0b52-9d1f-4c78-b2e4-5f80d3c91a6e";
+  char BLEc_StateChanged_UUID[37] = "4f6c2b18-d93e-4a57-8b0c-e2a71f5d9c34";
 
   // uint16_t BLEs_GenericAccess_UUID = 0x1800; // Generic Service
   // uint16_t BLEc_DeviceName_UUID    = 0x2A00; // Strip Led
@@ -79,27 +348,75 @@ struct BluetoothSett {
   uint16_t BLEc_FirmwareRevision_UUID  = 0x2A26; // v1.0
 };
 
-struct DeviceInfo {
-  const byte led_pin         = 13;
-  const byte strip_pin       = 14;
-  const byte push_button_pin = 16;
+#ifndef STRIP_MAX_LEDS
+// Pixels allocated for device.strip at compile time, the longest strip that
+// can be configured. Override with -D STRIP_MAX_LEDS=n
+#define STRIP_MAX_LEDS 2048
+#endif
 
-  const BluetoothSett bluetoothSett;
+typedef FixedNeoPixel<STRIP_MAX_LEDS> StripPixels;
 
+// Wire format of device.strip and the frames sent. Modes that copy bytes
+// straight into its pixel buffer rely on stripBytesPerPixel matching it.
+const neoPixelType stripPixelType = NEO_GRB + NEO_KHZ800;
+const uint8_t stripBytesPerPixel  = StripPixels::bytesPerPixel;
+
+///
+///@brief The settings kept in the settings record and settings.json. The
+/// storage task stages them in one of its own to import or export
+/// settings.json without device.
+///
+struct SettingsData {
   DefaultData defaultData;
   FixedColorData fixedColorData;
   RainbowData rainbowData;
   ColorSplitData colorSplitData;
   Mode_Type activeMode;
+  SegmentsData segmentsData;
+  TransitionData transitionData;
+  PaletteModeData paletteModeData;
+  PaletteData paletteData;
+  FireData fireData;
+  MeteorData meteorData;
+  TwinkleData twinkleData;
+  CometData cometData;
+  ProgramData programData;
+  SpectrumData spectrumData;
+  PulseData pulseData;
+  SparkleData sparkleData;
+  PaletteSparkleData paletteSparkleData;
+
+  bool isOn = true;
 
   void print() {
     defaultData.print();
     fixedColorData.print();
     rainbowData.print();
     colorSplitData.print();
-    Serial.println("ActiveMode: " + String(int(activeMode)));
-    Serial.println("OnOffState: " + String(isOn));
+    segmentsData.print();
+    transitionData.print();
+    paletteModeData.print();
+    paletteData.print();
+    fireData.print();
+    meteorData.print();
+    twinkleData.print();
+    cometData.print();
+    programData.print();
+    spectrumData.print();
+    pulseData.print();
+    sparkleData.print();
+    paletteSparkleData.print();
+    LOG_INFO(DEVICE, "ActiveMode: %u", uint8_t(activeMode));
+    LOG_INFO(DEVICE, "OnOffState: %u", isOn);
   }
+};
+
+struct DeviceInfo : SettingsData {
+  const byte led_pin         = 13;
+  const byte strip_pin       = 14;
+  const byte push_button_pin = 16;
+
+  const BluetoothSett bluetoothSett;
 
   // BLE
   BLEServer *bleSServer           = nullptr;
@@ -111,11 +428,29 @@ struct DeviceInfo {
   BLECharacteristic *blecRainbowData    = nullptr;
   BLECharacteristic *blecColorSplitData = nullptr;
   BLECharacteristic *blecActiveMode     = nullptr;
+  BLECharacteristic *blecSegmentData    = nullptr;
+  BLECharacteristic *blecTransitionData = nullptr;
+  BLECharacteristic *blecCommandBatch   = nullptr;
+  BLECharacteristic *blecStream         = nullptr;
+  BLECharacteristic *blecPaletteMode    = nullptr;
+  BLECharacteristic *blecPalette        = nullptr;
+  BLECharacteristic *blecFireData       = nullptr;
+  BLECharacteristic *blecMeteorData     = nullptr;
+  BLECharacteristic *blecTwinkleData    = nullptr;
+  BLECharacteristic *blecCometData      = nullptr;
+  BLECharacteristic *blecProgramMode    = nullptr;
+  BLECharacteristic *blecProgram        = nullptr;
+  BLECharacteristic *blecSpectrumData   = nullptr;
+  BLECharacteristic *blecPulseData      = nullptr;
+  BLECharacteristic *blecSparkleData    = nullptr;
+  BLECharacteristic *blecPaletteSparkle = nullptr;
 
   BLEService *blesServiceSettings     = nullptr;
   BLECharacteristic *blecSaveSettings = nullptr;
   BLECharacteristic *blecSendData     = nullptr;
   BLECharacteristic *blecOnOff        = nullptr;
+  BLECharacteristic *blecDiagnostics  = nullptr;
+  BLECharacteristic *blecStateChanged = nullptr;
 
   BLEService *blesGenericAccess                                  = nullptr;
   BLECharacteristic *blecDeviceName                              = nullptr;
@@ -129,12 +464,8 @@ struct DeviceInfo {
 
   bool deviceConnected = false;
 
-  Adafruit_NeoPixel led = Adafruit_NeoPixel(1, 13, NEO_GRB + NEO_KHZ800);
-  Adafruit_NeoPixel strip =
-      Adafruit_NeoPixel(30, int(strip_pin), NEO_GRB + NEO_KHZ800);
-
-  bool isOn = true;
-
+  // Frame buffer the modes render into, full scale before the output stage
+  StripPixels strip{30, -1, stripPixelType};
 } device;
 
 Adafruit_NeoPixel *led = new Adafruit_NeoPixel(1, 13, NEO_GRB + NEO_KHZ800);
@@ -0,0 +1,578 @@
+#ifndef SETTINGS_STORE_HPP
+#define SETTINGS_STORE_HPP
+
+#include "Arduino.h"
+#include "SPIFFS.h"
+#include "modes.hpp"
+#include "settings.h"
+#include <ArduinoJson.h>
+
+// Settings read at boot
+#define SETTINGS_FILE "/settings.bin"
+// Settings exchanged with JSON import/export (and the pre-binary layout)
+#define SETTINGS_JSON_FILE "/settings.json"
+
+#pragma region BinarySettings
+
+///
+/// Binary settings file:
+///   [SettingsHeader][record, header.size bytes][CRC-32 of everything before]
+/// All fields are little endian. A file of another version or size is
+/// refused, and setSettingsData() imports settings.json in its place.
+///
+
+const uint32_t settingsMagic   = 0x5344454C; // "LEDS"
+const uint16_t settingsVersion = 1;
+
+struct __attribute__((packed)) SettingsHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+};
+
+///@brief A zone with the payload of its mode's characteristic, zero padded
+struct __attribute__((packed)) SettingsSegment {
+  uint16_t start;
+  uint16_t length;
+  uint8_t mode;
+  uint8_t params[segmentParamsSize];
+};
+
+struct __attribute__((packed)) SettingsRecord {
+  uint16_t ledLenght;
+  uint8_t brightness;
+  uint8_t fixedColor[3];
+  uint8_t rainbowVelocity;
+  uint16_t endFirstLedSplit;
+  uint8_t splitColor1[3];
+  uint8_t splitColor2[3];
+  uint8_t mode;
+  uint8_t isOn;
+  uint16_t transitionMs;
+  uint8_t paletteVelocity;
+  uint8_t paletteCount;
+  uint8_t paletteBlend;
+  uint8_t paletteColors[paletteColorsMax][3];
+  uint8_t fireCooling;
+  uint8_t fireSparking;
+  uint8_t meteorColor[3];
+  uint8_t meteorVelocity;
+  uint8_t meteorTail;
+  uint8_t twinkleColor1[3];
+  uint8_t twinkleColor2[3];
+  uint8_t twinkleRate;
+  uint8_t cometColor1[3];
+  uint8_t cometColor2[3];
+  uint8_t cometVelocity;
+  uint8_t cometCount;
+  uint8_t programSlot;
+  uint8_t programParams[4];
+  uint8_t spectrumLow[3];
+  uint8_t spectrumHigh[3];
+  uint8_t spectrumGain;
+  uint8_t pulseColor[3];
+  uint8_t pulseVelocity;
+  uint8_t sparkleColor1[3];
+  uint8_t sparkleColor2[3];
+  uint8_t sparkleRate;
+  uint8_t sparkleOpacity;
+  uint8_t paletteSparkleVelocity;
+  uint8_t paletteSparkleRate;
+  uint8_t paletteSparkleBlend;
+  uint8_t segmentCount;
+  SettingsSegment segments[SEGMENTS_MAX];
+};
+
+///
+///@brief CRC-32 (IEEE 802.3), nibble table so it costs 64 bytes of flash
+///
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0) {
+  static const uint32_t table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+      0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+      0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+void copyColor(uint8_t *dst, const Color_RGB &color) {
+  dst[0] = color.r;
+  dst[1] = color.g;
+  dst[2] = color.b;
+}
+
+Color_RGB toColor(const uint8_t *src) {
+  return Color_RGB{src[0], src[1], src[2]};
+}
+
+///
+///@brief A stored length can come from a build with a larger STRIP_MAX_LEDS
+///
+uint16_t clampLength(uint16_t length) {
+  return length > StripPixels::capacity() ? StripPixels::capacity() : length;
+}
+
+SettingsRecord recordFromDevice(const SettingsData &dev) {
+  // Zeroed so unused zones do not change the CRC the persistence compares
+  SettingsRecord record;
+  memset(&record, 0, sizeof(record));
+
+  record.ledLenght  = dev.defaultData.ledLenght;
+  record.brightness = dev.defaultData.brightness;
+  copyColor(record.fixedColor, dev.fixedColorData.color);
+  record.rainbowVelocity  = dev.rainbowData.velocity;
+  record.endFirstLedSplit = dev.colorSplitData.endFirstLedSplit;
+  copyColor(record.splitColor1, dev.colorSplitData.color1);
+  copyColor(record.splitColor2, dev.colorSplitData.color2);
+  record.mode         = byte(dev.activeMode);
+  record.isOn         = dev.isOn;
+  record.transitionMs = dev.transitionData.duration;
+
+  record.paletteVelocity = dev.paletteModeData.velocity;
+  record.paletteCount    = dev.paletteData.count;
+  record.paletteBlend    = dev.paletteData.blend;
+  for (uint8_t i = 0; i < dev.paletteData.count; i++) {
+    copyColor(record.paletteColors[i], dev.paletteData.colors[i]);
+  }
+
+  record.fireCooling  = dev.fireData.cooling;
+  record.fireSparking = dev.fireData.sparking;
+  copyColor(record.meteorColor, dev.meteorData.color);
+  record.meteorVelocity = dev.meteorData.velocity;
+  record.meteorTail     = dev.meteorData.tail;
+  copyColor(record.twinkleColor1, dev.twinkleData.color1);
+  copyColor(record.twinkleColor2, dev.twinkleData.color2);
+  record.twinkleRate = dev.twinkleData.rate;
+  copyColor(record.cometColor1, dev.cometData.color1);
+  copyColor(record.cometColor2, dev.cometData.color2);
+  record.cometVelocity = dev.cometData.velocity;
+  record.cometCount    = dev.cometData.count;
+
+  record.programSlot = dev.programData.slot;
+  memcpy(record.programParams, dev.programData.params,
+         sizeof(record.programParams));
+
+  copyColor(record.spectrumLow, dev.spectrumData.low);
+  copyColor(record.spectrumHigh, dev.spectrumData.high);
+  record.spectrumGain = dev.spectrumData.gain;
+  copyColor(record.pulseColor, dev.pulseData.color);
+  record.pulseVelocity = dev.pulseData.velocity;
+
+  copyColor(record.sparkleColor1, dev.sparkleData.color1);
+  copyColor(record.sparkleColor2, dev.sparkleData.color2);
+  record.sparkleRate    = dev.sparkleData.rate;
+  record.sparkleOpacity = dev.sparkleData.opacity;
+
+  record.paletteSparkleVelocity = dev.paletteSparkleData.velocity;
+  record.paletteSparkleRate     = dev.paletteSparkleData.rate;
+  record.paletteSparkleBlend    = dev.paletteSparkleData.blend;
+
+  record.segmentCount = dev.segmentsData.count;
+  for (uint8_t i = 0; i < dev.segmentsData.count; i++) {
+    const SegmentData &segment = dev.segmentsData.segments[i];
+    SettingsSegment &stored    = record.segments[i];
+    stored.start               = segment.start;
+    stored.length              = segment.length;
+    stored.mode                = byte(segment.mode);
+    findMode(segment.mode)->encodeZone(segment, stored.params);
+  }
+  return record;
+}
+
+void recordToDevice(const SettingsRecord &record, SettingsData &dev) {
+  dev.defaultData.ledLenght           = clampLength(record.ledLenght);
+  dev.defaultData.brightness          = record.brightness;
+  dev.fixedColorData.color            = toColor(record.fixedColor);
+  dev.rainbowData.velocity            = record.rainbowVelocity;
+  dev.colorSplitData.endFirstLedSplit = record.endFirstLedSplit;
+  dev.colorSplitData.color1           = toColor(record.splitColor1);
+  dev.colorSplitData.color2           = toColor(record.splitColor2);
+  decodeMode(record.mode, dev.activeMode);
+  dev.isOn                    = record.isOn;
+  dev.transitionData.duration = record.transitionMs;
+
+  dev.paletteModeData.velocity = record.paletteVelocity;
+  memset(&dev.paletteData, 0, sizeof(dev.paletteData));
+  dev.paletteData.count = min<uint8_t>(record.paletteCount, paletteColorsMax);
+  dev.paletteData.blend = record.paletteBlend;
+  for (uint8_t i = 0; i < dev.paletteData.count; i++) {
+    dev.paletteData.colors[i] = toColor(record.paletteColors[i]);
+  }
+
+  dev.fireData.cooling    = record.fireCooling;
+  dev.fireData.sparking   = record.fireSparking;
+  dev.meteorData.color    = toColor(record.meteorColor);
+  dev.meteorData.velocity = record.meteorVelocity;
+  dev.meteorData.tail     = record.meteorTail;
+  dev.twinkleData.color1  = toColor(record.twinkleColor1);
+  dev.twinkleData.color2  = toColor(record.twinkleColor2);
+  dev.twinkleData.rate    = record.twinkleRate;
+  dev.cometData.color1    = toColor(record.cometColor1);
+  dev.cometData.color2    = toColor(record.cometColor2);
+  dev.cometData.velocity  = record.cometVelocity;
+  dev.cometData.count     = record.cometCount;
+
+  dev.programData.slot =
+      record.programSlot < programSlots ? record.programSlot : 0;
+  memcpy(dev.programData.params, record.programParams,
+         sizeof(dev.programData.params));
+
+  dev.spectrumData.low   = toColor(record.spectrumLow);
+  dev.spectrumData.high  = toColor(record.spectrumHigh);
+  dev.spectrumData.gain  = record.spectrumGain;
+  dev.pulseData.color    = toColor(record.pulseColor);
+  dev.pulseData.velocity = record.pulseVelocity;
+
+  dev.sparkleData.color1  = toColor(record.sparkleColor1);
+  dev.sparkleData.color2  = toColor(record.sparkleColor2);
+  dev.sparkleData.rate    = record.sparkleRate;
+  dev.sparkleData.opacity = record.sparkleOpacity;
+
+  dev.paletteSparkleData.velocity = record.paletteSparkleVelocity;
+  dev.paletteSparkleData.rate     = record.paletteSparkleRate;
+  Blend_Mode blend                = Blend_Mode::normal;
+  decodeBlendMode(record.paletteSparkleBlend, blend);
+  dev.paletteSparkleData.blend = byte(blend);
+
+  // Empty zones, zones with an unknown mode or parameters, past this build's
+  // strip or overlapping an earlier one are dropped
+  SegmentsData &table = dev.segmentsData;
+  table.count         = 0;
+  for (uint8_t i = 0; i < record.segmentCount && i < SEGMENTS_MAX; i++) {
+    const SettingsSegment &stored = record.segments[i];
+    SegmentData &segment          = table.segments[table.count];
+    if (stored.length == 0 || !decodeMode(stored.mode, segment.mode) ||
+        uint32_t(stored.start) + stored.length > StripPixels::capacity()) {
+      continue;
+    }
+    segment.start  = stored.start;
+    segment.length = stored.length;
+    memset(segment.params, 0, sizeof(segment.params));
+    if (!findMode(segment.mode)->decodeZone(stored.params, segmentParamsSize,
+                                            segment) ||
+        table.overlapping(segment, table.count) != table.count) {
+      continue;
+    }
+    table.count++;
+  }
+}
+
+///
+///@brief Temporary file saveSettingsRecord() writes before renaming it
+///
+void tempSettingsPath(const char *filename, char *path, size_t size) {
+  snprintf(path, size, "%s.tmp", filename);
+}
+
+///
+///@brief Load one binary settings file into device. No heap allocation.
+///
+///@return int Error Code
+/// 0 -> OK
+/// 2 -> Failed opening the file
+/// 3 -> Truncated file or unknown format
+/// 4 -> CRC mismatch
+///
+int loadSettingsFile(const char *filename) {
+  File file = SPIFFS.open(filename, FILE_READ);
+  if (!file) {
+    return 2;
+  }
+
+  // One byte over the file, so a longer one is seen as such
+  uint8_t buffer[sizeof(SettingsHeader) + sizeof(SettingsRecord) +
+                 sizeof(uint32_t) + 1];
+  size_t size = file.read(buffer, sizeof(buffer));
+  file.close();
+
+  SettingsHeader header;
+  if (size < sizeof(header) + sizeof(uint32_t)) {
+    return 3;
+  }
+  memcpy(&header, buffer, sizeof(header));
+  if (header.magic != settingsMagic ||
+      size != sizeof(header) + header.size + sizeof(uint32_t)) {
+    return 3;
+  }
+
+  uint32_t crc;
+  memcpy(&crc, buffer + sizeof(header) + header.size, sizeof(crc));
+  if (crc != crc32(buffer, sizeof(header) + header.size)) {
+    return 4;
+  }
+
+  if (header.version != settingsVersion ||
+      header.size != sizeof(SettingsRecord)) {
+    return 3;
+  }
+
+  SettingsRecord record;
+  memcpy(&record, buffer + sizeof(header), sizeof(record));
+  recordToDevice(record, device);
+  return 0;
+}
+
+///
+///@brief Load the binary settings into device.
+/// If filename is missing or corrupt but the temporary file of an interrupted
+/// saveSettingsRecord() is valid, that one is loaded and renamed into place.
+///
+///@return int Error Code of loadSettingsFile(filename)
+///
+int loadSettings(const char *filename) {
+  int error = loadSettingsFile(filename);
+  if (error == 0) {
+    return 0;
+  }
+
+  char temp[32];
+  tempSettingsPath(filename, temp, sizeof(temp));
+  if (loadSettingsFile(temp) == 0) {
+    SPIFFS.remove(filename);
+    SPIFFS.rename(temp, filename);
+    return 0;
+  }
+  return error;
+}
+
+///
+///@brief Write a settings record to the binary settings file.
+/// The record is written to a temporary file first and renamed over the old
+/// file, so a power cut leaves either the old or the new settings.
+///
+bool saveSettingsRecord(const SettingsRecord &record, const char *filename) {
+  uint8_t buffer[sizeof(SettingsHeader) + sizeof(SettingsRecord) +
+                 sizeof(uint32_t)];
+
+  SettingsHeader header = {settingsMagic, settingsVersion,
+                           sizeof(SettingsRecord)};
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), &record, sizeof(record));
+  uint32_t crc = crc32(buffer, sizeof(header) + sizeof(record));
+  memcpy(buffer + sizeof(header) + sizeof(record), &crc, sizeof(crc));
+
+  char temp[32];
+  tempSettingsPath(filename, temp, sizeof(temp));
+
+  File file = SPIFFS.open(temp, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  size_t written = file.write(buffer, sizeof(buffer));
+  file.close();
+  if (written != sizeof(buffer)) {
+    SPIFFS.remove(temp);
+    return false;
+  }
+
+  // SPIFFS cannot rename onto an existing file. Between remove() and
+  // rename() only the temporary file exists, loadSettings() recovers it.
+  SPIFFS.remove(filename);
+  return SPIFFS.rename(temp, filename);
+}
+
+///
+///@brief Write device to the binary settings file
+///
+bool saveSettings(const char *filename) {
+  return saveSettingsRecord(recordFromDevice(device), filename);
+}
+
+#pragma endregion BinarySettings
+
+#pragma region JsonSettings
+
+// Fits the settings with a full zone table and a full palette
+const size_t settingsJsonCapacity = 4096;
+
+///@brief Reads the object of every mode with parameters, sett[jsonKey()]
+template <typename Json> struct ModeJsonReader {
+  Json &sett;
+  SettingsData &dev;
+
+  template <typename Mode> void visit() {
+    if (Mode::jsonKey() != nullptr) {
+      Mode::fromJson(sett[Mode::jsonKey()], Mode::params(dev));
+    }
+  }
+};
+
+///@brief Writes the object of every mode with parameters
+template <typename Json> struct ModeJsonWriter {
+  Json &sett;
+  SettingsData &dev;
+
+  template <typename Mode> void visit() {
+    if (Mode::jsonKey() != nullptr) {
+      Mode::toJson(Mode::params(dev), sett[Mode::jsonKey()]);
+    }
+  }
+};
+
+///@brief Reads the parameters of a zone running one of the modes, in the
+/// layout of the mode's object
+template <typename Json> struct ZoneJsonReader {
+  Json json;
+  SegmentData &segment;
+
+  template <typename Mode> void visit() {
+    if (Mode::id() == segment.mode && Mode::jsonKey() != nullptr) {
+      Mode::fromJson(json, zoneParams<Mode>(segment));
+    }
+  }
+};
+
+///@brief Writes the parameters of a zone running one of the modes
+template <typename Json> struct ZoneJsonWriter {
+  Json json;
+  const SegmentData &segment;
+
+  template <typename Mode> void visit() {
+    if (Mode::id() == segment.mode && Mode::jsonKey() != nullptr) {
+      Mode::toJson(zoneParams<Mode>(segment), json);
+    }
+  }
+};
+
+///
+///@brief Import a settings.json file into dev
+///
+///@return int Error Code
+/// 0 -> OK
+/// 2 -> Failed opening the file
+/// 3 -> Failed to Deserialize file
+///
+int importJsonSettings(const char *filename, SettingsData &dev) {
+  File file = SPIFFS.open(filename, FILE_READ);
+  if (!file) {
+    return 2;
+  }
+
+  DynamicJsonDocument sett(settingsJsonCapacity);
+  DeserializationError error = deserializeJson(sett, file);
+  file.close();
+  if (error) {
+    return 3;
+  }
+
+  // DefaultData
+  dev.defaultData.ledLenght =
+      clampLength(sett["DefaultData"]["ledLenght"].as<uint16_t>());
+  dev.defaultData.brightness = sett["DefaultData"]["brightness"];
+
+  // The parameters of the modes, FixedColorData...
+  ModeJsonReader<DynamicJsonDocument> reader{sett, dev};
+  Modes::forEach(reader);
+
+  // Mode
+  decodeMode(sett["mode"].as<byte>(), dev.activeMode);
+
+  // isOn
+  dev.isOn = int(sett["isOn"]);
+
+  // TransitionData, missing in files written before transitions
+  JsonVariant duration = sett["TransitionData"]["duration"];
+  dev.transitionData.duration =
+      duration.isNull() ? defaultTransitionMs : duration.as<uint16_t>();
+
+  // PaletteData, missing in files written before palettes
+  JsonVariant colors = sett["PaletteData"]["colors"];
+  if (colors.isNull()) {
+    dev.paletteData = defaultPalette;
+  } else {
+    PaletteData &palette = dev.paletteData;
+    memset(&palette, 0, sizeof(palette));
+    palette.count = min<size_t>(colors.size(), paletteColorsMax);
+    palette.blend = sett["PaletteData"]["blend"].as<bool>();
+    for (uint8_t i = 0; i < palette.count; i++) {
+      palette.colors[i].r = colors[i][0];
+      palette.colors[i].g = colors[i][1];
+      palette.colors[i].b = colors[i][2];
+    }
+  }
+
+  // Segments, missing in files written before zones. A zone with an unknown
+  // mode or parameters, past the strip or overlapping an earlier one is
+  // dropped
+  JsonVariant segments = sett["Segments"];
+  SegmentsData &table  = dev.segmentsData;
+  table.count          = 0;
+  for (size_t i = 0; i < segments.size() && i < SEGMENTS_MAX; i++) {
+    JsonVariant stored   = segments[i];
+    SegmentData &segment = table.segments[table.count];
+    if (!decodeMode(stored["mode"].as<byte>(), segment.mode)) {
+      continue;
+    }
+    segment.start  = stored["start"];
+    segment.length = stored["length"];
+    memset(segment.params, 0, sizeof(segment.params));
+    // The object of the zone's mode, its defaults when it is missing
+    ZoneJsonReader<JsonVariant> zone{stored["params"], segment};
+    Modes::forEach(zone);
+    if (segment.length == 0 ||
+        uint32_t(segment.start) + segment.length > StripPixels::capacity()) {
+      continue;
+    }
+    if (table.overlapping(segment, table.count) != table.count) {
+      continue;
+    }
+    table.count++;
+  }
+
+  return 0;
+}
+
+///
+///@brief Export dev to a settings.json file
+///
+bool exportJsonSettings(const SettingsData &dev, const char *filename) {
+  DynamicJsonDocument sett(settingsJsonCapacity);
+
+  sett["DefaultData"]["ledLenght"]  = dev.defaultData.ledLenght;
+  sett["DefaultData"]["brightness"] = dev.defaultData.brightness;
+
+  ModeJsonWriter<DynamicJsonDocument> writer{
+      sett, const_cast<SettingsData &>(dev)};
+  Modes::forEach(writer);
+
+  sett["mode"] = (byte)dev.activeMode;
+  sett["isOn"] = (byte)dev.isOn;
+
+  sett["TransitionData"]["duration"] = dev.transitionData.duration;
+
+  const PaletteData &palette   = dev.paletteData;
+  sett["PaletteData"]["blend"]   = palette.blend;
+  for (uint8_t i = 0; i < palette.count; i++) {
+    JsonVariant color = sett["PaletteData"]["colors"][i];
+    color[0]          = palette.colors[i].r;
+    color[1]          = palette.colors[i].g;
+    color[2]          = palette.colors[i].b;
+  }
+
+  for (uint8_t i = 0; i < dev.segmentsData.count; i++) {
+    const SegmentData &segment = dev.segmentsData.segments[i];
+    JsonVariant stored         = sett["Segments"][i];
+    stored["start"]            = segment.start;
+    stored["length"]           = segment.length;
+    stored["mode"]             = (byte)segment.mode;
+    ZoneJsonWriter<JsonVariant> writer{stored["params"], segment};
+    Modes::forEach(writer);
+  }
+
+  File file = SPIFFS.open(filename, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  bool ok = serializeJson(sett, file) != 0;
+  file.close();
+  return ok;
+}
+
+#pragma endregion JsonSettings
+
+#endif // SETTINGS_STORE_HPP
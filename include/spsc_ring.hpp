@@ -0,0 +1,75 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+///
+///@brief Lock-free single-producer/single-consumer ring buffer.
+/// push() must only be called by one task and pop() by one other task; both
+/// are O(1) and never block. Capacity must be a power of two.
+///
+template <typename T, uint32_t Capacity> class SpscRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "SpscRing Capacity must be a power of two");
+
+public:
+  ///@brief Producer side. Returns false (and counts a drop) when full.
+  bool push(const T &item) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == Capacity) {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slots[h & (Capacity - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  ///@brief Producer side. Publishes all `count` items at once, the consumer
+  /// sees either none or all of them. Returns false (and counts a drop) when
+  /// they do not all fit, nothing is pushed then.
+  bool pushAll(const T *items, uint32_t count) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (Capacity - (h - tail.load(std::memory_order_acquire)) < count) {
+      drops.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      slots[(h + i) & (Capacity - 1)] = items[i];
+    }
+    head.store(h + count, std::memory_order_release);
+    return true;
+  }
+
+  ///@brief Consumer side. Returns false when empty.
+  bool pop(T &item) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t) {
+      return false;
+    }
+    item = slots[t & (Capacity - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) ==
+           tail.load(std::memory_order_acquire);
+  }
+
+  uint32_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+private:
+  T slots[Capacity];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+  std::atomic<uint32_t> drops{0};
+};
+
+#endif // SPSC_RING_HPP
@@ -0,0 +1,401 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+#include "Arduino.h"
+#include "loop_modes.hpp"
+#include "settings.h"
+#include "spsc_ring.hpp"
+#include <Adafruit_NeoPixel.h>
+
+///
+///@brief Frames streamed by the app for Mode_Type::stream.
+///
+/// A frame is sent as one or more packets:
+///   [flags, sequence, start lo, start hi, ops...]
+///   flags    streamKeyframe: the frame starts from black, resyncs the
+///            decoder after a lost packet
+///            streamEndOfFrame: the frame is complete, show it
+///   sequence +1 on every packet, a gap drops packets until a keyframe
+///   start    pixel the ops begin at
+/// ops rewrite the previous frame from start on, pixels are r, g, b:
+///   0b00nnnnnn           skip n + 1 pixels, they keep their color
+///   0b01nnnnnn r g b     n + 1 pixels of one color
+///   0b10nnnnnn (r g b)*  n + 1 pixels of their own color
+///   0b11nnnnnn m         skip (n << 8 | m) + 1 pixels
+///
+const uint8_t streamKeyframe   = 0x01;
+const uint8_t streamEndOfFrame = 0x02;
+
+const size_t streamHeaderSize = 4;
+// Longest packet, the largest BLE attribute
+const size_t streamPacketMax = 512;
+
+const uint8_t streamOpSkip       = 0x00;
+const uint8_t streamOpRun        = 0x40;
+const uint8_t streamOpLiteral    = 0x80;
+const uint8_t streamOpLongSkip   = 0xC0;
+const uint8_t streamOpMax        = 64; // pixels of a short op
+const uint16_t streamLongSkipMax = 1 << 14;
+
+struct StreamPacket {
+  uint16_t length;
+  uint8_t data[streamPacketMax];
+};
+
+///
+///@brief Keeps the streamed frame and applies packets to it.
+/// The frame is kept apart from the strip buffer, in its wire format: the
+/// ops are deltas of the frame as sent, the strip can hold a transition mix
+/// of it. draw() copies it into the strip when its zone is redrawn.
+///
+class StreamDecoder {
+public:
+  ///@brief Apply one packet to the frame
+  ///@return true if the packet completed a frame
+  bool decode(const uint8_t *packet, size_t length) {
+    if (length < streamHeaderSize) {
+      dropped++;
+      return false;
+    }
+    uint8_t flags    = packet[0];
+    uint8_t sequence = packet[1];
+    bool inOrder     = synced && sequence == uint8_t(lastSequence + 1);
+    lastSequence     = sequence;
+
+    if (flags & streamKeyframe) {
+      memset(frame, 0, sizeof(frame));
+      synced = true;
+    } else if (!inOrder) {
+      synced = false;
+      dropped++;
+      return false;
+    }
+
+    if (!applyOps(packet[2] | packet[3] << 8, packet + streamHeaderSize,
+                  length - streamHeaderSize)) {
+      // The frame no longer matches the sender's, wait for a keyframe
+      synced = false;
+      dropped++;
+      return false;
+    }
+    if (flags & streamEndOfFrame) {
+      frames++;
+      return true;
+    }
+    return false;
+  }
+
+  ///@brief Copy the first `count` pixels of the frame into the strip from
+  /// `first` on. Like the modes' colors they go through OutputStage.
+  void draw(Adafruit_NeoPixel &strip, uint16_t first, uint16_t count) const {
+    memcpy(strip.getPixels() + first * stripBytesPerPixel, frame,
+           size_t(count) * stripBytesPerPixel);
+  }
+
+  uint32_t framesDecoded() const { return frames; }
+  uint32_t packetsDropped() const { return dropped; }
+
+private:
+  static const uint16_t capacity = STRIP_MAX_LEDS;
+
+  void setPixel(uint16_t index, const uint8_t *rgb) {
+    uint8_t *pixel            = frame + index * stripBytesPerPixel;
+    pixel[StripFormat::red]   = rgb[0];
+    pixel[StripFormat::green] = rgb[1];
+    pixel[StripFormat::blue]  = rgb[2];
+  }
+
+  ///@return false if the ops are truncated or go past the frame
+  bool applyOps(uint32_t index, const uint8_t *ops, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+      uint8_t op     = ops[i++];
+      uint32_t count = (op & 0x3F) + 1;
+      switch (op & 0xC0) {
+      case streamOpSkip:
+        index += count;
+        break;
+      case streamOpLongSkip:
+        if (i >= length) {
+          return false;
+        }
+        index += ((count - 1) << 8 | ops[i++]) + 1;
+        break;
+      case streamOpRun:
+        if (length - i < 3 || index + count > capacity) {
+          return false;
+        }
+        for (uint32_t n = 0; n < count; n++) {
+          setPixel(index++, ops + i);
+        }
+        i += 3;
+        break;
+      case streamOpLiteral:
+        if (length - i < 3 * count || index + count > capacity) {
+          return false;
+        }
+        for (uint32_t n = 0; n < count; n++, i += 3) {
+          setPixel(index++, ops + i);
+        }
+        break;
+      }
+    }
+    return true;
+  }
+
+  uint8_t frame[STRIP_MAX_LEDS * stripBytesPerPixel] = {};
+  uint8_t lastSequence = 0;
+  bool synced          = false;
+  uint32_t frames      = 0;
+  uint32_t dropped     = 0;
+};
+
+StreamDecoder streamDecoder;
+
+///
+///@brief Splits frames into packets of at most `mtu` bytes, the app side of
+/// the codec. Frames are `count` pixels of r, g, b bytes. It is used by the
+/// host tools and benchmarks, and documents the format.
+///
+class StreamEncoder {
+public:
+  explicit StreamEncoder(size_t mtu)
+      : mtu(mtu < streamPacketMax ? mtu : streamPacketMax) {}
+
+  ///@brief Encode `next` as the changes from `previous`, nullptr sends a
+  /// keyframe. emit(const uint8_t *packet, size_t length) gets the packets.
+  ///@return the bytes of all the packets
+  template <typename Emit>
+  size_t encode(const uint8_t *previous, const uint8_t *next, uint16_t count,
+                Emit emit) {
+    total = 0;
+    begin(previous == nullptr ? streamKeyframe : 0, 0);
+
+    uint16_t i = 0;
+    while (i < count) {
+      uint16_t same = 0;
+      while (i + same < count && unchanged(previous, next, i + same)) {
+        same++;
+      }
+      if (same > 0) {
+        if (i + same < count) {
+          skip(i, same, emit);
+        }
+        i += same;
+        continue;
+      }
+
+      uint16_t run = 1;
+      while (run < streamOpMax && i + run < count &&
+             memcmp(next + 3 * i, next + 3 * (i + run), 3) == 0) {
+        run++;
+      }
+      if (run >= 2) {
+        reserve(4, i, emit);
+        packet[length++] = streamOpRun | (run - 1);
+        memcpy(packet + length, next + 3 * i, 3);
+        length += 3;
+        i += run;
+        continue;
+      }
+
+      // Literal up to an unchanged pixel or a run of 2, both cost less
+      uint16_t literal = 1;
+      while (literal < streamOpMax && i + literal < count &&
+             !unchanged(previous, next, i + literal) &&
+             (i + literal + 1 >= count ||
+              memcmp(next + 3 * (i + literal), next + 3 * (i + literal + 1),
+                     3) != 0)) {
+        literal++;
+      }
+      if (length + 4 > mtu) {
+        flush(i, emit);
+      }
+      literal = min<uint16_t>(literal, (mtu - length - 1) / 3);
+      packet[length++] = streamOpLiteral | (literal - 1);
+      memcpy(packet + length, next + 3 * i, 3 * literal);
+      length += 3 * literal;
+      i += literal;
+    }
+
+    packet[0] |= streamEndOfFrame;
+    send(emit);
+    return total;
+  }
+
+private:
+  static bool unchanged(const uint8_t *previous, const uint8_t *next,
+                        uint16_t i) {
+    static const uint8_t black[3] = {0, 0, 0};
+    const uint8_t *before = previous ? previous + 3 * i : black;
+    return memcmp(before, next + 3 * i, 3) == 0;
+  }
+
+  void begin(uint8_t flags, uint16_t start) {
+    packet[0] = flags;
+    packet[1] = sequence++;
+    packet[2] = lowByte(start);
+    packet[3] = highByte(start);
+    length    = streamHeaderSize;
+  }
+
+  template <typename Emit> void send(Emit &emit) {
+    emit((const uint8_t *)packet, length);
+    total += length;
+  }
+
+  template <typename Emit> void flush(uint16_t start, Emit &emit) {
+    send(emit);
+    begin(0, start);
+  }
+
+  ///@brief Make room for `bytes` of ops, a new packet starts at pixel i
+  template <typename Emit>
+  void reserve(size_t bytes, uint16_t i, Emit &emit) {
+    if (length + bytes > mtu) {
+      flush(i, emit);
+    }
+  }
+
+  template <typename Emit>
+  void skip(uint16_t i, uint16_t pixels, Emit &emit) {
+    if (length == streamHeaderSize) {
+      // Nothing in the packet yet, it can start after the skip
+      uint16_t start = packet[2] | packet[3] << 8;
+      start += pixels;
+      packet[2] = lowByte(start);
+      packet[3] = highByte(start);
+      return;
+    }
+    while (pixels > 0) {
+      uint16_t n = min<uint16_t>(pixels, streamLongSkipMax);
+      i += n;
+      pixels -= n;
+      if (n <= streamOpMax) {
+        reserve(1, i, emit);
+        if (length > streamHeaderSize) {
+          packet[length++] = streamOpSkip | (n - 1);
+        }
+      } else {
+        reserve(2, i, emit);
+        if (length > streamHeaderSize) {
+          packet[length++] = streamOpLongSkip | ((n - 1) >> 8);
+          packet[length++] = (n - 1) & 0xFF;
+        }
+      }
+    }
+  }
+
+  const size_t mtu;
+  uint8_t packet[streamPacketMax];
+  size_t length    = 0;
+  size_t total     = 0;
+  uint8_t sequence = 0;
+};
+
+#pragma region Transports
+
+///
+///@brief A link the app streams packets over. The render task takes the
+/// packets with receive() and applies them between two frames.
+///
+class StreamTransport {
+public:
+  virtual ~StreamTransport() {}
+
+  ///@brief Next packet received, false if there is none
+  virtual bool receive(StreamPacket &packet) = 0;
+};
+
+///
+///@brief Packets written to the Stream characteristic. push() runs on the
+/// Bluetooth task, receive() on the render task.
+///
+class BleStreamTransport : public StreamTransport {
+public:
+  bool push(const uint8_t *data, size_t length) {
+    if (length > streamPacketMax) {
+      return false;
+    }
+    StreamPacket packet;
+    packet.length = length;
+    memcpy(packet.data, data, length);
+    return packets.push(packet);
+  }
+
+  bool receive(StreamPacket &packet) override { return packets.pop(packet); }
+
+private:
+  SpscRing<StreamPacket, 8> packets;
+};
+
+BleStreamTransport bleStream;
+
+///
+///@brief Packets framed on a serial port:
+///   [0xA5, length lo, length hi, packet, checksum]
+/// checksum is the sum of the packet bytes modulo 256. A bad frame is
+/// skipped, the decoder resyncs on the next keyframe.
+///
+class UartStreamTransport : public StreamTransport {
+public:
+  static const uint8_t sync = 0xA5;
+
+  explicit UartStreamTransport(HardwareSerial &port) : port(port) {}
+
+  bool receive(StreamPacket &packet) override {
+    while (port.available() > 0) {
+      uint8_t value = port.read();
+      switch (state) {
+      case State::sync:
+        if (value == sync) {
+          state = State::lengthLow;
+        }
+        break;
+      case State::lengthLow:
+        expected = value;
+        state    = State::lengthHigh;
+        break;
+      case State::lengthHigh:
+        expected |= value << 8;
+        received = 0;
+        checksum = 0;
+        state    = expected <= streamPacketMax ? State::data : State::sync;
+        if (expected == 0) {
+          state = State::checksum;
+        }
+        break;
+      case State::data:
+        current.data[received++] = value;
+        checksum += value;
+        if (received == expected) {
+          state = State::checksum;
+        }
+        break;
+      case State::checksum:
+        state = State::sync;
+        if (value == checksum) {
+          current.length = expected;
+          packet         = current;
+          return true;
+        }
+        break;
+      }
+    }
+    return false;
+  }
+
+private:
+  enum class State : uint8_t { sync, lengthLow, lengthHigh, data, checksum };
+
+  HardwareSerial &port;
+  State state       = State::sync;
+  uint16_t expected = 0;
+  uint16_t received = 0;
+  uint8_t checksum  = 0;
+  StreamPacket current;
+};
+
+#pragma endregion Transports
+
+#endif // STREAM_HPP
@@ -0,0 +1,157 @@
+#ifndef TASKS_HPP
+#define TASKS_HPP
+
+#include "Arduino.h"
+#include "diagnostics.hpp"
+
+#ifdef ESP32
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#endif
+
+///
+/// The firmware runs on pinned tasks next to the Bluetooth stack:
+///   render   core 1, high priority: streamed packets, the frames, the output
+///   control  core 0: the commands of the GATT callbacks, the button, the
+///            status LED, notifications, serial commands, what to save
+///   storage  core 0, lowest priority: the settings files and the log
+///   audio    core 0, above control: the microphone and its analysis, only
+///            with a microphone, see audio.hpp
+/// The GATT callbacks only queue their payload (commands.hpp, stream.hpp) and
+/// raise an event. Control is the only task that changes device, and it does
+/// so holding the FrameLock, so render sees a change only between two frames.
+///
+
+// Events of the control task
+const uint32_t commandEvent    = 1 << 0; // commands queued
+const uint32_t buttonEvent     = 1 << 1; // the button changed
+const uint32_t connectionEvent = 1 << 2; // a client connected or left
+
+struct TaskSpec {
+  const char *name;
+  uint32_t stackBytes;
+  uint8_t priority;
+  uint8_t core;
+};
+
+// In Task_Id order. Bluetooth runs on core 0 above all of them.
+const TaskSpec taskSpecs[taskCount] = {
+    {"render", 6144, 5, 1},
+    {"control", 6144, 3, 0},
+    {"storage", 6144, 1, 0},
+    {"audio", 4096, 4, 0},
+};
+
+///
+///@brief The task handles, the event group of the control task and the
+/// frame mutex.
+/// On the host there are no tasks: main() runs their iterations in turn, and
+/// raise(), wait() and the lock do nothing.
+///
+class Tasks {
+public:
+  ///@brief Call before anything raises an event
+  void begin() {
+#ifdef ESP32
+    events     = xEventGroupCreate();
+    frameMutex = xSemaphoreCreateMutex();
+#endif
+  }
+
+  ///@return false if the task could not be created
+  bool start(Task_Id id, void (*body)(void *)) {
+#ifdef ESP32
+    const TaskSpec &spec = taskSpecs[uint8_t(id)];
+    return xTaskCreatePinnedToCore(body, spec.name, spec.stackBytes, nullptr,
+                                   spec.priority, &handles[uint8_t(id)],
+                                   spec.core) == pdPASS;
+#else
+    return true;
+#endif
+  }
+
+  ///@brief Any task: wake the control task for `bits`
+  void raise(uint32_t bits) {
+#ifdef ESP32
+    if (events != nullptr) {
+      xEventGroupSetBits(events, bits);
+    }
+#endif
+  }
+
+#ifdef ESP32
+  void IRAM_ATTR raiseFromISR(uint32_t bits) {
+    BaseType_t woken = pdFALSE;
+    if (events != nullptr &&
+        xEventGroupSetBitsFromISR(events, bits, &woken) == pdPASS &&
+        woken == pdTRUE) {
+      portYIELD_FROM_ISR();
+    }
+  }
+#endif
+
+  ///@brief Control task: block until one of `bits` is raised or for
+  /// timeoutMs, and clear them
+  ///@return the bits raised
+  uint32_t wait(uint32_t bits, unsigned long timeoutMs) {
+#ifdef ESP32
+    return xEventGroupWaitBits(events, bits, pdTRUE, pdFALSE,
+                               pdMS_TO_TICKS(timeoutMs)) &
+           bits;
+#else
+    return 0;
+#endif
+  }
+
+  void lockFrame() {
+#ifdef ESP32
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+#endif
+  }
+
+  void unlockFrame() {
+#ifdef ESP32
+    xSemaphoreGive(frameMutex);
+#endif
+  }
+
+  ///@brief Hand the stack high-water marks to the diagnostics
+  void reportStacks() {
+#ifdef ESP32
+    for (uint8_t i = 0; i < taskCount; i++) {
+      if (handles[i] != nullptr) {
+        // ESP-IDF counts stacks in bytes
+        diagnostics.setStackFree(Task_Id(i),
+                                 uxTaskGetStackHighWaterMark(handles[i]));
+      }
+    }
+#endif
+  }
+
+private:
+#ifdef ESP32
+  TaskHandle_t handles[taskCount] = {};
+  EventGroupHandle_t events       = nullptr;
+  SemaphoreHandle_t frameMutex    = nullptr;
+#endif
+} tasks;
+
+///
+///@brief Held by the render task while it renders and shows a frame, and by
+/// the other tasks while they change or copy what a frame reads (device,
+/// the engines, the output stage). The storage task only holds it to copy
+/// what it saves and writes the files without it: a flash write stalls the
+/// caches of both cores for one sector operation at a time, not for the
+/// whole file, and the render and control tasks keep running in between.
+///
+class FrameLock {
+public:
+  FrameLock() { tasks.lockFrame(); }
+  ~FrameLock() { tasks.unlockFrame(); }
+
+  FrameLock(const FrameLock &) = delete;
+  FrameLock &operator=(const FrameLock &) = delete;
+};
+
+#endif // TASKS_HPP
@@ -0,0 +1,143 @@
+#ifndef TRANSITION_HPP
+#define TRANSITION_HPP
+
+#include "Arduino.h"
+#include "compositor.hpp"
+#include "segments.hpp"
+#include "settings.h"
+
+///
+///@brief Crossfade from the previous active mode to the new one.
+/// begin() keeps the last frame shown, still in the strip buffer, as the
+/// outgoing frame. On every transition frame:
+///  - restoreIncoming() puts the clean incoming frame back into the strip,
+///    SegmentEngine then redraws it only when it is due, so a static mode is
+///    rendered once for the whole transition,
+///  - blend() saves the incoming frame, advances the outgoing one only if its
+///    mode is animated and writes the mix of the two into the strip.
+/// The mix is an 8.8 fixed point lerp over the wire format bytes, which does
+/// not depend on the byte order, so swar::lerp mixes 4 bytes per op.
+///
+class TransitionEngine {
+public:
+  static const uint16_t fps = 60;
+
+  ///@brief Start fading out of `segment`, the whole strip zone of the mode
+  /// being replaced. `state` is its SegmentEngine state, so an animated mode
+  /// carries on from where it was.
+  void begin(const SegmentData &segment,
+             const ModeState &state,
+             const Adafruit_NeoPixel &strip, uint16_t duration,
+             unsigned long now) {
+    if (duration == 0) {
+      running = false;
+      return;
+    }
+    // Interrupting a transition fades out of the mix on the strip, frozen.
+    animated = !running && !modeTiming(segment.mode).isStatic;
+
+    outgoingSegment = segment;
+    outgoingState   = state;
+    outgoing.setLength(strip.numPixels());
+    bytes = frameBytes(strip);
+    memcpy(outgoing.getPixels(), strip.getPixels(), bytes);
+
+    hasIncoming = false;
+    startMs     = now;
+    durationMs  = duration;
+    nextFrameMs = now;
+    running     = true;
+  }
+
+  bool active() const { return running; }
+
+  void cancel() { running = false; }
+
+  bool frameDue(unsigned long now) const {
+    return running && long(now - nextFrameMs) >= 0;
+  }
+
+  ///@return false if no transition is running
+  bool nextFrame(unsigned long &due) const {
+    due = nextFrameMs;
+    return running;
+  }
+
+  ///@brief Put the unmixed incoming frame back into the strip buffer
+  void restoreIncoming(Adafruit_NeoPixel &strip) {
+    if (running && hasIncoming && frameBytes(strip) == bytes) {
+      memcpy(strip.getPixels(), incoming, bytes);
+    }
+  }
+
+  ///@brief Mix the incoming frame in the strip with the outgoing one.
+  /// The last frame is the incoming one alone and ends the transition.
+  void blend(Adafruit_NeoPixel &strip, unsigned long now) {
+    if (!running) {
+      return;
+    }
+    if (frameBytes(strip) != bytes) {
+      // The length changed, the outgoing frame does not fit any more
+      running = false;
+      return;
+    }
+
+    uint8_t *pixels = strip.getPixels();
+    memcpy(incoming, pixels, bytes);
+    hasIncoming = true;
+
+    unsigned long elapsed = now - startMs;
+    if (elapsed >= durationMs) {
+      running = false;
+      return;
+    }
+    uint16_t alpha = uint16_t((uint32_t(elapsed) << 8) / durationMs);
+
+    if (animated) {
+      uint16_t length = SegmentEngine::visibleLength(outgoing, outgoingSegment);
+      const ModeEntry *mode = findMode(outgoingSegment.mode);
+      if (mode != nullptr &&
+          (mode->prepare == nullptr || mode->prepare(length))) {
+        mode->draw(outgoing, outgoingSegment, length, outgoingState, now);
+      }
+    }
+
+    const uint8_t *from = outgoing.getPixels();
+    size_t i            = 0;
+    for (; i + sizeof(uint32_t) <= bytes; i += sizeof(uint32_t)) {
+      uint32_t a, b;
+      memcpy(&a, from + i, sizeof(a));
+      memcpy(&b, incoming + i, sizeof(b));
+      a = swar::lerp(a, b, alpha);
+      memcpy(pixels + i, &a, sizeof(a));
+    }
+    for (; i < bytes; i++) {
+      pixels[i] = (from[i] * (256 - alpha) + incoming[i] * alpha) >> 8;
+    }
+
+    nextFrameMs = now + 1000UL / fps;
+  }
+
+private:
+  static size_t frameBytes(const Adafruit_NeoPixel &strip) {
+    return size_t(strip.numPixels()) * stripBytesPerPixel;
+  }
+
+  StripPixels outgoing{0, -1, stripPixelType};
+  uint8_t incoming[STRIP_MAX_LEDS * stripBytesPerPixel];
+  size_t bytes = 0;
+
+  SegmentData outgoingSegment;
+  ModeState outgoingState;
+  bool animated    = false;
+  bool hasIncoming = false;
+  bool running     = false;
+
+  unsigned long startMs     = 0;
+  unsigned long nextFrameMs = 0;
+  uint16_t durationMs       = 0;
+};
+
+TransitionEngine transitionEngine;
+
+#endif // TRANSITION_HPP
@@ -0,0 +1,257 @@
+#include "Adafruit_NeoPixel.h"
+
+static const uint8_t _NeoPixelGammaTable[256] = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,   2,   3,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   5,   6,
+    6,   6,   6,   7,   7,   7,   8,   8,   8,   9,   9,   9,   10,  10,  10,
+    11,  11,  11,  12,  12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,
+    17,  18,  18,  19,  19,  20,  20,  21,  21,  22,  22,  23,  24,  24,  25,
+    25,  26,  27,  27,  28,  29,  29,  30,  31,  31,  32,  33,  34,  34,  35,
+    36,  37,  38,  38,  39,  40,  41,  42,  42,  43,  44,  45,  46,  47,  48,
+    49,  50,  51,  52,  53,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63,
+    64,  65,  66,  68,  69,  70,  71,  72,  73,  75,  76,  77,  78,  80,  81,
+    82,  84,  85,  86,  88,  89,  90,  92,  93,  94,  96,  97,  99,  100, 102,
+    103, 105, 106, 108, 109, 111, 112, 114, 115, 117, 119, 120, 122, 124, 125,
+    127, 129, 130, 132, 134, 136, 137, 139, 141, 143, 145, 146, 148, 150, 152,
+    154, 156, 158, 160, 162, 164, 166, 168, 170, 172, 174, 176, 178, 180, 182,
+    184, 186, 188, 191, 193, 195, 197, 199, 202, 204, 206, 209, 211, 213, 215,
+    218, 220, 223, 225, 227, 230, 232, 235, 237, 240, 242, 245, 247, 250, 252,
+    255};
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, int16_t p, neoPixelType t)
+    : begun(false), brightness(0), pixels(NULL), endTime(0) {
+  updateType(t);
+  updateLength(n);
+  setPin(p);
+}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel()
+    : is800KHz(true), begun(false), numLEDs(0), numBytes(0), pin(-1),
+      brightness(0), pixels(NULL), rOffset(1), gOffset(0), bOffset(2),
+      wOffset(1), endTime(0) {}
+
+Adafruit_NeoPixel::~Adafruit_NeoPixel() { free(pixels); }
+
+void Adafruit_NeoPixel::show(void) {
+  shows++;
+  shownBytes += numBytes;
+}
+
+void Adafruit_NeoPixel::updateLength(uint16_t n) {
+  free(pixels);
+
+  numBytes = n * ((wOffset == rOffset) ? 3 : 4);
+  if ((pixels = (uint8_t *)malloc(numBytes))) {
+    memset(pixels, 0, numBytes);
+    numLEDs = n;
+  } else {
+    numLEDs = numBytes = 0;
+  }
+}
+
+void Adafruit_NeoPixel::updateType(neoPixelType t) {
+  bool oldThreeBytesPerPixel = (wOffset == rOffset);
+
+  wOffset  = (t >> 6) & 0b11;
+  rOffset  = (t >> 4) & 0b11;
+  gOffset  = (t >> 2) & 0b11;
+  bOffset  = t & 0b11;
+  is800KHz = (t < 256);
+
+  if (pixels) {
+    bool newThreeBytesPerPixel = (wOffset == rOffset);
+    if (newThreeBytesPerPixel != oldThreeBytesPerPixel)
+      updateLength(numLEDs);
+  }
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g,
+                                      uint8_t b) {
+  if (n < numLEDs) {
+    if (brightness) {
+      r = (r * brightness) >> 8;
+      g = (g * brightness) >> 8;
+      b = (b * brightness) >> 8;
+    }
+    uint8_t *p;
+    if (wOffset == rOffset) {
+      p = &pixels[n * 3];
+    } else {
+      p          = &pixels[n * 4];
+      p[wOffset] = 0;
+    }
+    p[rOffset] = r;
+    p[gOffset] = g;
+    p[bOffset] = b;
+  }
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g,
+                                      uint8_t b, uint8_t w) {
+  if (n < numLEDs) {
+    if (brightness) {
+      r = (r * brightness) >> 8;
+      g = (g * brightness) >> 8;
+      b = (b * brightness) >> 8;
+      w = (w * brightness) >> 8;
+    }
+    uint8_t *p;
+    if (wOffset == rOffset) {
+      p = &pixels[n * 3];
+    } else {
+      p          = &pixels[n * 4];
+      p[wOffset] = w;
+    }
+    p[rOffset] = r;
+    p[gOffset] = g;
+    p[bOffset] = b;
+  }
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t c) {
+  if (n < numLEDs) {
+    uint8_t *p, r = (uint8_t)(c >> 16), g = (uint8_t)(c >> 8), b = (uint8_t)c;
+    if (brightness) {
+      r = (r * brightness) >> 8;
+      g = (g * brightness) >> 8;
+      b = (b * brightness) >> 8;
+    }
+    if (wOffset == rOffset) {
+      p = &pixels[n * 3];
+    } else {
+      p          = &pixels[n * 4];
+      uint8_t w  = (uint8_t)(c >> 24);
+      p[wOffset] = brightness ? ((w * brightness) >> 8) : w;
+    }
+    p[rOffset] = r;
+    p[gOffset] = g;
+    p[bOffset] = b;
+  }
+}
+
+void Adafruit_NeoPixel::fill(uint32_t c, uint16_t first, uint16_t count) {
+  uint16_t i, end;
+
+  if (first >= numLEDs) {
+    return;
+  }
+
+  if (count == 0) {
+    end = numLEDs;
+  } else {
+    end = first + count;
+    if (end > numLEDs)
+      end = numLEDs;
+  }
+
+  for (i = first; i < end; i++) {
+    this->setPixelColor(i, c);
+  }
+}
+
+uint32_t Adafruit_NeoPixel::ColorHSV(uint16_t hue, uint8_t sat, uint8_t val) {
+  uint8_t r, g, b;
+
+  hue = (hue * 1530L + 32768) / 65536;
+
+  if (hue < 510) {
+    b = 0;
+    if (hue < 255) {
+      r = 255;
+      g = hue;
+    } else {
+      r = 510 - hue;
+      g = 255;
+    }
+  } else if (hue < 1020) {
+    r = 0;
+    if (hue < 765) {
+      g = 255;
+      b = hue - 510;
+    } else {
+      g = 1020 - hue;
+      b = 255;
+    }
+  } else if (hue < 1530) {
+    g = 0;
+    if (hue < 1275) {
+      r = hue - 1020;
+      b = 255;
+    } else {
+      r = 255;
+      b = 1530 - hue;
+    }
+  } else {
+    r = 255;
+    g = b = 0;
+  }
+
+  uint32_t v1 = 1 + val;
+  uint16_t s1 = 1 + sat;
+  uint8_t s2  = 255 - sat;
+  return ((((((r * s1) >> 8) + s2) * v1) & 0xff00) << 8) |
+         (((((g * s1) >> 8) + s2) * v1) & 0xff00) |
+         (((((b * s1) >> 8) + s2) * v1) >> 8);
+}
+
+uint32_t Adafruit_NeoPixel::getPixelColor(uint16_t n) const {
+  if (n >= numLEDs)
+    return 0;
+
+  uint8_t *p;
+
+  if (wOffset == rOffset) {
+    p = &pixels[n * 3];
+    if (brightness) {
+      return (((uint32_t)(p[rOffset] << 8) / brightness) << 16) |
+             (((uint32_t)(p[gOffset] << 8) / brightness) << 8) |
+             ((uint32_t)(p[bOffset] << 8) / brightness);
+    } else {
+      return ((uint32_t)p[rOffset] << 16) | ((uint32_t)p[gOffset] << 8) |
+             (uint32_t)p[bOffset];
+    }
+  } else {
+    p = &pixels[n * 4];
+    if (brightness) {
+      return (((uint32_t)(p[wOffset] << 8) / brightness) << 24) |
+             (((uint32_t)(p[rOffset] << 8) / brightness) << 16) |
+             (((uint32_t)(p[gOffset] << 8) / brightness) << 8) |
+             ((uint32_t)(p[bOffset] << 8) / brightness);
+    } else {
+      return ((uint32_t)p[wOffset] << 24) | ((uint32_t)p[rOffset] << 16) |
+             ((uint32_t)p[gOffset] << 8) | (uint32_t)p[bOffset];
+    }
+  }
+}
+
+void Adafruit_NeoPixel::setBrightness(uint8_t b) {
+  uint8_t newBrightness = b + 1;
+  if (newBrightness != brightness) {
+    uint8_t c, *ptr = pixels, oldBrightness = brightness - 1;
+    uint16_t scale;
+    if (oldBrightness == 0)
+      scale = 0;
+    else if (b == 255)
+      scale = 65535 / oldBrightness;
+    else
+      scale = (((uint16_t)newBrightness << 8) - 1) / oldBrightness;
+    for (uint16_t i = 0; i < numBytes; i++) {
+      c      = *ptr;
+      *ptr++ = (c * scale) >> 8;
+    }
+    brightness = newBrightness;
+  }
+}
+
+void Adafruit_NeoPixel::clear(void) { memset(pixels, 0, numBytes); }
+
+uint8_t Adafruit_NeoPixel::gamma8(uint8_t x) { return _NeoPixelGammaTable[x]; }
+
+uint32_t Adafruit_NeoPixel::gamma32(uint32_t x) {
+  uint8_t *y = (uint8_t *)&x;
+  for (uint8_t i = 0; i < 4; i++)
+    y[i] = gamma8(y[i]);
+  return x;
+}
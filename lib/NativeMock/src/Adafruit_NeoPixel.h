@@ -0,0 +1,88 @@
+#ifndef NATIVE_MOCK_ADAFRUIT_NEOPIXEL_H
+#define NATIVE_MOCK_ADAFRUIT_NEOPIXEL_H
+
+// Host stand-in for Adafruit_NeoPixel. The pixel-buffer side (setPixelColor,
+// fill, setBrightness, ColorHSV, gamma32...) is a faithful copy of the library
+// so render costs measured on the host are representative; show() does not
+// drive any pin, it only counts the frames and bytes that would be sent.
+
+#include "Arduino.h"
+
+typedef uint16_t neoPixelType;
+
+#define NEO_RGB ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_RBG ((0 << 6) | (0 << 4) | (2 << 2) | (1))
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_GBR ((2 << 6) | (2 << 4) | (0 << 2) | (1))
+#define NEO_BRG ((1 << 6) | (1 << 4) | (2 << 2) | (0))
+#define NEO_BGR ((2 << 6) | (2 << 4) | (1 << 2) | (0))
+#define NEO_RGBW ((3 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRBW ((3 << 6) | (1 << 4) | (0 << 2) | (2))
+
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+class Adafruit_NeoPixel {
+public:
+  Adafruit_NeoPixel(uint16_t n, int16_t pin = 6,
+                    neoPixelType type = NEO_GRB + NEO_KHZ800);
+  Adafruit_NeoPixel(void);
+  ~Adafruit_NeoPixel();
+
+  void begin(void) { begun = true; }
+  void show(void);
+  void setPin(int16_t p) { pin = p; }
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b);
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w);
+  void setPixelColor(uint16_t n, uint32_t c);
+  void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0);
+  void setBrightness(uint8_t b);
+  void clear(void);
+  void updateLength(uint16_t n);
+  void updateType(neoPixelType t);
+  bool canShow(void) { return true; }
+
+  uint8_t *getPixels(void) const { return pixels; }
+  uint8_t getBrightness(void) const { return brightness - 1; }
+  int16_t getPin(void) const { return pin; }
+  uint16_t numPixels(void) const { return numLEDs; }
+  uint32_t getPixelColor(uint16_t n) const;
+
+  static uint8_t gamma8(uint8_t x);
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) {
+    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+  }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b, uint8_t w) {
+    return ((uint32_t)w << 24) | ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+  }
+  static uint32_t ColorHSV(uint16_t hue, uint8_t sat = 255, uint8_t val = 255);
+  static uint32_t gamma32(uint32_t x);
+
+  // Host-only counters, reset with resetStats().
+  uint32_t showCount(void) const { return shows; }
+  uint64_t bytesShown(void) const { return shownBytes; }
+  void resetStats(void) {
+    shows      = 0;
+    shownBytes = 0;
+  }
+
+protected:
+  bool is800KHz;
+  bool begun;
+  uint16_t numLEDs;
+  uint16_t numBytes;
+  int16_t pin;
+  uint8_t brightness;
+  uint8_t *pixels;
+  uint8_t rOffset;
+  uint8_t gOffset;
+  uint8_t bOffset;
+  uint8_t wOffset;
+  uint32_t endTime;
+
+private:
+  uint32_t shows      = 0;
+  uint64_t shownBytes = 0;
+};
+
+#endif // NATIVE_MOCK_ADAFRUIT_NEOPIXEL_H
@@ -0,0 +1,127 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+
+namespace {
+bool frozen                = false;
+unsigned long frozenMicros = 0;
+bool serialEcho            = true;
+int pinState[64];
+bool pinStateInit = false;
+
+unsigned long long hostMicros() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+} // namespace
+
+namespace mock {
+void setMillis(unsigned long ms) {
+  frozen       = true;
+  frozenMicros = ms * 1000UL;
+}
+
+void advanceMillis(unsigned long ms) {
+  if (!frozen) {
+    setMillis(millis());
+  }
+  frozenMicros += ms * 1000UL;
+}
+
+void useRealClock() { frozen = false; }
+
+void setDigitalPin(uint8_t pin, int value) {
+  if (!pinStateInit) {
+    for (int &state : pinState) {
+      state = HIGH;
+    }
+    pinStateInit = true;
+  }
+  pinState[pin % 64] = value;
+}
+
+void setSerialEcho(bool enabled) { serialEcho = enabled; }
+} // namespace mock
+
+unsigned long micros() {
+  return frozen ? frozenMicros : (unsigned long)hostMicros();
+}
+
+unsigned long millis() { return micros() / 1000UL; }
+
+void delay(unsigned long ms) {
+  if (frozen) {
+    frozenMicros += ms * 1000UL;
+  } else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  }
+}
+
+void delayMicroseconds(unsigned int us) {
+  if (frozen) {
+    frozenMicros += us;
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+int digitalRead(uint8_t pin) {
+  return pinStateInit ? pinState[pin % 64] : HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) { mock::setDigitalPin(pin, val); }
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (serialEcho) {
+    fputc(c, stdout);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (serialEcho) {
+    fwrite(buffer, 1, size, stdout);
+  }
+  return size;
+}
+
+size_t HardwareSerial::print(const char *str) {
+  return write((const uint8_t *)str, strlen(str));
+}
+
+size_t HardwareSerial::print(char c) { return write((uint8_t)c); }
+
+size_t HardwareSerial::print(long value) {
+  return print(std::to_string(value).c_str());
+}
+
+size_t HardwareSerial::print(unsigned long value) {
+  return print(std::to_string(value).c_str());
+}
+
+size_t HardwareSerial::print(double value, int decimals) {
+  return print(String(value, decimals));
+}
+
+size_t HardwareSerial::printf(const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  return write((const uint8_t *)buf,
+               size_t(len) < sizeof(buf) ? size_t(len) : sizeof(buf) - 1);
+}
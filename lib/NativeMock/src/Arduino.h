@@ -0,0 +1,138 @@
+#ifndef NATIVE_MOCK_ARDUINO_H
+#define NATIVE_MOCK_ARDUINO_H
+
+// Host stand-in for the Arduino core. Only the subset of the API used by the
+// firmware headers is provided, so the render path can be compiled and
+// benchmarked on a Linux box (env:native).
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+// Like the ESP32 core
+using std::max;
+using std::min;
+
+#define lowByte(w) ((uint8_t)((w)&0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+namespace mock {
+///
+///@brief Freeze millis()/micros() at the given time. Benchmarks use it to
+/// step animations deterministically instead of following the wall clock.
+///
+void setMillis(unsigned long ms);
+void advanceMillis(unsigned long ms);
+/// Go back to a clock that follows the host monotonic clock.
+void useRealClock();
+
+/// Value returned by digitalRead(pin). Pins read HIGH until set.
+void setDigitalPin(uint8_t pin, int value);
+
+/// When false, Serial output is swallowed (default: true).
+void setSerialEcho(bool enabled);
+} // namespace mock
+
+class String {
+public:
+  String(const char *cstr = "") : s(cstr ? cstr : "") {}
+  String(const std::string &str) : s(str) {}
+  explicit String(char c) : s(1, c) {}
+  explicit String(int value) : s(std::to_string(value)) {}
+  explicit String(unsigned int value) : s(std::to_string(value)) {}
+  explicit String(long value) : s(std::to_string(value)) {}
+  explicit String(unsigned long value) : s(std::to_string(value)) {}
+  explicit String(unsigned char value) : s(std::to_string(value)) {}
+  explicit String(bool value) : s(std::to_string(int(value))) {}
+  explicit String(double value, unsigned char decimals = 2) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    s = buf;
+  }
+
+  const char *c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.length(); }
+  long toInt() const { return std::strtol(s.c_str(), nullptr, 10); }
+
+  String &operator+=(const String &rhs) {
+    s += rhs.s;
+    return *this;
+  }
+  String &operator+=(const char *rhs) {
+    s += rhs;
+    return *this;
+  }
+  bool operator==(const String &rhs) const { return s == rhs.s; }
+  bool operator!=(const String &rhs) const { return s != rhs.s; }
+
+  friend String operator+(const String &lhs, const String &rhs) {
+    return String(lhs.s + rhs.s);
+  }
+  friend String operator+(const String &lhs, const char *rhs) {
+    return String(lhs.s + rhs);
+  }
+  friend String operator+(const char *lhs, const String &rhs) {
+    return String(lhs + rhs.s);
+  }
+
+private:
+  std::string s;
+};
+
+class HardwareSerial {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  int available() { return 0; }
+  int read() { return -1; }
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+
+  size_t print(const char *str);
+  size_t print(const String &str) { return print(str.c_str()); }
+  size_t print(char c);
+  size_t print(int value) { return print(long(value)); }
+  size_t print(unsigned int value) { return print((unsigned long)value); }
+  size_t print(unsigned char value) { return print((unsigned long)value); }
+  size_t print(long value);
+  size_t print(unsigned long value);
+  size_t print(double value, int decimals = 2);
+
+  template <typename T> size_t println(const T &value) {
+    size_t n = print(value);
+    return n + print("\r\n");
+  }
+  size_t println() { return print("\r\n"); }
+
+  size_t printf(const char *format, ...)
+      __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+#endif // NATIVE_MOCK_ARDUINO_H
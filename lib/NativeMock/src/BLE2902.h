@@ -0,0 +1,9 @@
+#ifndef NATIVE_MOCK_BLE2902_H
+#define NATIVE_MOCK_BLE2902_H
+
+#include "BLEServer.h"
+
+// Client Characteristic Configuration descriptor
+class BLE2902 : public BLEDescriptor {};
+
+#endif // NATIVE_MOCK_BLE2902_H
@@ -0,0 +1,18 @@
+#ifndef NATIVE_MOCK_BLEDEVICE_H
+#define NATIVE_MOCK_BLEDEVICE_H
+
+#include "BLEServer.h"
+
+class BLEDevice {
+public:
+  static void init(const std::string &name) {}
+  static BLEServer *createServer() { return new BLEServer; }
+  static BLEAdvertising *getAdvertising() {
+    static BLEAdvertising advertising;
+    return &advertising;
+  }
+  static void startAdvertising() {}
+  static void setMTU(uint16_t mtu) {}
+};
+
+#endif // NATIVE_MOCK_BLEDEVICE_H
@@ -0,0 +1,90 @@
+#ifndef NATIVE_MOCK_BLESERVER_H
+#define NATIVE_MOCK_BLESERVER_H
+
+// Host stand-ins for the ESP32 BLE classes. The render path only holds
+// pointers to them; the payload decoders of ble.hpp, built by the host
+// tests, also need the callbacks and characteristics that keep their value.
+
+#include "Arduino.h"
+
+#include <string>
+
+class BLEUUID {
+public:
+  BLEUUID() = default;
+  BLEUUID(const char *uuid) {}
+  BLEUUID(uint16_t uuid) {}
+};
+
+class BLEDescriptor {
+public:
+  virtual ~BLEDescriptor() = default;
+};
+
+class BLECharacteristic;
+
+class BLECharacteristicCallbacks {
+public:
+  virtual ~BLECharacteristicCallbacks() = default;
+  virtual void onRead(BLECharacteristic *characteristic) {}
+  virtual void onWrite(BLECharacteristic *characteristic) {}
+};
+
+class BLECharacteristic {
+public:
+  static const uint32_t PROPERTY_READ     = 1 << 0;
+  static const uint32_t PROPERTY_WRITE    = 1 << 1;
+  static const uint32_t PROPERTY_NOTIFY   = 1 << 2;
+  static const uint32_t PROPERTY_INDICATE = 1 << 4;
+  static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+  void setValue(const uint8_t *data, size_t size) {
+    value.assign(reinterpret_cast<const char *>(data), size);
+  }
+  void setValue(const std::string &data) { value = data; }
+  std::string getValue() { return value; }
+  uint8_t *getData() { return reinterpret_cast<uint8_t *>(&value[0]); }
+  void notify(bool success = true) {}
+  void indicate() {}
+  void setCallbacks(BLECharacteristicCallbacks *callbacks) {}
+  void addDescriptor(BLEDescriptor *descriptor) {}
+
+private:
+  std::string value;
+};
+
+class BLEService {
+public:
+  BLECharacteristic *createCharacteristic(const char *uuid,
+                                          uint32_t properties) {
+    return new BLECharacteristic;
+  }
+  void start() {}
+};
+
+class BLEAdvertising {
+public:
+  void addServiceUUID(const char *uuid) {}
+  void start() {}
+};
+
+class BLEServer;
+
+class BLEServerCallbacks {
+public:
+  virtual ~BLEServerCallbacks() = default;
+  virtual void onConnect(BLEServer *server) {}
+  virtual void onDisconnect(BLEServer *server) {}
+};
+
+class BLEServer {
+public:
+  void setCallbacks(BLEServerCallbacks *callbacks) {}
+  BLEService *createService(BLEUUID uuid, uint32_t handles = 15,
+                            uint8_t instance = 0) {
+    return new BLEService;
+  }
+  uint32_t getConnectedCount() { return 0; }
+};
+
+#endif // NATIVE_MOCK_BLESERVER_H
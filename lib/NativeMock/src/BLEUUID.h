@@ -0,0 +1,6 @@
+#ifndef NATIVE_MOCK_BLEUUID_H
+#define NATIVE_MOCK_BLEUUID_H
+
+#include "BLEServer.h"
+
+#endif // NATIVE_MOCK_BLEUUID_H
@@ -0,0 +1,6 @@
+#ifndef NATIVE_MOCK_BLEUTILS_H
+#define NATIVE_MOCK_BLEUTILS_H
+
+#include "BLEServer.h"
+
+#endif // NATIVE_MOCK_BLEUTILS_H
@@ -0,0 +1,182 @@
+#include "FS.h"
+#include "SPIFFS.h"
+
+#include <map>
+#include <vector>
+
+namespace fs {
+
+typedef std::shared_ptr<std::vector<uint8_t>> FileData;
+
+class FSImpl {
+public:
+  std::map<std::string, FileData> files;
+};
+
+struct FileImpl {
+  std::shared_ptr<FSImpl> fs;
+  std::string path;
+  FileData data;
+  size_t pos    = 0;
+  bool writable = false;
+  bool isDir    = false;
+  std::map<std::string, FileData>::iterator next;
+};
+
+size_t File::write(uint8_t c) { return write(&c, 1); }
+
+size_t File::write(const uint8_t *buf, size_t size) {
+  if (!impl || !impl->writable) {
+    return 0;
+  }
+  std::vector<uint8_t> &bytes = *impl->data;
+  if (impl->pos + size > bytes.size()) {
+    bytes.resize(impl->pos + size);
+  }
+  memcpy(bytes.data() + impl->pos, buf, size);
+  impl->pos += size;
+  return size;
+}
+
+int File::available() {
+  if (!impl || impl->isDir) {
+    return 0;
+  }
+  return int(impl->data->size() - impl->pos);
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek() {
+  if (available() <= 0) {
+    return -1;
+  }
+  return (*impl->data)[impl->pos];
+}
+
+size_t File::read(uint8_t *buf, size_t size) {
+  size_t left = available();
+  if (size > left) {
+    size = left;
+  }
+  if (size) {
+    memcpy(buf, impl->data->data() + impl->pos, size);
+    impl->pos += size;
+  }
+  return size;
+}
+
+bool File::seek(uint32_t pos) {
+  if (!impl || impl->isDir || pos > impl->data->size()) {
+    return false;
+  }
+  impl->pos = pos;
+  return true;
+}
+
+size_t File::position() const { return impl ? impl->pos : 0; }
+
+size_t File::size() const {
+  return (impl && !impl->isDir) ? impl->data->size() : 0;
+}
+
+void File::close() { impl.reset(); }
+
+File::operator bool() const { return bool(impl); }
+
+const char *File::name() const { return impl ? impl->path.c_str() : ""; }
+
+boolean File::isDirectory(void) { return impl && impl->isDir; }
+
+File File::openNextFile(const char *mode) {
+  if (!impl || !impl->isDir || impl->next == impl->fs->files.end()) {
+    return File();
+  }
+  std::string path = (impl->next++)->first;
+  return FS(impl->fs).open(path.c_str(), mode);
+}
+
+void File::rewindDirectory(void) {
+  if (impl && impl->isDir) {
+    impl->next = impl->fs->files.begin();
+  }
+}
+
+File FS::open(const char *path, const char *mode) {
+  auto file  = std::make_shared<FileImpl>();
+  file->fs   = impl;
+  file->path = path;
+
+  if (file->path == "/") {
+    file->isDir = true;
+    file->next  = impl->files.begin();
+    return File(file);
+  }
+
+  auto it = impl->files.find(path);
+  if (mode[0] == 'r') {
+    if (it == impl->files.end()) {
+      return File();
+    }
+    file->data = it->second;
+  } else {
+    if (it == impl->files.end() || mode[0] == 'w') {
+      // Like SPIFFS, "w" truncates by replacing the file's contents.
+      impl->files[path] = std::make_shared<std::vector<uint8_t>>();
+    }
+    file->data     = impl->files[path];
+    file->writable = true;
+    file->pos      = mode[0] == 'a' ? file->data->size() : 0;
+  }
+  return File(file);
+}
+
+bool FS::exists(const char *path) {
+  return impl->files.find(path) != impl->files.end();
+}
+
+bool FS::remove(const char *path) { return impl->files.erase(path) > 0; }
+
+bool FS::rename(const char *pathFrom, const char *pathTo) {
+  auto from = impl->files.find(pathFrom);
+  // SPIFFS refuses to rename onto an existing name.
+  if (from == impl->files.end() || exists(pathTo)) {
+    return false;
+  }
+  impl->files[pathTo] = from->second;
+  impl->files.erase(from);
+  return true;
+}
+
+SPIFFSFS::SPIFFSFS() : FS(std::make_shared<FSImpl>()) {}
+
+bool SPIFFSFS::begin(bool formatOnFail, const char *basePath,
+                     uint8_t maxOpenFiles, const char *partitionLabel) {
+  (void)formatOnFail;
+  (void)basePath;
+  (void)maxOpenFiles;
+  (void)partitionLabel;
+  return true;
+}
+
+bool SPIFFSFS::format() {
+  impl->files.clear();
+  return true;
+}
+
+size_t SPIFFSFS::totalBytes() { return 1441792; }
+
+size_t SPIFFSFS::usedBytes() {
+  size_t used = 0;
+  for (auto &file : impl->files) {
+    used += file.second->size();
+  }
+  return used;
+}
+
+} // namespace fs
+
+fs::SPIFFSFS SPIFFS;
@@ -0,0 +1,69 @@
+#ifndef NATIVE_MOCK_FS_H
+#define NATIVE_MOCK_FS_H
+
+// Host stand-in for the ESP32 fs::FS / fs::File API, backed by memory.
+
+#include "Arduino.h"
+
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+struct FileImpl;
+class FSImpl;
+
+class File {
+public:
+  File() = default;
+  explicit File(std::shared_ptr<FileImpl> impl) : impl(impl) {}
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buf, size_t size);
+  int available();
+  int read();
+  int peek();
+  void flush() {}
+  size_t read(uint8_t *buf, size_t size);
+  size_t readBytes(char *buffer, size_t length) {
+    return read((uint8_t *)buffer, length);
+  }
+  bool seek(uint32_t pos);
+  size_t position() const;
+  size_t size() const;
+  void close();
+  operator bool() const;
+  const char *name() const;
+  boolean isDirectory(void);
+  File openNextFile(const char *mode = FILE_READ);
+  void rewindDirectory(void);
+
+private:
+  std::shared_ptr<FileImpl> impl;
+};
+
+class FS {
+public:
+  explicit FS(std::shared_ptr<FSImpl> impl) : impl(impl) {}
+
+  File open(const char *path, const char *mode = FILE_READ);
+  File open(const String &path, const char *mode = FILE_READ) {
+    return open(path.c_str(), mode);
+  }
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *pathFrom, const char *pathTo);
+
+protected:
+  std::shared_ptr<FSImpl> impl;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif // NATIVE_MOCK_FS_H
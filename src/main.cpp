@@ -25,7 +25,6 @@
 #include "FreeRTOS.h"
 
 #include <Adafruit_NeoPixel.h>
-#include <ArduinoJson.h>
 #include <BLE2902.h>
 #include <BLEDevice.h>
 #include <BLEServer.h>
@@ -34,164 +33,168 @@
 
 #include "Arduino.h"
 #include "SPIFFS.h"
+#include "audio.hpp"
 #include "ble.hpp"
+#include "clock.hpp"
+#include "diagnostics.hpp"
+#include "frame_scheduler.hpp"
+#include "log.hpp"
 #include "loop_modes.hpp"
+#include "modes.hpp"
+#include "output.hpp"
+#include "persistence.hpp"
+#include "power.hpp"
+#include "program_store.hpp"
+#include "renderer.hpp"
+#include "segments.hpp"
 #include "settings.h"
+#include "settings_store.hpp"
+#include "stream.hpp"
+#include "tasks.hpp"
+#include "transition.hpp"
+
+#ifdef STREAM_UART_BAUD
+// Streamed frames on a second serial port, Serial keeps the logs.
+// Build with -D STREAM_UART_BAUD=921600
+#ifndef STREAM_UART_RX_PIN
+#define STREAM_UART_RX_PIN 25
+#endif
+#ifndef STREAM_UART_TX_PIN
+#define STREAM_UART_TX_PIN 26
+#endif
+UartStreamTransport uartStream(Serial1);
+#endif
 
 bool SPIFFS_init() {
   if (!SPIFFS.begin(true)) {
-    Serial.println("An Error has occurred while mounting SPIFFS");
+    LOG_ERROR(DEVICE, "An Error has occurred while mounting SPIFFS");
     return false;
   }
   return true;
 }
 
 /**
- * @brief Create a Default Settings File object
+ * @brief Set the default settings and write them to the settings file
  *
  * @return int 0 -> OK | 1 -> ERROR
  */
 int createDefaultSettingsFile() {
-  Serial.print("Recreating Default Settings File");
-
-  File file = SPIFFS.open("/settings.json", FILE_WRITE);
-  DynamicJsonDocument sett(1024);
+  LOG_INFO(DEVICE, "Recreating Default Settings File");
 
   // DefaultData
-  sett["DefaultData"]["ledLenght"] = device.defaultData.ledLenght = 10;
-  sett["DefaultData"]["brightness"] = device.defaultData.brightness = 255;
+  device.defaultData.ledLenght  = 10;
+  device.defaultData.brightness = 255;
 
   // FixedColorData
-  sett["FixedColorData"]["color"][0] = device.fixedColorData.color.r = 100;
-  sett["FixedColorData"]["color"][1] = device.fixedColorData.color.g = 100;
-  sett["FixedColorData"]["color"][2] = device.fixedColorData.color.b = 100;
+  device.fixedColorData.color = Color_RGB{100, 100, 100};
 
   // RainbowData
-  sett["RainbowData"]["velocity"] = device.rainbowData.velocity = 50;
+  device.rainbowData.velocity = 50;
 
   // ColorSplitData
-  sett["ColorSplitData"]["endFirstLedSplit"] =
-      device.colorSplitData.endFirstLedSplit = 5;
-
-  sett["ColorSplitData"]["color1"][0] = device.colorSplitData.color1.r = 200;
-  sett["ColorSplitData"]["color1"][1] = device.colorSplitData.color1.g = 200;
-  sett["ColorSplitData"]["color1"][2] = device.colorSplitData.color1.b = 200;
-
-  sett["ColorSplitData"]["color2"][0] = device.colorSplitData.color2.r = 150;
-  sett["ColorSplitData"]["color2"][1] = device.colorSplitData.color2.g = 150;
-  sett["ColorSplitData"]["color2"][2] = device.colorSplitData.color2.b = 150;
+  device.colorSplitData.endFirstLedSplit = 5;
+  device.colorSplitData.color1           = Color_RGB{200, 200, 200};
+  device.colorSplitData.color2           = Color_RGB{150, 150, 150};
 
   // Mode
   device.activeMode = Mode_Type::fixed_color;
-  sett["mode"]      = int(device.activeMode);
+
+  // Zones, none: the whole strip runs activeMode
+  device.segmentsData.count = 0;
+
+  // TransitionData
+  device.transitionData.duration = defaultTransitionMs;
+
+  // Palette
+  device.paletteModeData.velocity = 50;
+  device.paletteData              = defaultPalette;
+
+  // Particle modes
+  device.fireData    = defaultFireData;
+  device.meteorData  = defaultMeteorData;
+  device.twinkleData = defaultTwinkleData;
+  device.cometData   = defaultCometData;
+
+  // Program mode
+  device.programData = defaultProgramData;
+
+  // Audio modes
+  device.spectrumData = defaultSpectrumData;
+  device.pulseData    = defaultPulseData;
+
+  // Layered modes
+  device.sparkleData        = defaultSparkleData;
+  device.paletteSparkleData = defaultPaletteSparkleData;
 
   // isOn
-  sett["isOn"] = device.isOn = true;
+  device.isOn = true;
 
-#define serializeJsonError 0
-  if (serializeJson(sett, file) == serializeJsonError) {
+  if (!saveSettings(SETTINGS_FILE)) {
     return 1;
   }
-
-  file.close();
   return 0;
 }
 
 /**
- * @brief Set the Json Settings Data object
+ * @brief Load the settings into device at boot
+ *
+ * The binary SETTINGS_FILE is the boot path. When it is missing or corrupt
+ * the settings are migrated from SETTINGS_JSON_FILE (the layout used before
+ * the binary format, and the one uploaded with data/), then from defaults.
  *
  * @return int Error Code
  * 0 -> OK
  * 1 -> SPIFFS initialization error
- * 2 -> Failed opening "/settings" file
- * 3 -> Failed to Deserialize file
+ * 2 -> Failed opening the settings file, migrated or defaults created
+ * 3 -> Corrupt settings file, migrated or defaults created
  */
-int setJsonSettingsData() {
+int setSettingsData() {
   // Initialize SPIFFS
   if (!SPIFFS_init()) {
-    Serial.println("ERROR: SPIFFS_init()");
+    LOG_ERROR(DEVICE, "ERROR: SPIFFS_init()");
+    createDefaultSettingsFile();
     return 1;
-  } else {
-    Serial.println("SPIFFS Initialized");
   }
 
-  // Open File Settings
-  File file = SPIFFS.open("/settings.json", FILE_READ);
-
-  // Error Checking for reading file
-  if (!file) {
-    Serial.print("Failed to open file for reading");
-    return 2;
-  } else {
-    Serial.println("File opened");
+  int error = loadSettings(SETTINGS_FILE);
+  if (error == 0) {
+    return 0;
   }
-
-  // Initialize Json document for settings
-  DynamicJsonDocument sett(1024);
-  // Error checking
-  DeserializationError error = deserializeJson(sett, file);
-  if (error) {
-    Serial.print("Failed to Deserialize.");
-    return 3;
-  } else {
-    Serial.println("Deserialization Completed");
+  if (error == 4) {
+    error = 3;
   }
 
-  file.close();
-
-  //-------- retrive settings --------//
-
-  Serial.println("Starting Retriving");
-
-  // DefaultData
-  device.defaultData.ledLenght  = sett["DefaultData"]["ledLenght"];
-  device.defaultData.brightness = sett["DefaultData"]["brightness"];
-
-  // FixedColorData
-  device.fixedColorData.color.r = sett["FixedColorData"]["color"][0];
-  device.fixedColorData.color.g = sett["FixedColorData"]["color"][1];
-  device.fixedColorData.color.b = sett["FixedColorData"]["color"][2];
-
-  // RainbowData
-  device.rainbowData.velocity = sett["RainbowData"]["velocity"];
-
-  // ColorSplitData
-  device.colorSplitData.endFirstLedSplit =
-      sett["ColorSplitData"]["endFirstLedSplit"];
-
-  device.colorSplitData.color1.r = sett["ColorSplitData"]["color1"][0];
-  device.colorSplitData.color1.g = sett["ColorSplitData"]["color1"][1];
-  device.colorSplitData.color1.b = sett["ColorSplitData"]["color1"][2];
-
-  device.colorSplitData.color2.r = sett["ColorSplitData"]["color2"][0];
-  device.colorSplitData.color2.g = sett["ColorSplitData"]["color2"][1];
-  device.colorSplitData.color2.b = sett["ColorSplitData"]["color2"][2];
-
-  // Mode
-  switch ((int)sett["mode"]) {
-  case (int)Mode_Type::fixed_color:
-    device.activeMode = Mode_Type::fixed_color;
-    break;
-  case (int)Mode_Type::rainbow:
-    device.activeMode = Mode_Type::rainbow;
-    break;
-  case (int)Mode_Type::color_split:
-    device.activeMode = Mode_Type::color_split;
-    break;
+  if (importJsonSettings(SETTINGS_JSON_FILE, device) == 0) {
+    LOG_INFO(DEVICE, "Settings migrated from " SETTINGS_JSON_FILE);
+    if (!saveSettings(SETTINGS_FILE)) {
+      LOG_ERROR(DEVICE, "ERROR: saveSettings(" SETTINGS_FILE ")");
+    }
+  } else {
+    createDefaultSettingsFile();
   }
-
-  // isOn
-  device.isOn = int(sett["isOn"]);
-
-  device.print();
-  return 0;
+  return error;
 }
 
+///
+///@brief Attribute handles of the data service: 1 for the service, 2 per
+/// characteristic and 1 per BLE2902 descriptor. Without a descriptor are
+/// Program, CommandBatch and Stream, with one DefaultData, ActiveMode,
+/// SegmentData, TransitionData, Palette and the mode characteristics.
+///
+constexpr uint32_t dataServiceHandles =
+    1 + 2 * 3 + 3 * (5 + Modes::characteristics());
+
 void BLE_init() {
   //-------- Initialize BLE Operations --------//
 
   // Create the BLE Device
   BLEDevice::init("Strip Led");
+  // The zone table and the palette do not fit the 20 bytes of a
+  // notification at the default MTU, offer the clients a larger one
+  BLEDevice::setMTU(ConnectionMtu::max);
+#ifdef ESP32
+  BLEDevice::setCustomGattsHandler(gattsEventHandler);
+#endif
 
   // Create the BLE Server
   device.bleSServer = BLEDevice::createServer();
@@ -199,52 +202,96 @@ void BLE_init() {
   // Set Server Callback
   device.bleSServer->setCallbacks(new StripServerCallbacks());
 
-  // Create the BLE Service
-  device.blesData =
-      device.bleSServer->createService(device.bluetoothSett.BLEs_Data_UUID);
+  // Create the BLE Service, with a handle for every attribute: the default
+  // of 15 would leave the later characteristics out
+  device.blesData = device.bleSServer->createService(
+      BLEUUID(device.bluetoothSett.BLEs_Data_UUID), dataServiceHandles);
 
   // blecDefaultData Characteristic
   device.blecDefaultData = device.blesData->createCharacteristic(
       device.bluetoothSett.BLEc_DefaultData_UUID,
-      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_NOTIFY);
 
   device.blecDefaultData->setCallbacks(new blecDefaultDataCallback());
-  // deviceInfo.blecDefaultData->addDescriptor(new BLE2902());
+  device.blecDefaultData->addDescriptor(new BLE2902());
 
-  // blecFixedColorData Characteristic
-  device.blecFixedColorData = device.blesData->createCharacteristic(
-      device.bluetoothSett.BLEc_FixedColorData_UUID,
-      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
-
-  device.blecFixedColorData->setCallbacks(new blecFixedColorDataCallback());
-  // deviceInfo.blecFixedColorData->addDescriptor(new BLE2902());
-
-  // blecRainbowData Characteristic
-  device.blecRainbowData = device.blesData->createCharacteristic(
-      device.bluetoothSett.BLEc_RainbowData_UUID,
-      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
-
-  device.blecRainbowData->setCallbacks(new blecRainbowDataCallback());
-  // deviceInfo.blecRainbowData->addDescriptor(new BLE2902());
-
-  // blecColorSplitData Characteristic
-  device.blecColorSplitData = device.blesData->createCharacteristic(
-      device.bluetoothSett.BLEc_ColorSplitData_UUID,
-      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
-
-  device.blecColorSplitData->setCallbacks(new blecColorSplitDataCallback());
-  // deviceInfo.blecColorSplitData->addDescriptor(new BLE2902());
+  // One characteristic per mode with parameters
+  for (const ModeEntry &mode : Modes::table) {
+    if (mode.characteristic == nullptr) {
+      continue;
+    }
+    BLECharacteristic *characteristic = device.blesData->createCharacteristic(
+        mode.uuid(device.bluetoothSett),
+        BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+            BLECharacteristic::PROPERTY_NOTIFY);
+
+    characteristic->setCallbacks(new blecModeDataCallback(mode));
+    characteristic->addDescriptor(new BLE2902());
+    device.*mode.characteristic = characteristic;
+  }
 
   // blecActiveMode Characteristic
   device.blecActiveMode = device.blesData->createCharacteristic(
       device.bluetoothSett.BLEc_ActiveMode_UUID,
-      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_NOTIFY);
 
   if (device.blecActiveMode == NULL)
-    Serial.println("blecActiveMode NULL");
+    LOG_ERROR(BLE, "blecActiveMode NULL");
 
   device.blecActiveMode->setCallbacks(new blecActiveModeCallback());
-  // deviceInfo.blecActiveMode->addDescriptor(new BLE2902());
+  device.blecActiveMode->addDescriptor(new BLE2902());
+
+  // blecSegmentData Characteristic
+  device.blecSegmentData = device.blesData->createCharacteristic(
+      device.bluetoothSett.BLEc_SegmentData_UUID,
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_NOTIFY);
+
+  device.blecSegmentData->setCallbacks(new blecSegmentDataCallback());
+  device.blecSegmentData->addDescriptor(new BLE2902());
+
+  // blecTransitionData Characteristic
+  device.blecTransitionData = device.blesData->createCharacteristic(
+      device.bluetoothSett.BLEc_TransitionData_UUID,
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_NOTIFY);
+
+  device.blecTransitionData->setCallbacks(new blecTransitionDataCallback());
+  device.blecTransitionData->addDescriptor(new BLE2902());
+
+  // blecPalette Characteristic
+  device.blecPalette = device.blesData->createCharacteristic(
+      device.bluetoothSett.BLEc_Palette_UUID,
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_NOTIFY);
+
+  device.blecPalette->setCallbacks(new blecPaletteCallback());
+  device.blecPalette->addDescriptor(new BLE2902());
+
+  // blecProgram Characteristic, reads back the status of the last write
+  device.blecProgram = device.blesData->createCharacteristic(
+      device.bluetoothSett.BLEc_Program_UUID,
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+
+  device.blecProgram->setCallbacks(new blecProgramCallback());
+
+  // blecCommandBatch Characteristic, written without response
+  device.blecCommandBatch = device.blesData->createCharacteristic(
+      device.bluetoothSett.BLEc_CommandBatch_UUID,
+      BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_WRITE_NR);
+
+  device.blecCommandBatch->setCallbacks(new blecCommandBatchCallback());
+
+  // blecStream Characteristic, written without response
+  device.blecStream = device.blesData->createCharacteristic(
+      device.bluetoothSett.BLEc_Stream_UUID,
+      BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_WRITE_NR);
+
+  device.blecStream->setCallbacks(new blecStreamCallback());
 
   // SERVICE - blesServiceSettings
   device.blesServiceSettings =
@@ -267,11 +314,27 @@ void BLE_init() {
   // Characteristic - blecOnOff
   device.blecOnOff = device.blesServiceSettings->createCharacteristic(
       device.bluetoothSett.BLEc_OnOff_UUID,
-      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE |
+          BLECharacteristic::PROPERTY_NOTIFY);
 
   device.blecOnOff->setCallbacks(new blecOnOffCallBack());
   device.blecOnOff->addDescriptor(new BLE2902());
 
+  // Characteristic - blecDiagnostics, read only
+  device.blecDiagnostics = device.blesServiceSettings->createCharacteristic(
+      device.bluetoothSett.BLEc_Diagnostics_UUID,
+      BLECharacteristic::PROPERTY_READ);
+
+  device.blecDiagnostics->setCallbacks(new blecDiagnosticsCallback());
+
+  // Characteristic - blecStateChanged, notifies the state fields too long
+  // to notify at the MTU of the connection
+  device.blecStateChanged = device.blesServiceSettings->createCharacteristic(
+      device.bluetoothSett.BLEc_StateChanged_UUID,
+      BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+
+  device.blecStateChanged->addDescriptor(new BLE2902());
+
   // Server - Device Information
   device.blesDeviceInformation = device.bleSServer->createService(
       device.bluetoothSett.BLEs_DeviceInformation_UUID);
@@ -325,30 +388,64 @@ void BLE_init() {
 
   device.bleaAdvertising->start();
 
-  Serial.println("Waiting a client connection to notify...");
+  LOG_INFO(BLE, "Waiting a client connection to notify...");
 }
 
+// Longest wait of the storage task for a settings record, the log is
+// written at least this often
+const unsigned long logDrainMs = 20;
+
+#ifdef ESP32
+void renderTask(void *);
+void controlTask(void *);
+void storageTask(void *);
+void audioTask(void *);
+void IRAM_ATTR buttonInterrupt();
+#endif
+
 void setup() {
   Serial.begin(115200);
+  tasks.begin();
 
-  Serial.println("BEGIN");
+  LOG_INFO(DEVICE, "BEGIN");
+#ifdef STREAM_UART_BAUD
+  Serial1.begin(STREAM_UART_BAUD, SERIAL_8N1, STREAM_UART_RX_PIN,
+                STREAM_UART_TX_PIN);
+#endif
 
-  switch (setJsonSettingsData()) {
+  switch (setSettingsData()) {
   case 0:
-    Serial.println("Json Settings OK.");
+    LOG_INFO(DEVICE, "Settings OK.");
     break;
   case 1:
-    Serial.println("SPIFFS initialization error.");
+    LOG_ERROR(DEVICE, "SPIFFS initialization error.");
     break;
   case 2:
-    Serial.println("Failed opening \"/settings\" file");
-    createDefaultSettingsFile();
+    LOG_ERROR(DEVICE, "Failed opening \"" SETTINGS_FILE "\" file");
     break;
   case 3:
-    Serial.println("Failed to Deserialize file");
-    createDefaultSettingsFile();
+    LOG_ERROR(DEVICE, "Corrupt \"" SETTINGS_FILE "\" file");
     break;
   }
+  loadPrograms();
+  device.print();
+  device.strip.setLength(device.defaultData.ledLenght);
+#ifdef ESP32
+  if (i2sAudioSource.begin()) {
+    audioSource = &i2sAudioSource;
+  } else {
+    LOG_INFO(DEVICE, "No microphone, the audio modes stay dark");
+  }
+  if (rmtOutputDriver.begin(device.strip_pin)) {
+    outputStage.begin(device.strip_pin, rmtOutputDriver);
+  } else {
+    LOG_ERROR(STRIP, "RMT output unavailable, show() blocks");
+    outputStage.begin(device.strip_pin, blockingOutputDriver);
+  }
+#else
+  outputStage.begin(device.strip_pin, simulatedOutputDriver);
+#endif
+  settingsPersistence.begin(recordFromDevice(device));
 
   BLE_init();
 
@@ -356,61 +453,275 @@ void setup() {
 
   pinMode(device.push_button_pin, INPUT);
   led->begin();
+
+#ifdef ESP32
+  attachInterrupt(digitalPinToInterrupt(device.push_button_pin),
+                  buttonInterrupt, CHANGE);
+  if (!tasks.start(Task_Id::storage, storageTask) ||
+      !tasks.start(Task_Id::control, controlTask) ||
+      !tasks.start(Task_Id::render, renderTask)) {
+    LOG_ERROR(DEVICE, "setup - ERROR - Tasks not started");
+  }
+  if (audioSource != nullptr && !tasks.start(Task_Id::audio, audioTask)) {
+    LOG_ERROR(DEVICE, "setup - ERROR - Audio task not started");
+  }
+#else
+  powerGovernor.begin();
+#endif
+}
+
+void showFrame() {
+  {
+    ScopedProbe probe(Probe_Id::show);
+    outputStage.show(device);
+  }
+  frameScheduler.frameShown();
+  diagnostics.frameShown();
+  audioFeed.frameShown(OutputDriver::wireMicros(device.strip.numPixels()));
 }
 
 void run_mod() {
-  switch (device.activeMode) {
-  case Mode_Type::fixed_color:
-    fixed_color(device);
-    break;
-  case Mode_Type::rainbow:
-    rainbow(device);
-    break;
-  case Mode_Type::color_split:
-    color_split(device);
-    break;
-  default:
-    break;
+  unsigned long now = frameClock->now();
+  bool redraw       = frameScheduler.redrawDue(device.isOn);
+
+  if (!device.isOn) {
+    if (redraw) {
+      transitionEngine.cancel();
+      device.strip.clear();
+      showFrame();
+    }
+    return;
   }
 
-  device.strip.clear();
-  device.strip.show();
+  // Only the frames actually rendered are timed
+  uint32_t start = cycleCount();
+  if (!renderFrame(device, redraw, now)) {
+    return;
+  }
+  diagnostics.record(Probe_Id::render, cycleCount() - start);
+  showFrame();
 }
 
-void loop() {
-  Serial.println("On-Off state: " + String(device.isOn));
+///
+///@brief The earliest time the render task has work to do without a new
+/// event (a command, a streamed packet): the next animation or transition
+/// frame.
+///
+///@return false if there is none, the render task can wait for an event
+///
+bool nextDeadline(unsigned long now, unsigned long &due) {
+  bool found    = false;
+  auto earliest = [&](unsigned long next) {
+    if (!found || long(next - due) < 0) {
+      due   = next;
+      found = true;
+    }
+  };
+
+  unsigned long next;
+  if (frameScheduler.redrawDue(device.isOn)) {
+    earliest(now);
+  }
+  if (device.isOn && transitionEngine.nextFrame(next)) {
+    earliest(next);
+  }
+  if (device.isOn && segmentEngine.nextFrame(device, now, next)) {
+    earliest(next);
+  }
+#ifdef STREAM_UART_BAUD
+  // No event for the UART, poll it at the frame rate of the animations
+  earliest(now + 1000UL / TransitionEngine::fps);
+#endif
+  return found;
+}
+
+///
+///@brief The newest sound analysis redraws the audio zones at once, rather
+/// than at their next frame
+///
+void applyAudioFeatures() {
+  audioFeed.listen(device.isOn && (runsMode(device, Mode_Type::spectrum) ||
+                                   runsMode(device, Mode_Type::pulse)));
+  if (audioFeed.receive(frameClock->now())) {
+    segmentEngine.invalidateMode(device, Mode_Type::spectrum);
+    segmentEngine.invalidateMode(device, Mode_Type::pulse);
+  }
+}
 
-  // ON - OFF Button Pressed
+///
+///@brief One iteration of the render task: the streamed packets, the sound
+/// analysis and the frame, if one is due, then sleep until the next one
+///
+void renderStep() {
+  unsigned long now;
+  unsigned long due;
+  bool hasDeadline;
+  {
+    FrameLock lock;
+    applyStreamPackets(bleStream);
+#ifdef STREAM_UART_BAUD
+    applyStreamPackets(uartStream);
+#endif
+    applyAudioFeatures();
+    run_mod();
+
+    // Frame deadlines are in frameClock time
+    now         = frameClock->now();
+    hasDeadline = nextDeadline(now, due);
+  }
+  diagnostics.loopDone(millis());
+  powerGovernor.sleep(now, hasDeadline, due);
+}
+
+///@brief Toggle the strip on a press of the button
+///@return true if it was pressed
+bool pollButton() {
   static uint8_t lastBtnState = HIGH;
   uint8_t state               = digitalRead(device.push_button_pin);
 
-  Serial.println("State: " + String(state));
-
-  if (state != lastBtnState) {
-    lastBtnState = lastBtnState == HIGH ? LOW : HIGH;
-    if (state == LOW) {
-      Serial.println("Button PRESSED");
-      device.isOn = !device.isOn;
-    }
+  if (state == lastBtnState) {
+    return false;
   }
+  lastBtnState = state;
+  if (state != LOW) {
+    return false;
+  }
+  device.isOn = !device.isOn;
+  LOG_INFO(DEVICE, "Button PRESSED - On-Off state: %u", device.isOn);
+  return true;
+}
 
-  // LED connection State
-  if (device.deviceConnected) {
+///@brief LED connection State, driven only when it changes
+void updateStatusLed() {
+  static bool ledConnected = true;
+  if (device.deviceConnected == ledConnected) {
+    return;
+  }
+  ledConnected = device.deviceConnected;
+  if (ledConnected) {
     led->fill(Adafruit_NeoPixel::Color(255, 255, 255));
-    led->show();
   } else {
     led->clear();
-    led->show();
   }
+  led->show();
+}
 
-  if (device.isOn == true) {
-    run_mod();
+///
+///@brief One iteration of the control task: the button and the commands,
+/// under the FrameLock, then the status LED, the notifications, the
+/// settings to save and the serial commands
+///@return the longest the control task may wait for an event
+///
+unsigned long controlStep() {
+  bool changed;
+  {
+    FrameLock lock;
+    changed = pollButton();
+    changed = applyPendingCommands() || changed;
+  }
+  if (changed) {
+    powerGovernor.wake();
+  }
+
+  updateStatusLed();
+  // One notification per changed field for the whole batch
+  stateNotifier.flush();
+
+  unsigned long now = frameClock->now();
+  settingsPersistence.update(recordFromDevice(device), now);
+  pollSerialCommands();
+  tasks.reportStacks();
+
+  unsigned long timeout = PowerGovernor::idleMaxMs;
+  unsigned long due;
+  if (settingsPersistence.nextWrite(due)) {
+    long left = long(due - now);
+    timeout   = left <= 0 ? 0 : min<unsigned long>(left, timeout);
+  }
+  return timeout;
+}
+
+///
+///@brief One iteration of the storage task: the settings record posted by
+/// the control task, if any, the changed programs, the settings.json export
+/// or import requested and the log
+///
+void storageStep() {
+#ifdef ESP32
+  SettingsRecord record;
+  // The record is a copy, written without the FrameLock, see FrameLock
+  if (settingsPersistence.receive(record, logDrainMs)) {
+    settingsPersistence.commit(record);
+  }
+#endif
+  programSaver.update(millis());
+  jsonSettingsTransfer.update();
+  logging::drain();
+}
+
+///
+///@brief One iteration of the audio task: a hop of samples, its analysis
+/// handed to the render task, woken to draw it
+///
+void audioStep() {
+  int16_t hop[audioHop];
+  if (audioSource->read(hop, audioHop) != audioHop) {
+    LOG_ERROR(DEVICE, "audioStep - Error: %s read failed",
+              audioSource->name());
+    delay(100);
+    return;
+  }
+  // read() returns as the last sample comes in
+  uint32_t captured = micros();
+  AudioFeatures features;
+  audioAnalyzer.analyze(hop, captured, features);
+  if (audioFeed.publish(features)) {
+    powerGovernor.wake();
   }
 }
 
+#ifdef ESP32
+void renderTask(void *) {
+  powerGovernor.begin();
+  for (;;) {
+    renderStep();
+  }
+}
+
+void controlTask(void *) {
+  for (;;) {
+    unsigned long timeout = controlStep();
+    tasks.wait(commandEvent | buttonEvent | connectionEvent, timeout);
+  }
+}
+
+void storageTask(void *) {
+  for (;;) {
+    storageStep();
+  }
+}
+
+void audioTask(void *) {
+  for (;;) {
+    audioStep();
+  }
+}
+
+void IRAM_ATTR buttonInterrupt() { tasks.raiseFromISR(buttonEvent); }
+
+// The work runs on the tasks started by setup()
+void loop() { vTaskDelete(nullptr); }
+#else
+void loop() {
+  controlStep();
+  renderStep();
+  storageStep();
+}
+#endif
+
 int main() {
   setup();
 
   while (true)
     loop();
-}
\ No newline at end of file
+}
@@ -0,0 +1,219 @@
+/*
+   The command batch (include/ble.hpp): decodeCommandBatch() on batches of
+   every function ID, the payloads of the older apps, and batches refused
+   whole for their layout, an unknown ID or a payload that is not valid.
+
+   pio test -e native -f test_command_batch
+*/
+
+#include "Arduino.h"
+
+#include "ble.hpp"
+#include <unity.h>
+#include <vector>
+
+typedef std::vector<uint8_t> Batch;
+
+static Command commands[commandBatchMax];
+
+///@brief One command of a batch: [id, length, value]
+void add(Batch &batch, byte id, const std::vector<uint8_t> &value) {
+  batch.push_back(id);
+  batch.push_back(value.size());
+  batch.insert(batch.end(), value.begin(), value.end());
+  batch[0]++;
+}
+
+uint8_t decode(const Batch &batch) {
+  return decodeCommandBatch(batch.data(), batch.size(), commands);
+}
+
+template <typename Mode> const typename Mode::Params &params(uint8_t index) {
+  return *reinterpret_cast<const typename Mode::Params *>(
+      commands[index].modeData.params);
+}
+
+void setUp() { memset(commands, 0, sizeof(commands)); }
+
+void tearDown() {}
+
+void test_state_commands() {
+  Batch batch = {0};
+  add(batch, byte(Batch_Id::default_data), {0x2C, 0x01, 80});
+  add(batch, byte(Batch_Id::active_mode), {byte(Mode_Type::fire)});
+  add(batch, byte(Batch_Id::on_off), {1});
+  add(batch, byte(Batch_Id::transition_data), {0xE8, 0x03});
+  TEST_ASSERT_EQUAL_UINT8(4, decode(batch));
+
+  TEST_ASSERT_EQUAL(int(Command_Type::default_data), int(commands[0].type));
+  TEST_ASSERT_EQUAL_UINT16(300, commands[0].defaultData.ledLenght);
+  TEST_ASSERT_EQUAL_UINT8(80, commands[0].defaultData.brightness);
+  TEST_ASSERT_EQUAL(int(Command_Type::active_mode), int(commands[1].type));
+  TEST_ASSERT_EQUAL_UINT8(byte(Mode_Type::fire), commands[1].activeMode);
+  TEST_ASSERT_EQUAL(int(Command_Type::on_off), int(commands[2].type));
+  TEST_ASSERT_TRUE(commands[2].isOn);
+  TEST_ASSERT_EQUAL(int(Command_Type::transition_data), int(commands[3].type));
+  TEST_ASSERT_EQUAL_UINT16(1000, commands[3].transitionData.duration);
+}
+
+void test_mode_commands() {
+  Batch batch = {0};
+  add(batch, FireMode::batchId(), {30, 120});
+  add(batch, ColorSplitMode::batchId(), {0x2C, 0x01, 1, 2, 3, 4, 5, 6});
+  add(batch, ProgramMode::batchId(), {1, 10, 20, 30, 40});
+  add(batch, PulseMode::batchId(), {9, 8, 7, 6});
+  add(batch, PaletteSparkleMode::batchId(), {20, 60, byte(Blend_Mode::add)});
+  TEST_ASSERT_EQUAL_UINT8(5, decode(batch));
+
+  TEST_ASSERT_EQUAL(int(Command_Type::mode_data), int(commands[0].type));
+  TEST_ASSERT_EQUAL(int(Mode_Type::fire), int(commands[0].modeData.mode));
+  TEST_ASSERT_EQUAL_UINT8(30, params<FireMode>(0).cooling);
+  TEST_ASSERT_EQUAL_UINT8(120, params<FireMode>(0).sparking);
+  TEST_ASSERT_EQUAL_UINT16(300, params<ColorSplitMode>(1).endFirstLedSplit);
+  TEST_ASSERT_EQUAL_UINT8(6, params<ColorSplitMode>(1).color2.b);
+  TEST_ASSERT_EQUAL_UINT8(1, params<ProgramMode>(2).slot);
+  TEST_ASSERT_EQUAL_UINT8(40, params<ProgramMode>(2).params[3]);
+  TEST_ASSERT_EQUAL(int(Mode_Type::pulse), int(commands[3].modeData.mode));
+  TEST_ASSERT_EQUAL_UINT8(6, params<PulseMode>(3).velocity);
+  TEST_ASSERT_EQUAL_UINT8(byte(Blend_Mode::add),
+                          params<PaletteSparkleMode>(4).blend);
+}
+
+void test_every_mode_id() {
+  for (const ModeEntry &mode : Modes::table) {
+    if (mode.batchId == 0) {
+      continue;
+    }
+    TEST_ASSERT_TRUE(findModeByBatchId(mode.batchId) == &mode);
+    // A payload of zeros is valid for every mode, slot 0 included
+    Batch batch = {1, mode.batchId, uint8_t(mode.payloadMin)};
+    batch.resize(batch.size() + mode.payloadMin, 0);
+    TEST_ASSERT_EQUAL_UINT8_MESSAGE(1, decode(batch), mode.name);
+    TEST_ASSERT_EQUAL(int(mode.id), int(commands[0].modeData.mode));
+  }
+}
+
+void test_older_payloads() {
+  // 8 bit ledLenght, 8 bit endFirstLedSplit
+  Batch batch = {0};
+  add(batch, byte(Batch_Id::default_data), {200, 50});
+  add(batch, ColorSplitMode::batchId(), {100, 1, 2, 3, 4, 5, 6});
+  TEST_ASSERT_EQUAL_UINT8(2, decode(batch));
+  TEST_ASSERT_EQUAL_UINT16(200, commands[0].defaultData.ledLenght);
+  TEST_ASSERT_EQUAL_UINT8(50, commands[0].defaultData.brightness);
+  TEST_ASSERT_EQUAL_UINT16(100, params<ColorSplitMode>(1).endFirstLedSplit);
+  TEST_ASSERT_EQUAL_UINT8(1, params<ColorSplitMode>(1).color1.r);
+  TEST_ASSERT_EQUAL_UINT8(6, params<ColorSplitMode>(1).color2.b);
+}
+
+void test_segment_commands() {
+  Batch batch = {0};
+  // Zone 2 from LED 10, 20 LEDs of meteor, its payload without padding
+  add(batch, byte(Batch_Id::segment_data),
+      {2, 10, 0, 20, 0, byte(Mode_Type::meteor), 1, 2, 3, 4, 5});
+  add(batch, byte(Batch_Id::segment_data), {1});
+  add(batch, byte(Batch_Id::segment_data),
+      {0, 0, 0, 5, 0, byte(Mode_Type::stream)});
+  TEST_ASSERT_EQUAL_UINT8(3, decode(batch));
+
+  TEST_ASSERT_EQUAL(int(Command_Type::segment_data), int(commands[0].type));
+  const SegmentCommand &zone = commands[0].segment;
+  TEST_ASSERT_EQUAL_UINT8(2, zone.index);
+  TEST_ASSERT_EQUAL_UINT16(10, zone.data.start);
+  TEST_ASSERT_EQUAL_UINT16(20, zone.data.length);
+  TEST_ASSERT_EQUAL(int(Mode_Type::meteor), int(zone.data.mode));
+  const MeteorData &meteor = zoneParams<MeteorMode>(zone.data);
+  TEST_ASSERT_EQUAL_UINT8(3, meteor.color.b);
+  TEST_ASSERT_EQUAL_UINT8(5, meteor.tail);
+
+  TEST_ASSERT_EQUAL(int(Command_Type::remove_segment), int(commands[1].type));
+  TEST_ASSERT_EQUAL_UINT8(1, commands[1].segmentIndex);
+  TEST_ASSERT_EQUAL(int(Mode_Type::stream),
+                    int(commands[2].segment.data.mode));
+}
+
+void test_full_batch() {
+  Batch batch = {0};
+  for (uint8_t i = 0; i < commandBatchMax; i++) {
+    add(batch, byte(Batch_Id::on_off), {uint8_t(i & 1)});
+  }
+  TEST_ASSERT_EQUAL_UINT8(commandBatchMax, decode(batch));
+  TEST_ASSERT_TRUE(commands[commandBatchMax - 1].isOn);
+
+  add(batch, byte(Batch_Id::on_off), {1});
+  TEST_ASSERT_EQUAL_UINT8(0, decode(batch));
+}
+
+void test_bad_layout() {
+  TEST_ASSERT_EQUAL_UINT8(0, decodeCommandBatch(nullptr, 0, commands));
+  TEST_ASSERT_EQUAL_UINT8(0, decode(Batch{0}));
+
+  Batch batch = {0};
+  add(batch, byte(Batch_Id::on_off), {1});
+  add(batch, byte(Batch_Id::active_mode), {1});
+  Batch fewer = batch;
+  fewer[0]    = 1; // the second command is left over
+  TEST_ASSERT_EQUAL_UINT8(0, decode(fewer));
+  Batch more = batch;
+  more[0]    = 3; // a third command is missing
+  TEST_ASSERT_EQUAL_UINT8(0, decode(more));
+
+  // Cut in the header of a command, then in its value
+  Batch cut(batch.begin(), batch.end() - 2);
+  TEST_ASSERT_EQUAL_UINT8(0, decode(cut));
+  cut = {0};
+  add(cut, byte(Batch_Id::transition_data), {0xE8, 0x03});
+  cut.pop_back();
+  TEST_ASSERT_EQUAL_UINT8(0, decode(cut));
+  Batch longer = batch;
+  longer[5]    = 2; // the value runs past the end
+  TEST_ASSERT_EQUAL_UINT8(0, decode(longer));
+}
+
+void test_bad_commands() {
+  struct Case {
+    byte id;
+    std::vector<uint8_t> value;
+  };
+  const Case cases[] = {
+      {0, {1}},
+      {0x80, {1}},
+      {0xFF, {1}},
+      {byte(Batch_Id::default_data), {200}},
+      {byte(Batch_Id::active_mode), {}},
+      {byte(Batch_Id::on_off), {}},
+      {byte(Batch_Id::transition_data), {1}},
+      {byte(Batch_Id::segment_data), {}},
+      {byte(Batch_Id::segment_data), {0, 0, 0, 5, 0}},
+      {byte(Batch_Id::segment_data), {0, 0, 0, 5, 0, 0xEE}},
+      {byte(Batch_Id::segment_data),
+       {0, 0, 0, 5, 0, byte(Mode_Type::fire), 1}},
+      {byte(Batch_Id::segment_data),
+       {0, 0, 0, 5, 0, byte(Mode_Type::program), programSlots, 0, 0, 0, 0}},
+      {FireMode::batchId(), {30}},
+      {ColorSplitMode::batchId(), {1, 2, 3, 4, 5, 6}},
+      {ProgramMode::batchId(), {programSlots, 0, 0, 0, 0}},
+      {CometMode::batchId(), {1, 2, 3, 4, 5, 6, 7}},
+      {PaletteSparkleMode::batchId(), {20, 60, byte(Blend_Mode::max) + 1}},
+  };
+  for (const Case &bad : cases) {
+    // After a valid command: the batch is refused whole
+    Batch batch = {0};
+    add(batch, byte(Batch_Id::on_off), {1});
+    add(batch, bad.id, bad.value);
+    TEST_ASSERT_EQUAL_UINT8(0, decode(batch));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_state_commands);
+  RUN_TEST(test_mode_commands);
+  RUN_TEST(test_every_mode_id);
+  RUN_TEST(test_older_payloads);
+  RUN_TEST(test_segment_commands);
+  RUN_TEST(test_full_batch);
+  RUN_TEST(test_bad_layout);
+  RUN_TEST(test_bad_commands);
+  return UNITY_END();
+}
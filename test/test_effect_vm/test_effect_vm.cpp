@@ -0,0 +1,186 @@
+/*
+   Effect programs (include/effect_vm.hpp): verifyProgram() on the built-in
+   program and on images refused for their size, version, length, opcodes
+   and registers, what it derives for EffectVm, and a verified program run.
+
+   pio test -e native -f test_effect_vm
+*/
+
+#include "Arduino.h"
+
+#include "effect_vm.hpp"
+#include <unity.h>
+#include <vector>
+
+typedef std::vector<uint8_t> Image;
+
+static EffectProgram program;
+static uint8_t at;
+
+///@brief An image of the instructions, [op, d, a, b] each
+Image image(std::initializer_list<EffectInstruction> code) {
+  Image bytes = {programVersion, uint8_t(code.size())};
+  for (const EffectInstruction &in : code) {
+    bytes.insert(bytes.end(), {in.op, in.d, in.a, in.b});
+  }
+  return bytes;
+}
+
+EffectInstruction op(Op_Code code, uint8_t d, uint8_t a = 0, uint8_t b = 0) {
+  return EffectInstruction{uint8_t(code), d, a, b};
+}
+
+Program_Error verify(const Image &bytes) {
+  return verifyProgram(bytes.data(), bytes.size(), program, at);
+}
+
+void assertRefused(Program_Error expected, uint8_t instruction,
+                   const Image &bytes) {
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(expected), uint8_t(verify(bytes)));
+  TEST_ASSERT_EQUAL_UINT8(instruction, at);
+}
+
+void setUp() { memset(&program, 0, sizeof(program)); }
+
+void tearDown() {}
+
+void test_default_program() {
+  TEST_ASSERT_EQUAL_UINT8(
+      uint8_t(Program_Error::none),
+      uint8_t(verifyProgram(defaultProgramImage, sizeof(defaultProgramImage),
+                            program, at)));
+  TEST_ASSERT_EQUAL_UINT8(3, program.count);
+  // time, position and p3 are read, the color is written
+  TEST_ASSERT_EQUAL_HEX32(1 << 2 | 1 << 3 | 1 << 7, program.initMask);
+  // time * p3 is the same for every pixel
+  TEST_ASSERT_EQUAL_HEX32(0b001, uint32_t(program.uniformMask));
+
+  uint8_t encoded[programImageMax];
+  TEST_ASSERT_EQUAL(sizeof(defaultProgramImage), program.encode(encoded));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(defaultProgramImage, encoded,
+                                sizeof(defaultProgramImage));
+}
+
+void test_masks() {
+  // Green and blue are never written: they are set, to 0, for every pixel
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(Program_Error::none),
+                          uint8_t(verify(image({op(Op_Code::ldi, 8, 255)}))));
+  TEST_ASSERT_EQUAL_HEX32(1 << 9 | 1 << 10, program.initMask);
+  TEST_ASSERT_EQUAL_HEX32(0b1, uint32_t(program.uniformMask));
+
+  // A register written twice is not uniform, nor what reads the pixel index
+  Image bytes = image({op(Op_Code::ldi, 11, 3), op(Op_Code::add, 8, 0, 11),
+                       op(Op_Code::ldi, 11, 4), op(Op_Code::mov, 9, 11),
+                       op(Op_Code::mov, 10, 4)});
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(Program_Error::none), uint8_t(verify(bytes)));
+  TEST_ASSERT_EQUAL_HEX32(1 << 0 | 1 << 4, program.initMask);
+  TEST_ASSERT_EQUAL_HEX32(0b10000, uint32_t(program.uniformMask));
+}
+
+void test_longest_program() {
+  std::vector<EffectInstruction> code(programMaxInstructions,
+                                      op(Op_Code::add, 8, 8, 0));
+  Image bytes = {programVersion, programMaxInstructions};
+  for (const EffectInstruction &in : code) {
+    bytes.insert(bytes.end(), {in.op, in.d, in.a, in.b});
+  }
+  TEST_ASSERT_EQUAL(programImageMax, bytes.size());
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(Program_Error::none), uint8_t(verify(bytes)));
+  TEST_ASSERT_EQUAL_UINT8(programMaxInstructions, program.count);
+}
+
+void test_run() {
+  // red 255, green the pixel index, blue the first param
+  Image bytes = image({op(Op_Code::ldi, 8, 255), op(Op_Code::mov, 9, 0),
+                       op(Op_Code::mov, 10, 4)});
+  TEST_ASSERT_EQUAL_UINT8(uint8_t(Program_Error::none), uint8_t(verify(bytes)));
+
+  const uint8_t params[4] = {77, 0, 0, 0};
+  device.strip.setLength(40);
+  effectVm.run<StripFormat>(program, device.strip, 0, 40, 0, params);
+  const uint8_t *pixel = device.strip.getPixels();
+  for (uint8_t i = 0; i < 40; i++, pixel += stripBytesPerPixel) {
+    TEST_ASSERT_EQUAL_UINT8(255, pixel[StripFormat::red]);
+    TEST_ASSERT_EQUAL_UINT8(i, pixel[StripFormat::green]);
+    TEST_ASSERT_EQUAL_UINT8(77, pixel[StripFormat::blue]);
+  }
+}
+
+void test_bad_size() {
+  assertRefused(Program_Error::bad_size, 0, Image{});
+  assertRefused(Program_Error::bad_size, 0, Image{programVersion});
+
+  Image bytes = image({op(Op_Code::ldi, 8, 1), op(Op_Code::ldi, 9, 1)});
+  Image shorter(bytes.begin(), bytes.end() - 1);
+  assertRefused(Program_Error::bad_size, 0, shorter);
+  bytes.push_back(0);
+  assertRefused(Program_Error::bad_size, 0, bytes);
+
+  // A header claiming more instructions than the image holds
+  bytes    = image({op(Op_Code::ldi, 8, 1)});
+  bytes[1] = 2;
+  assertRefused(Program_Error::bad_size, 0, bytes);
+}
+
+void test_bad_version() {
+  Image bytes = image({op(Op_Code::ldi, 8, 1)});
+  bytes[0]    = programVersion + 1;
+  assertRefused(Program_Error::bad_version, 0, bytes);
+  bytes[0] = 0;
+  assertRefused(Program_Error::bad_version, 0, bytes);
+}
+
+void test_too_long() {
+  Image bytes = {programVersion, programMaxInstructions + 1};
+  bytes.resize(2 + 4 * (programMaxInstructions + 1), 0);
+  assertRefused(Program_Error::too_long, 0, bytes);
+  bytes = {programVersion, 255};
+  assertRefused(Program_Error::too_long, 0, bytes);
+}
+
+void test_bad_opcode() {
+  assertRefused(Program_Error::bad_opcode, 1,
+                image({op(Op_Code::ldi, 8, 1), EffectInstruction{0, 8, 0, 0}}));
+  assertRefused(Program_Error::bad_opcode, 0,
+                image({EffectInstruction{uint8_t(Op_Code::noise) + 1, 8, 0,
+                                         0}}));
+  assertRefused(Program_Error::bad_opcode, 2,
+                image({op(Op_Code::ldi, 8, 1), op(Op_Code::ldi, 9, 1),
+                       EffectInstruction{0xFF, 10, 0, 0}}));
+}
+
+void test_bad_register() {
+  assertRefused(Program_Error::bad_register, 0,
+                image({op(Op_Code::ldi, programRegisters, 1)}));
+  assertRefused(Program_Error::bad_register, 1,
+                image({op(Op_Code::ldi, 8, 1),
+                       op(Op_Code::mov, 9, programRegisters)}));
+  assertRefused(Program_Error::bad_register, 0,
+                image({op(Op_Code::add, 8, 1, programRegisters)}));
+  assertRefused(Program_Error::bad_register, 0,
+                image({op(Op_Code::sel, 8, 1, 0xFF)}));
+  // hue writes d, d + 1 and d + 2
+  assertRefused(Program_Error::bad_register, 0,
+                image({op(Op_Code::hue, programRegisters - 2, 0)}));
+  TEST_ASSERT_EQUAL_UINT8(
+      uint8_t(Program_Error::none),
+      uint8_t(verify(image({op(Op_Code::hue, programRegisters - 3, 0)}))));
+  // The operands of ldi are a constant, not registers
+  TEST_ASSERT_EQUAL_UINT8(
+      uint8_t(Program_Error::none),
+      uint8_t(verify(image({op(Op_Code::ldi, 8, 0xFF, 0xFF)}))));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_default_program);
+  RUN_TEST(test_masks);
+  RUN_TEST(test_longest_program);
+  RUN_TEST(test_run);
+  RUN_TEST(test_bad_size);
+  RUN_TEST(test_bad_version);
+  RUN_TEST(test_too_long);
+  RUN_TEST(test_bad_opcode);
+  RUN_TEST(test_bad_register);
+  return UNITY_END();
+}
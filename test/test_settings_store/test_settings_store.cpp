@@ -0,0 +1,374 @@
+/*
+   The binary settings file (include/settings_store.hpp): a record loaded
+   into the device, the record written by saveSettings(), files refused for
+   their CRC, size, magic or version, zones dropped from a record, the
+   temporary file of an interrupted save.
+
+   pio test -e native -f test_settings_store
+*/
+
+#include "Arduino.h"
+
+#include "settings_store.hpp"
+#include <unity.h>
+#include <vector>
+
+typedef std::vector<uint8_t> Image;
+
+const char *path = "/settings.bin";
+const char *temp = "/settings.bin.tmp";
+
+///@brief A settings file holding `size` bytes of record
+Image image(uint16_t version, const void *record, uint16_t size) {
+  SettingsHeader header = {settingsMagic, version, size};
+  Image bytes(sizeof(header) + size);
+  memcpy(bytes.data(), &header, sizeof(header));
+  memcpy(bytes.data() + sizeof(header), record, size);
+  uint32_t crc = crc32(bytes.data(), bytes.size());
+  const uint8_t *end = reinterpret_cast<const uint8_t *>(&crc);
+  bytes.insert(bytes.end(), end, end + sizeof(crc));
+  return bytes;
+}
+
+template <typename Record>
+Image image(uint16_t version, const Record &record) {
+  return image(version, &record, sizeof(record));
+}
+
+void store(const char *filename, const Image &bytes) {
+  File file = SPIFFS.open(filename, FILE_WRITE);
+  file.write(bytes.data(), bytes.size());
+  file.close();
+}
+
+SettingsSegment zone(uint16_t start, uint16_t length, byte mode) {
+  SettingsSegment zone;
+  memset(&zone, 0, sizeof(zone));
+  zone.start  = start;
+  zone.length = length;
+  zone.mode   = mode;
+  return zone;
+}
+
+void setColor(uint8_t *rgb, uint8_t r, uint8_t g, uint8_t b) {
+  rgb[0] = r;
+  rgb[1] = g;
+  rgb[2] = b;
+}
+
+void assertColor(uint8_t r, uint8_t g, uint8_t b, const Color_RGB &color) {
+  TEST_ASSERT_EQUAL_UINT8(r, color.r);
+  TEST_ASSERT_EQUAL_UINT8(g, color.g);
+  TEST_ASSERT_EQUAL_UINT8(b, color.b);
+}
+
+///@brief A record without a default value
+SettingsRecord fixture() {
+  SettingsRecord record;
+  memset(&record, 0, sizeof(record));
+
+  record.ledLenght  = 600;
+  record.brightness = 90;
+  setColor(record.fixedColor, 1, 2, 3);
+  record.rainbowVelocity  = 7;
+  record.endFirstLedSplit = 300;
+  setColor(record.splitColor1, 4, 5, 6);
+  setColor(record.splitColor2, 7, 8, 9);
+  record.mode         = byte(Mode_Type::color_split);
+  record.isOn         = 1;
+  record.transitionMs = 1234;
+
+  record.paletteVelocity = 12;
+  record.paletteCount    = 2;
+  record.paletteBlend    = 1;
+  setColor(record.paletteColors[0], 13, 14, 15);
+  setColor(record.paletteColors[1], 16, 17, 18);
+
+  record.fireCooling  = 19;
+  record.fireSparking = 20;
+  setColor(record.meteorColor, 21, 22, 23);
+  record.meteorVelocity = 24;
+  record.meteorTail     = 25;
+  setColor(record.twinkleColor1, 26, 27, 28);
+  setColor(record.twinkleColor2, 29, 30, 31);
+  record.twinkleRate = 32;
+  setColor(record.cometColor1, 33, 34, 35);
+  setColor(record.cometColor2, 36, 37, 38);
+  record.cometVelocity = 39;
+  record.cometCount    = 4;
+
+  record.programSlot = 1;
+  setColor(record.programParams, 40, 41, 42);
+  record.programParams[3] = 43;
+
+  setColor(record.spectrumLow, 44, 45, 46);
+  setColor(record.spectrumHigh, 47, 48, 49);
+  record.spectrumGain = 50;
+  setColor(record.pulseColor, 51, 52, 53);
+  record.pulseVelocity = 54;
+
+  setColor(record.sparkleColor1, 55, 56, 57);
+  setColor(record.sparkleColor2, 58, 59, 60);
+  record.sparkleRate    = 61;
+  record.sparkleOpacity = 62;
+
+  record.paletteSparkleVelocity = 63;
+  record.paletteSparkleRate     = 64;
+  record.paletteSparkleBlend    = 2;
+
+  // The payloads of the FixedColor and Comet characteristics
+  record.segmentCount = 2;
+  record.segments[0]  = zone(0, 10, byte(Mode_Type::fixed_color));
+  setColor(record.segments[0].params, 10, 20, 30);
+  record.segments[1] = zone(10, 20, byte(Mode_Type::comet));
+  setColor(record.segments[1].params, 40, 50, 60);
+  setColor(record.segments[1].params + 3, 70, 80, 90);
+  record.segments[1].params[6] = 11;
+  record.segments[1].params[7] = 3;
+  return record;
+}
+
+void assertBase() {
+  TEST_ASSERT_EQUAL_UINT16(600, device.defaultData.ledLenght);
+  TEST_ASSERT_EQUAL_UINT8(90, device.defaultData.brightness);
+  assertColor(1, 2, 3, device.fixedColorData.color);
+  TEST_ASSERT_EQUAL_UINT8(7, device.rainbowData.velocity);
+  TEST_ASSERT_EQUAL_UINT16(300, device.colorSplitData.endFirstLedSplit);
+  assertColor(4, 5, 6, device.colorSplitData.color1);
+  assertColor(7, 8, 9, device.colorSplitData.color2);
+  TEST_ASSERT_EQUAL(int(Mode_Type::color_split), int(device.activeMode));
+  TEST_ASSERT_TRUE(device.isOn);
+}
+
+///@brief The zones of fixture() with the parameters of their own mode
+void assertZones() {
+  TEST_ASSERT_EQUAL_UINT8(2, device.segmentsData.count);
+  const SegmentData &fixed = device.segmentsData.segments[0];
+  TEST_ASSERT_EQUAL(int(Mode_Type::fixed_color), int(fixed.mode));
+  TEST_ASSERT_EQUAL_UINT16(10, fixed.length);
+  assertColor(10, 20, 30, zoneParams<FixedColorMode>(fixed).color);
+
+  const SegmentData &comet = device.segmentsData.segments[1];
+  TEST_ASSERT_EQUAL(int(Mode_Type::comet), int(comet.mode));
+  TEST_ASSERT_EQUAL_UINT16(10, comet.start);
+  const CometData &params = zoneParams<CometMode>(comet);
+  assertColor(40, 50, 60, params.color1);
+  assertColor(70, 80, 90, params.color2);
+  TEST_ASSERT_EQUAL_UINT8(11, params.velocity);
+  TEST_ASSERT_EQUAL_UINT8(3, params.count);
+}
+
+void assertPalette() {
+  TEST_ASSERT_EQUAL_UINT8(12, device.paletteModeData.velocity);
+  TEST_ASSERT_EQUAL_UINT8(2, device.paletteData.count);
+  TEST_ASSERT_TRUE(device.paletteData.blend);
+  assertColor(16, 17, 18, device.paletteData.colors[1]);
+}
+
+void assertParticles() {
+  TEST_ASSERT_EQUAL_UINT8(19, device.fireData.cooling);
+  assertColor(21, 22, 23, device.meteorData.color);
+  TEST_ASSERT_EQUAL_UINT8(25, device.meteorData.tail);
+  assertColor(29, 30, 31, device.twinkleData.color2);
+  TEST_ASSERT_EQUAL_UINT8(4, device.cometData.count);
+}
+
+void assertProgram() {
+  TEST_ASSERT_EQUAL_UINT8(1, device.programData.slot);
+  TEST_ASSERT_EQUAL_UINT8(43, device.programData.params[3]);
+}
+
+void assertAudio() {
+  assertColor(47, 48, 49, device.spectrumData.high);
+  TEST_ASSERT_EQUAL_UINT8(50, device.spectrumData.gain);
+  TEST_ASSERT_EQUAL_UINT8(54, device.pulseData.velocity);
+}
+
+void assertSparkle() {
+  assertColor(58, 59, 60, device.sparkleData.color2);
+  TEST_ASSERT_EQUAL_UINT8(62, device.sparkleData.opacity);
+  TEST_ASSERT_EQUAL_UINT8(64, device.paletteSparkleData.rate);
+  TEST_ASSERT_EQUAL_UINT8(2, device.paletteSparkleData.blend);
+}
+
+///@brief Nothing a test expects is left over from the one before
+void resetDevice() {
+  device.defaultData        = DefaultData();
+  device.activeMode         = Mode_Type::fixed_color;
+  device.isOn               = false;
+  device.segmentsData.count = 0;
+  device.transitionData     = TransitionData();
+  device.paletteModeData    = PaletteModeData();
+  device.paletteData        = PaletteData();
+  device.fireData           = FireData();
+  device.cometData          = CometData();
+  device.programData        = ProgramData();
+  device.spectrumData       = SpectrumData();
+  device.pulseData          = PulseData();
+  device.sparkleData        = SparkleData();
+  device.paletteSparkleData = PaletteSparkleData();
+}
+
+void setUp() {
+  SPIFFS.remove(path);
+  SPIFFS.remove(temp);
+  resetDevice();
+}
+
+void tearDown() {}
+
+void test_load() {
+  store(path, image(settingsVersion, fixture()));
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+  assertBase();
+  assertZones();
+  TEST_ASSERT_EQUAL_UINT16(1234, device.transitionData.duration);
+  assertPalette();
+  assertParticles();
+  assertProgram();
+  assertAudio();
+  assertSparkle();
+}
+
+void test_round_trip() {
+  store(path, image(settingsVersion, fixture()));
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+  const SettingsRecord stored = fixture();
+  SettingsRecord saved        = recordFromDevice(device);
+  TEST_ASSERT_EQUAL_MEMORY(&stored, &saved, sizeof(saved));
+  TEST_ASSERT_TRUE(saveSettings(path));
+  TEST_ASSERT_FALSE(SPIFFS.exists(temp));
+
+  resetDevice();
+  TEST_ASSERT_EQUAL(0, loadSettings(path));
+  SettingsRecord loaded = recordFromDevice(device);
+  TEST_ASSERT_EQUAL_MEMORY(&saved, &loaded, sizeof(saved));
+  assertBase();
+  assertZones();
+  assertAudio();
+  assertSparkle();
+
+  // A blend mode past max, from a later build, is read as normal
+  SettingsRecord record      = saved;
+  record.paletteSparkleBlend = 9;
+  store(path, image(settingsVersion, record));
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+  TEST_ASSERT_EQUAL_UINT8(byte(Blend_Mode::normal),
+                          device.paletteSparkleData.blend);
+}
+
+void test_drops_invalid_zones() {
+  SettingsRecord record = fixture();
+  record.segmentCount   = 6;
+  // Unknown mode, past the strip, over zone 0, a program slot out of range,
+  // empty
+  record.segments[2] = zone(40, 5, 0xEE);
+  record.segments[3] = zone(STRIP_MAX_LEDS - 2, 5, byte(Mode_Type::rainbow));
+  record.segments[4] = zone(5, 10, byte(Mode_Type::rainbow));
+  record.segments[1] = zone(50, 5, byte(Mode_Type::program));
+  record.segments[1].params[0] = programSlots;
+  record.segments[5] = zone(60, 0, byte(Mode_Type::rainbow));
+
+  store(path, image(settingsVersion, record));
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+  TEST_ASSERT_EQUAL_UINT8(1, device.segmentsData.count);
+  TEST_ASSERT_EQUAL(int(Mode_Type::fixed_color),
+                    int(device.segmentsData.segments[0].mode));
+}
+
+void test_refused_files() {
+  const SettingsRecord record = fixture();
+  const Image good             = image(settingsVersion, record);
+  store(path, good);
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+
+  TEST_ASSERT_EQUAL(2, loadSettingsFile("/missing.bin"));
+
+  Image bytes = good;
+  bytes[sizeof(SettingsHeader) + 3] ^= 0x10;
+  store(path, bytes);
+  TEST_ASSERT_EQUAL(4, loadSettingsFile(path));
+
+  bytes = good;
+  bytes.pop_back();
+  store(path, bytes);
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+
+  store(path, Image(good.begin(), good.begin() + 6));
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+
+  bytes = good;
+  bytes.push_back(0);
+  store(path, bytes);
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+
+  // A valid CRC over a bad magic, an unknown version, the wrong record size
+  Image badMagic = good;
+  badMagic[0]    = 'X';
+  uint32_t crc   = crc32(badMagic.data(), badMagic.size() - sizeof(crc));
+  memcpy(badMagic.data() + badMagic.size() - sizeof(crc), &crc, sizeof(crc));
+  store(path, badMagic);
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+
+  store(path, image(settingsVersion + 1, record));
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+  store(path, image(0, record));
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+  store(path, image(settingsVersion, &record, sizeof(record) - 1));
+  TEST_ASSERT_EQUAL(3, loadSettingsFile(path));
+
+  // None of them changed the device
+  assertBase();
+  assertAudio();
+}
+
+void test_recovers_temporary_file() {
+  // Cut between remove() and rename(): only the temporary file is left
+  store(temp, image(settingsVersion, fixture()));
+  TEST_ASSERT_EQUAL(0, loadSettings(path));
+  assertBase();
+  TEST_ASSERT_TRUE(SPIFFS.exists(path));
+  TEST_ASSERT_FALSE(SPIFFS.exists(temp));
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+
+  // A corrupt file and a valid temporary one
+  Image bytes = image(settingsVersion, fixture());
+  bytes[sizeof(SettingsHeader)] ^= 1;
+  store(path, bytes);
+  store(temp, image(settingsVersion, fixture()));
+  TEST_ASSERT_EQUAL(0, loadSettings(path));
+  TEST_ASSERT_EQUAL(0, loadSettingsFile(path));
+  TEST_ASSERT_FALSE(SPIFFS.exists(temp));
+
+  // Cut while writing the temporary file: the old file stays
+  SettingsRecord old = fixture();
+  old.ledLenght      = 200;
+  old.mode           = byte(Mode_Type::rainbow);
+  store(path, image(settingsVersion, old));
+  bytes = image(settingsVersion, fixture());
+  bytes.resize(bytes.size() / 2);
+  store(temp, bytes);
+  TEST_ASSERT_EQUAL(0, loadSettings(path));
+  TEST_ASSERT_EQUAL(int(Mode_Type::rainbow), int(device.activeMode));
+
+  // Both corrupt: the error of the file
+  bytes = image(settingsVersion, fixture());
+  bytes.back() ^= 1;
+  store(path, bytes);
+  store(temp, bytes);
+  TEST_ASSERT_EQUAL(4, loadSettings(path));
+  SPIFFS.remove(path);
+  TEST_ASSERT_EQUAL(2, loadSettings(path));
+  TEST_ASSERT_EQUAL_UINT16(200, device.defaultData.ledLenght);
+}
+
+int main() {
+  SPIFFS.begin();
+  UNITY_BEGIN();
+  RUN_TEST(test_load);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_drops_invalid_zones);
+  RUN_TEST(test_refused_files);
+  RUN_TEST(test_recovers_temporary_file);
+  return UNITY_END();
+}
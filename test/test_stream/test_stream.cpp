@@ -0,0 +1,249 @@
+/*
+   Round trips of streamed frames through StreamEncoder and StreamDecoder
+   (include/stream.hpp): every op, the packet sizes of the ATT MTUs, lost
+   packets and the keyframe that resyncs the decoder, malformed packets.
+
+   pio test -e native -f test_stream
+*/
+
+#include "Arduino.h"
+
+#include "stream.hpp"
+#include <unity.h>
+#include <vector>
+
+typedef std::vector<uint8_t> Packet;
+
+// Packet payloads at the default ATT MTU, 247 and the 517 offered
+const size_t payloads[] = {20, 244, streamPacketMax};
+const uint16_t length   = 1000;
+
+static StreamDecoder decoder;
+static uint8_t previous[STRIP_MAX_LEDS * 3];
+static uint8_t next[STRIP_MAX_LEDS * 3];
+static uint32_t seed;
+
+uint32_t random32() {
+  seed = seed * 1664525 + 1013904223;
+  return seed >> 8;
+}
+
+///@brief Rewrite a few spans of the frame, some black, some of one color,
+/// some of random pixels, the rest unchanged
+void mutate(uint8_t *rgb, uint16_t count) {
+  for (int edit = 0; edit < 4; edit++) {
+    uint16_t start = random32() % count;
+    uint16_t span  = min<uint32_t>(1 + random32() % 150, count - start);
+    uint32_t kind  = random32() % 3;
+    uint8_t color[3];
+    for (uint8_t &channel : color) {
+      channel = kind == 0 ? 0 : random32();
+    }
+    for (uint32_t i = 3 * start; i < 3 * (start + span); i++) {
+      rgb[i] = kind == 2 ? random32() : color[i % 3];
+    }
+  }
+}
+
+std::vector<Packet> encode(StreamEncoder &encoder, const uint8_t *from,
+                           const uint8_t *to, uint16_t count) {
+  std::vector<Packet> packets;
+  encoder.encode(from, to, count, [&](const uint8_t *data, size_t size) {
+    packets.emplace_back(data, data + size);
+  });
+  return packets;
+}
+
+///@return how many packets completed a frame
+int decode(const std::vector<Packet> &packets) {
+  int frames = 0;
+  for (const Packet &packet : packets) {
+    frames += decoder.decode(packet.data(), packet.size());
+  }
+  return frames;
+}
+
+void assertFrame(const uint8_t *rgb, uint16_t count) {
+  device.strip.setLength(count);
+  decoder.draw(device.strip, 0, count);
+  const uint8_t *pixel = device.strip.getPixels();
+  for (uint16_t i = 0; i < count; i++, pixel += stripBytesPerPixel) {
+    TEST_ASSERT_EQUAL_UINT8(rgb[3 * i], pixel[StripFormat::red]);
+    TEST_ASSERT_EQUAL_UINT8(rgb[3 * i + 1], pixel[StripFormat::green]);
+    TEST_ASSERT_EQUAL_UINT8(rgb[3 * i + 2], pixel[StripFormat::blue]);
+  }
+}
+
+void setUp() {
+  decoder = StreamDecoder();
+  seed    = 1;
+  memset(previous, 0, sizeof(previous));
+  memset(next, 0, sizeof(next));
+}
+
+void tearDown() {}
+
+void test_keyframe_round_trip() {
+  for (size_t payload : payloads) {
+    StreamEncoder encoder(payload);
+    mutate(next, length);
+    mutate(next, length);
+    std::vector<Packet> packets = encode(encoder, nullptr, next, length);
+
+    TEST_ASSERT_EQUAL_UINT8(streamKeyframe, packets.front()[0] & 0x03);
+    for (const Packet &packet : packets) {
+      TEST_ASSERT_LESS_OR_EQUAL(payload, packet.size());
+    }
+    TEST_ASSERT_EQUAL(1, decode(packets));
+    assertFrame(next, length);
+  }
+}
+
+void test_deltas_round_trip() {
+  for (size_t payload : payloads) {
+    setUp();
+    StreamEncoder encoder(payload);
+    TEST_ASSERT_EQUAL(1, decode(encode(encoder, nullptr, next, length)));
+    for (int frame = 0; frame < 50; frame++) {
+      memcpy(previous, next, sizeof(next));
+      mutate(next, length);
+      TEST_ASSERT_EQUAL(1, decode(encode(encoder, previous, next, length)));
+      assertFrame(next, length);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.packetsDropped());
+    TEST_ASSERT_EQUAL_UINT32(51, decoder.framesDecoded());
+  }
+}
+
+void test_whole_strip() {
+  // The last pixel of the largest strip, and skips longer than a short op
+  StreamEncoder encoder(streamPacketMax);
+  const uint16_t count = STRIP_MAX_LEDS;
+  next[3 * (count - 1)] = 255;
+  next[1]               = 7;
+  TEST_ASSERT_EQUAL(1, decode(encode(encoder, nullptr, next, count)));
+  assertFrame(next, count);
+
+  memcpy(previous, next, sizeof(next));
+  next[3 * (count - 1) + 2] = 9;
+  std::vector<Packet> packets = encode(encoder, previous, next, count);
+  TEST_ASSERT_EQUAL(1, packets.size());
+  TEST_ASSERT_EQUAL(1, decode(packets));
+  assertFrame(next, count);
+}
+
+void test_sequence_wraps() {
+  // Hundreds of packets of 20 bytes, the sequence goes past 255
+  StreamEncoder encoder(20);
+  size_t packets = 0;
+  for (int frame = 0; frame < 8; frame++) {
+    memcpy(previous, next, sizeof(next));
+    for (uint32_t i = 0; i < 3 * length; i++) {
+      next[i] = random32();
+    }
+    std::vector<Packet> sent =
+        encode(encoder, frame == 0 ? nullptr : previous, next, length);
+    packets += sent.size();
+    TEST_ASSERT_EQUAL(1, decode(sent));
+  }
+  TEST_ASSERT_GREATER_THAN(256, packets);
+  assertFrame(next, length);
+}
+
+void test_lost_packet_waits_for_keyframe() {
+  StreamEncoder encoder(20);
+  mutate(next, length);
+  TEST_ASSERT_EQUAL(1, decode(encode(encoder, nullptr, next, length)));
+
+  // The second packet of a delta is lost
+  memcpy(previous, next, sizeof(next));
+  mutate(next, length);
+  std::vector<Packet> packets = encode(encoder, previous, next, length);
+  TEST_ASSERT_GREATER_THAN(2, packets.size());
+  packets.erase(packets.begin() + 1);
+  TEST_ASSERT_EQUAL(0, decode(packets));
+  TEST_ASSERT_EQUAL_UINT32(packets.size() - 1, decoder.packetsDropped());
+
+  // The deltas that follow are dropped, they apply to a frame not decoded
+  memcpy(previous, next, sizeof(next));
+  mutate(next, length);
+  packets = encode(encoder, previous, next, length);
+  TEST_ASSERT_EQUAL(0, decode(packets));
+  TEST_ASSERT_EQUAL_UINT32(1, decoder.framesDecoded());
+
+  // A keyframe resyncs
+  mutate(next, length);
+  TEST_ASSERT_EQUAL(1, decode(encode(encoder, nullptr, next, length)));
+  assertFrame(next, length);
+
+  memcpy(previous, next, sizeof(next));
+  mutate(next, length);
+  TEST_ASSERT_EQUAL(1, decode(encode(encoder, previous, next, length)));
+  assertFrame(next, length);
+}
+
+void test_lost_keyframe_packet() {
+  StreamEncoder encoder(20);
+  mutate(next, length);
+  std::vector<Packet> packets = encode(encoder, nullptr, next, length);
+  packets.erase(packets.begin());
+  TEST_ASSERT_EQUAL(0, decode(packets));
+
+  TEST_ASSERT_EQUAL(1, decode(encode(encoder, nullptr, next, length)));
+  assertFrame(next, length);
+}
+
+void test_lost_end_of_frame() {
+  // The frame is not shown, the next delta is dropped
+  StreamEncoder encoder(20);
+  mutate(next, length);
+  std::vector<Packet> packets = encode(encoder, nullptr, next, length);
+  packets.pop_back();
+  TEST_ASSERT_EQUAL(0, decode(packets));
+
+  memcpy(previous, next, sizeof(next));
+  mutate(next, length);
+  TEST_ASSERT_EQUAL(0, decode(encode(encoder, previous, next, length)));
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.framesDecoded());
+}
+
+void test_malformed_packets() {
+  const uint8_t whole = streamKeyframe | streamEndOfFrame;
+  const uint8_t shortPacket[] = {whole, 0, 0};
+  TEST_ASSERT_FALSE(decoder.decode(shortPacket, sizeof(shortPacket)));
+
+  // A run without its color, then a delta: dropped until a keyframe
+  const uint8_t truncated[] = {whole, 1, 0, 0, streamOpRun | 3, 255};
+  TEST_ASSERT_FALSE(decoder.decode(truncated, sizeof(truncated)));
+  const uint8_t delta[] = {streamEndOfFrame, 2, 0, 0, streamOpRun, 1, 2, 3};
+  TEST_ASSERT_FALSE(decoder.decode(delta, sizeof(delta)));
+
+  // Past the end of the frame, a long skip without its second byte
+  const uint16_t last  = STRIP_MAX_LEDS - 1;
+  const uint8_t past[] = {whole, 3, lowByte(last), highByte(last),
+                          streamOpRun | 1, 1, 2, 3};
+  TEST_ASSERT_FALSE(decoder.decode(past, sizeof(past)));
+  const uint8_t longSkip[] = {whole, 4, 0, 0, streamOpLongSkip};
+  TEST_ASSERT_FALSE(decoder.decode(longSkip, sizeof(longSkip)));
+
+  TEST_ASSERT_EQUAL_UINT32(5, decoder.packetsDropped());
+  TEST_ASSERT_EQUAL_UINT32(0, decoder.framesDecoded());
+
+  const uint8_t good[] = {whole, 5, 1, 0, streamOpRun | 1, 1, 2, 3};
+  TEST_ASSERT_TRUE(decoder.decode(good, sizeof(good)));
+  const uint8_t expected[] = {0, 0, 0, 1, 2, 3, 1, 2, 3, 0, 0, 0};
+  assertFrame(expected, 4);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_keyframe_round_trip);
+  RUN_TEST(test_deltas_round_trip);
+  RUN_TEST(test_whole_strip);
+  RUN_TEST(test_sequence_wraps);
+  RUN_TEST(test_lost_packet_waits_for_keyframe);
+  RUN_TEST(test_lost_keyframe_packet);
+  RUN_TEST(test_lost_end_of_frame);
+  RUN_TEST(test_malformed_packets);
+  return UNITY_END();
+}
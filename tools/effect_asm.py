@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""Assemble an effect program for the program mode (include/effect_vm.hpp).
+
+Usage:
+  effect_asm.py SOURCE [-o FILE] [--hex] [--src HEADER]
+
+One instruction a line, `op d, a, b`, comments start with ';' or '#':
+
+  mul r11, time, p3     ; time * p3
+  add r12, r11, pos
+  hue red, r12
+
+Registers are r0 to r15, or their names: index, length, time, pos, p0 to
+p3, red, green, blue. `ldi d, value` loads a constant, -32768 to 65535.
+The opcodes are read from HEADER (include/effect_vm.hpp by default), so
+the assembler follows the firmware. Writes the image to FILE, or prints it
+as hex, the payload of the Program characteristic after the slot byte.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+VERSION = 1
+MAX_INSTRUCTIONS = 64
+NAMES = {"index": 0, "length": 1, "time": 2, "pos": 3, "p0": 4, "p1": 5,
+         "p2": 6, "p3": 7, "red": 8, "green": 9, "blue": 10}
+# Operands after d, the others are 2
+UNARY = {"mov", "wave", "tri", "noise", "hue"}
+
+OPCODE = re.compile(r"^\s*(\w+)\s*=\s*(0x[0-9A-Fa-f]+|\d+)\s*,", re.M)
+
+
+def load_opcodes(header):
+    with open(header, encoding="utf-8") as file:
+        source = file.read()
+    start = source.index("enum class Op_Code")
+    body = source[start:source.index("};", start)]
+    return {name: int(value, 0) for name, value in OPCODE.findall(body)}
+
+
+def register(text, line):
+    text = text.strip().lower()
+    if text in NAMES:
+        return NAMES[text]
+    match = re.fullmatch(r"r(\d+)", text)
+    if match is None or int(match.group(1)) > 15:
+        raise SyntaxError(f"line {line}: bad register '{text}'")
+    return int(match.group(1))
+
+
+def assemble(source, opcodes):
+    code = bytearray()
+    for line, text in enumerate(source.splitlines(), 1):
+        text = re.split(r"[;#]", text, 1)[0].strip()
+        if not text:
+            continue
+        op, _, rest = text.partition(" ")
+        op = op.lower()
+        if op not in opcodes:
+            raise SyntaxError(f"line {line}: unknown op '{op}'")
+        operands = [part for part in rest.split(",") if part.strip()]
+        if op == "ldi":
+            if len(operands) != 2:
+                raise SyntaxError(f"line {line}: ldi d, value")
+            value = int(operands[1].strip(), 0)
+            if not -32768 <= value <= 65535:
+                raise SyntaxError(f"line {line}: {value} out of range")
+            value &= 0xFFFF
+            code += bytes([opcodes[op], register(operands[0], line),
+                           value & 0xFF, value >> 8])
+            continue
+        count = 2 if op in UNARY else 3
+        if len(operands) != count:
+            raise SyntaxError(f"line {line}: {op} takes {count} registers")
+        registers = [register(operand, line) for operand in operands]
+        code += bytes([opcodes[op]] + registers + [0] * (3 - count))
+    if len(code) // 4 > MAX_INSTRUCTIONS:
+        raise SyntaxError(f"more than {MAX_INSTRUCTIONS} instructions")
+    return bytes([VERSION, len(code) // 4]) + bytes(code)
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source")
+    parser.add_argument("-o", "--out")
+    parser.add_argument("--hex", action="store_true")
+    parser.add_argument("--src", default=os.path.join(root, "include",
+                                                      "effect_vm.hpp"))
+    args = parser.parse_args()
+
+    with open(args.source, encoding="utf-8") as file:
+        try:
+            image = assemble(file.read(), load_opcodes(args.src))
+        except SyntaxError as error:
+            sys.exit(f"{args.source}: {error}")
+    if args.out and not args.hex:
+        with open(args.out, "wb") as file:
+            file.write(image)
+    else:
+        print(image.hex())
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""Decode the binary log records written to Serial by include/log.hpp.
+
+Usage:
+  log_decode.py [--src DIR ...] [--port PORT [--baud N] | FILE]
+
+The format strings are not in the firmware: they are read from the LOG_*
+calls in the sources (include/ and src/ by default) and matched by their
+32 bit FNV-1a, the id the firmware sends. Reads FILE, a serial PORT (needs
+pyserial) or stdin, and prints one line per record. Bytes outside of a
+valid frame (boot messages, noise) are skipped.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+LEVELS = {1: "ERROR", 2: "WARN", 3: "INFO", 4: "DEBUG"}
+CATEGORIES = {0x01: "BLE", 0x02: "STRIP", 0x04: "DEVICE"}
+DROPPED_ID = 0
+
+CALL = re.compile(
+    r'LOG_(?:ERROR|WARN|INFO|DEBUG)\(\s*\w+\s*,\s*'
+    r'((?:"(?:[^"\\]|\\.)*"\s*|[A-Z_][A-Z0-9_]*\s*)+)\s*[,)]')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"|([A-Z_][A-Z0-9_]*)')
+DEFINE = re.compile(r'#define\s+([A-Z_][A-Z0-9_]*)\s+"((?:[^"\\]|\\.)*)"')
+
+
+def fnv1a(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def unescape(text):
+    return text.encode("latin-1").decode("unicode_escape").encode("latin-1")
+
+
+def load_formats(directories):
+    sources = []
+    for directory in directories:
+        for root, _, files in os.walk(directory):
+            for name in files:
+                if name.endswith((".h", ".hpp", ".cpp")):
+                    with open(os.path.join(root, name), encoding="utf-8",
+                              errors="replace") as file:
+                        sources.append(file.read())
+
+    # String macros used in formats, e.g. SETTINGS_FILE
+    macros = {}
+    for source in sources:
+        for name, value in DEFINE.findall(source):
+            macros[name] = unescape(value)
+
+    formats = {}
+    for source in sources:
+        for match in CALL.finditer(source):
+            text = b""
+            for literal, macro in LITERAL.findall(match.group(1)):
+                text += unescape(literal) if not macro else macros.get(
+                    macro, b"")
+            formats[fnv1a(text)] = text.decode("utf-8", errors="replace")
+    return formats
+
+
+def parse_args(data):
+    args = []
+    i = 0
+    while i < len(data):
+        tag = chr(data[i])
+        i += 1
+        if tag == "i":
+            args.append(struct.unpack_from("<i", data, i)[0])
+            i += 4
+        elif tag == "u":
+            args.append(struct.unpack_from("<I", data, i)[0])
+            i += 4
+        elif tag == "f":
+            args.append(struct.unpack_from("<f", data, i)[0])
+            i += 4
+        elif tag == "s":
+            length = data[i]
+            args.append(data[i + 1:i + 1 + length].decode("utf-8", "replace"))
+            i += 1 + length
+        else:
+            raise ValueError("unknown argument tag %r" % tag)
+    return args
+
+
+def format_record(formats, millis, format_id, level, category, args):
+    if format_id == DROPPED_ID:
+        text = "%u log records dropped, the ring was full" % args[0]
+    elif format_id in formats:
+        # Python has no length modifiers
+        pattern = re.sub(r"%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z)?([diuxXcsf])",
+                         r"%\1\2", formats[format_id])
+        try:
+            text = pattern % tuple(args)
+        except (TypeError, ValueError):
+            text = "%s %r" % (formats[format_id], args)
+    else:
+        text = "unknown format 0x%08x %r" % (format_id, args)
+    prefix = CATEGORIES.get(category)
+    if prefix:
+        text = "[%s] - %s" % (prefix, text)
+    return "%10.3f %-5s %s" % (millis / 1000.0, LEVELS.get(level, "?"), text)
+
+
+def frames(read):
+    buffer = bytearray()
+    while True:
+        chunk = read()
+        if not chunk:
+            return
+        buffer += chunk
+        while True:
+            start = buffer.find(SYNC)
+            if start < 0:
+                buffer.clear()
+                break
+            del buffer[:start]
+            if len(buffer) < 2:
+                break
+            size = buffer[1]
+            if len(buffer) < 2 + size + 1:
+                break
+            payload = bytes(buffer[2:2 + size])
+            if size < 10 or sum(payload) & 0xFF != buffer[2 + size]:
+                del buffer[:1]  # Not a frame, look for the next sync byte
+                continue
+            del buffer[:2 + size + 1]
+            yield payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="recorded output, - for stdin")
+    parser.add_argument("--src", action="append",
+                        help="source directory to read the formats from")
+    parser.add_argument("--port", help="serial port")
+    parser.add_argument("--baud", type=int, default=115200)
+    options = parser.parse_args()
+
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    directories = options.src or [os.path.join(root, "include"),
+                                  os.path.join(root, "src")]
+    formats = load_formats(directories)
+
+    if options.port:
+        import serial  # pyserial
+
+        port = serial.Serial(options.port, options.baud, timeout=0.1)
+
+        def read():
+            while True:
+                data = port.read(256)
+                if data:
+                    return data
+    else:
+        stream = (sys.stdin.buffer if options.file in (None, "-") else
+                  open(options.file, "rb"))
+
+        def read():
+            return stream.read1(4096) if hasattr(stream, "read1") else \
+                stream.read(4096)
+
+    for payload in frames(read):
+        millis, format_id, level, category = struct.unpack_from("<IIBB",
+                                                                 payload)
+        try:
+            args = parse_args(payload[10:])
+        except (ValueError, struct.error, IndexError) as error:
+            print("bad record 0x%08x: %s" % (format_id, error))
+            continue
+        print(format_record(formats, millis, format_id, level, category,
+                            args), flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,482 @@
+/*
+   Offline render of a mode to a file (env:render), on a ManualClock: as fast
+   as the CPU allows and the same frames on every run.
+
+   Usage: program MODE [options]
+     MODE             a mode name: fixed_color, rainbow, color_split...
+     --length N       LEDs (default 60)
+     --seconds S      time rendered (default 10)
+     --fps F          frames written per second of it (default 60)
+     --brightness B   0-255 (default 255)
+     --velocity V     rainbow, palette, palette_sparkle, meteor, comet and
+                      pulse velocity, fire sparking, twinkle and sparkle
+                      rate, program param 3, spectrum gain (default 50)
+     --color R,G,B    fixed_color, meteor and pulse color, first color of
+                      color_split, twinkle, comet, spectrum and sparkle,
+                      program params 0-2
+     --color2 R,G,B   second color of color_split, twinkle, comet, spectrum
+                      and sparkle
+     --split N        color_split LEDs of the first color, fire cooling,
+                      meteor tail, comet count, sparkle opacity,
+                      palette_sparkle rate (default 30)
+     --palette R,G,B:R,G,B...
+                      palette colors, blended (default the settings' one)
+     --program FILE   effect program image run by the program mode
+                      (include/effect_vm.hpp), default the built-in rainbow
+     --wav FILE       sound of the spectrum and pulse modes, a PCM 16 bit
+                      WAV analyzed in step with the frames (include/audio.hpp)
+     --out FILE       write the frames (format below)
+     --ppm FILE       write a PPM image, one row per frame
+     --compare FILE   check the frames against a file written by --out,
+                      exit status 1 at the first difference
+
+   Frame file, little endian:
+     "LSF1", length (16), fps (16), frame count (32)
+     then the frames as packets of the stream codec (include/stream.hpp),
+     each packet preceded by its size (16): a keyframe every second, deltas
+     in between. A frame ends with the packet flagged streamEndOfFrame.
+   Frames are the colors sent to the LEDs, after the output stage
+   (include/output.hpp), as r, g, b.
+*/
+
+#include "Arduino.h"
+
+#include "audio.hpp"
+#include "clock.hpp"
+#include "modes.hpp"
+#include "output.hpp"
+#include "renderer.hpp"
+#include "settings.h"
+#include "stream.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+struct Options {
+  Mode_Type mode      = Mode_Type::fixed_color;
+  uint16_t length     = 60;
+  uint32_t seconds    = 10;
+  uint16_t fps        = 60;
+  uint8_t brightness  = 255;
+  uint8_t velocity    = 50;
+  Color_RGB color1    = Color_RGB{255, 80, 0};
+  Color_RGB color2    = Color_RGB{0, 40, 255};
+  uint16_t split      = 30;
+  PaletteData palette = defaultPalette;
+  const char *program = nullptr;
+  const char *wav     = nullptr;
+  const char *out     = nullptr;
+  const char *ppm     = nullptr;
+  const char *compare = nullptr;
+};
+
+static void usage() {
+  fprintf(stderr, "usage: program MODE [--length N] [--seconds S] [--fps F] "
+                  "[--brightness B] [--velocity V] [--color R,G,B] "
+                  "[--color2 R,G,B] [--split N] [--palette R,G,B:R,G,B...] "
+                  "[--program FILE] [--wav FILE] [--out FILE] [--ppm FILE] "
+                  "[--compare FILE]\nmodes:");
+  for (const ModeEntry &mode : Modes::table) {
+    fprintf(stderr, " %s", mode.name);
+  }
+  fprintf(stderr, "\n");
+}
+
+static bool parseColor(const char *text, Color_RGB &color) {
+  unsigned r, g, b;
+  if (sscanf(text, "%u,%u,%u", &r, &g, &b) != 3 || r > 255 || g > 255 ||
+      b > 255) {
+    return false;
+  }
+  color = Color_RGB{uint8_t(r), uint8_t(g), uint8_t(b)};
+  return true;
+}
+
+///@brief Colors separated by ':'
+static bool parsePalette(const char *text, PaletteData &palette) {
+  memset(&palette, 0, sizeof(palette));
+  palette.blend = true;
+  while (*text != '\0') {
+    if (palette.count == paletteColorsMax ||
+        !parseColor(text, palette.colors[palette.count++])) {
+      return false;
+    }
+    const char *next = strchr(text, ':');
+    text             = next != nullptr ? next + 1 : text + strlen(text);
+  }
+  return palette.count > 0;
+}
+
+static bool parseOptions(int argc, char **argv, Options &options) {
+  if (argc < 2) {
+    return false;
+  }
+  const ModeEntry *mode = nullptr;
+  for (const ModeEntry &entry : Modes::table) {
+    if (strcmp(argv[1], entry.name) == 0) {
+      mode = &entry;
+    }
+  }
+  if (mode == nullptr) {
+    return false;
+  }
+  options.mode = mode->id;
+
+  for (int i = 2; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (value == nullptr) {
+      return false;
+    }
+    i++;
+    if (strcmp(argv[i - 1], "--length") == 0) {
+      options.length = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--seconds") == 0) {
+      options.seconds = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--fps") == 0) {
+      options.fps = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--brightness") == 0) {
+      options.brightness = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--velocity") == 0) {
+      options.velocity = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--color") == 0) {
+      if (!parseColor(value, options.color1)) {
+        return false;
+      }
+    } else if (strcmp(argv[i - 1], "--color2") == 0) {
+      if (!parseColor(value, options.color2)) {
+        return false;
+      }
+    } else if (strcmp(argv[i - 1], "--split") == 0) {
+      options.split = strtoul(value, nullptr, 10);
+    } else if (strcmp(argv[i - 1], "--palette") == 0) {
+      if (!parsePalette(value, options.palette)) {
+        return false;
+      }
+    } else if (strcmp(argv[i - 1], "--program") == 0) {
+      options.program = value;
+    } else if (strcmp(argv[i - 1], "--wav") == 0) {
+      options.wav = value;
+    } else if (strcmp(argv[i - 1], "--out") == 0) {
+      options.out = value;
+    } else if (strcmp(argv[i - 1], "--ppm") == 0) {
+      options.ppm = value;
+    } else if (strcmp(argv[i - 1], "--compare") == 0) {
+      options.compare = value;
+    } else {
+      return false;
+    }
+  }
+  return options.length > 0 && options.length <= STRIP_MAX_LEDS &&
+         options.fps > 0;
+}
+
+///@brief The whole strip runs the mode, as with an empty zone table
+static void applyOptions(const Options &options) {
+  device.isOn                            = true;
+  device.activeMode                      = options.mode;
+  device.segmentsData.count              = 0;
+  device.defaultData.ledLenght           = options.length;
+  device.defaultData.brightness          = options.brightness;
+  device.rainbowData.velocity            = options.velocity;
+  device.fixedColorData.color            = options.color1;
+  device.colorSplitData.color1           = options.color1;
+  device.colorSplitData.color2           = options.color2;
+  device.colorSplitData.endFirstLedSplit = options.split;
+  device.paletteModeData.velocity        = options.velocity;
+  device.paletteData                     = options.palette;
+  device.fireData.cooling                = min<uint16_t>(options.split, 255);
+  device.fireData.sparking               = options.velocity;
+  device.meteorData.color                = options.color1;
+  device.meteorData.velocity             = options.velocity;
+  device.meteorData.tail                 = min<uint16_t>(options.split, 255);
+  device.twinkleData.color1              = options.color1;
+  device.twinkleData.color2              = options.color2;
+  device.twinkleData.rate                = options.velocity;
+  device.cometData.color1                = options.color1;
+  device.cometData.color2                = options.color2;
+  device.cometData.velocity              = options.velocity;
+  device.cometData.count                 = min<uint16_t>(options.split, 255);
+  device.programData.slot                = 0;
+  device.programData.params[0]           = options.color1.r;
+  device.programData.params[1]           = options.color1.g;
+  device.programData.params[2]           = options.color1.b;
+  device.programData.params[3]           = options.velocity;
+  device.spectrumData.low                = options.color1;
+  device.spectrumData.high               = options.color2;
+  device.spectrumData.gain               = options.velocity;
+  device.pulseData.color                 = options.color1;
+  device.pulseData.velocity              = options.velocity;
+  device.sparkleData.color1              = options.color1;
+  device.sparkleData.color2              = options.color2;
+  device.sparkleData.rate                = options.velocity;
+  device.sparkleData.opacity             = min<uint16_t>(options.split, 255);
+  device.paletteSparkleData              = defaultPaletteSparkleData;
+  device.paletteSparkleData.velocity     = options.velocity;
+  device.paletteSparkleData.rate         = min<uint16_t>(options.split, 255);
+  device.strip.setLength(options.length);
+}
+
+///@brief The strip buffer (wire order) as r, g, b
+static void stripColors(const Adafruit_NeoPixel &strip, uint8_t *rgb) {
+  const uint8_t *pixel = strip.getPixels();
+  for (uint16_t i = 0; i < strip.numPixels(); i++) {
+    rgb[3 * i]     = pixel[StripFormat::red];
+    rgb[3 * i + 1] = pixel[StripFormat::green];
+    rgb[3 * i + 2] = pixel[StripFormat::blue];
+    pixel += stripBytesPerPixel;
+  }
+}
+
+static void put16(std::vector<uint8_t> &file, uint16_t value) {
+  file.push_back(lowByte(value));
+  file.push_back(highByte(value));
+}
+
+static void put32(std::vector<uint8_t> &file, uint32_t value) {
+  put16(file, value & 0xFFFF);
+  put16(file, value >> 16);
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  uint8_t buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + size);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool writeFile(const char *path, const std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written;
+}
+
+///
+///@brief Reads the frames of a frame file back, through the stream decoder
+///
+class FrameReader {
+public:
+  ///@return false if it is not a frame file
+  bool open(std::vector<uint8_t> &&data) {
+    file = std::move(data);
+    if (file.size() < 12 || memcmp(file.data(), "LSF1", 4) != 0) {
+      return false;
+    }
+    length = file[4] | file[5] << 8;
+    fps    = file[6] | file[7] << 8;
+    frames = file[8] | file[9] << 8 | file[10] << 16 | uint32_t(file[11]) << 24;
+    offset = 12;
+    scratch.setLength(length);
+    return true;
+  }
+
+  ///@brief Decode the next frame, r, g, b into rgb
+  ///@return false at the end of the file or on a corrupt frame
+  bool next(uint8_t *rgb) {
+    while (offset + 2 <= file.size()) {
+      size_t size = file[offset] | file[offset + 1] << 8;
+      offset += 2;
+      if (offset + size > file.size()) {
+        return false;
+      }
+      bool complete = decoder.decode(file.data() + offset, size);
+      offset += size;
+      if (complete) {
+        decoder.draw(scratch, 0, length);
+        stripColors(scratch, rgb);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint16_t length = 0;
+  uint16_t fps    = 0;
+  uint32_t frames = 0;
+
+private:
+  std::vector<uint8_t> file;
+  size_t offset = 0;
+  StreamDecoder decoder;
+  StripPixels scratch{0, -1, stripPixelType};
+};
+
+///
+///@brief Analyze the hops of the sound captured by `now`, as the audio task
+/// would have, and redraw the audio zones with them
+///
+static void analyzeUntil(unsigned long now) {
+  static uint64_t analyzed = 0;
+  uint64_t captured        = uint64_t(now) * audioSampleRate / 1000;
+  int16_t hop[audioHop];
+  while (analyzed + audioHop <= captured &&
+         audioSource->read(hop, audioHop) == audioHop) {
+    analyzed += audioHop;
+    AudioFeatures features;
+    audioAnalyzer.analyze(hop, analyzed * 1000000 / audioSampleRate,
+                          features);
+    audioFeed.publish(features);
+    if (audioFeed.receive(now)) {
+      segmentEngine.invalidateMode(device, Mode_Type::spectrum);
+      segmentEngine.invalidateMode(device, Mode_Type::pulse);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+  applyOptions(options);
+
+  if (options.program != nullptr) {
+    std::vector<uint8_t> image;
+    EffectProgram program;
+    uint8_t at;
+    if (!readFile(options.program, image)) {
+      fprintf(stderr, "%s: cannot read\n", options.program);
+      return 2;
+    }
+    Program_Error error =
+        verifyProgram(image.data(), image.size(), program, at);
+    if (error != Program_Error::none) {
+      fprintf(stderr, "%s: error %u at instruction %u\n", options.program,
+              unsigned(error), at);
+      return 2;
+    }
+    effectPrograms.install(0, program);
+  }
+
+  if (options.wav != nullptr) {
+    if (!wavAudioSource.open(options.wav)) {
+      fprintf(stderr, "%s: not a PCM 16 bit WAV file\n", options.wav);
+      return 2;
+    }
+    audioSource = &wavAudioSource;
+    audioFeed.listen(true);
+  }
+
+  FrameReader golden;
+  if (options.compare != nullptr) {
+    std::vector<uint8_t> data;
+    if (!readFile(options.compare, data) || !golden.open(std::move(data))) {
+      fprintf(stderr, "%s: not a frame file\n", options.compare);
+      return 2;
+    }
+    uint32_t frames = options.seconds * options.fps;
+    if (golden.length != options.length || golden.fps != options.fps ||
+        golden.frames != frames) {
+      fprintf(stderr, "%s: %u frames of %u LEDs at %u fps, rendering %u of "
+                      "%u at %u\n",
+              options.compare, golden.frames, golden.length, golden.fps,
+              frames, options.length, options.fps);
+      return 1;
+    }
+  }
+
+  ManualClock clock;
+  frameClock = &clock;
+
+  const uint32_t frames = options.seconds * options.fps;
+  const size_t bytes    = size_t(options.length) * 3;
+  std::vector<uint8_t> previous(bytes), current(bytes), expected(bytes);
+  // What the output stage would send, nothing goes through an OutputDriver
+  static StripPixels sent{0, -1, stripPixelType};
+
+  std::vector<uint8_t> file = {'L', 'S', 'F', '1'};
+  put16(file, options.length);
+  put16(file, options.fps);
+  put32(file, frames);
+  std::vector<uint8_t> image;
+  StreamEncoder encoder(streamPacketMax);
+
+  typedef std::chrono::steady_clock wall;
+  double renderNs = 0;
+  int status      = 0;
+  bool redraw     = true;
+  for (uint32_t f = 0; f < frames; f++) {
+    // Frame times from the frame index, 1000 / fps does not drift
+    clock.set(uint64_t(f) * 1000 / options.fps);
+
+    const auto start = wall::now();
+    if (audioSource != nullptr) {
+      analyzeUntil(clock.now());
+    }
+    if (renderFrame(device, redraw, clock.now())) {
+      outputStage.setBrightness(device.defaultData.brightness);
+      outputStage.apply(device.strip, sent);
+    }
+    renderNs += std::chrono::duration<double, std::nano>(wall::now() - start)
+                    .count();
+    redraw = false;
+
+    stripColors(sent, current.data());
+    if (options.out != nullptr) {
+      bool keyframe = f % options.fps == 0;
+      encoder.encode(keyframe ? nullptr : previous.data(), current.data(),
+                     options.length, [&](const uint8_t *data, size_t size) {
+                       put16(file, size);
+                       file.insert(file.end(), data, data + size);
+                     });
+    }
+    if (options.ppm != nullptr) {
+      image.insert(image.end(), current.begin(), current.end());
+    }
+    if (options.compare != nullptr && status == 0) {
+      if (!golden.next(expected.data())) {
+        fprintf(stderr, "frame %u: missing from %s\n", f, options.compare);
+        status = 1;
+      } else if (expected != current) {
+        size_t i = 0;
+        while (expected[i] == current[i]) {
+          i++;
+        }
+        fprintf(stderr, "frame %u: LED %u differs\n", f, unsigned(i / 3));
+        status = 1;
+      }
+    }
+    previous.swap(current);
+  }
+
+  if (options.out != nullptr && !writeFile(options.out, file)) {
+    fprintf(stderr, "%s: write failed\n", options.out);
+    return 2;
+  }
+  if (options.ppm != nullptr) {
+    char header[32];
+    int size = snprintf(header, sizeof(header), "P6\n%u %u\n255\n",
+                        options.length, frames);
+    image.insert(image.begin(), header, header + size);
+    if (!writeFile(options.ppm, image)) {
+      fprintf(stderr, "%s: write failed\n", options.ppm);
+      return 2;
+    }
+  }
+
+  double seconds = renderNs / 1e9;
+  printf("%u frames of %u LEDs, %.0f ns/frame, %.0f frames/s, %.0fx real "
+         "time",
+         frames, options.length, frames ? renderNs / frames : 0.0,
+         seconds > 0 ? frames / seconds : 0.0,
+         seconds > 0 ? options.seconds / seconds : 0.0);
+  if (options.out != nullptr) {
+    printf(", %u B/frame", unsigned(frames ? (file.size() - 12) / frames : 0));
+  }
+  printf("\n");
+  if (options.compare != nullptr && status == 0) {
+    printf("%s: identical\n", options.compare);
+  }
+  return status;
+}